@@ -0,0 +1,574 @@
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <new>
+#include "io/compressor.h"
+#include "io/rw.h"
+
+#ifdef HAVE_ZLIB
+  #include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+  #include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+  #include <lz4frame.h>
+#endif
+
+namespace {
+  // Format names, compression levels and defaults.
+  struct format_info {
+    const char* name;
+    int min_level;
+    int max_level;
+    int default_level;
+  };
+
+  const format_info formats[] = {
+    {"gzip", 0, 9, 6},
+    {"zstd", 1, 22, 3},
+    {"lz4", 0, 12, 0}
+  };
+
+  // Compression context of a thread.
+  class codec {
+    public:
+      // Constructor.
+      codec(io::compressor::format fmt, int level)
+        : _M_format(fmt),
+          _M_level(level)
+      {
+      }
+
+      // Destructor.
+      ~codec()
+      {
+        switch (_M_format) {
+          case io::compressor::format::gzip:
+#ifdef HAVE_ZLIB
+            if (_M_initialized) {
+              deflateEnd(&_M_zstream);
+            }
+#endif
+
+            break;
+          case io::compressor::format::zstd:
+#ifdef HAVE_ZSTD
+            ZSTD_freeCCtx(_M_cctx);
+#endif
+
+            break;
+          case io::compressor::format::lz4:
+            break;
+        }
+      }
+
+      // Initialize context.
+      bool init()
+      {
+        switch (_M_format) {
+          case io::compressor::format::gzip:
+#ifdef HAVE_ZLIB
+            memset(&_M_zstream, 0, sizeof(z_stream));
+
+            // 15 + 16: gzip wrapper with the largest window.
+            return (_M_initialized = (deflateInit2(&_M_zstream,
+                                                   _M_level,
+                                                   Z_DEFLATED,
+                                                   15 + 16,
+                                                   8,
+                                                   Z_DEFAULT_STRATEGY) ==
+                                      Z_OK));
+#else
+            return false;
+#endif
+          case io::compressor::format::zstd:
+#ifdef HAVE_ZSTD
+            return ((_M_cctx = ZSTD_createCCtx()) != nullptr);
+#else
+            return false;
+#endif
+          case io::compressor::format::lz4:
+#ifdef HAVE_LZ4
+            return true;
+#else
+            return false;
+#endif
+        }
+
+        return false;
+      }
+
+      // Maximum size of a compressed frame of `len` bytes.
+      size_t bound(size_t len)
+      {
+        switch (_M_format) {
+          case io::compressor::format::gzip:
+#ifdef HAVE_ZLIB
+            return deflateBound(&_M_zstream, len);
+#else
+            break;
+#endif
+          case io::compressor::format::zstd:
+#ifdef HAVE_ZSTD
+            return ZSTD_compressBound(len);
+#else
+            break;
+#endif
+          case io::compressor::format::lz4:
+#ifdef HAVE_LZ4
+            {
+              LZ4F_preferences_t prefs;
+              preferences(prefs, len);
+
+              return LZ4F_compressFrameBound(len, &prefs);
+            }
+#else
+            break;
+#endif
+        }
+
+        return 0;
+      }
+
+      // Compress `len` bytes of `in` into a frame.
+      // Returns the size of the frame or 0 on error.
+      size_t compress(const uint8_t* in,
+                      size_t len,
+                      uint8_t* out,
+                      size_t outsize)
+      {
+        switch (_M_format) {
+          case io::compressor::format::gzip:
+#ifdef HAVE_ZLIB
+            if (deflateReset(&_M_zstream) == Z_OK) {
+              _M_zstream.next_in = const_cast<Bytef*>(in);
+              _M_zstream.avail_in = len;
+              _M_zstream.next_out = out;
+              _M_zstream.avail_out = outsize;
+
+              if (deflate(&_M_zstream, Z_FINISH) == Z_STREAM_END) {
+                return outsize - _M_zstream.avail_out;
+              }
+            }
+#endif
+
+            break;
+          case io::compressor::format::zstd:
+#ifdef HAVE_ZSTD
+            {
+              const size_t ret = ZSTD_compressCCtx(_M_cctx,
+                                                   out,
+                                                   outsize,
+                                                   in,
+                                                   len,
+                                                   _M_level);
+
+              if (!ZSTD_isError(ret)) {
+                return ret;
+              }
+            }
+#endif
+
+            break;
+          case io::compressor::format::lz4:
+#ifdef HAVE_LZ4
+            {
+              LZ4F_preferences_t prefs;
+              preferences(prefs, len);
+
+              const size_t ret = LZ4F_compressFrame(out,
+                                                    outsize,
+                                                    in,
+                                                    len,
+                                                    &prefs);
+
+              if (!LZ4F_isError(ret)) {
+                return ret;
+              }
+            }
+#endif
+
+            break;
+        }
+
+        return 0;
+      }
+
+    private:
+      io::compressor::format _M_format;
+      int _M_level;
+
+#ifdef HAVE_ZLIB
+      z_stream _M_zstream;
+      bool _M_initialized = false;
+#endif
+
+#ifdef HAVE_ZSTD
+      ZSTD_CCtx* _M_cctx = nullptr;
+#endif
+
+#ifdef HAVE_LZ4
+      // Frame preferences (the frame header records the content size).
+      void preferences(LZ4F_preferences_t& prefs, size_t len) const
+      {
+        memset(&prefs, 0, sizeof(LZ4F_preferences_t));
+        prefs.compressionLevel = _M_level;
+        prefs.frameInfo.contentSize = len;
+      }
+#endif
+
+      // Disable copy constructor and assignment operator.
+      codec(const codec&) = delete;
+      codec& operator=(const codec&) = delete;
+  };
+}
+
+io::compressor::~compressor()
+{
+  stop();
+
+  if (_M_frames) {
+    for (unsigned i = 0; i < _M_nframes; i++) {
+      free(_M_frames[i].in);
+      free(_M_frames[i].out);
+    }
+
+    free(_M_frames);
+  }
+}
+
+bool io::compressor::open(int fd,
+                          format fmt,
+                          int level,
+                          unsigned nthreads,
+                          size_t frame_size)
+{
+  if ((!available(fmt)) || (nthreads == 0) || (frame_size == 0)) {
+    return false;
+  }
+
+  _M_fd = fd;
+  _M_format = fmt;
+  _M_level = level;
+  _M_frame_size = frame_size;
+
+  // Two frames per compression thread: one being compressed while the next
+  // one is filled or waits to be written.
+  _M_nframes = 2 * nthreads;
+
+  if ((_M_frames = static_cast<frame*>(
+                     calloc(_M_nframes, sizeof(frame))
+                   )) == nullptr) {
+    return false;
+  }
+
+  if ((_M_threads = new (std::nothrow) std::thread[nthreads]) == nullptr) {
+    return false;
+  }
+
+  for (; _M_nthreads < nthreads; _M_nthreads++) {
+    try {
+      _M_threads[_M_nthreads] = std::thread(&compressor::compress_frames,
+                                            this);
+    } catch (...) {
+      // Continue with the threads which could be created.
+      break;
+    }
+  }
+
+  if (_M_nthreads > 0) {
+    try {
+      _M_writer = std::thread(&compressor::write_frames, this);
+      return true;
+    } catch (...) {
+    }
+  }
+
+  stop();
+
+  return false;
+}
+
+bool io::compressor::write(const void* data, size_t len)
+{
+  const uint8_t* ptr = static_cast<const uint8_t*>(data);
+
+  while (len > 0) {
+    if ((!_M_current) && (!acquire())) {
+      return false;
+    }
+
+    size_t n = _M_frame_size - _M_current->inlen;
+    if (n > len) {
+      n = len;
+    }
+
+    memcpy(_M_current->in + _M_current->inlen, ptr, n);
+    _M_current->inlen += n;
+    _M_in += n;
+
+    ptr += n;
+    len -= n;
+
+    if (_M_current->inlen == _M_frame_size) {
+      submit();
+    }
+  }
+
+  return true;
+}
+
+bool io::compressor::close()
+{
+  if ((_M_current) && (_M_current->inlen > 0)) {
+    submit();
+  }
+
+  _M_current = nullptr;
+
+  bool ret;
+
+  {
+    std::lock_guard<std::mutex> lock(_M_mutex);
+    _M_closing = true;
+    ret = !_M_failed;
+  }
+
+  _M_cond.notify_all();
+
+  stop();
+
+  return (ret) && (!_M_failed);
+}
+
+bool io::compressor::available(format fmt)
+{
+  switch (fmt) {
+    case format::gzip:
+#ifdef HAVE_ZLIB
+      return true;
+#else
+      return false;
+#endif
+    case format::zstd:
+#ifdef HAVE_ZSTD
+      return true;
+#else
+      return false;
+#endif
+    case format::lz4:
+#ifdef HAVE_LZ4
+      return true;
+#else
+      return false;
+#endif
+  }
+
+  return false;
+}
+
+bool io::compressor::parse(const char* s, format& fmt, int& level)
+{
+  const char* const colon = strchr(s, ':');
+  const size_t len = colon ? static_cast<size_t>(colon - s) : strlen(s);
+
+  for (size_t i = 0; i < sizeof(formats) / sizeof(formats[0]); i++) {
+    if ((strncasecmp(s, formats[i].name, len) == 0) &&
+        (formats[i].name[len] == 0)) {
+      if (colon) {
+        char* end;
+        const long n = strtol(colon + 1, &end, 10);
+        if ((end == colon + 1) ||
+            (*end != 0) ||
+            (n < formats[i].min_level) ||
+            (n > formats[i].max_level)) {
+          return false;
+        }
+
+        level = n;
+      } else {
+        level = formats[i].default_level;
+      }
+
+      fmt = static_cast<format>(i);
+
+      return true;
+    }
+  }
+
+  return false;
+}
+
+const char* io::compressor::name(format fmt)
+{
+  return formats[static_cast<unsigned>(fmt)].name;
+}
+
+bool io::compressor::acquire()
+{
+  std::unique_lock<std::mutex> lock(_M_mutex);
+
+  // The frame `_M_produced` reuses the slot of the frame
+  // `_M_produced - _M_nframes`, which has to be written first.
+  _M_cond.wait(lock, [this] {
+    return (_M_failed) || (_M_produced - _M_written < _M_nframes);
+  });
+
+  if (!_M_failed) {
+    frame* const f = &_M_frames[_M_produced % _M_nframes];
+
+    if ((f->in) ||
+        ((f->in = static_cast<uint8_t*>(malloc(_M_frame_size))) !=
+         nullptr)) {
+      f->inlen = 0;
+      f->compressed = false;
+
+      _M_current = f;
+
+      return true;
+    }
+
+    _M_failed = true;
+    _M_cond.notify_all();
+  }
+
+  return false;
+}
+
+void io::compressor::submit()
+{
+  {
+    std::lock_guard<std::mutex> lock(_M_mutex);
+    _M_produced++;
+  }
+
+  _M_current = nullptr;
+  _M_cond.notify_all();
+}
+
+void io::compressor::stop()
+{
+  if (_M_threads) {
+    {
+      // If the stream has not been closed, abort.
+      std::lock_guard<std::mutex> lock(_M_mutex);
+      if (!_M_closing) {
+        _M_failed = true;
+      }
+    }
+
+    _M_cond.notify_all();
+
+    for (unsigned i = 0; i < _M_nthreads; i++) {
+      _M_threads[i].join();
+    }
+
+    if (_M_writer.joinable()) {
+      _M_writer.join();
+    }
+
+    delete [] _M_threads;
+    _M_threads = nullptr;
+    _M_nthreads = 0;
+  }
+}
+
+void io::compressor::compress_frames()
+{
+  codec c(_M_format, _M_level);
+  bool initialized = c.init();
+
+  std::unique_lock<std::mutex> lock(_M_mutex);
+
+  do {
+    _M_cond.wait(lock, [this] {
+      return (_M_failed) || (_M_taken < _M_produced) || (_M_closing);
+    });
+
+    if ((_M_failed) || (_M_taken == _M_produced)) {
+      // Error or no more frames.
+      return;
+    }
+
+    frame& f = _M_frames[_M_taken++ % _M_nframes];
+
+    lock.unlock();
+
+    bool ret = false;
+
+    if (initialized) {
+      // Grow the output buffer if needed.
+      const size_t bound = c.bound(f.inlen);
+
+      if (bound > f.outsize) {
+        uint8_t* out;
+        if ((out = static_cast<uint8_t*>(realloc(f.out, bound))) != nullptr) {
+          f.out = out;
+          f.outsize = bound;
+        }
+      }
+
+      if (bound <= f.outsize) {
+        ret = ((f.outlen = c.compress(f.in, f.inlen, f.out, f.outsize)) > 0);
+      }
+    }
+
+    lock.lock();
+
+    if (ret) {
+      f.compressed = true;
+    } else {
+      _M_failed = true;
+    }
+
+    _M_cond.notify_all();
+  } while (true);
+}
+
+void io::compressor::write_frames()
+{
+  std::unique_lock<std::mutex> lock(_M_mutex);
+
+  do {
+    _M_cond.wait(lock, [this] {
+      return (_M_failed) ||
+             ((_M_written < _M_produced) &&
+              (_M_frames[_M_written % _M_nframes].compressed)) ||
+             ((_M_closing) && (_M_written == _M_produced));
+    });
+
+    if ((_M_failed) || (_M_written == _M_produced)) {
+      // Error or all the frames have been written.
+      return;
+    }
+
+    frame& f = _M_frames[_M_written % _M_nframes];
+
+    // The frames are written (and observed) by this thread only.
+    const uint64_t offset = _M_out;
+
+    lock.unlock();
+
+    if (_M_frame_fn) {
+      _M_frame_fn(_M_frame_arg, f.in, f.inlen, offset, f.outlen);
+    }
+
+    const bool ret = write_all(_M_fd, f.out, f.outlen);
+
+    lock.lock();
+
+    if (ret) {
+      f.compressed = false;
+
+      _M_out += f.outlen;
+      _M_written++;
+    } else {
+      _M_failed = true;
+    }
+
+    _M_cond.notify_all();
+  } while (true);
+}
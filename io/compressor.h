@@ -0,0 +1,178 @@
+#ifndef IO_COMPRESSOR_H
+#define IO_COMPRESSOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+namespace io {
+  // Compressed output stream.
+  // The data is cut into frames of a fixed size. A pool of threads
+  // compresses each frame on its own (a gzip member, a zstd frame or an LZ4
+  // frame) and a writer thread appends the compressed frames to the file in
+  // order, so the producer, the compression and the writes overlap and the
+  // uncompressed data never touches the disk. The concatenation of the
+  // frames is a valid file of the format, and every frame can be
+  // decompressed independently.
+  // Which formats are available depends on the libraries the program has
+  // been built with (HAVE_ZLIB, HAVE_ZSTD and HAVE_LZ4).
+  class compressor {
+    public:
+      // Compression formats.
+      enum class format {
+        gzip,
+        zstd,
+        lz4
+      };
+
+      // Default size of the uncompressed frames.
+      static constexpr const size_t default_frame_size = 4 * 1024 * 1024;
+
+      // Function called by the writer thread for each frame, in order, just
+      // before writing it: uncompressed data, offset of the compressed frame
+      // in the file and compressed size.
+      typedef void (*frame_function)(void* arg,
+                                     const uint8_t* data,
+                                     size_t len,
+                                     uint64_t offset,
+                                     size_t size);
+
+      // Constructor.
+      compressor() = default;
+
+      // Destructor.
+      ~compressor();
+
+      // Set function called for each frame (before open()).
+      void on_frame(frame_function fn, void* arg)
+      {
+        _M_frame_fn = fn;
+        _M_frame_arg = arg;
+      }
+
+      // Start compressing to `fd` with `nthreads` compression threads, in
+      // frames of `frame_size` uncompressed bytes.
+      bool open(int fd,
+                format fmt,
+                int level,
+                unsigned nthreads,
+                size_t frame_size = default_frame_size);
+
+      // Append data.
+      bool write(const void* data, size_t len);
+
+      // Compress the last frame and wait until all the frames have been
+      // written.
+      bool close();
+
+      // Number of bytes appended.
+      uint64_t bytes_in() const
+      {
+        return _M_in;
+      }
+
+      // Number of compressed bytes written (valid after close()).
+      uint64_t bytes_out() const
+      {
+        return _M_out;
+      }
+
+      // Number of frames written (valid after close()).
+      uint64_t frames() const
+      {
+        return _M_written;
+      }
+
+      // Has the program been built with support for the format?
+      static bool available(format fmt);
+
+      // Get format and compression level from a string "FORMAT[:LEVEL]".
+      static bool parse(const char* s, format& fmt, int& level);
+
+      // Get format name.
+      static const char* name(format fmt);
+
+    private:
+      // Frame.
+      struct frame {
+        // Uncompressed data.
+        uint8_t* in;
+        size_t inlen;
+
+        // Compressed data.
+        uint8_t* out;
+        size_t outlen;
+        size_t outsize;
+
+        // Has the frame been compressed?
+        bool compressed;
+      };
+
+      // Output file.
+      int _M_fd = -1;
+
+      // Format and compression level.
+      format _M_format = format::gzip;
+      int _M_level = 0;
+
+      // Size of the uncompressed frames.
+      size_t _M_frame_size = default_frame_size;
+
+      // Function called for each frame.
+      frame_function _M_frame_fn = nullptr;
+      void* _M_frame_arg = nullptr;
+
+      // Ring of frames; the frame with sequence number `n` is
+      // `_M_frames[n % _M_nframes]`.
+      frame* _M_frames = nullptr;
+      unsigned _M_nframes = 0;
+
+      // Frame being filled by write() (nullptr if none).
+      frame* _M_current = nullptr;
+
+      // Number of frames filled, taken by a compression thread and written.
+      uint64_t _M_produced = 0;
+      uint64_t _M_taken = 0;
+      uint64_t _M_written = 0;
+
+      // No more frames will be produced.
+      bool _M_closing = false;
+
+      // Has a compression or a write failed?
+      bool _M_failed = false;
+
+      // Protects the sequence numbers, the flags and the frame states.
+      std::mutex _M_mutex;
+      std::condition_variable _M_cond;
+
+      // Compression threads and writer thread.
+      std::thread* _M_threads = nullptr;
+      unsigned _M_nthreads = 0;
+      std::thread _M_writer;
+
+      // Bytes appended and written.
+      uint64_t _M_in = 0;
+      uint64_t _M_out = 0;
+
+      // Wait for a free frame.
+      bool acquire();
+
+      // Hand the current frame over to the compression threads.
+      void submit();
+
+      // Stop the threads and wait for them.
+      void stop();
+
+      // Thread functions.
+      void compress_frames();
+      void write_frames();
+
+      // Disable copy constructor and assignment operator.
+      compressor(const compressor&) = delete;
+      compressor& operator=(const compressor&) = delete;
+  };
+}
+
+#endif // IO_COMPRESSOR_H
@@ -0,0 +1,667 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/ioctl.h>
+#include <sys/vfs.h>
+#include <linux/fs.h>
+#include "io/copier.h"
+
+// Maximum number of bytes transferred by a single system call.
+static constexpr const uint64_t max_transfer = 0x7ffff000;
+
+// Size of the pipe used by splice().
+static constexpr const int pipe_size = 1024 * 1024;
+
+// Size of the window mapped into memory by the mmap() method.
+static constexpr const uint64_t mmap_window = 256ull * 1024 * 1024;
+
+// Size of the buffers of the io_uring method.
+static constexpr const uint32_t uring_chunk = 1024 * 1024;
+
+io::copier::~copier()
+{
+  if (_M_pipe[0] != -1) {
+    close(_M_pipe[0]);
+    close(_M_pipe[1]);
+  }
+
+  if (_M_buffers) {
+    if (_M_fixed_buffers) {
+      _M_ring.unregister_buffers();
+    }
+
+    _M_ring.destroy();
+    free(_M_buffers);
+  }
+}
+
+void io::copier::force(method m)
+{
+  for (size_t i = 0; i < number_methods; i++) {
+    _M_disabled[i] = (i != static_cast<unsigned>(m));
+  }
+}
+
+void io::copier::configure(const copier& other)
+{
+  for (size_t i = 0; i < number_methods; i++) {
+    _M_disabled[i] = other._M_disabled[i];
+  }
+
+  _M_reflink = other._M_reflink;
+  _M_depth = other._M_depth;
+}
+
+bool io::copier::copy(int infd,
+                      uint64_t inoff,
+                      int outfd,
+                      uint64_t outoff,
+                      uint64_t len)
+{
+  if (_M_reflink != reflink::never) {
+    uint64_t head, tail;
+    switch (clone(infd, inoff, outfd, outoff, len, head, tail)) {
+      case result::done:
+        // Copy the unaligned head and tail.
+        return (copy_range(infd, inoff, outfd, outoff, head) &&
+                copy_range(infd,
+                           inoff + len - tail,
+                           outfd,
+                           outoff + len - tail,
+                           tail));
+      case result::error:
+        return false;
+      default:
+        ;
+    }
+  }
+
+  return copy_range(infd, inoff, outfd, outoff, len);
+}
+
+bool io::copier::copy_range(int infd,
+                            uint64_t inoff,
+                            int outfd,
+                            uint64_t outoff,
+                            uint64_t len)
+{
+  for (size_t i = 0; (len > 0) && (i < number_methods); i++) {
+    if (!_M_disabled[i]) {
+      result res;
+
+      switch (static_cast<method>(i)) {
+        case method::io_uring:
+          res = io_uring(infd, inoff, outfd, outoff, len);
+          break;
+        case method::copy_file_range:
+          res = copy_file_range(infd, inoff, outfd, outoff, len);
+          break;
+        case method::sendfile:
+          res = sendfile(infd, inoff, outfd, outoff, len);
+          break;
+        case method::splice:
+          res = splice(infd, inoff, outfd, outoff, len);
+          break;
+        default:
+          res = mmap(infd, inoff, outfd, outoff, len);
+      }
+
+      switch (res) {
+        case result::done:
+          return true;
+        case result::error:
+          return false;
+        default:
+          // Try with the next method.
+          ;
+      }
+    }
+  }
+
+  return (len == 0);
+}
+
+void io::copier::add_stats(const copier& other)
+{
+  for (size_t i = 0; i < number_methods; i++) {
+    _M_copied[i] += other._M_copied[i];
+  }
+
+  _M_cloned += other._M_cloned;
+  _M_misaligned += other._M_misaligned;
+}
+
+bool io::copier::parse(const char* s, method& m)
+{
+  for (size_t i = 0; i < number_methods; i++) {
+    if (strcasecmp(s, name(static_cast<method>(i))) == 0) {
+      m = static_cast<method>(i);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+const char* io::copier::name(method m)
+{
+  switch (m) {
+    case method::io_uring:
+      return "io_uring";
+    case method::copy_file_range:
+      return "copy_file_range";
+    case method::sendfile:
+      return "sendfile";
+    case method::splice:
+      return "splice";
+    default:
+      return "mmap";
+  }
+}
+
+bool io::copier::parse(const char* s, reflink& mode)
+{
+  if (strcasecmp(s, "auto") == 0) {
+    mode = reflink::automatic;
+  } else if (strcasecmp(s, "always") == 0) {
+    mode = reflink::always;
+  } else if (strcasecmp(s, "never") == 0) {
+    mode = reflink::never;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+io::copier::result io::copier::clone(int infd,
+                                     uint64_t inoff,
+                                     int outfd,
+                                     uint64_t outoff,
+                                     uint64_t len,
+                                     uint64_t& head,
+                                     uint64_t& tail)
+{
+  // Get block size of the output file system.
+  struct statfs buf;
+  if ((fstatfs(outfd, &buf) != 0) || (buf.f_bsize <= 0)) {
+    return (_M_reflink == reflink::always) ? result::error : result::fallback;
+  }
+
+  const uint64_t bsize = buf.f_bsize;
+
+  // Number of bytes until the output offset is block-aligned.
+  head = (bsize - (outoff % bsize)) % bsize;
+
+  if (head >= len) {
+    return result::fallback;
+  }
+
+  // If the input offset is not aligned in the same way, nothing
+  // can be cloned (not an error, even with `always`).
+  if (((inoff + head) % bsize) != 0) {
+    _M_misaligned += ((len - head) / bsize) * bsize;
+    return result::fallback;
+  }
+
+  const uint64_t count = ((len - head) / bsize) * bsize;
+  if (count == 0) {
+    return result::fallback;
+  }
+
+  tail = len - head - count;
+
+  struct file_clone_range range;
+  range.src_fd = infd;
+  range.src_offset = inoff + head;
+  range.src_length = count;
+  range.dest_offset = outoff + head;
+
+  if (ioctl(outfd, FICLONERANGE, &range) == 0) {
+    _M_cloned += count;
+    return result::done;
+  }
+
+  switch (errno) {
+    case EOPNOTSUPP:
+    case ENOTTY:
+    case EXDEV:
+    case EINVAL:
+      if (_M_reflink == reflink::automatic) {
+        // The file system doesn't support reflinks.
+        _M_reflink = reflink::never;
+        return result::fallback;
+      }
+
+      // Fall through.
+    default:
+      return result::error;
+  }
+}
+
+bool io::copier::setup_ring()
+{
+  if ((_M_buffers = static_cast<uint8_t*>(
+                      aligned_alloc(4096, _M_depth * uring_chunk)
+                    )) != nullptr) {
+    if (_M_ring.create(_M_depth * 2)) {
+      struct iovec* iov;
+      if ((iov = static_cast<struct iovec*>(
+                   malloc(_M_depth * sizeof(struct iovec))
+                 )) != nullptr) {
+        for (unsigned i = 0; i < _M_depth; i++) {
+          iov[i].iov_base = _M_buffers + i * uring_chunk;
+          iov[i].iov_len = uring_chunk;
+        }
+
+        // If the buffers cannot be registered (locked memory limit),
+        // use non-fixed reads and writes.
+        _M_fixed_buffers = _M_ring.register_buffers(iov, _M_depth);
+
+        free(iov);
+
+        return true;
+      }
+
+      _M_ring.destroy();
+    }
+
+    free(_M_buffers);
+    _M_buffers = nullptr;
+  }
+
+  return false;
+}
+
+io::copier::result io::copier::io_uring(int infd,
+                                        uint64_t& inoff,
+                                        int outfd,
+                                        uint64_t& outoff,
+                                        uint64_t& len)
+{
+  // State of a buffer.
+  struct slot {
+    uint64_t inoff;
+    uint64_t outoff;
+    uint32_t len;
+    uint32_t done;
+    bool writing;
+  };
+
+  if ((!_M_buffers) && (!setup_ring())) {
+    disable(method::io_uring);
+    return result::fallback;
+  }
+
+  slot* slots;
+  unsigned* free_slots;
+  if ((slots = static_cast<slot*>(malloc(_M_depth * sizeof(slot)))) ==
+      nullptr) {
+    return result::fallback;
+  }
+
+  if ((free_slots = static_cast<unsigned*>(
+                      malloc(_M_depth * sizeof(unsigned))
+                    )) == nullptr) {
+    free(slots);
+    return result::fallback;
+  }
+
+  for (unsigned i = 0; i < _M_depth; i++) {
+    free_slots[i] = i;
+  }
+
+  // Register input and output files.
+  const int fds[2] = {infd, outfd};
+  const bool fixed_files = _M_ring.register_files(fds, 2);
+
+  // Queue read or write for the given slot.
+  auto queue = [&](unsigned idx) {
+    const slot& s = slots[idx];
+
+    struct io_uring_sqe* const sqe = _M_ring.get_sqe();
+
+    if (!s.writing) {
+      sqe->opcode = _M_fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      sqe->fd = fixed_files ? 0 : infd;
+      sqe->off = s.inoff + s.done;
+    } else {
+      sqe->opcode = _M_fixed_buffers ? IORING_OP_WRITE_FIXED :
+                                       IORING_OP_WRITE;
+
+      sqe->fd = fixed_files ? 1 : outfd;
+      sqe->off = s.outoff + s.done;
+    }
+
+    sqe->addr = reinterpret_cast<uintptr_t>(_M_buffers +
+                                            idx * uring_chunk +
+                                            s.done);
+
+    sqe->len = s.len - s.done;
+    sqe->buf_index = idx;
+    sqe->flags = fixed_files ? IOSQE_FIXED_FILE : 0;
+    sqe->user_data = idx;
+  };
+
+  uint64_t scheduled = 0;
+  unsigned nfree = _M_depth;
+  bool error = false;
+
+  do {
+    // Start reading as many chunks as possible.
+    while ((!error) && (scheduled < len) && (nfree > 0)) {
+      const unsigned idx = free_slots[--nfree];
+      slot& s = slots[idx];
+
+      const uint64_t left = len - scheduled;
+
+      s.inoff = inoff + scheduled;
+      s.outoff = outoff + scheduled;
+      s.len = (left < uring_chunk) ? left : uring_chunk;
+      s.done = 0;
+      s.writing = false;
+
+      queue(idx);
+
+      scheduled += s.len;
+    }
+
+    if (_M_ring.submit() < 0) {
+      // Requests might be in flight: the ring cannot be reused.
+      _M_buffers = nullptr;
+      _M_ring.destroy();
+      disable(method::io_uring);
+
+      error = true;
+      break;
+    }
+
+    // Process completions.
+    struct io_uring_cqe cqe;
+    bool wait = true;
+    while (_M_ring.get_cqe(cqe, wait)) {
+      const unsigned idx = cqe.user_data;
+      slot& s = slots[idx];
+
+      wait = false;
+
+      if (cqe.res > 0) {
+        if ((s.done += cqe.res) < s.len) {
+          // Short read or write.
+          if (!error) {
+            queue(idx);
+            continue;
+          }
+        } else if (!s.writing) {
+          if (!error) {
+            s.writing = true;
+            s.done = 0;
+
+            queue(idx);
+            continue;
+          }
+        } else {
+          account(method::io_uring, s.len);
+        }
+      } else {
+        // Error or unexpected end of file.
+        error = true;
+      }
+
+      free_slots[nfree++] = idx;
+    }
+  } while ((nfree < _M_depth) || ((!error) && (scheduled < len)));
+
+  if (fixed_files) {
+    _M_ring.unregister_files();
+  }
+
+  free(free_slots);
+  free(slots);
+
+  if (!error) {
+    inoff += len;
+    outoff += len;
+    len = 0;
+
+    return result::done;
+  }
+
+  return result::error;
+}
+
+io::copier::result io::copier::copy_file_range(int infd,
+                                               uint64_t& inoff,
+                                               int outfd,
+                                               uint64_t& outoff,
+                                               uint64_t& len)
+{
+  do {
+    loff_t in = inoff;
+    loff_t out = outoff;
+
+    ssize_t ret;
+    if ((ret = ::copy_file_range(infd,
+                                 &in,
+                                 outfd,
+                                 &out,
+                                 (len < max_transfer) ? len : max_transfer,
+                                 0)) > 0) {
+      account(method::copy_file_range, ret);
+
+      inoff += ret;
+      outoff += ret;
+
+      if ((len -= ret) == 0) {
+        return result::done;
+      }
+    } else if (ret == 0) {
+      // Some file systems report end of file instead of failing.
+      return result::fallback;
+    } else {
+      switch (errno) {
+        case EINTR:
+          break;
+        case ENOSYS:
+          // Not supported by the kernel.
+          disable(method::copy_file_range);
+
+          // Fall through.
+        case EXDEV:
+        case EINVAL:
+        case EOPNOTSUPP:
+        case EBADF:
+        case ETXTBSY:
+          return result::fallback;
+        default:
+          return result::error;
+      }
+    }
+  } while (true);
+}
+
+io::copier::result io::copier::sendfile(int infd,
+                                        uint64_t& inoff,
+                                        int outfd,
+                                        uint64_t& outoff,
+                                        uint64_t& len)
+{
+  // sendfile() writes at the current file offset of the output.
+  if (lseek(outfd, outoff, SEEK_SET) != static_cast<off_t>(outoff)) {
+    return result::fallback;
+  }
+
+  do {
+    off_t off = inoff;
+
+    ssize_t ret;
+    if ((ret = ::sendfile(outfd,
+                          infd,
+                          &off,
+                          (len < max_transfer) ? len : max_transfer)) > 0) {
+      account(method::sendfile, ret);
+
+      inoff += ret;
+      outoff += ret;
+
+      if ((len -= ret) == 0) {
+        return result::done;
+      }
+    } else if (ret == 0) {
+      return result::fallback;
+    } else {
+      switch (errno) {
+        case EINTR:
+          break;
+        case ENOSYS:
+          disable(method::sendfile);
+
+          // Fall through.
+        case EINVAL:
+        case EOPNOTSUPP:
+          return result::fallback;
+        default:
+          return result::error;
+      }
+    }
+  } while (true);
+}
+
+io::copier::result io::copier::splice(int infd,
+                                      uint64_t& inoff,
+                                      int outfd,
+                                      uint64_t& outoff,
+                                      uint64_t& len)
+{
+  // Create pipe (if not created yet).
+  if (_M_pipe[0] == -1) {
+    if (pipe2(_M_pipe, O_CLOEXEC) == 0) {
+      fcntl(_M_pipe[1], F_SETPIPE_SZ, pipe_size);
+    } else {
+      return result::fallback;
+    }
+  }
+
+  do {
+    // Move data from the input file into the pipe.
+    loff_t in = inoff;
+
+    ssize_t ret;
+    if ((ret = ::splice(infd,
+                        &in,
+                        _M_pipe[1],
+                        nullptr,
+                        (len < pipe_size) ? len : pipe_size,
+                        SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+      // Move data from the pipe into the output file.
+      size_t left = ret;
+      do {
+        loff_t out = outoff;
+
+        ssize_t n;
+        if ((n = ::splice(_M_pipe[0],
+                          nullptr,
+                          outfd,
+                          &out,
+                          left,
+                          SPLICE_F_MOVE | SPLICE_F_MORE)) > 0) {
+          account(method::splice, n);
+
+          inoff += n;
+          outoff += n;
+          len -= n;
+
+          left -= n;
+        } else if ((n < 0) && (errno == EINTR)) {
+          continue;
+        } else {
+          // Discard the data left in the pipe; it will be copied again
+          // by the next method.
+          close(_M_pipe[0]);
+          close(_M_pipe[1]);
+
+          _M_pipe[0] = -1;
+          _M_pipe[1] = -1;
+
+          return ((n < 0) && (errno != EINVAL)) ? result::error :
+                                                  result::fallback;
+        }
+      } while (left > 0);
+
+      if (len == 0) {
+        return result::done;
+      }
+    } else if (ret == 0) {
+      return result::fallback;
+    } else {
+      switch (errno) {
+        case EINTR:
+          break;
+        case ENOSYS:
+          disable(method::splice);
+
+          // Fall through.
+        case EINVAL:
+          return result::fallback;
+        default:
+          return result::error;
+      }
+    }
+  } while (true);
+}
+
+io::copier::result io::copier::mmap(int infd,
+                                    uint64_t& inoff,
+                                    int outfd,
+                                    uint64_t& outoff,
+                                    uint64_t& len)
+{
+  static const uint64_t pagesize = sysconf(_SC_PAGESIZE);
+
+  do {
+    // Map the next window of the input file into memory.
+    const uint64_t start = inoff & ~(pagesize - 1);
+    const uint64_t skip = inoff - start;
+    const uint64_t count = (len < mmap_window) ? len : mmap_window;
+
+    void* base;
+    if ((base = ::mmap(nullptr,
+                       skip + count,
+                       PROT_READ,
+                       MAP_SHARED,
+                       infd,
+                       start)) == MAP_FAILED) {
+      return result::error;
+    }
+
+    madvise(base, skip + count, MADV_SEQUENTIAL);
+
+    const uint8_t* ptr = static_cast<const uint8_t*>(base) + skip;
+    uint64_t written = 0;
+
+    do {
+      ssize_t ret;
+      if ((ret = pwrite(outfd, ptr, count - written, outoff)) > 0) {
+        account(method::mmap, ret);
+
+        ptr += ret;
+        written += ret;
+
+        inoff += ret;
+        outoff += ret;
+        len -= ret;
+      } else if ((ret < 0) && (errno != EINTR)) {
+        munmap(base, skip + count);
+        return result::error;
+      }
+    } while (written < count);
+
+    munmap(base, skip + count);
+  } while (len > 0);
+
+  return result::done;
+}
@@ -0,0 +1,217 @@
+#ifndef IO_COPIER_H
+#define IO_COPIER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "io/uring.h"
+
+namespace io {
+  // Copy engine.
+  // Copies byte ranges between file descriptors at explicit offsets, keeping
+  // the data in the kernel whenever possible. The first method which works
+  // is used; methods which are not supported by the kernel are disabled for
+  // the rest of the copier's lifetime.
+  //
+  // The io_uring method (disabled by default) reads and writes through
+  // registered buffers and registered files, keeping `queue depth` chunks in
+  // flight.
+  //
+  // If reflinks are enabled, the block-aligned part of each range is shared
+  // with the input file (FICLONERANGE) and only the unaligned head and tail
+  // are copied. Cloning requires the input and output offsets to have the
+  // same alignment relative to the block size of the file system.
+  class copier {
+    public:
+      // Reflink modes. `always` fails if the file system can't clone, but
+      // clones only when aligned: misaligned ranges are copied.
+      enum class reflink {
+        never,
+        automatic,
+        always
+      };
+
+      // Copy methods (in order of preference).
+      enum class method : unsigned {
+        io_uring,
+        copy_file_range,
+        sendfile,
+        splice,
+        mmap
+      };
+
+      static constexpr const size_t number_methods = 5;
+
+      // Constructor.
+      copier() = default;
+
+      // Destructor.
+      ~copier();
+
+      // Restrict the copier to a single method.
+      void force(method m);
+
+      // Enable method.
+      void enable(method m)
+      {
+        _M_disabled[static_cast<unsigned>(m)] = false;
+      }
+
+      // Set queue depth of the io_uring method.
+      void set_queue_depth(unsigned depth)
+      {
+        _M_depth = depth;
+      }
+
+      // Use the same configuration as another copier.
+      void configure(const copier& other);
+
+      // Set reflink mode.
+      void set_reflink(reflink mode)
+      {
+        _M_reflink = mode;
+      }
+
+      // Copy `len` bytes from `infd` (offset `inoff`) to `outfd`
+      // (offset `outoff`).
+      bool copy(int infd,
+                uint64_t inoff,
+                int outfd,
+                uint64_t outoff,
+                uint64_t len);
+
+      // Number of bytes copied using the method `m`.
+      uint64_t copied(method m) const
+      {
+        return _M_copied[static_cast<unsigned>(m)];
+      }
+
+      // Number of bytes shared with the input files.
+      uint64_t cloned() const
+      {
+        return _M_cloned;
+      }
+
+      // Number of bytes which could have been cloned but were copied
+      // because the input and output offsets had different alignments.
+      uint64_t misaligned() const
+      {
+        return _M_misaligned;
+      }
+
+      // Add the statistics of another copier.
+      void add_stats(const copier& other);
+
+      // Get method by name.
+      static bool parse(const char* s, method& m);
+
+      // Get method name.
+      static const char* name(method m);
+
+      // Get reflink mode by name.
+      static bool parse(const char* s, reflink& mode);
+
+    private:
+      // Result of a copy attempt.
+      enum class result {
+        done,
+        fallback,
+        error
+      };
+
+      // Disabled methods (io_uring is disabled by default).
+      bool _M_disabled[number_methods] = {true};
+
+      // Bytes copied per method.
+      uint64_t _M_copied[number_methods] = {};
+
+      // Pipe used by splice().
+      int _M_pipe[2] = {-1, -1};
+
+      // Reflink mode.
+      reflink _M_reflink = reflink::never;
+
+      // io_uring method.
+      uring _M_ring;
+      unsigned _M_depth = uring::default_depth;
+      uint8_t* _M_buffers = nullptr;
+      bool _M_fixed_buffers = false;
+
+      // Set up ring and buffers of the io_uring method.
+      bool setup_ring();
+
+      // Bytes shared with the input files.
+      uint64_t _M_cloned = 0;
+
+      // Bytes not cloned because of misaligned offsets.
+      uint64_t _M_misaligned = 0;
+
+      // Copy range using the first method which works.
+      bool copy_range(int infd,
+                      uint64_t inoff,
+                      int outfd,
+                      uint64_t outoff,
+                      uint64_t len);
+
+      // Clone the block-aligned part of the range.
+      // On return, `head` and `tail` contain the number of bytes at the
+      // beginning and at the end of the range which still have to be copied.
+      result clone(int infd,
+                   uint64_t inoff,
+                   int outfd,
+                   uint64_t outoff,
+                   uint64_t len,
+                   uint64_t& head,
+                   uint64_t& tail);
+
+      // Copy methods.
+      // On return, `inoff`, `outoff` and `len` reflect the data which is left
+      // to copy.
+      result io_uring(int infd,
+                      uint64_t& inoff,
+                      int outfd,
+                      uint64_t& outoff,
+                      uint64_t& len);
+
+      result copy_file_range(int infd,
+                             uint64_t& inoff,
+                             int outfd,
+                             uint64_t& outoff,
+                             uint64_t& len);
+
+      result sendfile(int infd,
+                      uint64_t& inoff,
+                      int outfd,
+                      uint64_t& outoff,
+                      uint64_t& len);
+
+      result splice(int infd,
+                    uint64_t& inoff,
+                    int outfd,
+                    uint64_t& outoff,
+                    uint64_t& len);
+
+      result mmap(int infd,
+                  uint64_t& inoff,
+                  int outfd,
+                  uint64_t& outoff,
+                  uint64_t& len);
+
+      // Disable method.
+      void disable(method m)
+      {
+        _M_disabled[static_cast<unsigned>(m)] = true;
+      }
+
+      // Account copied bytes.
+      void account(method m, uint64_t count)
+      {
+        _M_copied[static_cast<unsigned>(m)] += count;
+      }
+
+      // Disable copy constructor and assignment operator.
+      copier(const copier&) = delete;
+      copier& operator=(const copier&) = delete;
+  };
+}
+
+#endif // IO_COPIER_H
@@ -0,0 +1,239 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include "io/decompressor.h"
+
+// Magic numbers.
+static const uint8_t gzip_magic[] = {0x1f, 0x8b};
+static const uint8_t zstd_magic[] = {0x28, 0xb5, 0x2f, 0xfd};
+static const uint8_t lz4_magic[] = {0x04, 0x22, 0x4d, 0x18};
+
+io::decompressor::~decompressor()
+{
+#ifdef HAVE_ZLIB
+  if (_M_zinitialized) {
+    inflateEnd(&_M_zstream);
+  }
+#endif
+
+#ifdef HAVE_ZSTD
+  ZSTD_freeDCtx(_M_dctx);
+#endif
+
+#ifdef HAVE_LZ4
+  if (_M_lz4ctx) {
+    LZ4F_freeDecompressionContext(_M_lz4ctx);
+  }
+#endif
+
+  free(_M_in);
+}
+
+bool io::decompressor::open(int fd, compressor::format fmt)
+{
+  if ((!compressor::available(fmt)) ||
+      ((_M_in = static_cast<uint8_t*>(malloc(input_size))) == nullptr)) {
+    return false;
+  }
+
+  _M_fd = fd;
+  _M_format = fmt;
+
+  switch (fmt) {
+    case compressor::format::gzip:
+#ifdef HAVE_ZLIB
+      memset(&_M_zstream, 0, sizeof(z_stream));
+
+      // 15 + 16: gzip wrapper with the largest window.
+      return (_M_zinitialized = (inflateInit2(&_M_zstream, 15 + 16) ==
+                                 Z_OK));
+#else
+      break;
+#endif
+    case compressor::format::zstd:
+#ifdef HAVE_ZSTD
+      return ((_M_dctx = ZSTD_createDCtx()) != nullptr);
+#else
+      break;
+#endif
+    case compressor::format::lz4:
+#ifdef HAVE_LZ4
+      return (!LZ4F_isError(LZ4F_createDecompressionContext(&_M_lz4ctx,
+                                                            LZ4F_VERSION)));
+#else
+      break;
+#endif
+  }
+
+  return false;
+}
+
+ssize_t io::decompressor::read(void* buf, size_t len)
+{
+  uint8_t* const out = static_cast<uint8_t*>(buf);
+  size_t total = 0;
+
+  while (total < len) {
+    // Refill input buffer.
+    if ((_M_pos == _M_len) && (!_M_eof)) {
+      const ssize_t ret = ::read(_M_fd, _M_in, input_size);
+
+      if (ret > 0) {
+        _M_pos = 0;
+        _M_len = ret;
+      } else if (ret == 0) {
+        _M_eof = true;
+      } else if (errno != EINTR) {
+        return -1;
+      }
+
+      continue;
+    }
+
+    size_t consumed, produced;
+    if (!decompress(_M_in + _M_pos,
+                    _M_len - _M_pos,
+                    out + total,
+                    len - total,
+                    consumed,
+                    produced)) {
+      return -1;
+    }
+
+    _M_pos += consumed;
+    total += produced;
+
+    if ((consumed == 0) && (produced == 0)) {
+      if (_M_pos < _M_len) {
+        // No progress with input available.
+        return -1;
+      } else if (_M_eof) {
+        // End of the data (the last frame has to be complete).
+        if ((total == 0) && (!_M_boundary)) {
+          return -1;
+        }
+
+        break;
+      }
+    }
+  }
+
+  return total;
+}
+
+bool io::decompressor::detect(const void* buf,
+                              size_t len,
+                              compressor::format& fmt)
+{
+  if ((len >= sizeof(gzip_magic)) &&
+      (memcmp(buf, gzip_magic, sizeof(gzip_magic)) == 0)) {
+    fmt = compressor::format::gzip;
+    return true;
+  } else if ((len >= sizeof(zstd_magic)) &&
+             (memcmp(buf, zstd_magic, sizeof(zstd_magic)) == 0)) {
+    fmt = compressor::format::zstd;
+    return true;
+  } else if ((len >= sizeof(lz4_magic)) &&
+             (memcmp(buf, lz4_magic, sizeof(lz4_magic)) == 0)) {
+    fmt = compressor::format::lz4;
+    return true;
+  }
+
+  return false;
+}
+
+bool io::decompressor::decompress(const uint8_t* in,
+                                  size_t inlen,
+                                  uint8_t* out,
+                                  size_t outlen,
+                                  size_t& consumed,
+                                  size_t& produced)
+{
+  switch (_M_format) {
+    case compressor::format::gzip:
+#ifdef HAVE_ZLIB
+      {
+        // Input and output are processed in chunks which fit in an uInt.
+        const size_t inchunk = (inlen < input_size) ? inlen : input_size;
+        const size_t outchunk = (outlen < (1u << 30)) ? outlen : (1u << 30);
+
+        _M_zstream.next_in = const_cast<Bytef*>(in);
+        _M_zstream.avail_in = inchunk;
+        _M_zstream.next_out = out;
+        _M_zstream.avail_out = outchunk;
+
+        const int ret = inflate(&_M_zstream, Z_NO_FLUSH);
+
+        consumed = inchunk - _M_zstream.avail_in;
+        produced = outchunk - _M_zstream.avail_out;
+
+        if (ret == Z_STREAM_END) {
+          // The next member starts after this one.
+          _M_boundary = true;
+          return (inflateReset(&_M_zstream) == Z_OK);
+        } else if ((ret == Z_OK) || (ret == Z_BUF_ERROR)) {
+          if ((consumed > 0) || (produced > 0)) {
+            _M_boundary = false;
+          }
+
+          return true;
+        }
+      }
+#endif
+
+      break;
+    case compressor::format::zstd:
+#ifdef HAVE_ZSTD
+      {
+        ZSTD_inBuffer input = {in, inlen, 0};
+        ZSTD_outBuffer output = {out, outlen, 0};
+
+        const size_t ret = ZSTD_decompressStream(_M_dctx, &output, &input);
+        if (!ZSTD_isError(ret)) {
+          consumed = input.pos;
+          produced = output.pos;
+
+          // 0: a frame has been completely decoded and flushed.
+          if ((consumed > 0) || (produced > 0)) {
+            _M_boundary = (ret == 0);
+          }
+
+          return true;
+        }
+      }
+#endif
+
+      break;
+    case compressor::format::lz4:
+#ifdef HAVE_LZ4
+      {
+        size_t dstlen = outlen;
+        size_t srclen = inlen;
+
+        const size_t ret = LZ4F_decompress(_M_lz4ctx,
+                                           out,
+                                           &dstlen,
+                                           in,
+                                           &srclen,
+                                           nullptr);
+
+        if (!LZ4F_isError(ret)) {
+          consumed = srclen;
+          produced = dstlen;
+
+          // 0: the frame is complete.
+          if ((consumed > 0) || (produced > 0)) {
+            _M_boundary = (ret == 0);
+          }
+
+          return true;
+        }
+      }
+#endif
+
+      break;
+  }
+
+  return false;
+}
@@ -0,0 +1,94 @@
+#ifndef IO_DECOMPRESSOR_H
+#define IO_DECOMPRESSOR_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include "io/compressor.h"
+
+#ifdef HAVE_ZLIB
+  #include <zlib.h>
+#endif
+
+#ifdef HAVE_ZSTD
+  #include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+  #include <lz4frame.h>
+#endif
+
+namespace io {
+  // Streaming decompressor.
+  // Reads a gzip, zstd or LZ4 file sequentially and returns the
+  // decompressed data; files made of several members or frames (e.g. written
+  // by io::compressor) are decompressed as a whole.
+  class decompressor {
+    public:
+      // Size of the input buffer.
+      static constexpr const size_t input_size = 256 * 1024;
+
+      // Constructor.
+      decompressor() = default;
+
+      // Destructor.
+      ~decompressor();
+
+      // Start decompressing `fd` (from its current offset).
+      bool open(int fd, compressor::format fmt);
+
+      // Read up to `len` bytes of decompressed data.
+      // Returns the number of bytes read (less than `len` only at the end of
+      // the data, 0 once the end has been reached) or -1 on error
+      // (including a truncated last frame).
+      ssize_t read(void* buf, size_t len);
+
+      // Get the compression format from the first bytes of a file.
+      static bool detect(const void* buf, size_t len, compressor::format& fmt);
+
+    private:
+      // Input file.
+      int _M_fd = -1;
+      bool _M_eof = false;
+
+      // Format.
+      compressor::format _M_format = compressor::format::gzip;
+
+      // Input buffer.
+      uint8_t* _M_in = nullptr;
+      size_t _M_pos = 0;
+      size_t _M_len = 0;
+
+      // Is the decompressor at a frame boundary?
+      bool _M_boundary = true;
+
+#ifdef HAVE_ZLIB
+      z_stream _M_zstream;
+      bool _M_zinitialized = false;
+#endif
+
+#ifdef HAVE_ZSTD
+      ZSTD_DCtx* _M_dctx = nullptr;
+#endif
+
+#ifdef HAVE_LZ4
+      LZ4F_dctx* _M_lz4ctx = nullptr;
+#endif
+
+      // Decompress from `in` (`inlen` bytes) to `out` (`outlen` bytes).
+      // On return, `consumed` and `produced` contain the number of bytes
+      // consumed and produced.
+      bool decompress(const uint8_t* in,
+                      size_t inlen,
+                      uint8_t* out,
+                      size_t outlen,
+                      size_t& consumed,
+                      size_t& produced);
+
+      // Disable copy constructor and assignment operator.
+      decompressor(const decompressor&) = delete;
+      decompressor& operator=(const decompressor&) = delete;
+  };
+}
+
+#endif // IO_DECOMPRESSOR_H
@@ -0,0 +1,109 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <errno.h>
+#include <sys/stat.h>
+#include "io/pipe.h"
+
+void io::pipe_output::open(int fd)
+{
+  _M_fd = fd;
+
+  struct stat sbuf;
+  _M_pipe = ((fstat(fd, &sbuf) == 0) && (S_ISFIFO(sbuf.st_mode)));
+  _M_splice = _M_pipe;
+
+  if (_M_pipe) {
+    // Fewer stalls with a larger pipe (the limit for unprivileged users
+    // might be lower).
+    if (fcntl(fd, F_GETPIPE_SZ) < pipe_size) {
+      fcntl(fd, F_SETPIPE_SZ, pipe_size);
+    }
+  }
+}
+
+bool io::pipe_output::write(struct iovec* iov, unsigned niov, bool stable)
+{
+  while (niov > 0) {
+    ssize_t ret;
+
+    if ((stable) && (_M_splice)) {
+      // Reference the pages in the pipe (without blocking, to detect the
+      // stalls).
+      ret = vmsplice(_M_fd, iov, niov, SPLICE_F_NONBLOCK);
+
+      if (ret > 0) {
+        _M_spliced += ret;
+      } else if ((ret < 0) && (errno == EINVAL)) {
+        // Not supported: copy from now on.
+        _M_splice = false;
+        continue;
+      }
+    } else {
+      // A full pipe would block.
+      if ((_M_pipe) && (!wait())) {
+        return false;
+      }
+
+      if ((ret = writev(_M_fd, iov, niov)) > 0) {
+        _M_copied += ret;
+      }
+    }
+
+    if (ret > 0) {
+      // Skip the iovecs which have been written completely.
+      size_t written = ret;
+      while ((niov > 0) && (written >= iov->iov_len)) {
+        written -= iov->iov_len;
+
+        iov++;
+        niov--;
+      }
+
+      if (written > 0) {
+        iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + written;
+        iov->iov_len -= written;
+      }
+    } else if ((ret < 0) && (errno == EAGAIN)) {
+      if (!wait()) {
+        return false;
+      }
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool io::pipe_output::wait()
+{
+  struct pollfd pfd;
+  pfd.fd = _M_fd;
+  pfd.events = POLLOUT;
+
+  int ret;
+  if ((ret = poll(&pfd, 1, 0)) != 0) {
+    return (ret > 0) || (errno == EINTR);
+  }
+
+  // The pipe is full: wait for the reader.
+  struct timespec start;
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  do {
+    ret = poll(&pfd, 1, -1);
+  } while ((ret < 0) && (errno == EINTR));
+
+  struct timespec end;
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  _M_stalls++;
+  _M_stall_time += (end.tv_sec - start.tv_sec) * 1000000000ull +
+                   end.tv_nsec -
+                   start.tv_nsec;
+
+  // POLLERR: the reader has gone away (the write reports the error).
+  return (ret > 0);
+}
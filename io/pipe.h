@@ -0,0 +1,89 @@
+#ifndef IO_PIPE_H
+#define IO_PIPE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+
+namespace io {
+  // Sequential output to a file which can't be seeked (a pipe, a socket or
+  // a terminal), e.g. the standard output.
+  // If the file is a pipe, its capacity is raised and stable data (pages of
+  // files mapped into memory, which don't change until the reader of the
+  // pipe consumes them) is spliced into it with vmsplice(), without
+  // copying; other data is written with writev(). When the pipe is full,
+  // the output waits for the reader with poll(); these stalls are counted
+  // and timed, to tell a slow consumer from a slow producer.
+  class pipe_output {
+    public:
+      // Capacity requested for pipes.
+      static constexpr const int pipe_size = 1024 * 1024;
+
+      // Constructor.
+      pipe_output() = default;
+
+      // Open output.
+      void open(int fd);
+
+      // Write the data of the iovecs (the iovecs are modified).
+      bool write(struct iovec* iov, unsigned niov, bool stable);
+
+      // File descriptor.
+      int fd() const
+      {
+        return _M_fd;
+      }
+
+      // Is the output a pipe?
+      bool is_pipe() const
+      {
+        return _M_pipe;
+      }
+
+      // Number of bytes spliced and copied.
+      uint64_t spliced() const
+      {
+        return _M_spliced;
+      }
+
+      uint64_t copied() const
+      {
+        return _M_copied;
+      }
+
+      // Number of times the pipe was full and time spent waiting for the
+      // reader (nanoseconds).
+      uint64_t stalls() const
+      {
+        return _M_stalls;
+      }
+
+      uint64_t stall_time() const
+      {
+        return _M_stall_time;
+      }
+
+    private:
+      int _M_fd = -1;
+      bool _M_pipe = false;
+
+      // Can data be spliced into the pipe (vmsplice() might not be
+      // supported)?
+      bool _M_splice = false;
+
+      uint64_t _M_spliced = 0;
+      uint64_t _M_copied = 0;
+
+      uint64_t _M_stalls = 0;
+      uint64_t _M_stall_time = 0;
+
+      // Wait until the output is writable.
+      bool wait();
+
+      // Disable copy constructor and assignment operator.
+      pipe_output(const pipe_output&) = delete;
+      pipe_output& operator=(const pipe_output&) = delete;
+  };
+}
+
+#endif // IO_PIPE_H
@@ -0,0 +1,73 @@
+#include <unistd.h>
+#include <errno.h>
+#include "io/rw.h"
+
+bool io::read_all(int fd, void* buf, size_t count)
+{
+  uint8_t* ptr = static_cast<uint8_t*>(buf);
+
+  while (count > 0) {
+    const ssize_t ret = read(fd, ptr, count);
+    if (ret > 0) {
+      ptr += ret;
+      count -= ret;
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool io::pread_all(int fd, void* buf, size_t count, uint64_t off)
+{
+  uint8_t* ptr = static_cast<uint8_t*>(buf);
+
+  while (count > 0) {
+    const ssize_t ret = pread(fd, ptr, count, off);
+    if (ret > 0) {
+      ptr += ret;
+      count -= ret;
+      off += ret;
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool io::write_all(int fd, const void* buf, size_t count)
+{
+  const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+
+  while (count > 0) {
+    const ssize_t ret = write(fd, ptr, count);
+    if (ret > 0) {
+      ptr += ret;
+      count -= ret;
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool io::pwrite_all(int fd, const void* buf, size_t count, uint64_t off)
+{
+  const uint8_t* ptr = static_cast<const uint8_t*>(buf);
+
+  while (count > 0) {
+    const ssize_t ret = pwrite(fd, ptr, count, off);
+    if (ret > 0) {
+      ptr += ret;
+      count -= ret;
+      off += ret;
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  return true;
+}
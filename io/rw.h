@@ -0,0 +1,21 @@
+#ifndef IO_RW_H
+#define IO_RW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace io {
+  // Read exactly `count` bytes (retrying on short reads and EINTR).
+  bool read_all(int fd, void* buf, size_t count);
+
+  // Read exactly `count` bytes at offset `off`.
+  bool pread_all(int fd, void* buf, size_t count, uint64_t off);
+
+  // Write exactly `count` bytes.
+  bool write_all(int fd, const void* buf, size_t count);
+
+  // Write exactly `count` bytes at offset `off`.
+  bool pwrite_all(int fd, const void* buf, size_t count, uint64_t off);
+}
+
+#endif // IO_RW_H
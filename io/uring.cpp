@@ -0,0 +1,263 @@
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include "io/uring.h"
+
+static inline int io_uring_setup(unsigned entries, struct io_uring_params* p)
+{
+  return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int io_uring_enter(int fd,
+                                 unsigned to_submit,
+                                 unsigned min_complete,
+                                 unsigned flags)
+{
+  return syscall(__NR_io_uring_enter,
+                 fd,
+                 to_submit,
+                 min_complete,
+                 flags,
+                 nullptr,
+                 0);
+}
+
+static inline int io_uring_register(int fd,
+                                    unsigned opcode,
+                                    const void* arg,
+                                    unsigned nr_args)
+{
+  return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+io::uring::~uring()
+{
+  destroy();
+}
+
+bool io::uring::create(unsigned entries)
+{
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(struct io_uring_params));
+
+  if ((_M_fd = io_uring_setup(entries, &params)) != -1) {
+    _M_sq_ring_size = params.sq_off.array +
+                      params.sq_entries * sizeof(unsigned);
+
+    _M_cq_ring_size = params.cq_off.cqes +
+                      params.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+      if (_M_cq_ring_size > _M_sq_ring_size) {
+        _M_sq_ring_size = _M_cq_ring_size;
+      }
+    }
+
+    // Map submission queue ring.
+    if ((_M_sq_ring = mmap(nullptr,
+                           _M_sq_ring_size,
+                           PROT_READ | PROT_WRITE,
+                           MAP_SHARED | MAP_POPULATE,
+                           _M_fd,
+                           IORING_OFF_SQ_RING)) != MAP_FAILED) {
+      // Map completion queue ring.
+      if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        _M_cq_ring = _M_sq_ring;
+        _M_cq_ring_size = 0;
+      } else if ((_M_cq_ring = mmap(nullptr,
+                                    _M_cq_ring_size,
+                                    PROT_READ | PROT_WRITE,
+                                    MAP_SHARED | MAP_POPULATE,
+                                    _M_fd,
+                                    IORING_OFF_CQ_RING)) == MAP_FAILED) {
+        _M_cq_ring = nullptr;
+        destroy();
+
+        return false;
+      }
+
+      // Map submission queue entries.
+      _M_sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+
+      void* sqes;
+      if ((sqes = mmap(nullptr,
+                       _M_sqes_size,
+                       PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE,
+                       _M_fd,
+                       IORING_OFF_SQES)) != MAP_FAILED) {
+        _M_sqes = static_cast<struct io_uring_sqe*>(sqes);
+
+        uint8_t* const sq = static_cast<uint8_t*>(_M_sq_ring);
+        _M_sq_head = reinterpret_cast<unsigned*>(sq + params.sq_off.head);
+        _M_sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        _M_sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        _M_sq_mask = *reinterpret_cast<unsigned*>(sq +
+                                                  params.sq_off.ring_mask);
+        _M_sq_entries = params.sq_entries;
+
+        _M_sqe_tail = *_M_sq_tail;
+
+        uint8_t* const cq = static_cast<uint8_t*>(_M_cq_ring);
+        _M_cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        _M_cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        _M_cqes = reinterpret_cast<struct io_uring_cqe*>(
+                    cq + params.cq_off.cqes
+                  );
+
+        _M_cq_mask = *reinterpret_cast<unsigned*>(cq +
+                                                  params.cq_off.ring_mask);
+
+        return true;
+      }
+    } else {
+      _M_sq_ring = nullptr;
+    }
+
+    destroy();
+  }
+
+  return false;
+}
+
+void io::uring::destroy()
+{
+  if (_M_sqes) {
+    munmap(_M_sqes, _M_sqes_size);
+    _M_sqes = nullptr;
+  }
+
+  if ((_M_cq_ring) && (_M_cq_ring != _M_sq_ring)) {
+    munmap(_M_cq_ring, _M_cq_ring_size);
+  }
+
+  _M_cq_ring = nullptr;
+
+  if (_M_sq_ring) {
+    munmap(_M_sq_ring, _M_sq_ring_size);
+    _M_sq_ring = nullptr;
+  }
+
+  if (_M_fd != -1) {
+    close(_M_fd);
+    _M_fd = -1;
+  }
+
+  _M_sq_entries = 0;
+}
+
+struct io_uring_sqe* io::uring::get_sqe()
+{
+  const unsigned head = __atomic_load_n(_M_sq_head, __ATOMIC_ACQUIRE);
+
+  if (_M_sqe_tail - head < _M_sq_entries) {
+    const unsigned idx = _M_sqe_tail & _M_sq_mask;
+
+    struct io_uring_sqe* const sqe = &_M_sqes[idx];
+    memset(sqe, 0, sizeof(struct io_uring_sqe));
+
+    _M_sq_array[idx] = idx;
+    _M_sqe_tail++;
+
+    return sqe;
+  }
+
+  return nullptr;
+}
+
+unsigned io::uring::flush()
+{
+  const unsigned tail = *_M_sq_tail;
+
+  if (_M_sqe_tail != tail) {
+    __atomic_store_n(_M_sq_tail, _M_sqe_tail, __ATOMIC_RELEASE);
+  }
+
+  return _M_sqe_tail - __atomic_load_n(_M_sq_head, __ATOMIC_ACQUIRE);
+}
+
+int io::uring::submit(unsigned wait_nr)
+{
+  const unsigned to_submit = flush();
+
+  do {
+    int ret;
+    if ((ret = io_uring_enter(_M_fd,
+                              to_submit,
+                              wait_nr,
+                              (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0)) >=
+        0) {
+      return ret;
+    } else if (errno != EINTR) {
+      return -1;
+    }
+  } while (true);
+}
+
+bool io::uring::get_cqe(struct io_uring_cqe& cqe, bool wait)
+{
+  do {
+    const unsigned head = *_M_cq_head;
+
+    if (head != __atomic_load_n(_M_cq_tail, __ATOMIC_ACQUIRE)) {
+      cqe = _M_cqes[head & _M_cq_mask];
+      __atomic_store_n(_M_cq_head, head + 1, __ATOMIC_RELEASE);
+
+      return true;
+    } else if (!wait) {
+      return false;
+    } else if (submit(1) < 0) {
+      return false;
+    }
+  } while (true);
+}
+
+bool io::uring::register_buffers(const struct iovec* iov, unsigned count)
+{
+  return (io_uring_register(_M_fd, IORING_REGISTER_BUFFERS, iov, count) == 0);
+}
+
+void io::uring::unregister_buffers()
+{
+  io_uring_register(_M_fd, IORING_UNREGISTER_BUFFERS, nullptr, 0);
+}
+
+bool io::uring::register_files(const int* fds, unsigned count)
+{
+  return (io_uring_register(_M_fd, IORING_REGISTER_FILES, fds, count) == 0);
+}
+
+bool io::uring::update_files(unsigned off, const int* fds, unsigned count)
+{
+  struct io_uring_files_update update;
+  memset(&update, 0, sizeof(struct io_uring_files_update));
+
+  update.offset = off;
+  update.fds = reinterpret_cast<uintptr_t>(fds);
+
+  return (io_uring_register(_M_fd,
+                            IORING_REGISTER_FILES_UPDATE,
+                            &update,
+                            count) == static_cast<int>(count));
+}
+
+void io::uring::unregister_files()
+{
+  io_uring_register(_M_fd, IORING_UNREGISTER_FILES, nullptr, 0);
+}
+
+bool io::uring::fsync(int fd)
+{
+  struct io_uring_sqe* sqe;
+  if ((sqe = get_sqe()) != nullptr) {
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+
+    struct io_uring_cqe cqe;
+    return ((submit() == 1) && (get_cqe(cqe, true)) && (cqe.res == 0));
+  }
+
+  return false;
+}
@@ -0,0 +1,110 @@
+#ifndef IO_URING_H
+#define IO_URING_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+
+namespace io {
+  // Minimal io_uring wrapper (raw system calls, no liburing).
+  class uring {
+    public:
+      // Default queue depth.
+      static constexpr const unsigned default_depth = 32;
+
+      // Constructor.
+      uring() = default;
+
+      // Destructor.
+      ~uring();
+
+      // Create ring with (at least) `entries` submission queue entries.
+      bool create(unsigned entries);
+
+      // Destroy ring.
+      void destroy();
+
+      // Is the ring created?
+      bool valid() const
+      {
+        return (_M_fd != -1);
+      }
+
+      // Number of submission queue entries.
+      unsigned entries() const
+      {
+        return _M_sq_entries;
+      }
+
+      // Get a free submission queue entry (cleared).
+      // Returns nullptr if the submission queue is full.
+      struct io_uring_sqe* get_sqe();
+
+      // Submit the queued entries and wait for at least `wait_nr`
+      // completions.
+      // Returns the number of entries submitted or -1 on error.
+      int submit(unsigned wait_nr = 0);
+
+      // Get the next completion (waiting for it if `wait` is true).
+      bool get_cqe(struct io_uring_cqe& cqe, bool wait);
+
+      // Register buffers.
+      bool register_buffers(const struct iovec* iov, unsigned count);
+
+      // Unregister buffers.
+      void unregister_buffers();
+
+      // Register files (-1 entries are empty slots).
+      bool register_files(const int* fds, unsigned count);
+
+      // Replace registered files starting at slot `off`.
+      bool update_files(unsigned off, const int* fds, unsigned count);
+
+      // Unregister files.
+      void unregister_files();
+
+      // Synchronize file to disk through the ring.
+      bool fsync(int fd);
+
+    private:
+      // Ring file descriptor.
+      int _M_fd = -1;
+
+      // Mapped rings.
+      void* _M_sq_ring = nullptr;
+      size_t _M_sq_ring_size = 0;
+
+      void* _M_cq_ring = nullptr;
+      size_t _M_cq_ring_size = 0;
+
+      struct io_uring_sqe* _M_sqes = nullptr;
+      size_t _M_sqes_size = 0;
+
+      // Submission queue.
+      unsigned* _M_sq_head = nullptr;
+      unsigned* _M_sq_tail = nullptr;
+      unsigned* _M_sq_array = nullptr;
+      unsigned _M_sq_mask = 0;
+      unsigned _M_sq_entries = 0;
+
+      // Local tail (entries prepared but not yet submitted).
+      unsigned _M_sqe_tail = 0;
+
+      // Completion queue.
+      unsigned* _M_cq_head = nullptr;
+      unsigned* _M_cq_tail = nullptr;
+      struct io_uring_cqe* _M_cqes = nullptr;
+      unsigned _M_cq_mask = 0;
+
+      // Make the prepared entries visible to the kernel.
+      // Returns the number of entries to submit.
+      unsigned flush();
+
+      // Disable copy constructor and assignment operator.
+      uring(const uring&) = delete;
+      uring& operator=(const uring&) = delete;
+  };
+}
+
+#endif // IO_URING_H
@@ -0,0 +1,73 @@
+#include <unistd.h>
+#include <poll.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/inotify.h>
+#include "io/watcher.h"
+
+io::watcher::~watcher()
+{
+  if (_M_fd != -1) {
+    close(_M_fd);
+  }
+}
+
+bool io::watcher::open(const char* dirname)
+{
+  if ((_M_fd = inotify_init1(IN_CLOEXEC)) != -1) {
+    if (inotify_add_watch(_M_fd,
+                          dirname,
+                          IN_CLOSE_WRITE | IN_MOVED_TO | IN_ONLYDIR) != -1) {
+      return true;
+    }
+
+    close(_M_fd);
+    _M_fd = -1;
+  }
+
+  return false;
+}
+
+bool io::watcher::wait(file_function fn, void* arg, const sigset_t* sigmask)
+{
+  struct pollfd pfd;
+  pfd.fd = _M_fd;
+  pfd.events = POLLIN;
+
+  int ret;
+  if ((ret = ppoll(&pfd, 1, nullptr, sigmask)) <= 0) {
+    // Interrupted by a signal?
+    return (ret < 0) && (errno == EINTR);
+  }
+
+  // Large enough for a few events with the longest name.
+  alignas(struct inotify_event) uint8_t
+    buf[4 * (sizeof(struct inotify_event) + NAME_MAX + 1)];
+
+  ssize_t len;
+  do {
+    len = read(_M_fd, buf, sizeof(buf));
+  } while ((len < 0) && (errno == EINTR));
+
+  if (len <= 0) {
+    return false;
+  }
+
+  for (ssize_t off = 0; off < len; ) {
+    const struct inotify_event* const
+      event = reinterpret_cast<const struct inotify_event*>(buf + off);
+
+    if (event->mask & IN_Q_OVERFLOW) {
+      _M_overflows++;
+    } else if (event->mask & IN_IGNORED) {
+      // The directory has been removed or unmounted.
+      return false;
+    } else if ((!(event->mask & IN_ISDIR)) && (event->len > 0)) {
+      fn(arg, event->name);
+    }
+
+    off += sizeof(struct inotify_event) + event->len;
+  }
+
+  return true;
+}
@@ -0,0 +1,52 @@
+#ifndef IO_WATCHER_H
+#define IO_WATCHER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <signal.h>
+
+namespace io {
+  // Watcher of the files completed in a directory (inotify): files closed
+  // after being written (IN_CLOSE_WRITE) and files moved into the directory
+  // (IN_MOVED_TO, e.g. renamed when they are complete).
+  // The events are read in batches; the names are reported in the order
+  // the kernel queued them.
+  class watcher {
+    public:
+      // Function called for each completed file (name relative to the
+      // directory).
+      typedef void (*file_function)(void* arg, const char* name);
+
+      // Constructor.
+      watcher() = default;
+
+      // Destructor.
+      ~watcher();
+
+      // Watch directory.
+      bool open(const char* dirname);
+
+      // Wait until files are completed and call `fn` for each of them.
+      // The signal mask is replaced by `sigmask` while waiting (signals
+      // blocked otherwise can interrupt the wait, see ppoll()).
+      // Returns false on error or if the directory has gone away.
+      bool wait(file_function fn, void* arg, const sigset_t* sigmask);
+
+      // Number of times the event queue overflowed (events were lost).
+      uint64_t overflows() const
+      {
+        return _M_overflows;
+      }
+
+    private:
+      int _M_fd = -1;
+
+      uint64_t _M_overflows = 0;
+
+      // Disable copy constructor and assignment operator.
+      watcher(const watcher&) = delete;
+      watcher& operator=(const watcher&) = delete;
+  };
+}
+
+#endif // IO_WATCHER_H
@@ -6,264 +6,807 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <sys/mman.h>
-#include <dirent.h>
 #include <errno.h>
 #include <inttypes.h>
+#include <getopt.h>
+#include <limits.h>
+#include <ctype.h>
+#include <time.h>
+#include <signal.h>
+#include <new>
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+#include "pcap/scan.h"
+#include "pcap/cache.h"
+#include "pcap/decompress.h"
+#include "pcap/window.h"
+#include "pcap/offsets.h"
+#include "pcap/split.h"
+#include "pcap/merge.h"
+#include "pcap/flow.h"
+#include "pcap/filter.h"
+#include "pcap/dedup.h"
+#include "pcap/convert.h"
+#include "pcap/interfaces.h"
+#include "pcap/plan.h"
+#include "pcap/frames.h"
+#include "pcap/writer.h"
+#include "io/rw.h"
+#include "io/copier.h"
+#include "io/compressor.h"
+#include "io/watcher.h"
+#include "util/parallel.h"
+#include "util/file_set.h"
 
-namespace pcap {
-  enum class magic : uint32_t {
-    microseconds = 0xa1b2c3d4,
-    nanoseconds = 0xa1b23c4d
-  };
+// Policy for files whose link type is not the one of the first file.
+enum class linktype_policy {
+  fail,    // Don't write anything.
+  reject,  // Skip the file.
+  split    // Write an output file per link type.
+};
 
-  static constexpr const uint16_t version_major = 2;
-  static constexpr const uint16_t version_minor = 4;
-
-  struct pcap_file_header {
-    uint32_t magic;
-    uint16_t version_major;
-    uint16_t version_minor;
-    int32_t thiszone;
-    uint32_t sigfigs;
-    uint32_t snaplen;
-    uint32_t linktype;
-  };
+// Output settings.
+struct output_options {
+  unsigned nworkers;
+  io::uring* ring;
+  pcap::resolution res;
+  bool autores;
+  bool pcapng;
+  bool merge;
+  bool compress;
+  io::compressor::format compression;
+  int level;
+  size_t frame_size;
+  bool frame_index;
+  bool split;
+  pcap::splitter::mode split_mode;
+  uint64_t split_limit;
+  unsigned shards;
+  pcap::filter* filter;
+  pcap::deduplicator* dedup;
+  uint32_t snaplen;
+  bool sync;
+  bool verbose;
+};
 
-  struct timeval {
-    uint32_t tv_sec;
-    uint32_t tv_usec;
-  };
+// Output file written packet by packet (filtered, deduplicated, truncated
+// or sharded output).
+struct packet_output {
+  char name[PATH_MAX];
+  int fd;
+  io::compressor* stream;
+  pcap::frame_index* index;
+};
 
-  struct pcap_pkthdr {
-    timeval ts;
-    uint32_t caplen;
-    uint32_t len;
-  };
+// Routing of the packets written packet by packet.
+struct packet_routing {
+  pcap::filter* filter;
+  pcap::deduplicator* dedup;
+  unsigned nshards;
+  uint64_t packets;
+  uint64_t matched;
+  uint64_t duplicates;
+};
+
+// File seen while following the input directory.
+struct followed_file {
+  // Timestamps of the first and of the last packets (a file with another
+  // first timestamp is a new file which reuses the inode number).
+  uint64_t timestamp;
+  uint64_t last_timestamp;
+
+  // Has it been appended (or skipped)? Otherwise, it is in the reorder
+  // buffer.
+  bool appended;
+};
+
+// Appended files are forgotten once the output goes beyond their last
+// packet by more than an hour (the set is only pruned when it has doubled).
+static constexpr const uint64_t follow_horizon = 3600 * 1000000000ull;
+static constexpr const size_t follow_prune_min = 1024;
 
-  // Minimum size of a PCAP file.
-  static constexpr const size_t
-         minimum_size = sizeof(pcap_file_header) + sizeof(pcap_pkthdr);
+// Output file appended to while following the input directory.
+struct follow_state {
+  const char* dirname;
+  const char* filename;
+  const output_options* options;
+  io::copier* copier;
+  int fd;
+  dev_t dev;
+  ino_t ino;
+  uint64_t size;
+  pcap::resolution res;
+  uint32_t linktype;
+  uint64_t last_timestamp;
+  size_t reorder;
+  pcap::files pending;
+  util::file_set<followed_file> seen;
+  size_t prune_at;
+  size_t appended;
+  size_t late;
+  bool error;
+};
 
-  // PCAP file.
-  struct file {
-    // File name.
-    char* filename;
+// Set by SIGINT and SIGTERM: stop following the input directory.
+static volatile sig_atomic_t stop_following = 0;
 
-    // File size.
-    uint64_t filesize;
+static void usage(const char* program);
+static bool parse_time(const char* s, pcap::nanoseconds& ts);
+static bool parse_size(const char* s, uint64_t& size);
+static bool check_linktypes(pcap::files& files, linktype_policy policy);
+static bool split_output(const pcap::files& files,
+                         const char* filename,
+                         const output_options& options,
+                         io::copier& copier);
+static bool insert_suffix(const char* filename,
+                          const char* suffix,
+                          char* name,
+                          size_t size);
+static bool write_files(const pcap::files& files,
+                        const char* filename,
+                        const output_options& options,
+                        io::copier& copier);
+static bool write_chunks(const pcap::files& files,
+                         const char* filename,
+                         const output_options& options,
+                         io::copier& copier);
+static bool write_output(const pcap::files& files,
+                         const char* filename,
+                         const output_options& options,
+                         io::copier& copier);
+static bool write_packets(const pcap::files& files,
+                          const char* filename,
+                          const output_options& options);
+static unsigned route_packet(void* arg, const pcap::reader& r);
+static bool write_header(const pcap::files& files,
+                         pcap::resolution res,
+                         const pcap::pcapng::interfaces* ifaces,
+                         const char* outfilename,
+                         pcap::writer& w);
+static bool copy_file(io::copier& copier,
+                      int outfd,
+                      uint64_t outoff,
+                      const pcap::file& f,
+                      uint64_t len);
+static bool copy_files(const pcap::files& files,
+                       const pcap::plan& plan,
+                       pcap::resolution res,
+                       const pcap::pcapng::interfaces* ifaces,
+                       int outfd,
+                       const char* outfilename,
+                       unsigned nworkers,
+                       io::copier& copier);
+static bool copy_segment(const pcap::files& files,
+                         const pcap::segment& seg,
+                         pcap::resolution res,
+                         const pcap::pcapng::interfaces* ifaces,
+                         int outfd,
+                         uint64_t outoff,
+                         const char* outfilename,
+                         io::copier& copier);
+static bool stream_file(pcap::writer& w,
+                        const pcap::file& f,
+                        uint64_t len);
+static bool compress_files(const pcap::files& files,
+                           const pcap::plan& plan,
+                           pcap::resolution res,
+                           const pcap::pcapng::interfaces* ifaces,
+                           int outfd,
+                           const char* outfilename,
+                           const output_options& options,
+                           io::copier& copier);
+static bool pipe_files(const pcap::files& files,
+                       const pcap::plan& plan,
+                       pcap::resolution res,
+                       const pcap::pcapng::interfaces* ifaces,
+                       const output_options& options,
+                       io::copier& copier);
+static bool write_segments(const pcap::files& files,
+                           const pcap::plan& plan,
+                           const pcap::pcapng::interfaces* ifaces,
+                           const char* outfilename,
+                           io::copier& copier,
+                           pcap::writer& w);
+static bool follow_directory(pcap::files& files,
+                             const char* dirname,
+                             const char* filename,
+                             const output_options& options,
+                             size_t reorder,
+                             io::watcher& watcher,
+                             io::copier& copier);
+static void follow_file(void* arg, const char* name);
+static bool append_files(follow_state& st);
+static bool remember(follow_state& st, const pcap::file& f, bool appended);
+static void on_stop_signal(int signum);
+static bool is_stdout(const char* filename);
+static void print_pipe_stats(const io::pipe_output& pipe);
+static pcap::resolution output_resolution(const pcap::files& files);
+static void print_plan(const pcap::plan& plan);
+static void print_copy_stats(const io::copier& copier);
 
-    // Timestamp of the first packet.
-    uint64_t timestamp;
+int main(int argc, char** argv)
+{
+  static const struct option longopts[] = {
+    {"cache",          required_argument, nullptr, 'i'},
+    {"compress",       required_argument, nullptr, 'z'},
+    {"copy-method",    required_argument, nullptr, 'c'},
+    {"dedup",          required_argument, nullptr, 'd'},
+    {"end",            required_argument, nullptr, 'B'},
+    {"filter",         required_argument, nullptr, 'f'},
+    {"follow",         no_argument,       nullptr, 'w'},
+    {"format",         required_argument, nullptr, 'F'},
+    {"frame-index",    no_argument,       nullptr, 'x'},
+    {"frame-size",     required_argument, nullptr, 'Z'},
+    {"fsync",          no_argument,       nullptr, 's'},
+    {"ignore-ttl",     no_argument,       nullptr, 'I'},
+    {"io-uring",       no_argument,       nullptr, 'u'},
+    {"jobs",           required_argument, nullptr, 'j'},
+    {"linktype",       required_argument, nullptr, 'l'},
+    {"merge",          required_argument, nullptr, 'm'},
+    {"offset-index",   no_argument,       nullptr, 'o'},
+    {"queue-depth",    required_argument, nullptr, 'q'},
+    {"reflink",        required_argument, nullptr, 'r'},
+    {"reorder",        required_argument, nullptr, 'R'},
+    {"resolution",     required_argument, nullptr, 't'},
+    {"shards",         required_argument, nullptr, 'S'},
+    {"snaplen",        required_argument, nullptr, 'L'},
+    {"split-interval", required_argument, nullptr, 'G'},
+    {"split-packets",  required_argument, nullptr, 'P'},
+    {"split-size",     required_argument, nullptr, 'C'},
+    {"start",          required_argument, nullptr, 'A'},
+    {"tmp-size",       required_argument, nullptr, 'T'},
+    {"verbose",        no_argument,       nullptr, 'v'},
+    {"help",           no_argument,       nullptr, 'h'},
+    {nullptr,          0,                 nullptr,  0 }
   };
 
-  // List of PCAP files.
-  class files {
-    public:
-      // Constructor.
-      files() = default;
-
-      // Destructor.
-      ~files()
-      {
-        if (_M_files) {
-          for (; _M_used > 0; _M_used--) {
-            free(_M_files[_M_used - 1].filename);
-          }
+  io::copier copier;
+  io::uring ring;
+  const char* cache = nullptr;
+  unsigned depth = io::uring::default_depth;
+  unsigned nworkers = 1;
+  bool use_uring = false;
+  pcap::resolution res = pcap::resolution::microseconds;
+  bool autores = true;
+  bool pcapng = false;
+  linktype_policy policy = linktype_policy::fail;
+  bool merge = true;
+  bool compress = false;
+  io::compressor::format compression = io::compressor::format::gzip;
+  int level = 0;
+  size_t frame_size = io::compressor::default_frame_size;
+  bool frame_index = false;
+  pcap::nanoseconds start = 0;
+  pcap::nanoseconds end = UINT64_MAX;
+  bool window = false;
+  bool offset_index = false;
+  bool split = false;
+  pcap::splitter::mode split_mode = pcap::splitter::mode::size;
+  uint64_t split_limit = 0;
+  unsigned shards = 0;
+  pcap::filter filter;
+  bool filtered = false;
+  pcap::nanoseconds dedup_window = 0;
+  bool ignore_ttl = false;
+  pcap::deduplicator dedup;
+  uint32_t snaplen = 0;
+  bool follow = false;
+  size_t reorder = 2;
+  bool reorder_set = false;
+  bool sync = false;
+  bool verbose = false;
 
-          free(_M_files);
+  // Parse options.
+  int c;
+  while ((c = getopt_long(argc, argv, "A:B:c:C:d:f:F:G:i:Ij:l:L:m:oP:q:r:R:sS:t:T:uvwxz:Z:h", longopts, nullptr)) != -1) {
+    switch (c) {
+      case 'A':
+      case 'B':
+        if (!parse_time(optarg, (c == 'A') ? start : end)) {
+          fprintf(stderr, "Invalid time '%s'.\n", optarg);
+          return -1;
         }
-      }
 
-      // Add PCAP file.
-      bool add(const char* filename, uint64_t filesize, uint64_t timestamp)
-      {
-        // Allocate new PCAP files (if needed).
-        if (allocate()) {
-          char* f;
-          if ((f = strdup(filename)) != nullptr) {
-            file* entry = &_M_files[_M_used++];
+        window = true;
+        break;
+      case 'c':
+        if (strcasecmp(optarg, "auto") != 0) {
+          io::copier::method method;
+          if (io::copier::parse(optarg, method)) {
+            copier.force(method);
+          } else {
+            fprintf(stderr, "Invalid copy method '%s'.\n", optarg);
+            return -1;
+          }
+        }
+
+        break;
+      case 'C':
+      case 'G':
+      case 'P':
+        {
+          if (split) {
+            fprintf(stderr, "Only one split mode can be used.\n");
+            return -1;
+          }
+
+          bool valid;
+          if (c == 'C') {
+            split_mode = pcap::splitter::mode::size;
+            valid = parse_size(optarg, split_limit);
+          } else {
+            char* end;
+            errno = 0;
+            split_limit = strtoull(optarg, &end, 10);
+            valid = (*end == 0) && (end != optarg) && (errno == 0);
+
+            if (c == 'G') {
+              split_mode = pcap::splitter::mode::interval;
+
+              if (split_limit > UINT64_MAX / 1000000000ull) {
+                valid = false;
+              }
 
-            entry->filename = f;
-            entry->filesize = filesize;
-            entry->timestamp = timestamp;
+              split_limit *= 1000000000ull;
+            } else {
+              split_mode = pcap::splitter::mode::packets;
+            }
+          }
 
-            return true;
+          if ((!valid) || (split_limit == 0)) {
+            fprintf(stderr, "Invalid split limit '%s'.\n", optarg);
+            return -1;
           }
+
+          split = true;
         }
 
-        return false;
-      }
+        break;
+      case 'd':
+        {
+          // Microseconds, up to an hour.
+          char* end;
+          const unsigned long long n = strtoull(optarg, &end, 10);
+          if ((*end == 0) && (n >= 1) && (n <= 3600000000ull)) {
+            dedup_window = n * 1000;
+          } else {
+            fprintf(stderr, "Invalid deduplication window '%s'.\n", optarg);
+            return -1;
+          }
+        }
 
-      // Sort.
-      void sort()
-      {
-        qsort(_M_files, _M_used, sizeof(file), compare);
-      }
+        break;
+      case 'f':
+        {
+          char error[256];
+          if (!filter.compile(optarg, error, sizeof(error))) {
+            fprintf(stderr, "Invalid filter '%s': %s.\n", optarg, error);
+            return -1;
+          }
 
-      // Get PCAP file.
-      const file* get(size_t idx) const
-      {
-        return (idx < _M_used) ? &_M_files[idx] : nullptr;
-      }
+          filtered = true;
+        }
 
-    private:
-      // PCAP files.
-      file* _M_files = nullptr;
-      size_t _M_size = 0;
-      size_t _M_used = 0;
-
-      // Allocate.
-      bool allocate()
-      {
-        if (_M_used < _M_size) {
-          return true;
+        break;
+      case 'F':
+        if (strcasecmp(optarg, "pcap") == 0) {
+          pcapng = false;
+        } else if (strcasecmp(optarg, "pcapng") == 0) {
+          pcapng = true;
         } else {
-          size_t size = (_M_size > 0) ? _M_size * 2 : 1024;
-
-          file* files;
-          if ((files = static_cast<file*>(
-                         realloc(_M_files, size * sizeof(file))
-                       )) != nullptr) {
-            _M_files = files;
-            _M_size = size;
+          fprintf(stderr, "Invalid file format '%s'.\n", optarg);
+          return -1;
+        }
 
-            return true;
+        break;
+      case 'i':
+        cache = optarg;
+        break;
+      case 'I':
+        ignore_ttl = true;
+        break;
+      case 'j':
+        {
+          char* end;
+          const unsigned long n = strtoul(optarg, &end, 10);
+          if ((*end == 0) && (n >= 1) && (n <= 1024)) {
+            nworkers = n;
           } else {
-            return false;
+            fprintf(stderr, "Invalid number of jobs '%s'.\n", optarg);
+            return -1;
           }
         }
-      }
 
-      static int compare(const void* p1, const void* p2)
-      {
-        const file* const f1 = static_cast<const file*>(p1);
-        const file* const f2 = static_cast<const file*>(p2);
+        break;
+      case 'l':
+        if (strcasecmp(optarg, "fail") == 0) {
+          policy = linktype_policy::fail;
+        } else if (strcasecmp(optarg, "reject") == 0) {
+          policy = linktype_policy::reject;
+        } else if (strcasecmp(optarg, "split") == 0) {
+          policy = linktype_policy::split;
+        } else {
+          fprintf(stderr, "Invalid link type policy '%s'.\n", optarg);
+          return -1;
+        }
+
+        break;
+      case 'L':
+        {
+          char* end;
+          const unsigned long n = strtoul(optarg, &end, 10);
+          if ((*end == 0) && (n >= 1) && (n <= pcap::maximum_snaplen)) {
+            snaplen = n;
+          } else {
+            fprintf(stderr, "Invalid snapshot length '%s'.\n", optarg);
+            return -1;
+          }
+        }
 
-        if (f1->timestamp < f2->timestamp) {
+        break;
+      case 'm':
+        if (strcasecmp(optarg, "auto") == 0) {
+          merge = true;
+        } else if (strcasecmp(optarg, "never") == 0) {
+          merge = false;
+        } else {
+          fprintf(stderr, "Invalid merge mode '%s'.\n", optarg);
           return -1;
-        } else if (f1->timestamp > f2->timestamp) {
-          return 1;
+        }
+
+        break;
+      case 'o':
+        offset_index = true;
+        break;
+      case 'q':
+        {
+          char* end;
+          const unsigned long n = strtoul(optarg, &end, 10);
+          if ((*end == 0) && (n >= 1) && (n <= 4096)) {
+            depth = n;
+          } else {
+            fprintf(stderr, "Invalid queue depth '%s'.\n", optarg);
+            return -1;
+          }
+        }
+
+        break;
+      case 'r':
+        {
+          io::copier::reflink mode;
+          if (io::copier::parse(optarg, mode)) {
+            copier.set_reflink(mode);
+          } else {
+            fprintf(stderr, "Invalid reflink mode '%s'.\n", optarg);
+            return -1;
+          }
+        }
+
+        break;
+      case 'R':
+        {
+          char* end;
+          const unsigned long n = strtoul(optarg, &end, 10);
+          if ((*end == 0) && (end != optarg) && (n <= 1024)) {
+            reorder = n;
+            reorder_set = true;
+          } else {
+            fprintf(stderr, "Invalid reorder buffer size '%s'.\n", optarg);
+            return -1;
+          }
+        }
+
+        break;
+      case 's':
+        sync = true;
+        break;
+      case 'S':
+        {
+          char* end;
+          const unsigned long n = strtoul(optarg, &end, 10);
+          if ((*end == 0) && (n >= 1) && (n <= 1024)) {
+            shards = n;
+          } else {
+            fprintf(stderr, "Invalid number of shards '%s'.\n", optarg);
+            return -1;
+          }
+        }
+
+        break;
+      case 't':
+        if (strcasecmp(optarg, "auto") == 0) {
+          autores = true;
+        } else if ((strcasecmp(optarg, "us") == 0) ||
+                   (strcasecmp(optarg, "usec") == 0)) {
+          res = pcap::resolution::microseconds;
+          autores = false;
+        } else if ((strcasecmp(optarg, "ns") == 0) ||
+                   (strcasecmp(optarg, "nsec") == 0)) {
+          res = pcap::resolution::nanoseconds;
+          autores = false;
         } else {
-          return 0;
+          fprintf(stderr, "Invalid resolution '%s'.\n", optarg);
+          return -1;
         }
-      }
-  };
-}
 
-static void usage(const char* program);
-static bool get_first_timestamp(const char* filename, uint64_t& timestamp);
-static bool copy_file(int outfd,
-                      const char* filename,
-                      uint64_t filesize,
-                      size_t offset);
+        break;
+      case 'T':
+        {
+          uint64_t size;
+          if (!parse_size(optarg, size)) {
+            fprintf(stderr, "Invalid size '%s'.\n", optarg);
+            return -1;
+          }
+
+          pcap::set_decompressed_limit(size);
+        }
+
+        break;
+      case 'u':
+        use_uring = true;
+        break;
+      case 'v':
+        verbose = true;
+        break;
+      case 'w':
+        follow = true;
+        break;
+      case 'z':
+        if (!io::compressor::parse(optarg, compression, level)) {
+          fprintf(stderr, "Invalid compression '%s'.\n", optarg);
+          return -1;
+        }
+
+        if (!io::compressor::available(compression)) {
+          fprintf(stderr,
+                  "This build doesn't support %s compression.\n",
+                  io::compressor::name(compression));
+
+          return -1;
+        }
+
+        compress = true;
+        break;
+      case 'x':
+        frame_index = true;
+        break;
+      case 'Z':
+        {
+          char* end;
+          const unsigned long n = strtoul(optarg, &end, 10);
+          if ((*end == 0) && (n >= 1) && (n <= 1024)) {
+            frame_size = n * 1024 * 1024;
+          } else {
+            fprintf(stderr, "Invalid frame size '%s'.\n", optarg);
+            return -1;
+          }
+        }
+
+        break;
+      default:
+        usage(argv[0]);
+        return -1;
+    }
+  }
+
+  argc -= (optind - 1);
+  argv += (optind - 1);
+
+  if (start >= end) {
+    fprintf(stderr, "The start of the time window is not before its end.\n");
+    return -1;
+  }
+
+  if (dedup_window > 0) {
+    if (!dedup.init(dedup_window, ignore_ttl)) {
+      fprintf(stderr, "Error allocating memory.\n");
+      return -1;
+    }
+  } else if (ignore_ttl) {
+    fprintf(stderr, "--ignore-ttl requires --dedup.\n");
+    return -1;
+  }
+
+  // The standard output is a single stream.
+  if ((argc == 3) &&
+      (is_stdout(argv[2])) &&
+      ((split) ||
+       (shards > 0) ||
+       (policy == linktype_policy::split) ||
+       (frame_index) ||
+       (sync))) {
+    fprintf(stderr,
+            "Splitting, sharding, --linktype=split, --frame-index and "
+            "--fsync need an\noutput file.\n");
+
+    return -1;
+  }
+
+  // Following appends the new files to a PCAP file as they are copied.
+  if (follow) {
+    if ((pcapng) ||
+        (compress) ||
+        (frame_index) ||
+        (split) ||
+        (shards > 0) ||
+        (policy == linktype_policy::split) ||
+        (filtered) ||
+        (dedup_window > 0) ||
+        (snaplen > 0) ||
+        (window) ||
+        ((argc == 3) && (is_stdout(argv[2])))) {
+      fprintf(stderr,
+              "--follow appends to an uncompressed PCAP output file: it "
+              "can't be used with\npcapng, compressed, split, sharded, "
+              "filtered, deduplicated or truncated output,\n"
+              "--linktype=split, --frame-index or a time window.\n");
+
+      return -1;
+    }
+  } else if (reorder_set) {
+    fprintf(stderr, "--reorder requires --follow.\n");
+    return -1;
+  }
+
+  // io_uring backend.
+  if (use_uring) {
+    // Probing takes three entries per file.
+    if (ring.create(depth * 3)) {
+      copier.enable(io::copier::method::io_uring);
+      copier.set_queue_depth(depth);
+    } else {
+      fprintf(stderr, "io_uring is not available, using blocking I/O.\n");
+      use_uring = false;
+    }
+  }
 
-int main(int argc, const char** argv)
-{
   // Check usage.
   if (argc == 3) {
     // If it is a directory...
     struct stat sbuf;
     if ((stat(argv[1], &sbuf) == 0) && (S_ISDIR(sbuf.st_mode))) {
-      // Open output file for writing.
-      int fd;
-      if ((fd = open(argv[2], O_CREAT | O_TRUNC | O_WRONLY, 0644)) != -1) {
-        // Open directory.
-        DIR* dir;
-        if ((dir = opendir(argv[1])) != nullptr) {
-          pcap::files files;
-
-          // Size of the output file.
-          uint64_t filesize = sizeof(pcap::pcap_file_header);
-
-          struct dirent* entry;
-          while ((entry = readdir(dir)) != nullptr) {
-            // Compose full filename.
-            char pathname[PATH_MAX];
-            snprintf(pathname,
-                     sizeof(pathname),
-                     "%s/%s",
-                     argv[1],
-                     entry->d_name);
-
-            // If it is a regular file and is not too small...
-            if ((stat(pathname, &sbuf) == 0) &&
-                (S_ISREG(sbuf.st_mode)) &&
-                (sbuf.st_size > static_cast<off_t>(pcap::minimum_size))) {
-              size_t len = strlen(entry->d_name);
-
-              // PCAP file?
-              if ((len > 5) &&
-                  (entry->d_name[len - 5] == '.') &&
-                  (strcasecmp(entry->d_name + len - 4, "pcap") == 0)) {
-                // Get timestamp of the first packet.
-                uint64_t timestamp;
-                if (get_first_timestamp(pathname, timestamp)) {
-                  if (files.add(pathname, sbuf.st_size, timestamp)) {
-                    // Increment size of the output file.
-                    filesize += (sbuf.st_size -
-                                 sizeof(pcap::pcap_file_header));
-                  } else {
-                    fprintf(stderr, "Error allocating memory.\n");
-
-                    closedir(dir);
-
-                    close(fd);
-                    unlink(argv[2]);
-
-                    return -1;
-                  }
-                }
-              }
-            }
+      pcap::files files;
+
+      // Watch the directory before scanning it, not to miss files.
+      io::watcher watcher;
+      if ((follow) && (!watcher.open(argv[1]))) {
+        fprintf(stderr,
+                "Error watching directory '%s' (%s).\n",
+                argv[1],
+                strerror(errno));
+
+        return -1;
+      }
+
+      // Scan directory.
+      pcap::scan_options options;
+      options.nworkers = nworkers;
+      options.ring = use_uring ? &ring : nullptr;
+
+      // Fill the index completely, so later runs don't have to open the
+      // files. Overlap detection needs the timestamp of the last packet and
+      // pcapng output the size of the packets as blocks. The time window
+      // needs the timestamp of the last packet to skip whole files,
+      // splitting the sizes of the files, and sharding, filtering,
+      // deduplicating and truncating the files which overlap, and
+      // following the directory the files which arrive late.
+      options.cache = cache;
+      options.walk = (cache != nullptr) ||
+                     (merge) ||
+                     (pcapng) ||
+                     (window) ||
+                     (split) ||
+                     (shards > 0) ||
+                     (filtered) ||
+                     (dedup_window > 0) ||
+                     (snaplen > 0) ||
+                     (follow);
+
+      if (pcap::scan(argv[1], options, files)) {
+        // Sort PCAP files.
+        files.sort();
+
+        // Walk the compressed files (the probe only decompressed their
+        // beginning).
+        size_t nunwalked = 0;
+        for (size_t i = 0; i < files.count(); i++) {
+          const pcap::file* const f = files.get(i);
+
+          if ((f->valid) && (f->compressed) && (!f->walked)) {
+            nunwalked++;
           }
+        }
 
-          closedir(dir);
-
-          if (ftruncate(fd, filesize) == 0) {
-            // Sort PCAP files.
-            files.sort();
-
-            const pcap::file* file;
-            for (size_t i = 0; (file = files.get(i)) != nullptr; i++) {
-              if (!copy_file(fd,
-                             file->filename,
-                             file->filesize,
-                             (i > 0) ? sizeof(pcap::pcap_file_header) : 0)) {
-                const uint64_t
-                  to_copy = (i > 0) ?
-                    file->filesize - sizeof(pcap::pcap_file_header) :
-                    file->filesize;
-
-                fprintf(stderr,
-                        "Error copying %" PRIu64 " bytes from '%s' to '%s'.\n",
-                        to_copy,
-                        file->filename,
-                        argv[2]);
-
-                close(fd);
-                unlink(argv[2]);
-
-                return -1;
-              }
-            }
+        if (!pcap::decompress(files, nworkers)) {
+          fprintf(stderr, "Error allocating memory.\n");
+          return -1;
+        }
+
+        // Save the walks in the index cache, so the compressed files are
+        // not decompressed again to be walked. The files which are not
+        // valid are still in the list, so their records are kept.
+        if ((cache) &&
+            (nunwalked > 0) &&
+            (!pcap::cache::save(cache, files))) {
+          fprintf(stderr, "Error saving index '%s'.\n", cache);
+        }
+
+        files.compact();
+
+        // Index the packet offsets of the files (the sidecar files which
+        // are up to date are kept).
+        if (offset_index) {
+          const size_t nbuilt = pcap::build_offset_indices(files, nworkers);
+
+          if (verbose) {
+            fprintf(stderr, "%zu offset indices built.\n", nbuilt);
+          }
+        }
+
+        // Keep the packets in the time window.
+        if ((window) && (!pcap::select(files, start, end, nworkers))) {
+          fprintf(stderr, "Error allocating memory.\n");
+          return -1;
+        }
+
+        if ((window) && (files.count() == 0)) {
+          fprintf(stderr, "Warning: no packets in the time window.\n");
+        }
 
-            close(fd);
+        output_options out;
+        out.nworkers = nworkers;
+        out.ring = use_uring ? &ring : nullptr;
+        out.res = res;
+        out.autores = autores;
+        out.pcapng = pcapng;
+        out.merge = merge;
+        out.compress = compress;
+        out.compression = compression;
+        out.level = level;
+        out.frame_size = frame_size;
+        out.frame_index = frame_index;
+        out.split = split;
+        out.split_mode = split_mode;
+        out.split_limit = split_limit;
+        out.shards = shards;
+        out.filter = filtered ? &filter : nullptr;
+        out.dedup = (dedup_window > 0) ? &dedup : nullptr;
+        out.snaplen = snaplen;
+        out.sync = sync;
+        out.verbose = verbose;
 
-            return 0;
+        // pcapng files can hold several link types.
+        bool ret;
+        if ((pcapng) || (check_linktypes(files, policy))) {
+          if ((policy == linktype_policy::split) && (!pcapng)) {
+            ret = split_output(files, argv[2], out, copier);
+          } else if (follow) {
+            ret = follow_directory(files,
+                                   argv[1],
+                                   argv[2],
+                                   out,
+                                   reorder,
+                                   watcher,
+                                   copier);
           } else {
-            fprintf(stderr,
-                    "Error truncating file '%s' to %" PRIu64 " bytes.\n",
-                    argv[2],
-                    filesize);
+            ret = write_files(files, argv[2], out, copier);
           }
         } else {
-          fprintf(stderr, "Error opening directory '%s'.\n", argv[1]);
+          ret = false;
         }
 
-        close(fd);
-        unlink(argv[2]);
+        if (ret) {
+          if (verbose) {
+            print_copy_stats(copier);
+          }
+
+          return 0;
+        }
       } else {
-        fprintf(stderr, "Error opening file '%s' for writing.\n", argv[2]);
+        fprintf(stderr,
+                "Error scanning directory '%s' (%s).\n",
+                argv[1],
+                strerror(errno));
       }
     } else {
       fprintf(stderr, "'%s' doesn't exist or is not a directory.\n", argv[1]);
@@ -277,93 +820,1836 @@ int main(int argc, const char** argv)
 
 void usage(const char* program)
 {
-  fprintf(stderr, "Usage: %s <directory> <filename>\n", program);
+  fprintf(stderr, "Usage: %s [OPTIONS] <directory> <filename>\n", program);
+  fprintf(stderr, "\n");
+  fprintf(stderr, "<filename> can be - (standard output, streamed).\n");
+  fprintf(stderr, "\n");
+  fprintf(stderr, "Options:\n");
+  fprintf(stderr, "  -c, --copy-method=METHOD  Copy method: auto (default), "
+                  "copy_file_range,\n");
+  fprintf(stderr, "                            sendfile, splice or mmap.\n");
+  fprintf(stderr, "  -F, --format=FORMAT       Output file format: pcap "
+                  "(default) or pcapng.\n");
+  fprintf(stderr, "  -i, --cache=FILE          Index caching the timestamps "
+                  "of each file.\n");
+  fprintf(stderr, "  -s, --fsync               Synchronize the output file to "
+                  "disk.\n");
+  fprintf(stderr, "  -t, --resolution=RES      Timestamp resolution of the "
+                  "output: auto (default),\n");
+  fprintf(stderr, "                            us or ns. auto keeps the "
+                  "resolution of the input\n");
+  fprintf(stderr, "                            files if they all have the same "
+                  "one, ns otherwise.\n");
+  fprintf(stderr, "  -u, --io-uring            Use io_uring for probing, "
+                  "copying and syncing.\n");
+  fprintf(stderr, "  -l, --linktype=POLICY     Files with another link "
+                  "type than the first one:\n");
+  fprintf(stderr, "                            fail (default), reject (skip "
+                  "them) or split (one\n");
+  fprintf(stderr, "                            output file per link type, "
+                  "FILENAME.LINKTYPE.EXT).\n");
+  fprintf(stderr, "  -m, --merge=MODE          auto (default): merge the "
+                  "packets of files with\n");
+  fprintf(stderr, "                            overlapping timestamps; never: "
+                  "assume that files\n");
+  fprintf(stderr, "                            don't overlap (no packet "
+                  "headers are read).\n");
+  fprintf(stderr, "  -q, --queue-depth=N       io_uring queue depth "
+                  "(default: %u).\n",
+          io::uring::default_depth);
+  fprintf(stderr, "  -j, --jobs=N              Scan and copy using N threads "
+                  "(default: 1).\n");
+  fprintf(stderr, "  -r, --reflink=MODE        Share extents with the input "
+                  "files: auto,\n");
+  fprintf(stderr, "                            always or never (default). "
+                  "'always' fails if the\n");
+  fprintf(stderr, "                            file system can't clone, but "
+                  "still copies the ranges\n");
+  fprintf(stderr, "                            whose offsets are not aligned "
+                  "alike: normally only\n");
+  fprintf(stderr, "                            the first input can be "
+                  "cloned.\n");
+  fprintf(stderr, "  -v, --verbose             Report the copy methods used.\n");
+  fprintf(stderr, "  -z, --compress=FMT[:LVL]  Compress the output with gzip, "
+                  "zstd or lz4 (in\n");
+  fprintf(stderr, "                            independent frames, compressed "
+                  "by N threads, see -j).\n");
+  fprintf(stderr, "  -Z, --frame-size=MIB      Uncompressed size of the "
+                  "frames (default: %zu).\n",
+          io::compressor::default_frame_size / (1024 * 1024));
+  fprintf(stderr, "  -x, --frame-index         Write the offsets and "
+                  "timestamps of the frames to\n");
+  fprintf(stderr, "                            FILENAME.fidx.\n");
+  fprintf(stderr, "  -T, --tmp-size=SIZE       Keep up to SIZE bytes of "
+                  "decompressed inputs in\n");
+  fprintf(stderr, "                            $TMPDIR between reads "
+                  "(default: %" PRIu64 "M).\n",
+          pcap::default_decompressed_limit / (1024 * 1024));
+  fprintf(stderr, "  -A, --start=TIME          Skip the packets before TIME: "
+                  "seconds since the\n");
+  fprintf(stderr, "                            Epoch or "
+                  "YYYY-MM-DDTHH:MM:SS (UTC), with an\n");
+  fprintf(stderr, "                            optional fraction "
+                  "(.NNNNNNNNN).\n");
+  fprintf(stderr, "  -B, --end=TIME            Skip the packets at or after "
+                  "TIME.\n");
+  fprintf(stderr, "  -o, --offset-index        Index the packet offsets of "
+                  "each PCAP file into\n");
+  fprintf(stderr, "                            FILE.oidx (reused while the "
+                  "file is unchanged), to\n");
+  fprintf(stderr, "                            seek by time (see --start and "
+                  "--end).\n");
+  fprintf(stderr, "  -C, --split-size=SIZE     Split the output into files "
+                  "FILENAME.NNNNN.EXT\n");
+  fprintf(stderr, "                            with SIZE bytes of packets "
+                  "(suffixes K, M, G).\n");
+  fprintf(stderr, "  -P, --split-packets=N     Split the output into files of "
+                  "N packets.\n");
+  fprintf(stderr, "  -G, --split-interval=SEC  Split the output into files "
+                  "of SEC seconds\n");
+  fprintf(stderr, "                            (starting at multiples of "
+                  "SEC).\n");
+  fprintf(stderr, "  -f, --filter=EXPR         Only write the packets matching "
+                  "the filter\n");
+  fprintf(stderr, "                            expression (subset of the "
+                  "pcap-filter syntax).\n");
+  fprintf(stderr, "  -d, --dedup=USEC          Drop the packets identical to "
+                  "one written less than\n");
+  fprintf(stderr, "                            USEC microseconds before "
+                  "(captured by several taps).\n");
+  fprintf(stderr, "  -I, --ignore-ttl          Ignore the TTL (hop limit) "
+                  "and the IPv4 header\n");
+  fprintf(stderr, "                            checksum when comparing the "
+                  "packets.\n");
+  fprintf(stderr, "  -L, --snaplen=N           Truncate the packets to N "
+                  "bytes.\n");
+  fprintf(stderr, "  -S, --shards=N            Write the packets to N files "
+                  "FILENAME.NNNN.EXT by\n");
+  fprintf(stderr, "                            hash of their flow (both "
+                  "directions in the same\n");
+  fprintf(stderr, "                            file).\n");
+  fprintf(stderr, "  -w, --follow              Keep watching the directory "
+                  "and append the files\n");
+  fprintf(stderr, "                            closed or moved into it "
+                  "(until SIGINT or SIGTERM).\n");
+  fprintf(stderr, "  -R, --reorder=N           Hold back the N most recent "
+                  "files, to merge the files\n");
+  fprintf(stderr, "                            arriving late "
+                  "(default: 2).\n");
+  fprintf(stderr, "  -h, --help                Show this help.\n");
 }
 
-bool get_first_timestamp(const char* filename, uint64_t& timestamp)
+bool parse_size(const char* s, uint64_t& size)
 {
-  // Open PCAP file for reading.
-  int fd;
-  if ((fd = open(filename, O_RDONLY)) != -1) {
-    // Read PCAP file header and the header of the first packet.
-    uint8_t buf[pcap::minimum_size];
-    if (read(fd, buf, pcap::minimum_size) ==
-        static_cast<ssize_t>(pcap::minimum_size)) {
-      const pcap::pcap_file_header* const
-        filehdr = reinterpret_cast<const pcap::pcap_file_header*>(buf);
-
-      // Check magic and version.
-      if (((static_cast<pcap::magic>(filehdr->magic) ==
-            pcap::magic::microseconds) ||
-           (static_cast<pcap::magic>(filehdr->magic) ==
-            pcap::magic::nanoseconds)) &&
-          (filehdr->version_major == pcap::version_major) &&
-          (filehdr->version_minor == pcap::version_minor)) {
-        const pcap::pcap_pkthdr* const
-          pkthdr = reinterpret_cast<const pcap::pcap_pkthdr*>(
-                     buf + sizeof(pcap::pcap_file_header)
-                   );
-
-        timestamp = (pkthdr->ts.tv_sec * 1000000ull) +
-                    pkthdr->ts.tv_usec;
+  char* end;
+  errno = 0;
+  size = strtoull(s, &end, 10);
+  if ((end == s) || (errno != 0)) {
+    return false;
+  }
 
-        close(fd);
+  unsigned shift;
+  switch (*end) {
+    case 0:
+      return true;
+    case 'k':
+    case 'K':
+      shift = 10;
+      break;
+    case 'm':
+    case 'M':
+      shift = 20;
+      break;
+    case 'g':
+    case 'G':
+      shift = 30;
+      break;
+    default:
+      return false;
+  }
 
-        return true;
+  if ((end[1] != 0) || (size > (UINT64_MAX >> shift))) {
+    return false;
+  }
+
+  size <<= shift;
+
+  return true;
+}
+
+bool parse_time(const char* s, pcap::nanoseconds& ts)
+{
+  uint64_t sec;
+  const char* ptr;
+
+  struct tm tm;
+  memset(&tm, 0, sizeof(struct tm));
+
+  if (((ptr = strptime(s, "%Y-%m-%dT%H:%M:%S", &tm)) != nullptr) ||
+      ((ptr = strptime(s, "%Y-%m-%d %H:%M:%S", &tm)) != nullptr)) {
+    const time_t t = timegm(&tm);
+    if (t < 0) {
+      return false;
+    }
+
+    sec = t;
+  } else if (isdigit(*s)) {
+    char* end;
+    errno = 0;
+    sec = strtoull(s, &end, 10);
+    if (errno != 0) {
+      return false;
+    }
+
+    ptr = end;
+  } else {
+    return false;
+  }
+
+  // Fraction of a second (digits beyond nanoseconds are ignored).
+  uint64_t frac = 0;
+  if (*ptr == '.') {
+    unsigned ndigits = 0;
+    for (ptr++; isdigit(*ptr); ptr++) {
+      if (ndigits++ < 9) {
+        frac = (frac * 10) + (*ptr - '0');
       }
     }
 
-    close(fd);
+    if (ndigits == 0) {
+      return false;
+    }
+
+    for (; ndigits < 9; ndigits++) {
+      frac *= 10;
+    }
   }
 
-  return false;
+  if ((*ptr != 0) || (sec >= UINT64_MAX / 1000000000ull)) {
+    return false;
+  }
+
+  ts = (sec * 1000000000ull) + frac;
+
+  return true;
 }
 
-bool copy_file(int outfd,
-               const char* filename,
-               uint64_t filesize,
-               size_t offset)
+bool check_linktypes(pcap::files& files, linktype_policy policy)
 {
-  // Open file for reading.
-  int infd;
-  if ((infd = open(filename, O_RDONLY)) != -1) {
-    // Map file into memory.
-    void* base;
-    if ((base = mmap(nullptr,
-                     filesize,
-                     PROT_READ,
-                     MAP_SHARED,
-                     infd,
-                     0)) != MAP_FAILED) {
-      const uint8_t* ptr = static_cast<const uint8_t*>(base) + offset;
-      const uint64_t to_copy = filesize - offset;
-
-      uint64_t written = 0;
-
-      do {
-        ssize_t ret;
-        if ((ret = write(outfd, ptr, to_copy - written)) > 0) {
-          if ((written += ret) == to_copy) {
-            munmap(base, filesize);
-            close(infd);
-
-            return true;
-          } else {
-            ptr += ret;
-          }
-        } else if (ret < 0) {
-          if (errno != EINTR) {
-            munmap(base, filesize);
-            close(infd);
+  const pcap::file* const first = files.get(0);
+  if (!first) {
+    return true;
+  }
+
+  size_t nrejected = 0;
+
+  for (size_t i = 0; i < files.count(); i++) {
+    pcap::file* const f = files.get(i);
+
+    // Files with several link types (pcapng) can't be written to a PCAP
+    // file.
+    if ((f->linktype == pcap::linktype_mixed) ||
+        ((f->linktype != first->linktype) &&
+         (policy != linktype_policy::split))) {
+      switch (policy) {
+        case linktype_policy::fail:
+          fprintf(stderr,
+                  "The link type of '%s' (%u) is not the link type of "
+                  "'%s' (%u).\n",
+                  f->filename,
+                  f->linktype,
+                  first->filename,
+                  first->linktype);
+
+          return false;
+        case linktype_policy::reject:
+        case linktype_policy::split:
+          fprintf(stderr,
+                  "Skipping '%s': different link type.\n",
+                  f->filename);
+
+          f->valid = false;
+          nrejected++;
+
+          break;
+      }
+    }
+  }
+
+  if (nrejected > 0) {
+    files.compact();
+  }
+
+  return true;
+}
+
+bool split_output(const pcap::files& files,
+                  const char* filename,
+                  const output_options& options,
+                  io::copier& copier)
+{
+  const size_t count = files.count();
+
+  // Output files are written one link type at a time; `done` marks the
+  // files already written.
+  bool* done;
+  if ((done = static_cast<bool*>(calloc(count > 0 ? count : 1,
+                                        sizeof(bool)))) == nullptr) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return false;
+  }
+
+  // Single link type?
+  bool single = true;
+  for (size_t i = 1; i < count; i++) {
+    if (files.get(i)->linktype != files.get(0)->linktype) {
+      single = false;
+      break;
+    }
+  }
+
+  bool ret = true;
+
+  for (size_t i = 0; (ret) && (i < count); i++) {
+    if (done[i]) {
+      continue;
+    }
+
+    const uint32_t linktype = files.get(i)->linktype;
+
+    // Collect the files with the same link type (in timestamp order).
+    pcap::files group;
+    for (size_t j = i; j < count; j++) {
+      const pcap::file* const f = files.get(j);
+
+      if ((!done[j]) && (f->linktype == linktype)) {
+        if (!group.add(f->filename, *f)) {
+          fprintf(stderr, "Error allocating memory.\n");
+
+          ret = false;
+          break;
+        }
+
+        done[j] = true;
+      }
+    }
 
-            return false;
+    if (ret) {
+      if (single) {
+        ret = write_files(group, filename, options, copier);
+      } else {
+        // Insert the link type before the extension of the filename.
+        char suffix[16];
+        snprintf(suffix, sizeof(suffix), "%u", linktype);
+
+        char name[PATH_MAX];
+        if (insert_suffix(filename, suffix, name, sizeof(name))) {
+          if (options.verbose) {
+            fprintf(stderr, "Link type %u: '%s'.\n", linktype, name);
           }
+
+          ret = write_files(group, name, options, copier);
+        } else {
+          fprintf(stderr, "Filename too long.\n");
+          ret = false;
         }
-      } while (true);
+      }
     }
+  }
 
-    close(infd);
+  free(done);
+
+  return ret;
+}
+
+bool insert_suffix(const char* filename,
+                   const char* suffix,
+                   char* name,
+                   size_t size)
+{
+  const char* const slash = strrchr(filename, '/');
+  const char* const base = slash ? slash + 1 : filename;
+  const char* dot = strrchr(base, '.');
+
+  if ((!dot) || (dot == base)) {
+    dot = filename + strlen(filename);
+  } else if ((strcmp(dot, ".gz") == 0) ||
+             (strcmp(dot, ".zst") == 0) ||
+             (strcmp(dot, ".lz4") == 0)) {
+    // Keep the extension before the one of the compression format.
+    const char* prev = dot;
+    while ((prev > base) && (*(prev - 1) != '.')) {
+      prev--;
+    }
+
+    if (prev - 1 > base) {
+      dot = prev - 1;
+    }
   }
 
-  return false;
+  return (snprintf(name,
+                   size,
+                   "%.*s.%s%s",
+                   static_cast<int>(dot - filename),
+                   filename,
+                   suffix,
+                   dot) < static_cast<int>(size));
+}
+
+bool write_files(const pcap::files& files,
+                 const char* filename,
+                 const output_options& options,
+                 io::copier& copier)
+{
+  return (options.split) ? write_chunks(files, filename, options, copier) :
+                           write_output(files, filename, options, copier);
+}
+
+bool write_chunks(const pcap::files& files,
+                  const char* filename,
+                  const output_options& options,
+                  io::copier& copier)
+{
+  // Compute the boundaries of all the chunks up front.
+  pcap::splitter splitter;
+  if (!splitter.build(files,
+                      options.split_mode,
+                      options.split_limit,
+                      options.pcapng,
+                      options.nworkers)) {
+    fprintf(stderr, "Error indexing the files to split the output.\n");
+    return false;
+  }
+
+  // Each chunk is planned, sized and copied like a whole output, into
+  // FILENAME.NNNNN.EXT (empty chunks are skipped).
+  size_t n = 0;
+  for (size_t i = 0; i < splitter.count(); i++) {
+    pcap::files chunk;
+    if (!splitter.get(i, chunk)) {
+      fprintf(stderr, "Error reading the files of chunk %zu.\n", i);
+      return false;
+    }
+
+    if (chunk.count() == 0) {
+      continue;
+    }
+
+    char suffix[32];
+    snprintf(suffix, sizeof(suffix), "%05zu", n++);
+
+    char name[PATH_MAX];
+    if (!insert_suffix(filename, suffix, name, sizeof(name))) {
+      fprintf(stderr, "Filename too long.\n");
+      return false;
+    }
+
+    if (options.verbose) {
+      fprintf(stderr, "Chunk %zu: '%s'.\n", n - 1, name);
+    }
+
+    if (!write_output(chunk, name, options, copier)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool write_output(const pcap::files& files,
+                  const char* filename,
+                  const output_options& options,
+                  io::copier& copier)
+{
+  // Filtered, deduplicated, truncated and sharded outputs are written
+  // packet by packet.
+  if ((options.filter) ||
+      (options.dedup) ||
+      (options.snaplen > 0) ||
+      (options.shards > 0)) {
+    return write_packets(files, filename, options);
+  }
+
+  const bool to_stdout = is_stdout(filename);
+
+  // Open output file for writing.
+  int fd;
+  if (to_stdout) {
+    fd = STDOUT_FILENO;
+  } else if ((fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0644)) ==
+             -1) {
+    fprintf(stderr, "Error opening file '%s' for writing.\n", filename);
+    return false;
+  }
+
+  // Resolution of the output file.
+  const pcap::resolution res = options.autores ? output_resolution(files) :
+                                                 options.res;
+
+  // Interfaces of the pcapng output file.
+  pcap::pcapng::interfaces ifaces;
+  if ((options.pcapng) && (!ifaces.build(files, options.nworkers))) {
+    fprintf(stderr, "Error reading the interfaces of the files.\n");
+
+    if (!to_stdout) {
+      close(fd);
+      unlink(filename);
+    }
+
+    return false;
+  }
+
+  // Plan output.
+  pcap::plan plan;
+  if (!plan.build(files,
+                  options.merge,
+                  res,
+                  options.pcapng ? &ifaces : nullptr)) {
+    fprintf(stderr, "Error allocating memory.\n");
+
+    if (!to_stdout) {
+      close(fd);
+      unlink(filename);
+    }
+
+    return false;
+  }
+
+  if (plan.overlapping_files() > plan.merged_files()) {
+    fprintf(stderr,
+            "Warning: %zu files overlap in time with the next file, "
+            "the output is not\nin timestamp order "
+            "(use --merge=auto).\n",
+            plan.overlapping_files());
+  }
+
+  if (options.verbose) {
+    print_plan(plan);
+
+    if (options.pcapng) {
+      fprintf(stderr, "%zu interfaces.\n", ifaces.count());
+    }
+  }
+
+  // Uncompressed output to the standard output is streamed in order, without
+  // sizing it.
+  if ((to_stdout) && (!options.compress)) {
+    return pipe_files(files,
+                      plan,
+                      res,
+                      options.pcapng ? &ifaces : nullptr,
+                      options,
+                      copier);
+  }
+
+  // Compressed output is written as a stream; otherwise the file is sized
+  // up front and the segments are written in parallel.
+  if ((options.compress) || (ftruncate(fd, plan.size()) == 0)) {
+    if ((options.compress) ?
+          compress_files(files,
+                         plan,
+                         res,
+                         options.pcapng ? &ifaces : nullptr,
+                         fd,
+                         filename,
+                         options,
+                         copier) :
+          copy_files(files,
+                     plan,
+                     res,
+                     options.pcapng ? &ifaces : nullptr,
+                     fd,
+                     filename,
+                     options.nworkers,
+                     copier)) {
+      if (to_stdout) {
+        return true;
+      }
+
+      // Synchronize output file to disk (if requested).
+      if ((options.sync) &&
+          ((!options.ring) || (!options.ring->fsync(fd))) &&
+          (fsync(fd) != 0)) {
+        fprintf(stderr, "Error synchronizing file '%s'.\n", filename);
+
+        close(fd);
+        return false;
+      }
+
+      close(fd);
+      return true;
+    }
+  } else {
+    fprintf(stderr,
+            "Error truncating file '%s' to %" PRIu64 " bytes.\n",
+            filename,
+            plan.size());
+  }
+
+  if (!to_stdout) {
+    close(fd);
+    unlink(filename);
+  }
+
+  return false;
+}
+
+bool write_packets(const pcap::files& files,
+                   const char* filename,
+                   const output_options& options)
+{
+  const size_t count = files.count();
+  const unsigned noutputs = (options.shards > 0) ? options.shards : 1;
+
+  // The standard output is a single output (not sharded).
+  const bool to_stdout = is_stdout(filename);
+  io::pipe_output pipe;
+
+  // Resolution of the output files.
+  const pcap::resolution res = options.autores ? output_resolution(files) :
+                                                 options.res;
+
+  // Interfaces of the pcapng output files (every shard has all of them).
+  pcap::pcapng::interfaces ifaces;
+  if ((options.pcapng) && (!ifaces.build(files, options.nworkers))) {
+    fprintf(stderr, "Error reading the interfaces of the files.\n");
+    return false;
+  }
+
+  if ((options.pcapng) && (options.snaplen > 0)) {
+    ifaces.limit_snaplen(options.snaplen);
+  }
+
+  if (options.filter) {
+    // The link types of the interfaces of pcapng files are only known
+    // packet by packet.
+    for (size_t i = 0; i < count; i++) {
+      const pcap::file* const f = files.get(i);
+
+      if ((!pcap::is_pcapng(f->magic)) &&
+          (!pcap::filter::supports(f->linktype))) {
+        fprintf(stderr,
+                "Warning: the filter doesn't support the link type %u of "
+                "'%s', its packets\nare dropped.\n",
+                f->linktype,
+                f->filename);
+
+        break;
+      }
+    }
+
+    if ((options.verbose) &&
+        (count > 0) &&
+        (pcap::filter::supports(files.get(0)->linktype))) {
+      fprintf(stderr,
+              "Filter program (link type %u):\n",
+              files.get(0)->linktype);
+
+      options.filter->dump(files.get(0)->linktype, stderr);
+    }
+  }
+
+  packet_output* outputs;
+  pcap::writer** writers;
+  if ((outputs = static_cast<packet_output*>(
+                   calloc(noutputs, sizeof(packet_output))
+                 )) == nullptr) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return false;
+  }
+
+  if ((writers = static_cast<pcap::writer**>(
+                   calloc(noutputs, sizeof(pcap::writer*))
+                 )) == nullptr) {
+    fprintf(stderr, "Error allocating memory.\n");
+
+    free(outputs);
+    return false;
+  }
+
+  for (unsigned i = 0; i < noutputs; i++) {
+    outputs[i].fd = -1;
+  }
+
+  bool ret = true;
+
+  // Open the output files (FILENAME.NNNN.EXT for the shards) and write
+  // their headers.
+  for (unsigned i = 0; (ret) && (i < noutputs); i++) {
+    packet_output* const out = &outputs[i];
+
+    if (options.shards > 0) {
+      char suffix[16];
+      snprintf(suffix, sizeof(suffix), "%04u", i);
+
+      ret = insert_suffix(filename, suffix, out->name, sizeof(out->name));
+    } else {
+      ret = (snprintf(out->name, sizeof(out->name), "%s", filename) <
+             static_cast<int>(sizeof(out->name)));
+    }
+
+    if (!ret) {
+      fprintf(stderr, "Filename too long.\n");
+      break;
+    }
+
+    if (to_stdout) {
+      out->fd = STDOUT_FILENO;
+      pipe.open(out->fd);
+    } else if ((out->fd = open(out->name,
+                               O_CREAT | O_TRUNC | O_WRONLY,
+                               0644)) == -1) {
+      fprintf(stderr, "Error opening file '%s' for writing.\n", out->name);
+
+      ret = false;
+      break;
+    }
+
+    if (options.compress) {
+      // Timestamp index of the frames.
+      if ((options.frame_index) &&
+          ((out->index = new (std::nothrow) pcap::frame_index(
+                           options.pcapng,
+                           options.pcapng ? ifaces.header_size() :
+                                            sizeof(pcap::pcap_file_header)
+                         )) == nullptr)) {
+        fprintf(stderr, "Error allocating memory.\n");
+
+        ret = false;
+        break;
+      }
+
+      if ((out->stream = new (std::nothrow) io::compressor()) == nullptr) {
+        fprintf(stderr, "Error allocating memory.\n");
+
+        ret = false;
+        break;
+      }
+
+      if (out->index) {
+        out->stream->on_frame(pcap::frame_index::add, out->index);
+      }
+
+      if (!out->stream->open(out->fd,
+                             options.compression,
+                             options.level,
+                             options.nworkers,
+                             options.frame_size)) {
+        fprintf(stderr,
+                "Error starting %s compression.\n",
+                io::compressor::name(options.compression));
+
+        ret = false;
+        break;
+      }
+
+      writers[i] = new (std::nothrow) pcap::writer(*out->stream, res);
+    } else if (to_stdout) {
+      writers[i] = new (std::nothrow) pcap::writer(pipe, res);
+    } else {
+      writers[i] = new (std::nothrow) pcap::writer(out->fd, 0, res);
+    }
+
+    if (!writers[i]) {
+      fprintf(stderr, "Error allocating memory.\n");
+
+      ret = false;
+      break;
+    }
+
+    if (options.snaplen > 0) {
+      writers[i]->set_snaplen(options.snaplen);
+    }
+
+    if (count > 0) {
+      ret = write_header(files,
+                         res,
+                         options.pcapng ? &ifaces : nullptr,
+                         out->name,
+                         *writers[i]);
+    }
+
+    if ((ret) && (options.shards > 0) && (options.verbose)) {
+      fprintf(stderr, "Shard %u: '%s'.\n", i, out->name);
+    }
+  }
+
+  // Files which overlap in time are merged together, the others are read
+  // one after the other.
+  packet_routing routing;
+  routing.filter = options.filter;
+  routing.dedup = options.dedup;
+  routing.nshards = options.shards;
+  routing.packets = 0;
+  routing.matched = 0;
+  routing.duplicates = 0;
+
+  for (size_t first = 0; (ret) && (first < count); ) {
+    uint64_t last_timestamp = files.get(first)->last_timestamp;
+
+    size_t last = first + 1;
+    for (; (last < count) && (files.get(last)->timestamp <= last_timestamp);
+         last++) {
+      if (files.get(last)->last_timestamp > last_timestamp) {
+        last_timestamp = files.get(last)->last_timestamp;
+      }
+    }
+
+    if (!pcap::merge(files,
+                     first,
+                     last,
+                     writers,
+                     noutputs,
+                     route_packet,
+                     &routing,
+                     options.pcapng ? &ifaces : nullptr)) {
+      fprintf(stderr, "Error writing '%s'.\n", filename);
+      ret = false;
+    }
+
+    first = last;
+  }
+
+  for (unsigned i = 0; i < noutputs; i++) {
+    packet_output* const out = &outputs[i];
+
+    delete writers[i];
+
+    if (out->stream) {
+      if ((ret) && (!out->stream->close())) {
+        fprintf(stderr, "Error writing file '%s'.\n", out->name);
+        ret = false;
+      }
+
+      delete out->stream;
+    }
+
+    if (out->index) {
+      char name[PATH_MAX];
+      if ((ret) &&
+          ((snprintf(name,
+                     sizeof(name),
+                     "%s.fidx",
+                     out->name) >= static_cast<int>(sizeof(name))) ||
+           (!out->index->save(name)))) {
+        fprintf(stderr, "Error saving frame index of '%s'.\n", out->name);
+        ret = false;
+      }
+
+      delete out->index;
+    }
+
+    if ((out->fd != -1) && (!to_stdout)) {
+      // Synchronize output file to disk (if requested).
+      if ((ret) &&
+          (options.sync) &&
+          ((!options.ring) || (!options.ring->fsync(out->fd))) &&
+          (fsync(out->fd) != 0)) {
+        fprintf(stderr, "Error synchronizing file '%s'.\n", out->name);
+        ret = false;
+      }
+
+      close(out->fd);
+    }
+  }
+
+  if ((!ret) && (!to_stdout)) {
+    for (unsigned i = 0; i < noutputs; i++) {
+      if (outputs[i].fd != -1) {
+        unlink(outputs[i].name);
+      }
+    }
+  }
+
+  if ((ret) && (to_stdout) && (!options.compress) && (options.verbose)) {
+    print_pipe_stats(pipe);
+  }
+
+  if ((ret) && (options.filter) && (options.verbose)) {
+    fprintf(stderr,
+            "%" PRIu64 " of %" PRIu64 " packets match the filter.\n",
+            routing.matched,
+            routing.packets);
+  }
+
+  if ((ret) && (options.dedup) && (options.verbose)) {
+    fprintf(stderr,
+            "%" PRIu64 " duplicate packets dropped.\n",
+            routing.duplicates);
+  }
+
+  free(writers);
+  free(outputs);
+
+  return ret;
+}
+
+unsigned route_packet(void* arg, const pcap::reader& r)
+{
+  packet_routing* const routing = static_cast<packet_routing*>(arg);
+
+  routing->packets++;
+
+  if (routing->filter) {
+    if (!routing->filter->match(r.linktype(),
+                                r.data(),
+                                r.header()->caplen,
+                                r.header()->len)) {
+      return pcap::drop_packet;
+    }
+
+    routing->matched++;
+  }
+
+  if ((routing->dedup) &&
+      (routing->dedup->duplicate(r.linktype(),
+                                 r.data(),
+                                 r.header()->caplen,
+                                 r.header()->len,
+                                 r.timestamp()))) {
+    routing->duplicates++;
+    return pcap::drop_packet;
+  }
+
+  if (routing->nshards == 0) {
+    return 0;
+  }
+
+  return pcap::flow_shard(pcap::flow_hash(r.linktype(),
+                                          r.data(),
+                                          r.header()->caplen),
+                          routing->nshards);
+}
+
+bool write_header(const pcap::files& files,
+                  pcap::resolution res,
+                  const pcap::pcapng::interfaces* ifaces,
+                  const char* outfilename,
+                  pcap::writer& w)
+{
+  if (ifaces) {
+    // Write the pcapng section header and interface description blocks.
+    if ((!ifaces->write(w)) || (!w.flush())) {
+      fprintf(stderr,
+              "Error writing pcapng header to '%s'.\n",
+              outfilename);
+
+      return false;
+    }
+  } else {
+    // Write the PCAP file header of the first file (in host byte order, with
+    // the magic number of the output resolution and the largest snapshot
+    // length, up to the one of the writer).
+    const pcap::file* const first = files.get(0);
+    pcap::pcap_file_header hdr;
+
+    bool ret;
+    if ((ret = pcap::read_data(*first, &hdr, sizeof(hdr))) == true) {
+      if (pcap::is_swapped(hdr.magic)) {
+        pcap::swap(hdr);
+      } else if (pcap::is_pcapng(first->magic)) {
+        // Build a PCAP file header for a pcapng file.
+        hdr.version_major = pcap::version_major;
+        hdr.version_minor = pcap::version_minor;
+        hdr.thiszone = 0;
+        hdr.sigfigs = 0;
+        hdr.linktype = first->linktype;
+      }
+
+      hdr.magic = pcap::magic_of(res);
+
+      // Largest snapshot length of the input files.
+      hdr.snaplen = first->snaplen;
+      for (size_t i = 1; i < files.count(); i++) {
+        if (files.get(i)->snaplen > hdr.snaplen) {
+          hdr.snaplen = files.get(i)->snaplen;
+        }
+      }
+
+      if (hdr.snaplen > w.snaplen()) {
+        hdr.snaplen = w.snaplen();
+      }
+
+      ret = (w.copy(&hdr, sizeof(hdr))) && (w.flush());
+    }
+
+    if (!ret) {
+      fprintf(stderr,
+              "Error copying PCAP file header from '%s' to '%s'.\n",
+              first->filename,
+              outfilename);
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool copy_file(io::copier& copier,
+               int outfd,
+               uint64_t outoff,
+               const pcap::file& f,
+               uint64_t len)
+{
+  // Open file for reading (a compressed file is decompressed into a
+  // temporary file, released once copied).
+  uint64_t size;
+  int infd;
+  if ((infd = pcap::open_data(f, size)) != -1) {
+    const bool ret = copier.copy(infd, f.begin, outfd, outoff, len);
+
+    close(infd);
+
+    return ret;
+  }
+
+  return false;
+}
+
+bool copy_files(const pcap::files& files,
+               const pcap::plan& plan,
+               pcap::resolution res,
+               const pcap::pcapng::interfaces* ifaces,
+               int outfd,
+               const char* outfilename,
+               unsigned nworkers,
+               io::copier& copier)
+{
+  const size_t count = files.count();
+
+  if (count == 0) {
+    return true;
+  }
+
+  pcap::writer w(outfd, 0, res);
+  if (!write_header(files, res, ifaces, outfilename, w)) {
+    return false;
+  }
+
+  const size_t nsegments = plan.count();
+
+  if (nworkers > nsegments) {
+    nworkers = nsegments;
+  }
+
+  // Each worker has its own copier and its own output file descriptor
+  // (sendfile() writes at the file offset of the descriptor).
+  io::copier* copiers;
+  int* fds;
+  if (((copiers = new (std::nothrow) io::copier[nworkers]) == nullptr) ||
+      ((fds = static_cast<int*>(malloc(nworkers * sizeof(int)))) ==
+       nullptr)) {
+    delete [] copiers;
+
+    fprintf(stderr, "Error allocating memory.\n");
+    return false;
+  }
+
+  fds[0] = outfd;
+
+  unsigned nfds = 1;
+  for (; nfds < nworkers; nfds++) {
+    if ((fds[nfds] = open(outfilename, O_WRONLY)) == -1) {
+      fprintf(stderr,
+              "Error opening file '%s' for writing.\n",
+              outfilename);
+
+      break;
+    }
+  }
+
+  bool ret = false;
+
+  if (nfds == nworkers) {
+    for (unsigned i = 0; i < nworkers; i++) {
+      copiers[i].configure(copier);
+    }
+
+    ret = util::parallel_for(
+            nsegments,
+            nworkers,
+            [&](unsigned worker, size_t idx) {
+              return copy_segment(files,
+                                  *plan.get(idx),
+                                  res,
+                                  ifaces,
+                                  fds[worker],
+                                  plan.get(idx)->outoff,
+                                  outfilename,
+                                  copiers[worker]);
+            }
+          );
+
+    for (unsigned i = 0; i < nworkers; i++) {
+      copier.add_stats(copiers[i]);
+    }
+  }
+
+  for (unsigned i = 1; i < nfds; i++) {
+    close(fds[i]);
+  }
+
+  free(fds);
+  delete [] copiers;
+
+  return ret;
+}
+
+bool copy_segment(const pcap::files& files,
+                  const pcap::segment& seg,
+                  pcap::resolution res,
+                  const pcap::pcapng::interfaces* ifaces,
+                  int outfd,
+                  uint64_t outoff,
+                  const char* outfilename,
+                  io::copier& copier)
+{
+  if (seg.convert) {
+    // Convert packet headers (or packets to pcapng blocks).
+    const pcap::file* const file = files.get(seg.first);
+
+    pcap::writer w(outfd, outoff, res);
+
+    if (((ifaces) ?
+           pcap::convert(*file,
+                         ifaces->map(seg.first),
+                         ifaces->identity(seg.first),
+                         copier,
+                         w) :
+           pcap::convert(*file, w)) &&
+        (w.offset() == outoff + seg.size)) {
+      return true;
+    }
+
+    fprintf(stderr,
+            "Error converting '%s' into '%s'.\n",
+            file->filename,
+            outfilename);
+  } else if (!seg.merge()) {
+    // Copy file.
+    const pcap::file* const file = files.get(seg.first);
+
+    if (copy_file(copier, outfd, outoff, *file, seg.size)) {
+      return true;
+    }
+
+    fprintf(stderr,
+            "Error copying %" PRIu64 " bytes from '%s' to '%s'.\n",
+            seg.size,
+            file->filename,
+            outfilename);
+  } else {
+    // Merge files.
+    pcap::writer w(outfd, outoff, res);
+
+    if ((pcap::merge(files, seg.first, seg.last, w, ifaces)) &&
+        (w.offset() == outoff + seg.size)) {
+      return true;
+    }
+
+    fprintf(stderr,
+            "Error merging %zu files ('%s'...) into '%s'.\n",
+            seg.last - seg.first,
+            files.get(seg.first)->filename,
+            outfilename);
+  }
+
+  return false;
+}
+
+bool stream_file(pcap::writer& w, const pcap::file& f, uint64_t len)
+{
+  if (len == 0) {
+    return true;
+  }
+
+  // Open file for reading.
+  uint64_t size;
+  int fd;
+  if ((fd = pcap::open_data(f, size)) == -1) {
+    return false;
+  }
+
+  const uint64_t inoff = f.begin;
+
+  // Map file into memory.
+  void* base;
+  if ((base = mmap(nullptr,
+                   inoff + len,
+                   PROT_READ,
+                   MAP_SHARED,
+                   fd,
+                   0)) == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  close(fd);
+
+  madvise(base, inoff + len, MADV_SEQUENTIAL);
+
+  // The writer is flushed before unmapping the file.
+  const bool ret = (w.write(static_cast<const uint8_t*>(base) + inoff, len)) &&
+                   (w.flush());
+
+  munmap(base, inoff + len);
+
+  return ret;
+}
+
+bool compress_files(const pcap::files& files,
+                    const pcap::plan& plan,
+                    pcap::resolution res,
+                    const pcap::pcapng::interfaces* ifaces,
+                    int outfd,
+                    const char* outfilename,
+                    const output_options& options,
+                    io::copier& copier)
+{
+  if (files.count() == 0) {
+    return true;
+  }
+
+  // Timestamp index of the frames.
+  pcap::frame_index index(ifaces != nullptr,
+                          ifaces ? ifaces->header_size() :
+                                   sizeof(pcap::pcap_file_header));
+
+  // The segments are produced in order by this thread; the compression
+  // threads and the writer thread of the stream run behind it.
+  io::compressor stream;
+  if (options.frame_index) {
+    stream.on_frame(pcap::frame_index::add, &index);
+  }
+
+  if (!stream.open(outfd,
+                   options.compression,
+                   options.level,
+                   options.nworkers,
+                   options.frame_size)) {
+    fprintf(stderr,
+            "Error starting %s compression.\n",
+            io::compressor::name(options.compression));
+
+    return false;
+  }
+
+  pcap::writer w(stream, res);
+  if ((!write_header(files, res, ifaces, outfilename, w)) ||
+      (!write_segments(files, plan, ifaces, outfilename, copier, w))) {
+    return false;
+  }
+
+  if (!stream.close()) {
+    fprintf(stderr, "Error writing file '%s'.\n", outfilename);
+    return false;
+  }
+
+  if (options.frame_index) {
+    char filename[PATH_MAX];
+    if ((snprintf(filename,
+                  sizeof(filename),
+                  "%s.fidx",
+                  outfilename) >= static_cast<int>(sizeof(filename))) ||
+        (!index.save(filename))) {
+      fprintf(stderr, "Error saving frame index of '%s'.\n", outfilename);
+      return false;
+    }
+  }
+
+  if (options.verbose) {
+    fprintf(stderr,
+            "%s: %" PRIu64 " bytes compressed into %" PRIu64 " bytes "
+            "(%" PRIu64 " frames).\n",
+            io::compressor::name(options.compression),
+            stream.bytes_in(),
+            stream.bytes_out(),
+            stream.frames());
+  }
+
+  return true;
+}
+
+bool pipe_files(const pcap::files& files,
+                const pcap::plan& plan,
+                pcap::resolution res,
+                const pcap::pcapng::interfaces* ifaces,
+                const output_options& options,
+                io::copier& copier)
+{
+  if (files.count() == 0) {
+    return true;
+  }
+
+  // The segments are written in order, the mapped input pages spliced into
+  // the pipe.
+  io::pipe_output pipe;
+  pipe.open(STDOUT_FILENO);
+
+  pcap::writer w(pipe, res);
+  if ((!write_header(files, res, ifaces, "-", w)) ||
+      (!write_segments(files, plan, ifaces, "-", copier, w)) ||
+      (!w.flush())) {
+    return false;
+  }
+
+  if (options.verbose) {
+    print_pipe_stats(pipe);
+  }
+
+  return true;
+}
+
+bool write_segments(const pcap::files& files,
+                    const pcap::plan& plan,
+                    const pcap::pcapng::interfaces* ifaces,
+                    const char* outfilename,
+                    io::copier& copier,
+                    pcap::writer& w)
+{
+  for (size_t i = 0; i < plan.count(); i++) {
+    const pcap::segment* const seg = plan.get(i);
+    const pcap::file* const file = files.get(seg->first);
+
+    bool ret;
+    if (seg->convert) {
+      // Convert packet headers (or packets to pcapng blocks).
+      ret = (ifaces) ?
+              pcap::convert(*file,
+                            ifaces->map(seg->first),
+                            ifaces->identity(seg->first),
+                            copier,
+                            w) :
+              pcap::convert(*file, w);
+    } else if (!seg->merge()) {
+      // Copy file.
+      ret = stream_file(w, *file, seg->size);
+    } else {
+      // Merge files.
+      ret = pcap::merge(files, seg->first, seg->last, w, ifaces);
+    }
+
+    if ((!ret) || (w.offset() != seg->outoff + seg->size)) {
+      fprintf(stderr,
+              "Error writing %zu files ('%s'...) into '%s'.\n",
+              seg->last - seg->first,
+              file->filename,
+              outfilename);
+
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool follow_directory(pcap::files& files,
+                      const char* dirname,
+                      const char* filename,
+                      const output_options& options,
+                      size_t reorder,
+                      io::watcher& watcher,
+                      io::copier& copier)
+{
+  follow_state st;
+  st.dirname = dirname;
+  st.filename = filename;
+  st.options = &options;
+  st.copier = &copier;
+  st.fd = -1;
+  st.size = 0;
+  st.res = options.res;
+  st.linktype = 0;
+  st.last_timestamp = 0;
+  st.reorder = reorder;
+  st.prune_at = follow_prune_min;
+  st.appended = 0;
+  st.late = 0;
+  st.error = false;
+
+  // The most recent files go to the reorder buffer (the last one might
+  // still be being written).
+  const size_t count = files.count();
+  for (size_t i = (count > reorder) ? count - reorder : 0; i < count; i++) {
+    pcap::file* const f = files.get(i);
+
+    if ((!st.pending.add(f->filename, *f)) || (!remember(st, *f, false))) {
+      fprintf(stderr, "Error allocating memory.\n");
+      return false;
+    }
+
+    f->valid = false;
+  }
+
+  files.compact();
+
+  if (files.count() > 0) {
+    // Write the other files as usual and reopen the output.
+    if (!write_output(files, filename, options, copier)) {
+      return false;
+    }
+
+    if ((st.fd = open(filename, O_WRONLY)) == -1) {
+      fprintf(stderr, "Error opening file '%s' for writing.\n", filename);
+      return false;
+    }
+
+    struct stat sbuf;
+    if (fstat(st.fd, &sbuf) != 0) {
+      fprintf(stderr, "Error getting the size of '%s'.\n", filename);
+
+      close(st.fd);
+      return false;
+    }
+
+    st.size = sbuf.st_size;
+
+    if (options.autores) {
+      st.res = output_resolution(files);
+    }
+
+    st.linktype = files.get(0)->linktype;
+
+    for (size_t i = 0; i < files.count(); i++) {
+      const pcap::file* const f = files.get(i);
+
+      if (f->last_timestamp > st.last_timestamp) {
+        st.last_timestamp = f->last_timestamp;
+      }
+
+      if (!remember(st, *f, true)) {
+        fprintf(stderr, "Error allocating memory.\n");
+
+        close(st.fd);
+        return false;
+      }
+    }
+  } else if ((st.fd = open(filename, O_CREAT | O_TRUNC | O_WRONLY, 0644)) ==
+             -1) {
+    // The PCAP file header is written with the first file appended.
+    fprintf(stderr, "Error opening file '%s' for writing.\n", filename);
+    return false;
+  }
+
+  // The output file itself might be in the directory.
+  struct stat sbuf;
+  if (fstat(st.fd, &sbuf) != 0) {
+    fprintf(stderr, "Error getting the status of '%s'.\n", filename);
+
+    close(st.fd);
+    return false;
+  }
+
+  st.dev = sbuf.st_dev;
+  st.ino = sbuf.st_ino;
+
+  // SIGINT and SIGTERM are only delivered while waiting for files, so the
+  // files are appended as a whole.
+  struct sigaction act;
+  memset(&act, 0, sizeof(act));
+  act.sa_handler = on_stop_signal;
+  sigemptyset(&act.sa_mask);
+
+  sigset_t mask;
+  sigset_t waitmask;
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+
+  sigprocmask(SIG_BLOCK, &mask, &waitmask);
+  sigdelset(&waitmask, SIGINT);
+  sigdelset(&waitmask, SIGTERM);
+
+  sigaction(SIGINT, &act, nullptr);
+  sigaction(SIGTERM, &act, nullptr);
+
+  if (options.verbose) {
+    fprintf(stderr, "Following '%s'.\n", dirname);
+  }
+
+  uint64_t overflows = 0;
+
+  while ((!stop_following) && (!st.error)) {
+    if (!watcher.wait(follow_file, &st, &waitmask)) {
+      fprintf(stderr, "Error watching directory '%s'.\n", dirname);
+
+      st.error = true;
+      break;
+    }
+
+    if (watcher.overflows() != overflows) {
+      overflows = watcher.overflows();
+
+      fprintf(stderr,
+              "Warning: events of '%s' were lost, some files might not "
+              "have been appended.\n",
+              dirname);
+    }
+  }
+
+  // Flush the reorder buffer.
+  while ((!st.error) && (st.pending.count() > 0)) {
+    st.error = !append_files(st);
+  }
+
+  if ((!st.error) &&
+      (options.sync) &&
+      ((!options.ring) || (!options.ring->fsync(st.fd))) &&
+      (fsync(st.fd) != 0)) {
+    fprintf(stderr, "Error synchronizing file '%s'.\n", filename);
+    st.error = true;
+  }
+
+  close(st.fd);
+
+  if (options.verbose) {
+    fprintf(stderr,
+            "%zu files appended (%zu late), %" PRIu64 " bytes.\n",
+            st.appended,
+            st.late,
+            st.size);
+  }
+
+  return !st.error;
+}
+
+void follow_file(void* arg, const char* name)
+{
+  follow_state* const st = static_cast<follow_state*>(arg);
+
+  if ((st->error) || (!pcap::is_capture_name(name))) {
+    return;
+  }
+
+  // Compose full filename.
+  char pathname[PATH_MAX];
+  snprintf(pathname, sizeof(pathname), "%s/%s", st->dirname, name);
+
+  // Skip the output file and the files already in the reorder buffer (they
+  // are probed again when they are appended).
+  struct stat sbuf;
+  if ((stat(pathname, &sbuf) != 0) ||
+      ((sbuf.st_dev == st->dev) && (sbuf.st_ino == st->ino))) {
+    return;
+  }
+
+  const util::file_set<followed_file>::entry* const
+    e = st->seen.find(sbuf.st_dev, sbuf.st_ino);
+
+  if ((e) && (!e->value.appended)) {
+    return;
+  }
+
+  pcap::file info;
+  if (!pcap::scan_file(pathname, true, info)) {
+    fprintf(stderr, "Skipping '%s': not a valid PCAP file.\n", pathname);
+    return;
+  }
+
+  if ((e) && (e->value.timestamp == info.timestamp)) {
+    fprintf(stderr,
+            "Warning: '%s' has been modified after being appended.\n",
+            pathname);
+
+    return;
+  }
+
+  if ((!st->pending.add(pathname, info)) || (!remember(*st, info, false))) {
+    fprintf(stderr, "Error allocating memory.\n");
+
+    st->error = true;
+    return;
+  }
+
+  st->pending.sort();
+
+  // Append the earliest files once the reorder buffer is full.
+  while (st->pending.count() > st->reorder) {
+    if (!append_files(*st)) {
+      st->error = true;
+      return;
+    }
+  }
+}
+
+bool append_files(follow_state& st)
+{
+  const output_options& options = *st.options;
+
+  // Take the earliest file of the reorder buffer and the files which
+  // overlap it, probed again (they might have grown).
+  pcap::files batch;
+  uint64_t end = 0;
+
+  for (size_t i = 0; i < st.pending.count(); i++) {
+    pcap::file* const f = st.pending.get(i);
+
+    if ((i > 0) && (f->timestamp > end)) {
+      break;
+    }
+
+    // A file is only appended once.
+    pcap::file info;
+    if (pcap::scan_file(f->filename, true, info)) {
+      if ((!batch.add(f->filename, info)) || (!remember(st, info, true))) {
+        fprintf(stderr, "Error allocating memory.\n");
+        return false;
+      }
+
+      if (info.last_timestamp > end) {
+        end = info.last_timestamp;
+      }
+    } else {
+      fprintf(stderr, "Skipping '%s': not a valid PCAP file.\n", f->filename);
+
+      if (!remember(st, *f, true)) {
+        fprintf(stderr, "Error allocating memory.\n");
+        return false;
+      }
+    }
+
+    f->valid = false;
+  }
+
+  st.pending.compact();
+
+  batch.sort();
+
+  // The link type is the one of the output file (or of the first file).
+  for (size_t i = 0; i < batch.count(); i++) {
+    pcap::file* const f = batch.get(i);
+
+    if ((st.size == 0) && (i == 0)) {
+      st.linktype = f->linktype;
+    }
+
+    if ((f->linktype == pcap::linktype_mixed) ||
+        (f->linktype != st.linktype)) {
+      fprintf(stderr, "Skipping '%s': different link type.\n", f->filename);
+      f->valid = false;
+    }
+  }
+
+  batch.compact();
+
+  if (batch.count() == 0) {
+    return true;
+  }
+
+  // Files which start before the end of the output arrived too late to be
+  // merged.
+  if (batch.get(0)->timestamp < st.last_timestamp) {
+    fprintf(stderr,
+            "Warning: '%s' starts before the end of the output, the output "
+            "is not\nin timestamp order (use a larger --reorder).\n",
+            batch.get(0)->filename);
+
+    st.late++;
+  }
+
+  // Walk the compressed files.
+  if (!pcap::decompress(batch, 1)) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return false;
+  }
+
+  batch.compact();
+
+  if (batch.count() == 0) {
+    return true;
+  }
+
+  // Write the PCAP file header with the first file.
+  static constexpr const uint64_t header_size = sizeof(pcap::pcap_file_header);
+
+  if (st.size == 0) {
+    if (options.autores) {
+      st.res = output_resolution(batch);
+    }
+
+    pcap::writer w(st.fd, 0, st.res);
+    if (!write_header(batch, st.res, nullptr, st.filename, w)) {
+      return false;
+    }
+
+    st.size = header_size;
+  }
+
+  pcap::plan plan;
+  if (!plan.build(batch, options.merge, st.res, nullptr)) {
+    fprintf(stderr, "Error allocating memory.\n");
+    return false;
+  }
+
+  // The output file is sized up front, the segments are appended after the
+  // current end.
+  const uint64_t size = st.size + plan.size() - header_size;
+
+  if (ftruncate(st.fd, size) != 0) {
+    fprintf(stderr,
+            "Error truncating file '%s' to %" PRIu64 " bytes.\n",
+            st.filename,
+            size);
+
+    return false;
+  }
+
+  for (size_t i = 0; i < plan.count(); i++) {
+    const pcap::segment* const seg = plan.get(i);
+
+    if (!copy_segment(batch,
+                      *seg,
+                      st.res,
+                      nullptr,
+                      st.fd,
+                      st.size + seg->outoff - header_size,
+                      st.filename,
+                      *st.copier)) {
+      // Drop the partial append.
+      if (ftruncate(st.fd, st.size) != 0) {
+        fprintf(stderr, "Error truncating file '%s'.\n", st.filename);
+      }
+
+      return false;
+    }
+  }
+
+  st.size = size;
+
+  for (size_t i = 0; i < batch.count(); i++) {
+    const pcap::file* const f = batch.get(i);
+
+    if (f->last_timestamp > st.last_timestamp) {
+      st.last_timestamp = f->last_timestamp;
+    }
+  }
+
+  st.appended += batch.count();
+
+  if (options.verbose) {
+    fprintf(stderr,
+            "Appended %zu files ('%s'...), %" PRIu64 " bytes.\n",
+            batch.count(),
+            batch.get(0)->filename,
+            plan.size() - header_size);
+  }
+
+  // Forget the files which ended long before the end of the output.
+  if (st.seen.count() >= st.prune_at) {
+    const uint64_t horizon = (st.last_timestamp > follow_horizon) ?
+                               st.last_timestamp - follow_horizon :
+                               0;
+
+    if (!st.seen.remove_if([horizon](const followed_file& f) {
+                             return (f.appended) &&
+                                    (f.last_timestamp < horizon);
+                           })) {
+      fprintf(stderr, "Error allocating memory.\n");
+      return false;
+    }
+
+    st.prune_at = (st.seen.count() * 2 > follow_prune_min) ?
+                    st.seen.count() * 2 :
+                    follow_prune_min;
+  }
+
+  return true;
+}
+
+bool remember(follow_state& st, const pcap::file& f, bool appended)
+{
+  util::file_set<followed_file>::entry* e;
+  if ((e = st.seen.insert(f.device, f.inode)) != nullptr) {
+    e->value.timestamp = f.timestamp;
+    e->value.last_timestamp = f.last_timestamp;
+    e->value.appended = appended;
+
+    return true;
+  }
+
+  return false;
+}
+
+void on_stop_signal(int signum)
+{
+  stop_following = 1;
+}
+
+bool is_stdout(const char* filename)
+{
+  return (strcmp(filename, "-") == 0);
+}
+
+pcap::resolution output_resolution(const pcap::files& files)
+{
+  const pcap::file* file;
+  if ((file = files.get(0)) != nullptr) {
+    const pcap::resolution res = pcap::resolution_of(file->magic);
+
+    for (size_t i = 1; (file = files.get(i)) != nullptr; i++) {
+      if (pcap::resolution_of(file->magic) != res) {
+        // Mixed resolutions: don't lose precision.
+        return pcap::resolution::nanoseconds;
+      }
+    }
+
+    return res;
+  }
+
+  return pcap::resolution::microseconds;
+}
+
+void print_plan(const pcap::plan& plan)
+{
+  fprintf(stderr,
+          "%zu segments, %zu merged (%zu files), %zu converted, "
+          "%" PRIu64 " bytes.\n",
+          plan.count(),
+          plan.clusters(),
+          plan.merged_files(),
+          plan.converted_files(),
+          plan.size());
+}
+
+void print_copy_stats(const io::copier& copier)
+{
+  if (copier.cloned() > 0) {
+    fprintf(stderr, "reflink: %" PRIu64 " bytes.\n", copier.cloned());
+  }
+
+  if (copier.misaligned() > 0) {
+    fprintf(stderr,
+            "Not cloned (misaligned): %" PRIu64 " bytes.\n",
+            copier.misaligned());
+  }
+
+  for (size_t i = 0; i < io::copier::number_methods; i++) {
+    const io::copier::method method = static_cast<io::copier::method>(i);
+
+    const uint64_t copied = copier.copied(method);
+    if (copied > 0) {
+      fprintf(stderr,
+              "%s: %" PRIu64 " bytes.\n",
+              io::copier::name(method),
+              copied);
+    }
+  }
+}
+
+void print_pipe_stats(const io::pipe_output& pipe)
+{
+  fprintf(stderr,
+          "%s: %" PRIu64 " bytes spliced, %" PRIu64 " bytes written.\n",
+          pipe.is_pipe() ? "pipe" : "stdout",
+          pipe.spliced(),
+          pipe.copied());
+
+  if (pipe.stalls() > 0) {
+    fprintf(stderr,
+            "The pipe was full %" PRIu64 " times (%.3f s waiting for the "
+            "reader).\n",
+            pipe.stalls(),
+            pipe.stall_time() / 1e9);
+  }
 }
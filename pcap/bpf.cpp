@@ -0,0 +1,617 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pcap/bpf.h"
+
+namespace {
+  // Operations of the interpreter (in the order of its table of labels).
+  enum operation_index {
+    ld_w_abs,
+    ld_h_abs,
+    ld_b_abs,
+    ld_w_ind,
+    ld_h_ind,
+    ld_b_ind,
+    ld_len,
+    ld_imm,
+    ld_mem,
+    ldx_imm,
+    ldx_mem,
+    ldx_len,
+    ldx_msh,
+    st,
+    stx,
+    add_k,
+    add_x,
+    sub_k,
+    sub_x,
+    mul_k,
+    mul_x,
+    div_k,
+    div_x,
+    mod_k,
+    mod_x,
+    and_k,
+    and_x,
+    or_k,
+    or_x,
+    xor_k,
+    xor_x,
+    lsh_k,
+    lsh_x,
+    rsh_k,
+    rsh_x,
+    neg,
+    ja,
+    jeq_k,
+    jeq_x,
+    jgt_k,
+    jgt_x,
+    jge_k,
+    jge_x,
+    jset_k,
+    jset_x,
+    ret_k,
+    ret_a,
+    tax,
+    txa,
+    noperations
+  };
+}
+
+// Minimum capture length of the paths which never accept a packet.
+static constexpr const uint64_t never = UINT64_MAX;
+
+// Minimum capture length of the accepting paths through a load of the
+// bytes before `end`, followed by paths needing `next` bytes.
+static inline uint64_t extend(uint64_t next, uint64_t end)
+{
+  return ((next == never) || (next >= end)) ? next : end;
+}
+
+// Operation of an instruction code (-1 if it is invalid).
+static int operation_of(uint16_t code)
+{
+  using namespace pcap::bpf;
+
+  switch (code) {
+    case class_ld | size_w | mode_abs: return ld_w_abs;
+    case class_ld | size_h | mode_abs: return ld_h_abs;
+    case class_ld | size_b | mode_abs: return ld_b_abs;
+    case class_ld | size_w | mode_ind: return ld_w_ind;
+    case class_ld | size_h | mode_ind: return ld_h_ind;
+    case class_ld | size_b | mode_ind: return ld_b_ind;
+    case class_ld | size_w | mode_len: return ld_len;
+    case class_ld | size_w | mode_imm: return ld_imm;
+    case class_ld | size_w | mode_mem: return ld_mem;
+    case class_ldx | size_w | mode_imm: return ldx_imm;
+    case class_ldx | size_w | mode_mem: return ldx_mem;
+    case class_ldx | size_w | mode_len: return ldx_len;
+    case class_ldx | size_b | mode_msh: return ldx_msh;
+    case class_st: return st;
+    case class_stx: return stx;
+    case class_alu | op_add | src_k: return add_k;
+    case class_alu | op_add | src_x: return add_x;
+    case class_alu | op_sub | src_k: return sub_k;
+    case class_alu | op_sub | src_x: return sub_x;
+    case class_alu | op_mul | src_k: return mul_k;
+    case class_alu | op_mul | src_x: return mul_x;
+    case class_alu | op_div | src_k: return div_k;
+    case class_alu | op_div | src_x: return div_x;
+    case class_alu | op_mod | src_k: return mod_k;
+    case class_alu | op_mod | src_x: return mod_x;
+    case class_alu | op_and | src_k: return and_k;
+    case class_alu | op_and | src_x: return and_x;
+    case class_alu | op_or | src_k: return or_k;
+    case class_alu | op_or | src_x: return or_x;
+    case class_alu | op_xor | src_k: return xor_k;
+    case class_alu | op_xor | src_x: return xor_x;
+    case class_alu | op_lsh | src_k: return lsh_k;
+    case class_alu | op_lsh | src_x: return lsh_x;
+    case class_alu | op_rsh | src_k: return rsh_k;
+    case class_alu | op_rsh | src_x: return rsh_x;
+    case class_alu | op_neg: return neg;
+    case class_jmp | op_ja: return ja;
+    case class_jmp | op_jeq | src_k: return jeq_k;
+    case class_jmp | op_jeq | src_x: return jeq_x;
+    case class_jmp | op_jgt | src_k: return jgt_k;
+    case class_jmp | op_jgt | src_x: return jgt_x;
+    case class_jmp | op_jge | src_k: return jge_k;
+    case class_jmp | op_jge | src_x: return jge_x;
+    case class_jmp | op_jset | src_k: return jset_k;
+    case class_jmp | op_jset | src_x: return jset_x;
+    case class_ret | src_k: return ret_k;
+    case class_ret | src_a: return ret_a;
+    case class_misc | op_tax: return tax;
+    case class_misc | op_txa: return txa;
+    default: return -1;
+  }
+}
+
+pcap::bpf::program::~program()
+{
+  free(_M_code);
+}
+
+bool pcap::bpf::program::load(const instruction* insns, size_t count)
+{
+  if (!validate(insns, count)) {
+    return false;
+  }
+
+  operation* code;
+  if ((code = static_cast<operation*>(
+                malloc(count * sizeof(operation))
+              )) == nullptr) {
+    return false;
+  }
+
+  const void* const* labels;
+  execute(nullptr, nullptr, 0, 0, &labels);
+
+  for (size_t i = 0; i < count; i++) {
+    const instruction& insn = insns[i];
+    operation& op = code[i];
+
+    op.label = labels[operation_of(insn.code)];
+    op.k = insn.k;
+
+    if (insn.code == (class_jmp | op_ja)) {
+      op.jt = &code[i + 1 + insn.k];
+      op.jf = op.jt;
+    } else {
+      op.jt = &code[i + 1 + insn.jt];
+      op.jf = &code[i + 1 + insn.jf];
+    }
+  }
+
+  free(_M_code);
+  _M_code = code;
+
+  _M_min_caplen = compute_min_caplen(insns, count);
+
+  return true;
+}
+
+uint32_t pcap::bpf::program::compute_min_caplen(const instruction* insns,
+                                                size_t count)
+{
+  // All the jumps are forward: the minimum capture length of the accepting
+  // paths from each instruction is computed from the last one. A path needs
+  // all the bytes it loads (a load out of the packet drops it).
+  uint64_t* need;
+  if ((need = static_cast<uint64_t*>(
+                malloc((count + 1) * sizeof(uint64_t))
+              )) == nullptr) {
+    return 0;
+  }
+
+  need[count] = never;
+
+  for (size_t i = count; i > 0; i--) {
+    const instruction& insn = insns[i - 1];
+    const uint64_t next = need[i];
+
+    uint64_t n;
+    switch (insn.code) {
+      case class_ret | src_k:
+        n = (insn.k != 0) ? 0 : never;
+        break;
+      case class_ret | src_a:
+        n = 0;
+        break;
+      case class_ld | size_w | mode_abs:
+      case class_ld | size_w | mode_ind:
+        n = extend(next, static_cast<uint64_t>(insn.k) + 4);
+        break;
+      case class_ld | size_h | mode_abs:
+      case class_ld | size_h | mode_ind:
+        n = extend(next, static_cast<uint64_t>(insn.k) + 2);
+        break;
+      case class_ld | size_b | mode_abs:
+      case class_ld | size_b | mode_ind:
+      case class_ldx | size_b | mode_msh:
+        n = extend(next, static_cast<uint64_t>(insn.k) + 1);
+        break;
+      case class_jmp | op_ja:
+        n = need[i + insn.k];
+        break;
+      default:
+        if ((insn.code & 0x07) == class_jmp) {
+          const uint64_t t = need[i + insn.jt];
+          const uint64_t f = need[i + insn.jf];
+          n = (t < f) ? t : f;
+        } else {
+          n = next;
+        }
+
+        break;
+    }
+
+    need[i - 1] = n;
+  }
+
+  const uint64_t n = need[0];
+  free(need);
+
+  return (n < UINT32_MAX) ? static_cast<uint32_t>(n) : UINT32_MAX;
+}
+
+bool pcap::bpf::validate(const instruction* insns, size_t count)
+{
+  if ((count == 0) || (count > max_instructions)) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const instruction& insn = insns[i];
+
+    if (operation_of(insn.code) < 0) {
+      return false;
+    }
+
+    switch (insn.code) {
+      case class_ld | size_w | mode_mem:
+      case class_ldx | size_w | mode_mem:
+      case class_st:
+      case class_stx:
+        if (insn.k >= memwords) {
+          return false;
+        }
+
+        break;
+      case class_alu | op_div | src_k:
+      case class_alu | op_mod | src_k:
+        if (insn.k == 0) {
+          return false;
+        }
+
+        break;
+      case class_alu | op_lsh | src_k:
+      case class_alu | op_rsh | src_k:
+        if (insn.k >= 32) {
+          return false;
+        }
+
+        break;
+      case class_jmp | op_ja:
+        if (insn.k >= count - i - 1) {
+          return false;
+        }
+
+        break;
+      default:
+        if (((insn.code & 0x07) == class_jmp) &&
+            ((i + 1 + insn.jt >= count) || (i + 1 + insn.jf >= count))) {
+          return false;
+        }
+
+        break;
+    }
+  }
+
+  // The program has to end with a return.
+  return ((insns[count - 1].code & 0x07) == class_ret);
+}
+
+// Read big-endian integers.
+static inline uint32_t load32(const uint8_t* ptr)
+{
+  uint32_t n;
+  memcpy(&n, ptr, sizeof(uint32_t));
+  return __builtin_bswap32(n);
+}
+
+static inline uint32_t load16(const uint8_t* ptr)
+{
+  uint16_t n;
+  memcpy(&n, ptr, sizeof(uint16_t));
+  return __builtin_bswap16(n);
+}
+
+// Direct-threaded code needs the addresses of labels and computed gotos (a
+// GNU extension).
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+
+uint32_t pcap::bpf::program::execute(const operation* code,
+                                     const uint8_t* data,
+                                     uint32_t caplen,
+                                     uint32_t len,
+                                     const void* const** labels)
+{
+  static const void* const table[noperations] = {
+    &&op_ld_w_abs,
+    &&op_ld_h_abs,
+    &&op_ld_b_abs,
+    &&op_ld_w_ind,
+    &&op_ld_h_ind,
+    &&op_ld_b_ind,
+    &&op_ld_len,
+    &&op_ld_imm,
+    &&op_ld_mem,
+    &&op_ldx_imm,
+    &&op_ldx_mem,
+    &&op_ldx_len,
+    &&op_ldx_msh,
+    &&op_st,
+    &&op_stx,
+    &&op_add_k,
+    &&op_add_x,
+    &&op_sub_k,
+    &&op_sub_x,
+    &&op_mul_k,
+    &&op_mul_x,
+    &&op_div_k,
+    &&op_div_x,
+    &&op_mod_k,
+    &&op_mod_x,
+    &&op_and_k,
+    &&op_and_x,
+    &&op_or_k,
+    &&op_or_x,
+    &&op_xor_k,
+    &&op_xor_x,
+    &&op_lsh_k,
+    &&op_lsh_x,
+    &&op_rsh_k,
+    &&op_rsh_x,
+    &&op_neg,
+    &&op_ja,
+    &&op_jeq_k,
+    &&op_jeq_x,
+    &&op_jgt_k,
+    &&op_jgt_x,
+    &&op_jge_k,
+    &&op_jge_x,
+    &&op_jset_k,
+    &&op_jset_x,
+    &&op_ret_k,
+    &&op_ret_a,
+    &&op_tax,
+    &&op_txa
+  };
+
+  if (!code) {
+    *labels = table;
+    return 0;
+  }
+
+  const operation* pc = code;
+  uint32_t A = 0;
+  uint32_t X = 0;
+  uint32_t M[memwords] = {0};
+  uint64_t off;
+
+// Go to the next operation or to one of the targets of a jump.
+#define NEXT() do { pc++; goto *pc->label; } while (0)
+#define JUMP(cond) do { pc = (cond) ? pc->jt : pc->jf; \
+                        goto *pc->label; } while (0)
+
+  goto *pc->label;
+
+op_ld_w_abs:
+  if (static_cast<uint64_t>(pc->k) + 4 > caplen) {
+    return 0;
+  }
+
+  A = load32(data + pc->k);
+  NEXT();
+
+op_ld_h_abs:
+  if (static_cast<uint64_t>(pc->k) + 2 > caplen) {
+    return 0;
+  }
+
+  A = load16(data + pc->k);
+  NEXT();
+
+op_ld_b_abs:
+  if (pc->k >= caplen) {
+    return 0;
+  }
+
+  A = data[pc->k];
+  NEXT();
+
+op_ld_w_ind:
+  if ((off = static_cast<uint64_t>(X) + pc->k) + 4 > caplen) {
+    return 0;
+  }
+
+  A = load32(data + off);
+  NEXT();
+
+op_ld_h_ind:
+  if ((off = static_cast<uint64_t>(X) + pc->k) + 2 > caplen) {
+    return 0;
+  }
+
+  A = load16(data + off);
+  NEXT();
+
+op_ld_b_ind:
+  if ((off = static_cast<uint64_t>(X) + pc->k) >= caplen) {
+    return 0;
+  }
+
+  A = data[off];
+  NEXT();
+
+op_ld_len:
+  A = len;
+  NEXT();
+
+op_ld_imm:
+  A = pc->k;
+  NEXT();
+
+op_ld_mem:
+  A = M[pc->k];
+  NEXT();
+
+op_ldx_imm:
+  X = pc->k;
+  NEXT();
+
+op_ldx_mem:
+  X = M[pc->k];
+  NEXT();
+
+op_ldx_len:
+  X = len;
+  NEXT();
+
+op_ldx_msh:
+  if (pc->k >= caplen) {
+    return 0;
+  }
+
+  X = (data[pc->k] & 0x0f) << 2;
+  NEXT();
+
+op_st:
+  M[pc->k] = A;
+  NEXT();
+
+op_stx:
+  M[pc->k] = X;
+  NEXT();
+
+op_add_k:
+  A += pc->k;
+  NEXT();
+
+op_add_x:
+  A += X;
+  NEXT();
+
+op_sub_k:
+  A -= pc->k;
+  NEXT();
+
+op_sub_x:
+  A -= X;
+  NEXT();
+
+op_mul_k:
+  A *= pc->k;
+  NEXT();
+
+op_mul_x:
+  A *= X;
+  NEXT();
+
+op_div_k:
+  A /= pc->k;
+  NEXT();
+
+op_div_x:
+  if (X == 0) {
+    return 0;
+  }
+
+  A /= X;
+  NEXT();
+
+op_mod_k:
+  A %= pc->k;
+  NEXT();
+
+op_mod_x:
+  if (X == 0) {
+    return 0;
+  }
+
+  A %= X;
+  NEXT();
+
+op_and_k:
+  A &= pc->k;
+  NEXT();
+
+op_and_x:
+  A &= X;
+  NEXT();
+
+op_or_k:
+  A |= pc->k;
+  NEXT();
+
+op_or_x:
+  A |= X;
+  NEXT();
+
+op_xor_k:
+  A ^= pc->k;
+  NEXT();
+
+op_xor_x:
+  A ^= X;
+  NEXT();
+
+op_lsh_k:
+  A <<= pc->k;
+  NEXT();
+
+op_lsh_x:
+  A = (X < 32) ? A << X : 0;
+  NEXT();
+
+op_rsh_k:
+  A >>= pc->k;
+  NEXT();
+
+op_rsh_x:
+  A = (X < 32) ? A >> X : 0;
+  NEXT();
+
+op_neg:
+  A = -A;
+  NEXT();
+
+op_ja:
+  JUMP(true);
+
+op_jeq_k:
+  JUMP(A == pc->k);
+
+op_jeq_x:
+  JUMP(A == X);
+
+op_jgt_k:
+  JUMP(A > pc->k);
+
+op_jgt_x:
+  JUMP(A > X);
+
+op_jge_k:
+  JUMP(A >= pc->k);
+
+op_jge_x:
+  JUMP(A >= X);
+
+op_jset_k:
+  JUMP((A & pc->k) != 0);
+
+op_jset_x:
+  JUMP((A & X) != 0);
+
+op_ret_k:
+  return pc->k;
+
+op_ret_a:
+  return A;
+
+op_tax:
+  X = A;
+  NEXT();
+
+op_txa:
+  A = X;
+  NEXT();
+
+#undef JUMP
+#undef NEXT
+}
+
+#pragma GCC diagnostic pop
@@ -0,0 +1,148 @@
+#ifndef PCAP_BPF_H
+#define PCAP_BPF_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace pcap {
+  namespace bpf {
+    // Classic BPF instruction (as in struct sock_filter).
+    struct instruction {
+      uint16_t code;
+      uint8_t jt;
+      uint8_t jf;
+      uint32_t k;
+    };
+
+    // Instruction classes.
+    static constexpr const uint16_t class_ld = 0x00;
+    static constexpr const uint16_t class_ldx = 0x01;
+    static constexpr const uint16_t class_st = 0x02;
+    static constexpr const uint16_t class_stx = 0x03;
+    static constexpr const uint16_t class_alu = 0x04;
+    static constexpr const uint16_t class_jmp = 0x05;
+    static constexpr const uint16_t class_ret = 0x06;
+    static constexpr const uint16_t class_misc = 0x07;
+
+    // Sizes and modes of the loads.
+    static constexpr const uint16_t size_w = 0x00;
+    static constexpr const uint16_t size_h = 0x08;
+    static constexpr const uint16_t size_b = 0x10;
+
+    static constexpr const uint16_t mode_imm = 0x00;
+    static constexpr const uint16_t mode_abs = 0x20;
+    static constexpr const uint16_t mode_ind = 0x40;
+    static constexpr const uint16_t mode_mem = 0x60;
+    static constexpr const uint16_t mode_len = 0x80;
+    static constexpr const uint16_t mode_msh = 0xa0;
+
+    // Operations of the ALU, jump and miscellaneous instructions.
+    static constexpr const uint16_t op_add = 0x00;
+    static constexpr const uint16_t op_sub = 0x10;
+    static constexpr const uint16_t op_mul = 0x20;
+    static constexpr const uint16_t op_div = 0x30;
+    static constexpr const uint16_t op_or = 0x40;
+    static constexpr const uint16_t op_and = 0x50;
+    static constexpr const uint16_t op_lsh = 0x60;
+    static constexpr const uint16_t op_rsh = 0x70;
+    static constexpr const uint16_t op_neg = 0x80;
+    static constexpr const uint16_t op_mod = 0x90;
+    static constexpr const uint16_t op_xor = 0xa0;
+
+    static constexpr const uint16_t op_ja = 0x00;
+    static constexpr const uint16_t op_jeq = 0x10;
+    static constexpr const uint16_t op_jgt = 0x20;
+    static constexpr const uint16_t op_jge = 0x30;
+    static constexpr const uint16_t op_jset = 0x40;
+
+    static constexpr const uint16_t op_tax = 0x00;
+    static constexpr const uint16_t op_txa = 0x80;
+
+    // Sources of the operands (the return value for `class_ret`).
+    static constexpr const uint16_t src_k = 0x00;
+    static constexpr const uint16_t src_x = 0x08;
+    static constexpr const uint16_t src_a = 0x10;
+
+    // Number of words of scratch memory.
+    static constexpr const unsigned memwords = 16;
+
+    // Maximum number of instructions.
+    static constexpr const size_t max_instructions = 4096;
+
+    // Program ready to be run.
+    // The instructions are validated (as by the kernel) and translated to a
+    // direct-threaded form: each instruction holds the address of the code
+    // of its operation and pointers to the instructions it jumps to, so the
+    // interpreter goes from one operation to the next with a single
+    // indirect jump, without decoding. The minimum capture length of the
+    // packets the program can accept is computed up front, so shorter
+    // packets are rejected without running it.
+    class program {
+      public:
+        // Constructor.
+        program() = default;
+
+        // Destructor.
+        ~program();
+
+        // Load program.
+        // Returns false if it is invalid.
+        bool load(const instruction* insns, size_t count);
+
+        // Run the program on a packet: number of bytes to keep (0 to drop
+        // the packet).
+        uint32_t run(const void* data, uint32_t caplen, uint32_t len) const
+        {
+          if ((caplen < _M_min_caplen) || (!_M_code)) {
+            return 0;
+          }
+
+          return execute(_M_code,
+                         static_cast<const uint8_t*>(data),
+                         caplen,
+                         len);
+        }
+
+        // Minimum capture length of the packets accepted (UINT32_MAX if
+        // the program never accepts a packet).
+        uint32_t min_caplen() const
+        {
+          return _M_min_caplen;
+        }
+
+      private:
+        // Translated instruction.
+        struct operation {
+          const void* label;
+          uint32_t k;
+          const operation* jt;
+          const operation* jf;
+        };
+
+        operation* _M_code = nullptr;
+
+        uint32_t _M_min_caplen = UINT32_MAX;
+
+        // Run translated program (or get the addresses of the code of the
+        // operations if `code` is nullptr).
+        static uint32_t execute(const operation* code,
+                                const uint8_t* data,
+                                uint32_t caplen,
+                                uint32_t len,
+                                const void* const** labels = nullptr);
+
+        // Minimum capture length of the packets accepted by `insns`.
+        static uint32_t compute_min_caplen(const instruction* insns,
+                                           size_t count);
+
+        // Disable copy constructor and assignment operator.
+        program(const program&) = delete;
+        program& operator=(const program&) = delete;
+    };
+
+    // Is the program valid?
+    bool validate(const instruction* insns, size_t count);
+  }
+}
+
+#endif // PCAP_BPF_H
@@ -0,0 +1,194 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "pcap/cache.h"
+#include "io/rw.h"
+
+// Signature and version of the index file.
+static const uint8_t signature[8] = {'M', 'C', 'A', 'P', 'I', 'D', 'X', 0};
+static constexpr const uint32_t version = 8;
+
+pcap::cache::~cache()
+{
+  free(_M_records);
+}
+
+bool pcap::cache::load(const char* filename)
+{
+  free(_M_records);
+  _M_records = nullptr;
+  _M_count = 0;
+
+  int fd;
+  if ((fd = open(filename, O_RDONLY)) != -1) {
+    header hdr;
+    struct stat sbuf;
+
+    if ((io::read_all(fd, &hdr, sizeof(header))) &&
+        (memcmp(hdr.signature, signature, sizeof(signature)) == 0) &&
+        (hdr.version == version) &&
+        (hdr.record_size == sizeof(record)) &&
+        (fstat(fd, &sbuf) == 0) &&
+        (static_cast<uint64_t>(sbuf.st_size) ==
+         sizeof(header) + hdr.count * sizeof(record))) {
+      if ((hdr.count == 0) ||
+          ((_M_records = static_cast<record*>(
+                           malloc(hdr.count * sizeof(record))
+                         )) != nullptr)) {
+        if ((hdr.count == 0) ||
+            (io::read_all(fd, _M_records, hdr.count * sizeof(record)))) {
+          _M_count = hdr.count;
+        } else {
+          free(_M_records);
+          _M_records = nullptr;
+        }
+      }
+    }
+
+    close(fd);
+  }
+
+  return true;
+}
+
+bool pcap::cache::find(uint64_t device,
+                       uint64_t inode,
+                       uint64_t filesize,
+                       int64_t mtime,
+                       file& f) const
+{
+  record key;
+  key.device = device;
+  key.inode = inode;
+
+  const record* r;
+  if (((r = static_cast<const record*>(
+              bsearch(&key, _M_records, _M_count, sizeof(record), compare)
+            )) != nullptr) &&
+      (r->filesize == filesize) &&
+      (r->mtime == mtime)) {
+    f.filesize = r->filesize;
+    f.device = r->device;
+    f.inode = r->inode;
+    f.mtime = r->mtime;
+    f.timestamp = r->first_timestamp;
+    f.last_timestamp = r->last_timestamp;
+    f.packets = r->packets;
+    f.end = r->end;
+    f.records_size = r->records_size;
+    f.blocks_size = r->blocks_size;
+    f.magic = r->magic;
+    f.snaplen = r->snaplen;
+    f.linktype = r->linktype;
+    f.valid = ((r->flags & flag_valid) != 0);
+    f.walked = ((r->flags & flag_walked) != 0);
+    f.compressed = ((r->flags & flag_compressed) != 0);
+    f.compression = static_cast<io::compressor::format>(
+                      (r->flags >> compression_shift) & 0xff
+                    );
+
+    return true;
+  }
+
+  return false;
+}
+
+bool pcap::cache::save(const char* filename, const files& files)
+{
+  const size_t count = files.count();
+
+  record* records;
+  if ((records = static_cast<record*>(
+                   malloc((count + 1) * sizeof(record))
+                 )) == nullptr) {
+    return false;
+  }
+
+  for (size_t i = 0; i < count; i++) {
+    const file* const f = files.get(i);
+    record* const r = &records[i];
+
+    r->device = f->device;
+    r->inode = f->inode;
+    r->filesize = f->filesize;
+    r->mtime = f->mtime;
+    r->first_timestamp = f->valid ? f->timestamp : 0;
+    r->last_timestamp = f->walked ? f->last_timestamp : 0;
+    r->packets = f->walked ? f->packets : 0;
+    r->end = f->walked ? f->end : 0;
+    r->records_size = f->walked ? f->records_size : 0;
+    r->blocks_size = f->walked ? f->blocks_size : 0;
+    r->magic = f->valid ? f->magic : 0;
+    r->snaplen = f->valid ? f->snaplen : 0;
+    r->linktype = f->valid ? f->linktype : 0;
+    r->flags = (f->valid ? flag_valid : 0) |
+               (f->walked ? flag_walked : 0) |
+               (f->compressed ?
+                  flag_compressed |
+                  (static_cast<uint32_t>(f->compression) << compression_shift) :
+                  0);
+  }
+
+  qsort(records, count, sizeof(record), compare);
+
+  // Write to a temporary file and rename it, so readers never see a
+  // partially written index.
+  char tmpname[PATH_MAX];
+  if (snprintf(tmpname,
+               sizeof(tmpname),
+               "%s.%ld.tmp",
+               filename,
+               static_cast<long>(getpid())) >=
+      static_cast<int>(sizeof(tmpname))) {
+    free(records);
+    return false;
+  }
+
+  int fd;
+  if ((fd = open(tmpname, O_CREAT | O_TRUNC | O_WRONLY, 0644)) != -1) {
+    header hdr;
+    memcpy(hdr.signature, signature, sizeof(signature));
+    hdr.version = version;
+    hdr.record_size = sizeof(record);
+    hdr.count = count;
+
+    bool ret = (io::write_all(fd, &hdr, sizeof(header))) &&
+               (io::write_all(fd, records, count * sizeof(record)));
+
+    free(records);
+
+    // The descriptor is closed exactly once, even if close() fails (it is
+    // released anyway and might already belong to another thread).
+    ret = (close(fd) == 0) && (ret);
+
+    if ((ret) && (rename(tmpname, filename) == 0)) {
+      return true;
+    }
+
+    unlink(tmpname);
+  } else {
+    free(records);
+  }
+
+  return false;
+}
+
+int pcap::cache::compare(const void* p1, const void* p2)
+{
+  const record* const r1 = static_cast<const record*>(p1);
+  const record* const r2 = static_cast<const record*>(p2);
+
+  if (r1->device != r2->device) {
+    return (r1->device < r2->device) ? -1 : 1;
+  } else if (r1->inode < r2->inode) {
+    return -1;
+  } else if (r1->inode > r2->inode) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
@@ -0,0 +1,79 @@
+#ifndef PCAP_CACHE_H
+#define PCAP_CACHE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/files.h"
+
+namespace pcap {
+  // Persistent index of per-file information.
+  // Records are keyed by device and inode number (inode numbers are only
+  // unique per file system) and validated against the file size and the
+  // modification time, so a file which has been rewritten is probed again.
+  // The index is a flat array of fixed-size records sorted by device and
+  // inode number, looked up by binary search.
+  class cache {
+    public:
+      // Constructor.
+      cache() = default;
+
+      // Destructor.
+      ~cache();
+
+      // Load index. A missing or invalid index is treated as empty.
+      bool load(const char* filename);
+
+      // Look up file; on success, fills everything but the file name.
+      bool find(uint64_t device,
+                uint64_t inode,
+                uint64_t filesize,
+                int64_t mtime,
+                file& f) const;
+
+      // Save index of the files [0, files.count()).
+      static bool save(const char* filename, const files& files);
+
+    private:
+      // On-disk record.
+      struct record {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t filesize;
+        int64_t mtime;
+        uint64_t first_timestamp;
+        uint64_t last_timestamp;
+        uint64_t packets;
+        uint64_t end;
+        uint64_t records_size;
+        uint64_t blocks_size;
+        uint32_t magic;
+        uint32_t snaplen;
+        uint32_t linktype;
+        uint32_t flags;
+      };
+
+      // On-disk header.
+      struct header {
+        uint8_t signature[8];
+        uint32_t version;
+        uint32_t record_size;
+        uint64_t count;
+      };
+
+      // Record flags.
+      static constexpr const uint32_t flag_valid = 0x01;
+      static constexpr const uint32_t flag_walked = 0x02;
+      static constexpr const uint32_t flag_compressed = 0x04;
+
+      // Compression format (bits 8-15 of the flags).
+      static constexpr const unsigned compression_shift = 8;
+
+      // Records.
+      record* _M_records = nullptr;
+      size_t _M_count = 0;
+
+      static int compare(const void* p1, const void* p2);
+  };
+}
+
+#endif // PCAP_CACHE_H
@@ -0,0 +1,344 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "pcap/convert.h"
+#include "pcap/swap.h"
+#include "pcap/pcapng.h"
+#include "pcap/decompress.h"
+
+// Number of packets per batch (two iovecs per packet).
+static constexpr const size_t batch_size = pcap::writer::max_iov / 2;
+
+// Convert the fractional parts of the timestamps.
+static void convert_fractions(pcap::pcap_pkthdr* hdrs,
+                              size_t count,
+                              pcap::resolution res)
+{
+  if (res == pcap::resolution::nanoseconds) {
+    for (size_t i = 0; i < count; i++) {
+      hdrs[i].ts.tv_usec *= 1000;
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      hdrs[i].ts.tv_usec /= 1000;
+    }
+  }
+}
+
+// Write the packets of a pcapng file.
+static bool convert_pcapng(const uint8_t* begin,
+                           uint64_t size,
+                           const pcap::file& f,
+                           pcap::writer& w,
+                           pcap::resolution res)
+{
+  pcap::pcapng::parser parser;
+  if (!parser.open(begin, size)) {
+    return false;
+  }
+
+  parser.set_window(f.window_start, f.window_end);
+
+  const uint64_t divisor = (res == pcap::resolution::nanoseconds) ? 1 : 1000;
+
+  pcap::pcapng::packet pkt;
+  while (parser.next(pkt)) {
+    pcap::pcap_pkthdr hdr;
+    hdr.ts.tv_sec = pkt.timestamp / 1000000000ull;
+    hdr.ts.tv_usec = (pkt.timestamp % 1000000000ull) / divisor;
+    hdr.caplen = pkt.caplen;
+    hdr.len = pkt.len;
+
+    if (!w.write(hdr, pkt.data)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool pcap::convert(const file& f, writer& w)
+{
+  // Open file for reading.
+  uint64_t size;
+  int fd;
+  if ((fd = open_data(f, size)) == -1) {
+    return false;
+  }
+
+  // Map file into memory.
+  void* base;
+  if ((base = mmap(nullptr,
+                   size,
+                   PROT_READ,
+                   MAP_SHARED,
+                   fd,
+                   0)) == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  close(fd);
+
+  madvise(base, size, MADV_SEQUENTIAL);
+
+  const uint8_t* const begin = static_cast<const uint8_t*>(base);
+  const uint8_t* const end = begin + f.data_end();
+  const uint8_t* ptr = begin + f.begin;
+
+  const resolution res = w.timestamp_resolution();
+
+  // pcapng file?
+  if (is_pcapng(f.magic)) {
+    const bool ret = (convert_pcapng(begin, size, f, w, res)) && (w.flush());
+
+    munmap(base, size);
+
+    return ret;
+  }
+
+  const bool swapped = is_swapped(f.magic);
+  const bool same_resolution = (resolution_of(f.magic) == res);
+
+  pcap_pkthdr hdrs[batch_size];
+  const uint8_t* data[batch_size];
+
+  bool ret = true;
+
+  do {
+    // Gather packet headers.
+    size_t count = 0;
+    while ((count < batch_size) && (ptr + sizeof(pcap_pkthdr) <= end)) {
+      const pcap_pkthdr* const hdr = reinterpret_cast<const pcap_pkthdr*>(ptr);
+
+      const uint32_t caplen = swapped ? __builtin_bswap32(hdr->caplen) :
+                                        hdr->caplen;
+
+      const uint8_t* const next = ptr + sizeof(pcap_pkthdr) + caplen;
+      if (next > end) {
+        break;
+      }
+
+      hdrs[count] = *hdr;
+      data[count] = ptr + sizeof(pcap_pkthdr);
+      count++;
+
+      ptr = next;
+    }
+
+    if (count == 0) {
+      break;
+    }
+
+    if (swapped) {
+      swap(hdrs, count);
+    }
+
+    if (!same_resolution) {
+      convert_fractions(hdrs, count, res);
+    }
+
+    // Scatter.
+    for (size_t i = 0; i < count; i++) {
+      if (!w.write(hdrs[i], data[i])) {
+        ret = false;
+        break;
+      }
+    }
+  } while (ret);
+
+  // Bytes after the last complete packet (only if the packet headers have
+  // not been walked) are copied as they are.
+  if ((ret) && (ptr < end)) {
+    ret = w.write(ptr, end - ptr);
+  }
+
+  // The writer is flushed before unmapping the file.
+  ret = (ret) && (w.flush());
+
+  munmap(base, size);
+
+  return ret;
+}
+
+// Write the packets of a PCAP file as enhanced packet blocks.
+static bool blocks_from_pcap(const uint8_t* begin,
+                             const pcap::file& f,
+                             uint32_t interface,
+                             pcap::writer& w)
+{
+  const bool swapped = pcap::is_swapped(f.magic);
+  const bool nanoseconds = (pcap::resolution_of(f.magic) ==
+                            pcap::resolution::nanoseconds);
+
+  const uint8_t* const end = begin + f.data_end();
+  const uint8_t* ptr = begin + f.begin;
+
+  while (ptr + sizeof(pcap::pcap_pkthdr) <= end) {
+    pcap::pcap_pkthdr hdr = *reinterpret_cast<const pcap::pcap_pkthdr*>(ptr);
+    if (swapped) {
+      pcap::swap(hdr);
+    }
+
+    const uint8_t* const data = ptr + sizeof(pcap::pcap_pkthdr);
+    if (data + hdr.caplen > end) {
+      break;
+    }
+
+    const uint64_t ticks = nanoseconds ?
+                             hdr.ts.tv_sec * 1000000000ull + hdr.ts.tv_usec :
+                             hdr.ts.tv_sec * 1000000ull + hdr.ts.tv_usec;
+
+    if (!pcap::pcapng::write_packet(w,
+                                    interface,
+                                    ticks,
+                                    data,
+                                    hdr.caplen,
+                                    hdr.len)) {
+      return false;
+    }
+
+    ptr = data + hdr.caplen;
+  }
+
+  return true;
+}
+
+// Copy the blocks [start, end) of a mapped file at the offset of the writer
+// (or append them to its compressed stream or pipe).
+static bool copy_blocks(int fd,
+                        const uint8_t* begin,
+                        const uint8_t* start,
+                        const uint8_t* end,
+                        io::copier& copier,
+                        pcap::writer& w)
+{
+  if (w.sequential()) {
+    return w.write(start, end - start);
+  }
+
+  const uint64_t off = w.offset();
+
+  return (w.seek(off + (end - start))) &&
+         (copier.copy(fd, start - begin, w.fd(), off, end - start));
+}
+
+// Write the packets of a pcapng file as enhanced packet blocks.
+static bool blocks_from_pcapng(int fd,
+                               const uint8_t* begin,
+                               uint64_t size,
+                               const pcap::file& f,
+                               const uint32_t* map,
+                               bool identity,
+                               io::copier& copier,
+                               pcap::writer& w)
+{
+  pcap::pcapng::parser parser;
+  if (!parser.open(begin, size)) {
+    return false;
+  }
+
+  parser.set_window(f.window_start, f.window_end);
+
+  // Run of enhanced packet blocks to be copied.
+  const uint8_t* start = nullptr;
+  const uint8_t* end = nullptr;
+
+  pcap::pcapng::packet pkt;
+  while (parser.next(pkt)) {
+    if ((pkt.enhanced) && (!parser.swapped())) {
+      if (identity) {
+        if (pkt.block == end) {
+          end += pkt.block_length;
+        } else {
+          // Copy the previous run.
+          if ((start) && (!copy_blocks(fd, begin, start, end, copier, w))) {
+            return false;
+          }
+
+          start = pkt.block;
+          end = start + pkt.block_length;
+        }
+
+        continue;
+      }
+
+      if (!pcap::pcapng::write_block(w,
+                                     pkt.block,
+                                     pkt.block_length,
+                                     map[pkt.interface])) {
+        return false;
+      }
+    } else {
+      // Copy the pending run first.
+      if (start) {
+        if (!copy_blocks(fd, begin, start, end, copier, w)) {
+          return false;
+        }
+
+        start = nullptr;
+        end = nullptr;
+      }
+
+      if (!pcap::pcapng::write_packet(w,
+                                      map[pkt.interface],
+                                      pkt.ticks,
+                                      pkt.data,
+                                      pkt.caplen,
+                                      pkt.len)) {
+        return false;
+      }
+    }
+  }
+
+  return (!start) || (copy_blocks(fd, begin, start, end, copier, w));
+}
+
+bool pcap::convert(const file& f,
+                   const uint32_t* map,
+                   bool identity,
+                   io::copier& copier,
+                   writer& w)
+{
+  // Open file for reading.
+  uint64_t size;
+  int fd;
+  if ((fd = open_data(f, size)) == -1) {
+    return false;
+  }
+
+  // Map file into memory.
+  void* base;
+  if ((base = mmap(nullptr,
+                   size,
+                   PROT_READ,
+                   MAP_SHARED,
+                   fd,
+                   0)) == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  madvise(base, size, MADV_SEQUENTIAL);
+
+  const uint8_t* const begin = static_cast<const uint8_t*>(base);
+
+  bool ret = is_pcapng(f.magic) ?
+               blocks_from_pcapng(fd,
+                                  begin,
+                                  size,
+                                  f,
+                                  map,
+                                  identity,
+                                  copier,
+                                  w) :
+               blocks_from_pcap(begin, f, map[0], w);
+
+  // The writer is flushed before unmapping the file.
+  ret = (ret) && (w.flush());
+
+  munmap(base, size);
+  close(fd);
+
+  return ret;
+}
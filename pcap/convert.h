@@ -0,0 +1,37 @@
+#ifndef PCAP_CONVERT_H
+#define PCAP_CONVERT_H
+
+#include <stdint.h>
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+#include "pcap/writer.h"
+#include "io/copier.h"
+
+namespace pcap {
+  // Copy the packets of a PCAP file with `w` (which is flushed), converting
+  // their headers to the host byte order and their timestamps to the
+  // resolution of the writer.
+  // Packet headers are processed in batches: they are gathered into an
+  // array, byte-swapped with SIMD shuffles (if needed), their fractional
+  // parts converted in a single vectorized loop and scattered into a header
+  // buffer, which is written together with the packet data (referenced in
+  // the mapped file) with pwritev().
+  // The packets of pcapng files are written with PCAP packet headers.
+  bool convert(const file& f, writer& w);
+
+  // Copy the packets of a PCAP or pcapng file with `w` (which is flushed)
+  // as pcapng enhanced packet blocks, with the interface IDs in `map`.
+  // Enhanced packet blocks in host byte order are written as they are (with
+  // their options), other packets are encoded.
+  // If the interfaces of a pcapng file keep their IDs (`identity`), runs of
+  // consecutive enhanced packet blocks in host byte order are copied with
+  // `copier` (in the kernel, if possible) unless the writer appends to a
+  // compressed stream.
+  bool convert(const file& f,
+               const uint32_t* map,
+               bool identity,
+               io::copier& copier,
+               writer& w);
+}
+
+#endif // PCAP_CONVERT_H
@@ -0,0 +1,415 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <limits.h>
+#include <mutex>
+#include "pcap/decompress.h"
+#include "pcap/probe.h"
+#include "pcap/pcapng.h"
+#include "io/decompressor.h"
+#include "io/rw.h"
+#include "util/parallel.h"
+
+// Size of the buffer for decompressed data.
+static constexpr const size_t buffer_size = 1024 * 1024;
+
+// Create an unlinked temporary file (/tmp is often in memory).
+static int create_temporary()
+{
+  const char* dir = getenv("TMPDIR");
+  if ((!dir) || (!*dir)) {
+    dir = "/var/tmp";
+  }
+
+  int fd;
+  if ((fd = open(dir, O_TMPFILE | O_RDWR | O_CLOEXEC, 0600)) != -1) {
+    return fd;
+  }
+
+  // O_TMPFILE not supported by the file system.
+  char name[PATH_MAX];
+  if ((snprintf(name,
+                sizeof(name),
+                "%s/mergecap.XXXXXX",
+                dir) < static_cast<int>(sizeof(name))) &&
+      ((fd = mkostemp(name, O_CLOEXEC)) != -1)) {
+    unlink(name);
+    return fd;
+  }
+
+  return -1;
+}
+
+// Decompress file into an unlinked temporary file.
+// Returns the file descriptor of the temporary file or -1 on error.
+static int decompress_file(const pcap::file& f, uint64_t& size)
+{
+  // Open file for reading.
+  int infd;
+  if ((infd = open(f.filename, O_RDONLY)) == -1) {
+    return -1;
+  }
+
+  int fd = -1;
+
+  uint8_t* buf;
+  if ((buf = static_cast<uint8_t*>(malloc(buffer_size))) != nullptr) {
+    io::decompressor decompressor;
+    if ((decompressor.open(infd, f.compression)) &&
+        ((fd = create_temporary()) != -1)) {
+      size = 0;
+
+      ssize_t len;
+      while ((len = decompressor.read(buf, buffer_size)) > 0) {
+        if (!io::write_all(fd, buf, len)) {
+          len = -1;
+          break;
+        }
+
+        size += len;
+      }
+
+      if (len < 0) {
+        close(fd);
+        fd = -1;
+      }
+    }
+
+    free(buf);
+  }
+
+  close(infd);
+
+  return fd;
+}
+
+namespace {
+  // Decompressed copies kept for the files read again (the walk, the
+  // interfaces of a pcapng output, the time window, the chunks and the
+  // output itself), so each file is normally decompressed once. The copies
+  // which exceed the limit are dropped, least recently used first; the
+  // descriptors already handed out stay valid.
+  class copies {
+    public:
+      // Constructor.
+      copies() = default;
+
+      // Destructor.
+      ~copies();
+
+      // Get a new descriptor of the copy of the file (and its size).
+      // Returns -1 if there is no copy.
+      int get(const pcap::file& f, uint64_t& size);
+
+      // Keep a copy of the file (`fd` stays owned by the caller).
+      void put(const pcap::file& f, int fd, uint64_t size);
+
+      // Set the maximum size of the copies.
+      void set_limit(uint64_t limit);
+
+    private:
+      // Copy of a file.
+      struct copy {
+        uint64_t device;
+        uint64_t inode;
+        uint64_t filesize;
+        int64_t mtime;
+
+        int fd;
+        uint64_t size;
+
+        // Tick of the last use.
+        uint64_t used;
+      };
+
+      copy* _M_copies = nullptr;
+      size_t _M_size = 0;
+      size_t _M_used = 0;
+
+      // Total size of the copies and maximum.
+      uint64_t _M_total = 0;
+      uint64_t _M_limit = pcap::default_decompressed_limit;
+
+      uint64_t _M_tick = 0;
+
+      std::mutex _M_mutex;
+
+      // Find the copy of the file.
+      copy* find(const pcap::file& f);
+
+      // Drop the least recently used copies above the limit.
+      void trim();
+
+      // Disable copy constructor and assignment operator.
+      copies(const copies&) = delete;
+      copies& operator=(const copies&) = delete;
+  };
+}
+
+static copies kept;
+
+copies::~copies()
+{
+  for (size_t i = 0; i < _M_used; i++) {
+    close(_M_copies[i].fd);
+  }
+
+  free(_M_copies);
+}
+
+int copies::get(const pcap::file& f, uint64_t& size)
+{
+  std::lock_guard<std::mutex> lock(_M_mutex);
+
+  copy* c;
+  if ((c = find(f)) == nullptr) {
+    return -1;
+  }
+
+  c->used = ++_M_tick;
+  size = c->size;
+
+  return fcntl(c->fd, F_DUPFD_CLOEXEC, 0);
+}
+
+void copies::put(const pcap::file& f, int fd, uint64_t size)
+{
+  std::lock_guard<std::mutex> lock(_M_mutex);
+
+  // Already decompressed by another thread meanwhile?
+  if (find(f)) {
+    return;
+  }
+
+  if (_M_used == _M_size) {
+    const size_t n = (_M_size > 0) ? _M_size * 2 : 64;
+
+    copy* array;
+    if ((array = static_cast<copy*>(
+                   realloc(_M_copies, n * sizeof(copy))
+                 )) == nullptr) {
+      return;
+    }
+
+    _M_copies = array;
+    _M_size = n;
+  }
+
+  copy* const c = &_M_copies[_M_used];
+  if ((c->fd = fcntl(fd, F_DUPFD_CLOEXEC, 0)) == -1) {
+    return;
+  }
+
+  c->device = f.device;
+  c->inode = f.inode;
+  c->filesize = f.filesize;
+  c->mtime = f.mtime;
+  c->size = size;
+  c->used = ++_M_tick;
+
+  _M_used++;
+  _M_total += size;
+
+  trim();
+}
+
+void copies::set_limit(uint64_t limit)
+{
+  std::lock_guard<std::mutex> lock(_M_mutex);
+
+  _M_limit = limit;
+  trim();
+}
+
+copies::copy* copies::find(const pcap::file& f)
+{
+  for (size_t i = 0; i < _M_used; i++) {
+    copy* const c = &_M_copies[i];
+
+    if ((c->device == f.device) &&
+        (c->inode == f.inode) &&
+        (c->filesize == f.filesize) &&
+        (c->mtime == f.mtime)) {
+      return c;
+    }
+  }
+
+  return nullptr;
+}
+
+void copies::trim()
+{
+  while (_M_total > _M_limit) {
+    size_t lru = 0;
+    for (size_t i = 1; i < _M_used; i++) {
+      if (_M_copies[i].used < _M_copies[lru].used) {
+        lru = i;
+      }
+    }
+
+    close(_M_copies[lru].fd);
+    _M_total -= _M_copies[lru].size;
+
+    _M_copies[lru] = _M_copies[--_M_used];
+  }
+}
+
+// Get a descriptor of the decompressed data of a file: its kept copy or a
+// new one.
+static int decompressed_data(const pcap::file& f, uint64_t& size)
+{
+  int fd;
+  if ((fd = kept.get(f, size)) == -1) {
+    if ((fd = decompress_file(f, size)) != -1) {
+      kept.put(f, fd, size);
+    }
+  }
+
+  return fd;
+}
+
+// Get the fields of the file header and the timestamp of the first packet
+// from the beginning of the decompressed data.
+static bool read_header(int fd, uint64_t size, pcap::file& f)
+{
+  uint8_t buf[pcap::minimum_size];
+  if ((size < sizeof(buf)) || (!io::pread_all(fd, buf, sizeof(buf), 0))) {
+    return false;
+  }
+
+  if (pcap::pcapng::parser::is_pcapng(buf, sizeof(buf))) {
+    // Set when the file is walked.
+    f.magic = static_cast<uint32_t>(pcap::magic::pcapng);
+    return true;
+  }
+
+  pcap::file hdr;
+  memset(&hdr, 0, sizeof(pcap::file));
+
+  // The data must not be compressed again.
+  if ((!pcap::get_first_timestamp(buf, hdr)) || (hdr.compressed)) {
+    return false;
+  }
+
+  f.valid = hdr.valid;
+  f.magic = hdr.magic;
+  f.snaplen = hdr.snaplen;
+  f.linktype = hdr.linktype;
+  f.timestamp = hdr.timestamp;
+
+  return true;
+}
+
+bool pcap::decompress(files& files, unsigned nworkers)
+{
+  const size_t count = files.count();
+
+  // Indices of the compressed files to walk.
+  size_t* compressed;
+  if ((compressed = static_cast<size_t*>(
+                      malloc((count > 0 ? count : 1) * sizeof(size_t))
+                    )) == nullptr) {
+    return false;
+  }
+
+  size_t ncompressed = 0;
+  for (size_t i = 0; i < count; i++) {
+    const file* const f = files.get(i);
+
+    if ((f->valid) && (f->compressed) && (!f->walked)) {
+      compressed[ncompressed++] = i;
+    }
+  }
+
+  // Each worker decompresses whole files and only touches their entries.
+  // The latest files go first: the copies kept at the end are the ones of
+  // the earliest files, which are read first.
+  util::parallel_for(
+    ncompressed,
+    nworkers,
+    [&](unsigned worker, size_t idx) {
+      file* const f = files.get(compressed[ncompressed - 1 - idx]);
+
+      uint64_t size;
+      int fd;
+      if ((fd = decompressed_data(*f, size)) != -1) {
+        // Only the beginning of the file was probed: use the header of the
+        // decompressed data.
+        const bool ret = (read_header(fd, size, *f)) &&
+                         (pcap::walk(fd, size, *f));
+
+        close(fd);
+
+        if ((ret) && (f->valid)) {
+          return true;
+        }
+
+        fprintf(stderr,
+                "Skipping '%s': not a valid PCAP file once decompressed.\n",
+                f->filename);
+      } else {
+        fprintf(stderr, "Skipping '%s': error decompressing.\n", f->filename);
+      }
+
+      f->valid = false;
+
+      return true;
+    }
+  );
+
+  free(compressed);
+
+  return true;
+}
+
+int pcap::open_data(const file& f, uint64_t& size)
+{
+  if (!f.compressed) {
+    size = f.filesize;
+    return open(f.filename, O_RDONLY);
+  }
+
+  int fd;
+  if ((fd = decompressed_data(f, size)) != -1) {
+    // The file might have been replaced since it was probed.
+    file hdr = f;
+    if ((read_header(fd, size, hdr)) &&
+        (hdr.magic == f.magic) &&
+        (hdr.linktype == f.linktype) &&
+        ((!f.walked) || (size >= f.end))) {
+      return fd;
+    }
+
+    close(fd);
+  }
+
+  return -1;
+}
+
+bool pcap::read_data(const file& f, void* buf, size_t len)
+{
+  int fd;
+  if ((fd = open(f.filename, O_RDONLY)) == -1) {
+    return false;
+  }
+
+  bool ret;
+  if (!f.compressed) {
+    ret = io::pread_all(fd, buf, len, 0);
+  } else {
+    io::decompressor decompressor;
+    ret = (decompressor.open(fd, f.compression)) &&
+          (decompressor.read(buf, len) == static_cast<ssize_t>(len));
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+void pcap::set_decompressed_limit(uint64_t limit)
+{
+  kept.set_limit(limit);
+}
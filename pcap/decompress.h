@@ -0,0 +1,42 @@
+#ifndef PCAP_DECOMPRESS_H
+#define PCAP_DECOMPRESS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/files.h"
+
+namespace pcap {
+  // Default maximum size of the decompressed copies kept (1 GiB).
+  static constexpr const uint64_t default_decompressed_limit = 1ull << 30;
+
+  // Walk the valid compressed files of the list which haven't been walked yet
+  // (the probe only decompressed their beginning), using `nworkers` threads.
+  // Each file is decompressed into a temporary file (see open_data()), its
+  // header is checked again and its packet headers are walked. Files which
+  // can't be decompressed or are not valid are marked as not valid, but are
+  // left in the list (so they can be saved in the index cache): compact it
+  // afterwards.
+  // Returns false if memory could not be allocated.
+  bool decompress(files& files, unsigned nworkers);
+
+  // Open the data of a PCAP file for reading and get its size: the file
+  // itself or, for a compressed file, a copy decompressed into an unlinked
+  // temporary file on disk (in $TMPDIR or /var/tmp). The copy is kept for
+  // the next reads of the file, within the limit set by
+  // set_decompressed_limit(), and released once it is not kept anymore and
+  // its last descriptor is closed. The decompressed data is checked against
+  // the file header found by the probe and the end of the last packet.
+  // Returns -1 on error.
+  int open_data(const file& f, uint64_t& size);
+
+  // Set the maximum total size of the decompressed copies kept between
+  // reads (the least recently used ones are released first; 0: a file is
+  // decompressed again every time it is read).
+  void set_decompressed_limit(uint64_t limit);
+
+  // Read the first `len` bytes of the data of a PCAP file (only the
+  // beginning of a compressed file is decompressed).
+  bool read_data(const file& f, void* buf, size_t len);
+}
+
+#endif // PCAP_DECOMPRESS_H
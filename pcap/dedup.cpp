@@ -0,0 +1,420 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pcap/dedup.h"
+#include "pcap/flow.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+#endif
+
+// Initial number of entries of the queue (power of 2, half the number of
+// slots of the table).
+static constexpr const size_t initial_capacity = 4096;
+
+// Stripes: 32 bytes (4 words), scrambled every 8 stripes.
+static constexpr const size_t stripe_size = 32;
+static constexpr const size_t stripes_per_block = 8;
+
+static constexpr const uint32_t prime32_1 = 0x9e3779b1u;
+static constexpr const uint64_t prime64_1 = 0x9e3779b185ebca87ull;
+static constexpr const uint64_t prime64_2 = 0xc2b2ae3d27d4eb4full;
+static constexpr const uint64_t prime64_3 = 0x165667b19e3779f9ull;
+static constexpr const uint64_t prime64_4 = 0x85ebca77c2b2ae63ull;
+
+// Secret: the stripe `s` of a block uses the words `s` to `s + 3`, the
+// scrambling the words 8 to 11.
+alignas(32) static const uint64_t secret[12] = {
+  0x48daecdda6ade12eull,
+  0x220f842588879be9ull,
+  0x358368c8c9d2e94eull,
+  0x6c8de60241041bd8ull,
+  0xdbcf42c89eb5cfe4ull,
+  0x656962c60ad28ce8ull,
+  0x1518534951c1c588ull,
+  0xad7fe83e526073e7ull,
+  0x72c0d8f8a92f762full,
+  0x96e278eae9578274ull,
+  0xc7e048634bd7a761ull,
+  0xadb90de7d178d685ull
+};
+
+// Accumulate function (`nstripes` whole stripes).
+typedef void (*accumulate_function)(uint64_t*, const uint8_t*, size_t);
+
+#if defined(__SIZEOF_INT128__)
+  __extension__ typedef unsigned __int128 uint128;
+#endif
+
+// Fold of the 128-bit product of two words.
+static inline uint64_t mul_fold(uint64_t a, uint64_t b)
+{
+#if defined(__SIZEOF_INT128__)
+  const uint128 product = static_cast<uint128>(a) * b;
+  return static_cast<uint64_t>(product) ^
+         static_cast<uint64_t>(product >> 64);
+#else
+  // Four 32x32->64-bit products.
+  const uint64_t lo_lo = (a & 0xffffffff) * (b & 0xffffffff);
+  const uint64_t hi_lo = (a >> 32) * (b & 0xffffffff);
+  const uint64_t lo_hi = (a & 0xffffffff) * (b >> 32);
+  const uint64_t hi_hi = (a >> 32) * (b >> 32);
+
+  const uint64_t cross = (lo_lo >> 32) + (hi_lo & 0xffffffff) + lo_hi;
+  const uint64_t upper = (hi_lo >> 32) + (cross >> 32) + hi_hi;
+  const uint64_t lower = (cross << 32) | (lo_lo & 0xffffffff);
+
+  return lower ^ upper;
+#endif
+}
+
+static inline void stripe_scalar(uint64_t* acc,
+                                 const uint8_t* ptr,
+                                 const uint64_t* key)
+{
+  uint64_t words[4];
+  memcpy(words, ptr, sizeof(words));
+
+  for (unsigned i = 0; i < 4; i++) {
+    const uint64_t dk = words[i] ^ key[i];
+
+    acc[i ^ 1] += words[i];
+    acc[i] += (dk & 0xffffffff) * (dk >> 32);
+  }
+}
+
+static inline void scramble_scalar(uint64_t* acc)
+{
+  for (unsigned i = 0; i < 4; i++) {
+    acc[i] = (acc[i] ^ (acc[i] >> 47) ^ secret[8 + i]) * prime32_1;
+  }
+}
+
+static void accumulate_scalar(uint64_t* acc,
+                              const uint8_t* ptr,
+                              size_t nstripes)
+{
+  for (size_t i = 0; i < nstripes; i++) {
+    const size_t s = i % stripes_per_block;
+
+    stripe_scalar(acc, ptr + i * stripe_size, secret + s);
+
+    if (s == stripes_per_block - 1) {
+      scramble_scalar(acc);
+    }
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("avx2")))
+  static void accumulate_avx2(uint64_t* acc,
+                              const uint8_t* ptr,
+                              size_t nstripes)
+  {
+    const __m256i prime = _mm256_set1_epi32(prime32_1);
+    const __m256i scramble_key = _mm256_load_si256(
+                                   reinterpret_cast<const __m256i*>(secret + 8)
+                                 );
+
+    __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(acc));
+
+    for (size_t i = 0; i < nstripes; i++) {
+      const size_t s = i % stripes_per_block;
+
+      const __m256i data = _mm256_loadu_si256(
+                             reinterpret_cast<const __m256i*>(
+                               ptr + i * stripe_size
+                             )
+                           );
+
+      const __m256i key = _mm256_loadu_si256(
+                            reinterpret_cast<const __m256i*>(secret + s)
+                          );
+
+      // Low half times high half of each word mixed with the key, plus the
+      // neighbouring word.
+      const __m256i dk = _mm256_xor_si256(data, key);
+      const __m256i product = _mm256_mul_epu32(dk, _mm256_srli_epi64(dk, 32));
+      const __m256i swapped = _mm256_shuffle_epi32(data,
+                                                   _MM_SHUFFLE(1, 0, 3, 2));
+
+      a = _mm256_add_epi64(a, _mm256_add_epi64(product, swapped));
+
+      if (s == stripes_per_block - 1) {
+        // 64-bit multiply by a 32-bit prime out of two 32x32 multiplies.
+        const __m256i x = _mm256_xor_si256(
+                            _mm256_xor_si256(a, _mm256_srli_epi64(a, 47)),
+                            scramble_key
+                          );
+
+        const __m256i lo = _mm256_mul_epu32(x, prime);
+        const __m256i hi = _mm256_mul_epu32(_mm256_srli_epi64(x, 32), prime);
+
+        a = _mm256_add_epi64(lo, _mm256_slli_epi64(hi, 32));
+      }
+    }
+
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(acc), a);
+  }
+#endif // defined(__x86_64__) || defined(__i386__)
+
+static accumulate_function select()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    return accumulate_avx2;
+  }
+#endif
+
+  return accumulate_scalar;
+}
+
+pcap::deduplicator::~deduplicator()
+{
+  free(_M_slots);
+  free(_M_queue);
+}
+
+bool pcap::deduplicator::init(nanoseconds window, bool ignore_volatile)
+{
+  uint64_t* slots;
+  entry* queue;
+  if ((slots = static_cast<uint64_t*>(
+                 calloc(2 * initial_capacity, sizeof(uint64_t))
+               )) != nullptr) {
+    if ((queue = static_cast<entry*>(
+                   malloc(initial_capacity * sizeof(entry))
+                 )) != nullptr) {
+      free(_M_slots);
+      free(_M_queue);
+
+      _M_slots = slots;
+      _M_mask = 2 * initial_capacity - 1;
+
+      _M_queue = queue;
+      _M_capacity = initial_capacity;
+      _M_head = 0;
+      _M_count = 0;
+
+      _M_window = window;
+      _M_ignore_volatile = ignore_volatile;
+
+      return true;
+    }
+
+    free(slots);
+  }
+
+  return false;
+}
+
+bool pcap::deduplicator::duplicate(uint32_t linktype,
+                                   const void* data,
+                                   uint32_t caplen,
+                                   uint32_t len,
+                                   nanoseconds timestamp)
+{
+  // Expire the packets which are out of the window.
+  while (_M_count > 0) {
+    const entry& e = _M_queue[_M_head];
+    if (timestamp < e.timestamp + _M_window) {
+      break;
+    }
+
+    remove(e.hash);
+
+    _M_head = (_M_head + 1) & (_M_capacity - 1);
+    _M_count--;
+  }
+
+  // 0 marks the empty slots.
+  uint64_t h = hash(linktype, static_cast<const uint8_t*>(data), caplen, len);
+  if (h == 0) {
+    h = 1;
+  }
+
+  size_t idx = find(h);
+  if (_M_slots[idx] == h) {
+    return true;
+  }
+
+  if (_M_count == _M_capacity) {
+    // If the table can't grow, the packet is kept without being
+    // remembered.
+    if (!grow()) {
+      return false;
+    }
+
+    idx = find(h);
+  }
+
+  _M_slots[idx] = h;
+
+  entry* const e = &_M_queue[(_M_head + _M_count) & (_M_capacity - 1)];
+  e->hash = h;
+  e->timestamp = timestamp;
+
+  _M_count++;
+
+  return false;
+}
+
+// Hash of `len` bytes accumulating the whole stripes with `fn`.
+static uint64_t hash_with(accumulate_function fn,
+                          const void* data,
+                          size_t len,
+                          uint64_t seed)
+{
+  const uint8_t* const ptr = static_cast<const uint8_t*>(data);
+
+  uint64_t acc[4] = {
+    prime64_1 + seed,
+    prime64_2 - seed,
+    prime64_3 + seed,
+    prime64_4 - seed
+  };
+
+  // Whole stripes.
+  const size_t nstripes = len / stripe_size;
+  fn(acc, ptr, nstripes);
+
+  // Last stripe, zero-padded.
+  const size_t rem = len % stripe_size;
+  if (rem > 0) {
+    uint8_t last[stripe_size];
+    memcpy(last, ptr + nstripes * stripe_size, rem);
+    memset(last + rem, 0, stripe_size - rem);
+
+    stripe_scalar(acc, last, secret + nstripes % stripes_per_block);
+  }
+
+  // Merge the accumulators with the length.
+  uint64_t h = len * prime64_1;
+  h += mul_fold(acc[0] ^ secret[1], acc[1] ^ secret[2]);
+  h += mul_fold(acc[2] ^ secret[3], acc[3] ^ secret[4]);
+
+  // Avalanche.
+  h ^= h >> 37;
+  h *= prime64_3;
+  h ^= h >> 32;
+
+  return h;
+}
+
+uint64_t pcap::deduplicator::hash(const void* data, size_t len, uint64_t seed)
+{
+  static const accumulate_function fn = select();
+
+  return hash_with(fn, data, len, seed);
+}
+
+uint64_t pcap::deduplicator::hash_scalar(const void* data,
+                                         size_t len,
+                                         uint64_t seed)
+{
+  return hash_with(accumulate_scalar, data, len, seed);
+}
+
+uint64_t pcap::deduplicator::hash(uint32_t linktype,
+                                  const uint8_t* data,
+                                  uint32_t caplen,
+                                  uint32_t len) const
+{
+  size_t offset;
+  unsigned version;
+  if ((_M_ignore_volatile) &&
+      (ip_header(linktype, data, caplen, offset, version))) {
+    // Copy the bytes up to the IPv4 header checksum (or the IPv6 hop limit)
+    // with the volatile fields zeroed and hash them first.
+    uint8_t head[64];
+    const size_t n = offset + ((version == 4) ? 12 : 8);
+
+    if ((n <= caplen) && (n <= sizeof(head))) {
+      memcpy(head, data, n);
+
+      if (version == 4) {
+        head[offset + 8] = 0;
+        head[offset + 10] = 0;
+        head[offset + 11] = 0;
+      } else {
+        head[offset + 7] = 0;
+      }
+
+      return hash(data + n, caplen - n, hash(head, n, len));
+    }
+  }
+
+  return hash(data, caplen, len);
+}
+
+size_t pcap::deduplicator::find(uint64_t h) const
+{
+  size_t idx = h & _M_mask;
+  while ((_M_slots[idx] != 0) && (_M_slots[idx] != h)) {
+    idx = (idx + 1) & _M_mask;
+  }
+
+  return idx;
+}
+
+void pcap::deduplicator::remove(uint64_t h)
+{
+  size_t idx = find(h);
+  if (_M_slots[idx] == 0) {
+    return;
+  }
+
+  // Shift back the following entries of the cluster which are not at or
+  // after their home slot anymore.
+  size_t next = idx;
+  while (_M_slots[next = (next + 1) & _M_mask] != 0) {
+    const size_t home = _M_slots[next] & _M_mask;
+
+    const bool in_place = (idx <= next) ? ((idx < home) && (home <= next)) :
+                                          ((idx < home) || (home <= next));
+
+    if (!in_place) {
+      _M_slots[idx] = _M_slots[next];
+      idx = next;
+    }
+  }
+
+  _M_slots[idx] = 0;
+}
+
+bool pcap::deduplicator::grow()
+{
+  const size_t capacity = 2 * _M_capacity;
+
+  uint64_t* slots;
+  entry* queue;
+  if ((slots = static_cast<uint64_t*>(
+                 calloc(2 * capacity, sizeof(uint64_t))
+               )) == nullptr) {
+    return false;
+  }
+
+  if ((queue = static_cast<entry*>(malloc(capacity * sizeof(entry)))) ==
+      nullptr) {
+    free(slots);
+    return false;
+  }
+
+  // Move the entries to the start of the new queue and rebuild the table.
+  free(_M_slots);
+  _M_slots = slots;
+  _M_mask = 2 * capacity - 1;
+
+  for (size_t i = 0; i < _M_count; i++) {
+    queue[i] = _M_queue[(_M_head + i) & (_M_capacity - 1)];
+    _M_slots[find(queue[i].hash)] = queue[i].hash;
+  }
+
+  free(_M_queue);
+  _M_queue = queue;
+  _M_capacity = capacity;
+  _M_head = 0;
+
+  return true;
+}
@@ -0,0 +1,91 @@
+#ifndef PCAP_DEDUP_H
+#define PCAP_DEDUP_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/pcap.h"
+
+namespace pcap {
+  // Detector of duplicate packets (the same packet captured by several
+  // taps, a few microseconds apart).
+  // Each packet is reduced to a 64-bit hash of its length and captured
+  // bytes (optionally with the TTL or hop limit and the IPv4 header checksum
+  // zeroed, as they change between the hops of a routed path), looked up in
+  // an open-addressing table (linear probing) of the hashes of the packets
+  // seen during the last `window` nanoseconds. The packets are expected in
+  // timestamp order (merged stream): the hashes are also queued in the
+  // order they were inserted and expired from the front of the queue,
+  // removing them from the table by backward shifting, so the memory used
+  // is bounded by the number of packets in the window.
+  class deduplicator {
+    public:
+      // Constructor.
+      deduplicator() = default;
+
+      // Destructor.
+      ~deduplicator();
+
+      // Initialize.
+      bool init(nanoseconds window, bool ignore_volatile);
+
+      // Is the packet a duplicate of a packet seen during the window?
+      // Otherwise, it is remembered.
+      bool duplicate(uint32_t linktype,
+                     const void* data,
+                     uint32_t caplen,
+                     uint32_t len,
+                     nanoseconds timestamp);
+
+      // 64-bit hash of `len` bytes.
+      // The bytes are accumulated in 32-byte stripes like xxh3 does (a
+      // 32x32->64-bit multiply of the halves of each word mixed with a
+      // secret, plus the word itself), four words per instruction if the
+      // CPU supports AVX2 (selected at run time); both give the same result.
+      static uint64_t hash(const void* data, size_t len, uint64_t seed);
+
+      // Same hash, never using AVX2 (reference of the AVX2 code).
+      static uint64_t hash_scalar(const void* data, size_t len, uint64_t seed);
+
+    private:
+      // Hash and timestamp of a packet.
+      struct entry {
+        uint64_t hash;
+        nanoseconds timestamp;
+      };
+
+      // Open-addressing table (0: empty slot).
+      uint64_t* _M_slots = nullptr;
+      size_t _M_mask = 0;
+
+      // Queue of the entries in the table, in insertion order (circular
+      // buffer).
+      entry* _M_queue = nullptr;
+      size_t _M_capacity = 0;
+      size_t _M_head = 0;
+      size_t _M_count = 0;
+
+      nanoseconds _M_window = 0;
+      bool _M_ignore_volatile = false;
+
+      // Hash of a packet.
+      uint64_t hash(uint32_t linktype,
+                    const uint8_t* data,
+                    uint32_t caplen,
+                    uint32_t len) const;
+
+      // Find slot of `h` (or the empty slot where it would go).
+      size_t find(uint64_t h) const;
+
+      // Remove `h` from the table.
+      void remove(uint64_t h);
+
+      // Grow the table and the queue.
+      bool grow();
+
+      // Disable copy constructor and assignment operator.
+      deduplicator(const deduplicator&) = delete;
+      deduplicator& operator=(const deduplicator&) = delete;
+  };
+}
+
+#endif // PCAP_DEDUP_H
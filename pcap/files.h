@@ -0,0 +1,202 @@
+#ifndef PCAP_FILES_H
+#define PCAP_FILES_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcap/pcap.h"
+#include "io/compressor.h"
+
+namespace pcap {
+  // PCAP (or pcapng) file.
+  struct file {
+    // File name.
+    char* filename;
+
+    // File size.
+    uint64_t filesize;
+
+    // Device and inode numbers and modification time (nanoseconds since
+    // the Epoch).
+    uint64_t device;
+    uint64_t inode;
+    int64_t mtime;
+
+    // Timestamp of the first packet (nanoseconds).
+    uint64_t timestamp;
+
+    // Timestamp of the last packet (nanoseconds), number of packets, end
+    // of the last complete packet and size of the packets once written to a
+    // PCAP file and to a pcapng file (only if `walked` is true).
+    uint64_t last_timestamp;
+    uint64_t packets;
+    uint64_t end;
+    uint64_t records_size;
+    uint64_t blocks_size;
+
+    // Fields of the PCAP file header (pcapng files: `magic::pcapng`, link
+    // type of the first interface and largest snapshot length).
+    uint32_t magic;
+    uint32_t snaplen;
+    uint32_t linktype;
+
+    // Is it a valid PCAP file?
+    bool valid;
+
+    // Have the packet headers been walked?
+    bool walked;
+
+    // Is the file compressed (its data is read with pcap::open_data())?
+    bool compressed;
+    io::compressor::format compression;
+
+    // Offset of the first packet record of a PCAP file and time window
+    // [window_start, window_end) of the packets of a pcapng file (the
+    // packets outside of the time window are skipped).
+    uint64_t begin;
+    uint64_t window_start;
+    uint64_t window_end;
+
+    // Select all the packets.
+    void select_all()
+    {
+      begin = sizeof(pcap_file_header);
+      window_start = 0;
+      window_end = UINT64_MAX;
+    }
+
+    // End of the packet data (a truncated last packet is excluded if the
+    // packet headers have been walked).
+    uint64_t data_end() const
+    {
+      return walked ? end : filesize;
+    }
+
+    // Size of the packets once written to a PCAP file (pcapng files are
+    // always walked).
+    uint64_t output_size() const
+    {
+      return walked ? records_size : filesize - begin;
+    }
+  };
+
+  // List of PCAP files.
+  class files {
+    public:
+      // Constructor.
+      files() = default;
+
+      // Destructor.
+      ~files()
+      {
+        if (_M_files) {
+          for (; _M_used > 0; _M_used--) {
+            free(_M_files[_M_used - 1].filename);
+          }
+
+          free(_M_files);
+        }
+      }
+
+      // Add PCAP file (`info` holds everything but the file name).
+      bool add(const char* filename, const file& info)
+      {
+        // Allocate new PCAP files (if needed).
+        if (allocate()) {
+          char* f;
+          if ((f = strdup(filename)) != nullptr) {
+            file* entry = &_M_files[_M_used++];
+
+            *entry = info;
+            entry->filename = f;
+
+            return true;
+          }
+        }
+
+        return false;
+      }
+
+      // Sort.
+      void sort()
+      {
+        qsort(_M_files, _M_used, sizeof(file), compare);
+      }
+
+      // Get number of PCAP files.
+      size_t count() const
+      {
+        return _M_used;
+      }
+
+      // Get PCAP file.
+      const file* get(size_t idx) const
+      {
+        return (idx < _M_used) ? &_M_files[idx] : nullptr;
+      }
+
+      file* get(size_t idx)
+      {
+        return (idx < _M_used) ? &_M_files[idx] : nullptr;
+      }
+
+      // Remove the files which are not valid.
+      void compact()
+      {
+        size_t used = 0;
+        for (size_t i = 0; i < _M_used; i++) {
+          if (_M_files[i].valid) {
+            _M_files[used++] = _M_files[i];
+          } else {
+            free(_M_files[i].filename);
+          }
+        }
+
+        _M_used = used;
+      }
+
+    private:
+      // PCAP files.
+      file* _M_files = nullptr;
+      size_t _M_size = 0;
+      size_t _M_used = 0;
+
+      // Allocate.
+      bool allocate()
+      {
+        if (_M_used < _M_size) {
+          return true;
+        } else {
+          size_t size = (_M_size > 0) ? _M_size * 2 : 1024;
+
+          file* files;
+          if ((files = static_cast<file*>(
+                         realloc(_M_files, size * sizeof(file))
+                       )) != nullptr) {
+            _M_files = files;
+            _M_size = size;
+
+            return true;
+          } else {
+            return false;
+          }
+        }
+      }
+
+      static int compare(const void* p1, const void* p2)
+      {
+        const file* const f1 = static_cast<const file*>(p1);
+        const file* const f2 = static_cast<const file*>(p2);
+
+        if (f1->timestamp < f2->timestamp) {
+          return -1;
+        } else if (f1->timestamp > f2->timestamp) {
+          return 1;
+        } else {
+          return 0;
+        }
+      }
+  };
+}
+
+#endif // PCAP_FILES_H
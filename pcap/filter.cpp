@@ -0,0 +1,1743 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <arpa/inet.h>
+#include <new>
+#include "pcap/filter.h"
+
+// Link types.
+static constexpr const uint32_t linktype_ethernet = 1;
+static constexpr const uint32_t linktype_raw = 101;
+static constexpr const uint32_t linktype_linux_sll = 113;
+static constexpr const uint32_t linktype_ipv4 = 228;
+static constexpr const uint32_t linktype_ipv6 = 229;
+static constexpr const uint32_t linktype_linux_sll2 = 276;
+
+// Ethertypes.
+static constexpr const uint32_t ethertype_ipv4 = 0x0800;
+static constexpr const uint32_t ethertype_arp = 0x0806;
+static constexpr const uint32_t ethertype_ipv6 = 0x86dd;
+
+// Protocols.
+static constexpr const uint8_t protocol_icmp = 1;
+static constexpr const uint8_t protocol_tcp = 6;
+static constexpr const uint8_t protocol_udp = 17;
+static constexpr const uint8_t protocol_icmp6 = 58;
+static constexpr const uint8_t protocol_sctp = 132;
+
+// Address families (bits).
+static constexpr const unsigned family_ipv4 = 1;
+static constexpr const unsigned family_ipv6 = 2;
+
+// Protocols of the port primitives (bits).
+static constexpr const unsigned ports_tcp = 1;
+static constexpr const unsigned ports_udp = 2;
+static constexpr const unsigned ports_sctp = 4;
+
+// Return value of the programs for the packets accepted (whole packet).
+static constexpr const uint32_t accept_packet = 262144;
+
+// Label which is not used.
+static constexpr const uint32_t no_label = UINT32_MAX;
+
+namespace {
+  // Types of nodes.
+  enum class node_type {
+    and_,
+    or_,
+    not_,
+    ip,
+    ip6,
+    arp,
+    protocol,
+    host,
+    net,
+    port,
+    length
+  };
+
+  // Endpoints of the host, net and port primitives.
+  enum class direction {
+    src,
+    dst,
+    src_or_dst,
+    src_and_dst
+  };
+
+  // Comparisons of the length primitives.
+  enum class comparison {
+    eq,
+    ne,
+    lt,
+    le,
+    gt,
+    ge
+  };
+
+  // Protocol qualifiers.
+  enum class qualifier {
+    none,
+    ip,
+    ip6,
+    tcp,
+    udp,
+    sctp
+  };
+
+  // Type qualifiers.
+  enum class value_type {
+    none,
+    host,
+    net,
+    port,
+    portrange
+  };
+
+  // Qualifiers of a primitive.
+  struct qualifiers {
+    qualifier proto;
+    bool has_dir;
+    direction dir;
+    value_type type;
+  };
+
+  // Tokens.
+  enum class token {
+    end,
+    word,
+    lparen,
+    rparen,
+    not_,
+    and_,
+    or_,
+    relop
+  };
+}
+
+struct pcap::filter::node {
+  node_type type;
+
+  // Operands (`and_`, `or_` and `not_`).
+  size_t left;
+  size_t right;
+
+  // Address families (`protocol`, `host`, `net` and `port`).
+  unsigned families;
+
+  // Endpoints (`host`, `net` and `port`).
+  direction dir;
+
+  // Protocol number (`protocol`) and protocols (`port`).
+  uint8_t protocol;
+  unsigned protocols;
+
+  // Address and prefix length (`host` and `net`).
+  uint8_t addr[16];
+  unsigned prefix;
+
+  // Range of ports (`port`) and length (`length`).
+  comparison cmp;
+  uint32_t lo;
+  uint32_t hi;
+};
+
+class pcap::filter::parser {
+  public:
+    // Constructor.
+    parser(filter& f, const char* expr, char* error, size_t size)
+      : _M_filter(f),
+        _M_ptr(expr),
+        _M_error(error),
+        _M_errsize(size)
+    {
+    }
+
+    // Parse the expression into the tree of the filter.
+    bool parse()
+    {
+      size_t idx;
+      if ((next()) && (expression(idx))) {
+        if (_M_token == token::end) {
+          return true;
+        }
+
+        return fail("syntax error near '%s'", _M_text);
+      }
+
+      return false;
+    }
+
+  private:
+    filter& _M_filter;
+
+    // Position in the expression.
+    const char* _M_ptr;
+
+    // Error message.
+    char* _M_error;
+    size_t _M_errsize;
+
+    // Current token.
+    token _M_token = token::end;
+    char _M_text[128];
+    comparison _M_cmp = comparison::eq;
+
+    // Qualifiers of the previous primitive.
+    qualifiers _M_last;
+    bool _M_has_last = false;
+
+    // Parser state (for a lookahead).
+    struct state {
+      const char* ptr;
+      token tok;
+      char text[128];
+      comparison cmp;
+    };
+
+    void save(state& s) const
+    {
+      s.ptr = _M_ptr;
+      s.tok = _M_token;
+      memcpy(s.text, _M_text, sizeof(_M_text));
+      s.cmp = _M_cmp;
+    }
+
+    void restore(const state& s)
+    {
+      _M_ptr = s.ptr;
+      _M_token = s.tok;
+      memcpy(_M_text, s.text, sizeof(_M_text));
+      _M_cmp = s.cmp;
+    }
+
+    // Read the next token.
+    bool next();
+
+    // expression: term { (and | or) term }
+    bool expression(size_t& idx);
+
+    // term: not term | '(' expression ')' | primitive
+    bool term(size_t& idx);
+
+    // Primitive.
+    bool primitive(size_t& idx);
+
+    // Primitive with a value.
+    bool value(const qualifiers& q, size_t& idx);
+
+    // Is the current token the word `w`?
+    bool is(const char* w) const
+    {
+      return (_M_token == token::word) && (strcmp(_M_text, w) == 0);
+    }
+
+    // Is the current token a keyword?
+    bool keyword() const;
+
+    // Parse a number not greater than `max`.
+    bool number(const char* s, uint32_t max, uint32_t& n) const;
+
+    // Parse a protocol (number or name).
+    bool protocol(const char* s, uint8_t& proto) const;
+
+    // Parse an address; `family` is set to its family.
+    bool address(const char* s, uint8_t* addr, unsigned& family) const;
+
+    // Add node.
+    bool add(const node& n, size_t& idx);
+
+    // Add operator node.
+    bool add(node_type type, size_t left, size_t right, size_t& idx)
+    {
+      node n;
+      memset(&n, 0, sizeof(node));
+      n.type = type;
+      n.left = left;
+      n.right = right;
+
+      return add(n, idx);
+    }
+
+    // Set error message; returns false.
+    __attribute__((format(printf, 2, 3)))
+    bool fail(const char* format, ...);
+};
+
+class pcap::filter::generator {
+  public:
+    // Constructor.
+    generator(const filter& f, uint32_t linktype);
+
+    // Destructor.
+    ~generator();
+
+    // Generate the program (the caller frees the instructions).
+    // Returns false if the link type is not supported or on error.
+    bool generate(bpf::instruction*& insns, size_t& count);
+
+  private:
+    const filter& _M_filter;
+
+    // Link layer: offset of the ethertype (if `_M_version` is false) or IP
+    // version in the high nibble of the first byte (raw IP), and offset of
+    // the network header.
+    bool _M_supported = true;
+    bool _M_version = false;
+    uint32_t _M_ethertype = 0;
+    uint32_t _M_l3 = 0;
+
+    // Instructions and labels of their targets.
+    bpf::instruction* _M_insns = nullptr;
+    uint32_t* _M_jt = nullptr;
+    uint32_t* _M_jf = nullptr;
+    size_t _M_size = 0;
+    size_t _M_count = 0;
+
+    // Positions of the labels.
+    size_t* _M_labels = nullptr;
+    size_t _M_lsize = 0;
+    size_t _M_nlabels = 0;
+
+    bool _M_failed = false;
+
+    // New label.
+    uint32_t label();
+
+    // Place label at the next instruction.
+    void place(uint32_t l);
+
+    // Emit instruction.
+    void emit(uint16_t code, uint32_t k);
+
+    // Emit jump.
+    void jump(uint16_t code, uint32_t k, uint32_t t, uint32_t f);
+
+    // Emit unconditional jump.
+    void always(uint32_t target);
+
+    // Load (`code`) at `offset`, mask (if not 0xffffffff) and compare with
+    // `value`.
+    void test(uint16_t code,
+              uint32_t offset,
+              uint32_t mask,
+              uint16_t op,
+              uint32_t value,
+              uint32_t t,
+              uint32_t f);
+
+    // Generate the code of a node: jump to `t` if it matches, to `f`
+    // otherwise.
+    void generate(size_t idx, uint32_t t, uint32_t f);
+
+    // Is the packet of the address family?
+    void family(unsigned family, uint32_t t, uint32_t f);
+
+    // Generate `ipv4` for IPv4 packets and `ipv6` for IPv6 packets (of the
+    // families).
+    template<typename IPv4, typename IPv6>
+    void ip(unsigned families,
+            IPv4 ipv4,
+            IPv6 ipv6,
+            uint32_t t,
+            uint32_t f);
+
+    // Combine the tests of the source (`endpoint(true, ...)`) and the
+    // destination.
+    template<typename Endpoint>
+    void endpoints(direction dir, Endpoint endpoint, uint32_t t, uint32_t f);
+
+    // Compare the address at `offset` (`len` bytes) with the one of the node
+    // (prefix of `prefix` bits).
+    void address(uint32_t offset,
+                 const uint8_t* addr,
+                 size_t len,
+                 unsigned prefix,
+                 uint32_t t,
+                 uint32_t f);
+
+    // Is the transport protocol at `offset` one of `protocols`?
+    void protocols(uint32_t offset,
+                   unsigned protocols,
+                   uint32_t t,
+                   uint32_t f);
+
+    // Is the port loaded by `code` at `offset` in [lo, hi]?
+    void port(uint16_t code,
+              uint32_t offset,
+              uint32_t lo,
+              uint32_t hi,
+              uint32_t t,
+              uint32_t f);
+
+    // Disable copy constructor and assignment operator.
+    generator(const generator&) = delete;
+    generator& operator=(const generator&) = delete;
+};
+
+pcap::filter::~filter()
+{
+  clear();
+}
+
+bool pcap::filter::compile(const char* expr, char* error, size_t size)
+{
+  clear();
+
+  parser p(*this, expr, error, size);
+  if (p.parse()) {
+    if (_M_used > 0) {
+      return true;
+    }
+
+    snprintf(error, size, "empty filter");
+  }
+
+  clear();
+
+  return false;
+}
+
+bool pcap::filter::supports(uint32_t linktype)
+{
+  switch (linktype) {
+    case linktype_ethernet:
+    case linktype_raw:
+    case linktype_linux_sll:
+    case linktype_ipv4:
+    case linktype_ipv6:
+    case linktype_linux_sll2:
+      return true;
+    default:
+      return false;
+  }
+}
+
+bool pcap::filter::dump(uint32_t linktype, FILE* out)
+{
+  const compiled* const c = get(linktype);
+  if (!c->program) {
+    return false;
+  }
+
+  for (size_t i = 0; i < c->count; i++) {
+    const bpf::instruction& insn = c->insns[i];
+    const uint16_t cls = insn.code & 0x07;
+
+    char operand[64];
+    const char* name;
+
+    switch (cls) {
+      case bpf::class_ld:
+      case bpf::class_ldx:
+        {
+          const uint16_t size = insn.code & 0x18;
+          const uint16_t mode = insn.code & 0xe0;
+
+          if (cls == bpf::class_ld) {
+            name = (mode == bpf::mode_abs) || (mode == bpf::mode_ind) ?
+                     ((size == bpf::size_h) ? "ldh" :
+                      (size == bpf::size_b) ? "ldb" :
+                                              "ld") :
+                     "ld";
+          } else {
+            name = (mode == bpf::mode_msh) ? "ldxb" : "ldx";
+          }
+
+          switch (mode) {
+            case bpf::mode_abs:
+              snprintf(operand, sizeof(operand), "[%u]", insn.k);
+              break;
+            case bpf::mode_ind:
+              snprintf(operand, sizeof(operand), "[x + %u]", insn.k);
+              break;
+            case bpf::mode_mem:
+              snprintf(operand, sizeof(operand), "M[%u]", insn.k);
+              break;
+            case bpf::mode_len:
+              snprintf(operand, sizeof(operand), "#pktlen");
+              break;
+            case bpf::mode_msh:
+              snprintf(operand, sizeof(operand), "4*([%u]&0xf)", insn.k);
+              break;
+            default:
+              snprintf(operand, sizeof(operand), "#0x%x", insn.k);
+              break;
+          }
+        }
+
+        break;
+      case bpf::class_st:
+      case bpf::class_stx:
+        name = (cls == bpf::class_st) ? "st" : "stx";
+        snprintf(operand, sizeof(operand), "M[%u]", insn.k);
+        break;
+      case bpf::class_alu:
+        {
+          static const char* const names[] = {
+            "add", "sub", "mul", "div", "or", "and", "lsh", "rsh", "neg",
+            "mod", "xor"
+          };
+
+          name = names[(insn.code >> 4) & 0x0f];
+
+          if ((insn.code & 0xf0) == bpf::op_neg) {
+            operand[0] = 0;
+          } else if (insn.code & bpf::src_x) {
+            snprintf(operand, sizeof(operand), "x");
+          } else {
+            snprintf(operand, sizeof(operand), "#0x%x", insn.k);
+          }
+        }
+
+        break;
+      case bpf::class_jmp:
+        {
+          static const char* const names[] = {
+            "ja", "jeq", "jgt", "jge", "jset"
+          };
+
+          name = names[(insn.code >> 4) & 0x0f];
+
+          if ((insn.code & 0xf0) == bpf::op_ja) {
+            snprintf(operand, sizeof(operand), "%zu", i + 1 + insn.k);
+          } else {
+            char value[16];
+            if (insn.code & bpf::src_x) {
+              snprintf(value, sizeof(value), "x");
+            } else {
+              snprintf(value, sizeof(value), "#0x%x", insn.k);
+            }
+
+            snprintf(operand,
+                     sizeof(operand),
+                     "%s jt %zu jf %zu",
+                     value,
+                     i + 1 + insn.jt,
+                     i + 1 + insn.jf);
+          }
+        }
+
+        break;
+      case bpf::class_ret:
+        name = "ret";
+
+        if (insn.code & bpf::src_a) {
+          snprintf(operand, sizeof(operand), "a");
+        } else {
+          snprintf(operand, sizeof(operand), "#%u", insn.k);
+        }
+
+        break;
+      default:
+        name = (insn.code & bpf::op_txa) ? "txa" : "tax";
+        operand[0] = 0;
+        break;
+    }
+
+    fprintf(out, "(%03zu) %-8s %s\n", i, name, operand);
+  }
+
+  return true;
+}
+
+const pcap::filter::compiled* pcap::filter::get(uint32_t linktype)
+{
+  // Returned if the program can't be stored.
+  static const compiled none = {0, nullptr, 0, nullptr};
+
+  for (size_t i = 0; i < _M_nprograms; i++) {
+    if (_M_programs[i].linktype == linktype) {
+      return &_M_programs[i];
+    }
+  }
+
+  compiled* programs;
+  if ((programs = static_cast<compiled*>(
+                    realloc(_M_programs,
+                            (_M_nprograms + 1) * sizeof(compiled))
+                  )) == nullptr) {
+    return &none;
+  }
+
+  _M_programs = programs;
+
+  compiled* const c = &_M_programs[_M_nprograms++];
+  c->linktype = linktype;
+  c->insns = nullptr;
+  c->count = 0;
+  c->program = nullptr;
+
+  generator g(*this, linktype);
+  if (g.generate(c->insns, c->count)) {
+    if (((c->program = new (std::nothrow) bpf::program()) != nullptr) &&
+        (!c->program->load(c->insns, c->count))) {
+      delete c->program;
+      c->program = nullptr;
+    }
+  }
+
+  // The array might have moved.
+  _M_last = nullptr;
+
+  return c;
+}
+
+void pcap::filter::clear()
+{
+  free(_M_nodes);
+  _M_nodes = nullptr;
+  _M_size = 0;
+  _M_used = 0;
+
+  for (size_t i = 0; i < _M_nprograms; i++) {
+    free(_M_programs[i].insns);
+    delete _M_programs[i].program;
+  }
+
+  free(_M_programs);
+  _M_programs = nullptr;
+  _M_nprograms = 0;
+
+  _M_last = nullptr;
+}
+
+bool pcap::filter::parser::next()
+{
+  while ((*_M_ptr == ' ') || (*_M_ptr == '\t') || (*_M_ptr == '\n')) {
+    _M_ptr++;
+  }
+
+  const char* const start = _M_ptr;
+
+  switch (*_M_ptr) {
+    case 0:
+      _M_token = token::end;
+      _M_text[0] = 0;
+      return true;
+    case '(':
+      _M_token = token::lparen;
+      _M_ptr++;
+      break;
+    case ')':
+      _M_token = token::rparen;
+      _M_ptr++;
+      break;
+    case '&':
+    case '|':
+      if (_M_ptr[1] != _M_ptr[0]) {
+        return fail("syntax error near '%s'", _M_ptr);
+      }
+
+      _M_token = (*_M_ptr == '&') ? token::and_ : token::or_;
+      _M_ptr += 2;
+      break;
+    case '!':
+      if (_M_ptr[1] == '=') {
+        _M_token = token::relop;
+        _M_cmp = comparison::ne;
+        _M_ptr += 2;
+      } else {
+        _M_token = token::not_;
+        _M_ptr++;
+      }
+
+      break;
+    case '<':
+    case '>':
+      _M_token = token::relop;
+
+      if (_M_ptr[1] == '=') {
+        _M_cmp = (*_M_ptr == '<') ? comparison::le : comparison::ge;
+        _M_ptr += 2;
+      } else {
+        _M_cmp = (*_M_ptr == '<') ? comparison::lt : comparison::gt;
+        _M_ptr++;
+      }
+
+      break;
+    case '=':
+      _M_token = token::relop;
+      _M_cmp = comparison::eq;
+      _M_ptr += (_M_ptr[1] == '=') ? 2 : 1;
+      break;
+    default:
+      // Escaped name ("\tcp").
+      if (*_M_ptr == '\\') {
+        _M_ptr++;
+      }
+
+      while (((*_M_ptr >= 'a') && (*_M_ptr <= 'z')) ||
+             ((*_M_ptr >= 'A') && (*_M_ptr <= 'Z')) ||
+             ((*_M_ptr >= '0') && (*_M_ptr <= '9')) ||
+             (*_M_ptr == '.') ||
+             (*_M_ptr == ':') ||
+             (*_M_ptr == '/') ||
+             (*_M_ptr == '-') ||
+             (*_M_ptr == '_')) {
+        _M_ptr++;
+      }
+
+      if (_M_ptr == start + (*start == '\\')) {
+        return fail("invalid character '%c'", *_M_ptr);
+      }
+
+      _M_token = token::word;
+      break;
+  }
+
+  const size_t len = _M_ptr - start;
+  if (len >= sizeof(_M_text)) {
+    return fail("token too long");
+  }
+
+  memcpy(_M_text, start, len);
+  _M_text[len] = 0;
+
+  if (_M_token == token::word) {
+    if (strcmp(_M_text, "and") == 0) {
+      _M_token = token::and_;
+    } else if (strcmp(_M_text, "or") == 0) {
+      _M_token = token::or_;
+    } else if (strcmp(_M_text, "not") == 0) {
+      _M_token = token::not_;
+    }
+  }
+
+  return true;
+}
+
+bool pcap::filter::parser::expression(size_t& idx)
+{
+  if (!term(idx)) {
+    return false;
+  }
+
+  while ((_M_token == token::and_) || (_M_token == token::or_)) {
+    const node_type type = (_M_token == token::and_) ? node_type::and_ :
+                                                       node_type::or_;
+
+    size_t right;
+    if ((!next()) || (!term(right)) || (!add(type, idx, right, idx))) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool pcap::filter::parser::term(size_t& idx)
+{
+  switch (_M_token) {
+    case token::not_:
+      {
+        size_t operand;
+        return (next()) &&
+               (term(operand)) &&
+               (add(node_type::not_, operand, 0, idx));
+      }
+    case token::lparen:
+      if ((next()) && (expression(idx))) {
+        if (_M_token == token::rparen) {
+          return next();
+        }
+
+        return fail("missing ')'");
+      }
+
+      return false;
+    case token::word:
+      return primitive(idx);
+    case token::end:
+      return fail("unexpected end of the expression");
+    default:
+      return fail("syntax error near '%s'", _M_text);
+  }
+}
+
+bool pcap::filter::parser::primitive(size_t& idx)
+{
+  node n;
+  memset(&n, 0, sizeof(node));
+
+  // Length primitives.
+  if ((is("len")) || (is("greater")) || (is("less"))) {
+    n.type = node_type::length;
+
+    if (is("len")) {
+      if ((!next()) || (_M_token != token::relop)) {
+        return fail("'len' has to be followed by a comparison");
+      }
+
+      n.cmp = _M_cmp;
+    } else {
+      n.cmp = is("greater") ? comparison::ge : comparison::le;
+    }
+
+    if ((!next()) ||
+        (_M_token != token::word) ||
+        (!number(_M_text, UINT32_MAX, n.lo))) {
+      return fail("invalid length '%s'", _M_text);
+    }
+
+    return (add(n, idx)) && (next());
+  }
+
+  // Protocols without qualifiers.
+  if ((is("icmp")) || (is("icmp6")) || (is("arp"))) {
+    if (is("arp")) {
+      n.type = node_type::arp;
+    } else {
+      n.type = node_type::protocol;
+      n.families = is("icmp") ? family_ipv4 : family_ipv6;
+      n.protocol = is("icmp") ? protocol_icmp : protocol_icmp6;
+    }
+
+    return (add(n, idx)) && (next());
+  }
+
+  qualifiers q;
+  q.proto = qualifier::none;
+  q.has_dir = false;
+  q.dir = direction::src_or_dst;
+  q.type = value_type::none;
+
+  // Protocol qualifier.
+  if (is("ip")) {
+    q.proto = qualifier::ip;
+  } else if (is("ip6")) {
+    q.proto = qualifier::ip6;
+  } else if (is("tcp")) {
+    q.proto = qualifier::tcp;
+  } else if (is("udp")) {
+    q.proto = qualifier::udp;
+  } else if (is("sctp")) {
+    q.proto = qualifier::sctp;
+  }
+
+  if ((q.proto != qualifier::none) && (!next())) {
+    return false;
+  }
+
+  // Protocol number.
+  if (((q.proto == qualifier::none) ||
+       (q.proto == qualifier::ip) ||
+       (q.proto == qualifier::ip6)) &&
+      (is("proto"))) {
+    n.type = node_type::protocol;
+    n.families = (q.proto == qualifier::ip) ? family_ipv4 :
+                 (q.proto == qualifier::ip6) ? family_ipv6 :
+                                               family_ipv4 | family_ipv6;
+
+    if ((!next()) ||
+        (_M_token != token::word) ||
+        (!protocol(_M_text, n.protocol))) {
+      return fail("invalid protocol '%s'", _M_text);
+    }
+
+    return (add(n, idx)) && (next());
+  }
+
+  // Direction qualifier.
+  if ((is("src")) || (is("dst"))) {
+    q.has_dir = true;
+    q.dir = is("src") ? direction::src : direction::dst;
+
+    if (!next()) {
+      return false;
+    }
+
+    // "src or dst" and "src and dst".
+    if ((_M_token == token::and_) || (_M_token == token::or_)) {
+      state s;
+      save(s);
+
+      const bool both = (_M_token == token::and_);
+
+      if (!next()) {
+        return false;
+      }
+
+      if (is((q.dir == direction::src) ? "dst" : "src")) {
+        q.dir = both ? direction::src_and_dst : direction::src_or_dst;
+
+        if (!next()) {
+          return false;
+        }
+      } else {
+        restore(s);
+        return fail("'%s' has to be followed by a value",
+                    (q.dir == direction::src) ? "src" : "dst");
+      }
+    }
+  }
+
+  // Type qualifier.
+  if (is("host")) {
+    q.type = value_type::host;
+  } else if (is("net")) {
+    q.type = value_type::net;
+  } else if (is("port")) {
+    q.type = value_type::port;
+  } else if (is("portrange")) {
+    q.type = value_type::portrange;
+  }
+
+  if ((q.type != value_type::none) && (!next())) {
+    return false;
+  }
+
+  if ((_M_token == token::word) && (!keyword())) {
+    if ((q.proto == qualifier::none) &&
+        (!q.has_dir) &&
+        (q.type == value_type::none) &&
+        (_M_has_last)) {
+      // Qualifiers of the previous primitive.
+      q = _M_last;
+    }
+
+    if (q.type == value_type::none) {
+      q.type = value_type::host;
+    }
+
+    if (!value(q, idx)) {
+      return false;
+    }
+
+    _M_last = q;
+    _M_has_last = true;
+
+    return next();
+  }
+
+  if ((q.proto != qualifier::none) &&
+      (!q.has_dir) &&
+      (q.type == value_type::none)) {
+    // Protocol.
+    switch (q.proto) {
+      case qualifier::ip:
+        n.type = node_type::ip;
+        break;
+      case qualifier::ip6:
+        n.type = node_type::ip6;
+        break;
+      default:
+        n.type = node_type::protocol;
+        n.families = family_ipv4 | family_ipv6;
+        n.protocol = (q.proto == qualifier::tcp) ? protocol_tcp :
+                     (q.proto == qualifier::udp) ? protocol_udp :
+                                                   protocol_sctp;
+
+        break;
+    }
+
+    return add(n, idx);
+  }
+
+  if ((_M_token == token::word) || (q.has_dir) || (q.type != value_type::none)) {
+    return fail("missing value before '%s'", _M_text);
+  }
+
+  return fail("syntax error near '%s'", _M_text);
+}
+
+bool pcap::filter::parser::value(const qualifiers& q, size_t& idx)
+{
+  node n;
+  memset(&n, 0, sizeof(node));
+  n.dir = q.dir;
+
+  switch (q.type) {
+    case value_type::host:
+    case value_type::net:
+      {
+        if ((q.proto != qualifier::none) &&
+            (q.proto != qualifier::ip) &&
+            (q.proto != qualifier::ip6)) {
+          return fail("'%s' is not valid with a protocol qualifier",
+                      (q.type == value_type::host) ? "host" : "net");
+        }
+
+        char text[sizeof(_M_text)];
+        memcpy(text, _M_text, sizeof(text));
+
+        char* const slash = strchr(text, '/');
+        if (slash) {
+          *slash = 0;
+        }
+
+        if (!address(text, n.addr, n.families)) {
+          return fail("invalid address '%s'", _M_text);
+        }
+
+        const uint32_t bits = (n.families == family_ipv4) ? 32 : 128;
+
+        if ((q.proto == qualifier::ip) && (n.families != family_ipv4)) {
+          return fail("'%s' is not an IPv4 address", _M_text);
+        } else if ((q.proto == qualifier::ip6) &&
+                   (n.families != family_ipv6)) {
+          return fail("'%s' is not an IPv6 address", _M_text);
+        }
+
+        n.prefix = bits;
+
+        if (slash) {
+          uint32_t prefix;
+          if ((q.type != value_type::net) ||
+              (!number(slash + 1, bits, prefix))) {
+            return fail("invalid network '%s'", _M_text);
+          }
+
+          n.prefix = prefix;
+        }
+
+        n.type = (q.type == value_type::host) ? node_type::host :
+                                                node_type::net;
+      }
+
+      break;
+    case value_type::port:
+    case value_type::portrange:
+      {
+        n.type = node_type::port;
+
+        if (q.type == value_type::port) {
+          if (!number(_M_text, 65535, n.lo)) {
+            return fail("invalid port '%s'", _M_text);
+          }
+
+          n.hi = n.lo;
+        } else {
+          char text[sizeof(_M_text)];
+          memcpy(text, _M_text, sizeof(text));
+
+          char* const dash = strchr(text, '-');
+          if (dash) {
+            *dash = 0;
+          }
+
+          if ((!dash) ||
+              (!number(text, 65535, n.lo)) ||
+              (!number(dash + 1, 65535, n.hi)) ||
+              (n.lo > n.hi)) {
+            return fail("invalid port range '%s'", _M_text);
+          }
+        }
+
+        switch (q.proto) {
+          case qualifier::ip:
+            n.families = family_ipv4;
+            n.protocols = ports_tcp | ports_udp | ports_sctp;
+            break;
+          case qualifier::ip6:
+            n.families = family_ipv6;
+            n.protocols = ports_tcp | ports_udp | ports_sctp;
+            break;
+          case qualifier::tcp:
+            n.families = family_ipv4 | family_ipv6;
+            n.protocols = ports_tcp;
+            break;
+          case qualifier::udp:
+            n.families = family_ipv4 | family_ipv6;
+            n.protocols = ports_udp;
+            break;
+          case qualifier::sctp:
+            n.families = family_ipv4 | family_ipv6;
+            n.protocols = ports_sctp;
+            break;
+          default:
+            n.families = family_ipv4 | family_ipv6;
+            n.protocols = ports_tcp | ports_udp | ports_sctp;
+            break;
+        }
+      }
+
+      break;
+    default:
+      return fail("syntax error near '%s'", _M_text);
+  }
+
+  return add(n, idx);
+}
+
+bool pcap::filter::parser::keyword() const
+{
+  static const char* const keywords[] = {
+    "ip", "ip6", "arp", "tcp", "udp", "sctp", "icmp", "icmp6", "proto",
+    "src", "dst", "host", "net", "port", "portrange", "len", "greater",
+    "less"
+  };
+
+  for (size_t i = 0; i < sizeof(keywords) / sizeof(keywords[0]); i++) {
+    if (strcmp(_M_text, keywords[i]) == 0) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool pcap::filter::parser::number(const char* s,
+                                  uint32_t max,
+                                  uint32_t& n) const
+{
+  if ((*s < '0') || (*s > '9')) {
+    return false;
+  }
+
+  char* end;
+  const unsigned long long v = strtoull(s, &end, 0);
+
+  if ((*end == 0) && (v <= max)) {
+    n = static_cast<uint32_t>(v);
+    return true;
+  }
+
+  return false;
+}
+
+bool pcap::filter::parser::protocol(const char* s, uint8_t& proto) const
+{
+  static const struct {
+    const char* name;
+    uint8_t number;
+  } protocols[] = {
+    {"icmp",  protocol_icmp},
+    {"tcp",   protocol_tcp},
+    {"udp",   protocol_udp},
+    {"icmp6", protocol_icmp6},
+    {"sctp",  protocol_sctp}
+  };
+
+  // Names can be escaped ("\tcp").
+  if (*s == '\\') {
+    s++;
+  }
+
+  for (size_t i = 0; i < sizeof(protocols) / sizeof(protocols[0]); i++) {
+    if (strcmp(s, protocols[i].name) == 0) {
+      proto = protocols[i].number;
+      return true;
+    }
+  }
+
+  uint32_t n;
+  if (number(s, 255, n)) {
+    proto = static_cast<uint8_t>(n);
+    return true;
+  }
+
+  return false;
+}
+
+bool pcap::filter::parser::address(const char* s,
+                                   uint8_t* addr,
+                                   unsigned& family) const
+{
+  if (inet_pton(AF_INET, s, addr) == 1) {
+    family = family_ipv4;
+    return true;
+  } else if (inet_pton(AF_INET6, s, addr) == 1) {
+    family = family_ipv6;
+    return true;
+  }
+
+  return false;
+}
+
+bool pcap::filter::parser::add(const node& n, size_t& idx)
+{
+  if (_M_filter._M_used == _M_filter._M_size) {
+    const size_t size = (_M_filter._M_size > 0) ? _M_filter._M_size * 2 : 16;
+
+    node* nodes;
+    if ((nodes = static_cast<node*>(
+                   realloc(_M_filter._M_nodes, size * sizeof(node))
+                 )) == nullptr) {
+      return fail("out of memory");
+    }
+
+    _M_filter._M_nodes = nodes;
+    _M_filter._M_size = size;
+  }
+
+  idx = _M_filter._M_used++;
+  _M_filter._M_nodes[idx] = n;
+
+  return true;
+}
+
+bool pcap::filter::parser::fail(const char* format, ...)
+{
+  va_list ap;
+  va_start(ap, format);
+  vsnprintf(_M_error, _M_errsize, format, ap);
+  va_end(ap);
+
+  return false;
+}
+
+pcap::filter::generator::generator(const filter& f, uint32_t linktype)
+  : _M_filter(f)
+{
+  switch (linktype) {
+    case linktype_ethernet:
+      _M_ethertype = 12;
+      _M_l3 = 14;
+      break;
+    case linktype_linux_sll:
+      _M_ethertype = 14;
+      _M_l3 = 16;
+      break;
+    case linktype_linux_sll2:
+      _M_ethertype = 0;
+      _M_l3 = 20;
+      break;
+    case linktype_raw:
+    case linktype_ipv4:
+    case linktype_ipv6:
+      _M_version = true;
+      _M_l3 = 0;
+      break;
+    default:
+      _M_supported = false;
+      break;
+  }
+}
+
+pcap::filter::generator::~generator()
+{
+  free(_M_insns);
+  free(_M_jt);
+  free(_M_jf);
+  free(_M_labels);
+}
+
+bool pcap::filter::generator::generate(bpf::instruction*& insns,
+                                       size_t& count)
+{
+  if ((!_M_supported) || (_M_filter._M_used == 0)) {
+    return false;
+  }
+
+  const uint32_t t = label();
+  const uint32_t f = label();
+
+  generate(_M_filter._M_used - 1, t, f);
+
+  place(t);
+  emit(bpf::class_ret | bpf::src_k, accept_packet);
+
+  place(f);
+  emit(bpf::class_ret | bpf::src_k, 0);
+
+  if ((_M_failed) || (_M_count > bpf::max_instructions)) {
+    return false;
+  }
+
+  // Resolve the targets of the jumps (all forward).
+  for (size_t i = 0; i < _M_count; i++) {
+    bpf::instruction& insn = _M_insns[i];
+
+    if ((insn.code & 0x07) != bpf::class_jmp) {
+      continue;
+    }
+
+    const size_t jt = _M_labels[_M_jt[i]] - (i + 1);
+
+    if ((insn.code & 0xf0) == bpf::op_ja) {
+      insn.k = jt;
+    } else {
+      const size_t jf = _M_labels[_M_jf[i]] - (i + 1);
+
+      // Too far for a conditional jump.
+      if ((jt > UINT8_MAX) || (jf > UINT8_MAX)) {
+        return false;
+      }
+
+      insn.jt = jt;
+      insn.jf = jf;
+    }
+  }
+
+  insns = _M_insns;
+  count = _M_count;
+  _M_insns = nullptr;
+
+  return true;
+}
+
+uint32_t pcap::filter::generator::label()
+{
+  if (_M_nlabels == _M_lsize) {
+    const size_t size = (_M_lsize > 0) ? _M_lsize * 2 : 64;
+
+    size_t* labels;
+    if ((labels = static_cast<size_t*>(
+                    realloc(_M_labels, size * sizeof(size_t))
+                  )) == nullptr) {
+      _M_failed = true;
+      return 0;
+    }
+
+    _M_labels = labels;
+    _M_lsize = size;
+  }
+
+  _M_labels[_M_nlabels] = SIZE_MAX;
+
+  return _M_nlabels++;
+}
+
+void pcap::filter::generator::place(uint32_t l)
+{
+  if (!_M_failed) {
+    _M_labels[l] = _M_count;
+  }
+}
+
+void pcap::filter::generator::emit(uint16_t code, uint32_t k)
+{
+  jump(code, k, no_label, no_label);
+}
+
+void pcap::filter::generator::jump(uint16_t code,
+                                   uint32_t k,
+                                   uint32_t t,
+                                   uint32_t f)
+{
+  if (_M_failed) {
+    return;
+  }
+
+  if (_M_count == _M_size) {
+    const size_t size = (_M_size > 0) ? _M_size * 2 : 64;
+
+    bpf::instruction* insns;
+    uint32_t* jt;
+    uint32_t* jf;
+    if ((insns = static_cast<bpf::instruction*>(
+                   realloc(_M_insns, size * sizeof(bpf::instruction))
+                 )) != nullptr) {
+      _M_insns = insns;
+    }
+
+    if ((jt = static_cast<uint32_t*>(
+                realloc(_M_jt, size * sizeof(uint32_t))
+              )) != nullptr) {
+      _M_jt = jt;
+    }
+
+    if ((jf = static_cast<uint32_t*>(
+                realloc(_M_jf, size * sizeof(uint32_t))
+              )) != nullptr) {
+      _M_jf = jf;
+    }
+
+    if ((!insns) || (!jt) || (!jf)) {
+      _M_failed = true;
+      return;
+    }
+
+    _M_size = size;
+  }
+
+  bpf::instruction& insn = _M_insns[_M_count];
+  insn.code = code;
+  insn.jt = 0;
+  insn.jf = 0;
+  insn.k = k;
+
+  _M_jt[_M_count] = t;
+  _M_jf[_M_count] = f;
+  _M_count++;
+}
+
+void pcap::filter::generator::always(uint32_t target)
+{
+  jump(bpf::class_jmp | bpf::op_ja, 0, target, target);
+}
+
+void pcap::filter::generator::test(uint16_t code,
+                                   uint32_t offset,
+                                   uint32_t mask,
+                                   uint16_t op,
+                                   uint32_t value,
+                                   uint32_t t,
+                                   uint32_t f)
+{
+  emit(code, offset);
+
+  if (mask != 0xffffffff) {
+    emit(bpf::class_alu | bpf::op_and | bpf::src_k, mask);
+  }
+
+  jump(bpf::class_jmp | op | bpf::src_k, value, t, f);
+}
+
+void pcap::filter::generator::generate(size_t idx, uint32_t t, uint32_t f)
+{
+  const node& n = _M_filter._M_nodes[idx];
+
+  switch (n.type) {
+    case node_type::and_:
+      {
+        const uint32_t right = label();
+        generate(n.left, right, f);
+        place(right);
+        generate(n.right, t, f);
+      }
+
+      break;
+    case node_type::or_:
+      {
+        const uint32_t right = label();
+        generate(n.left, t, right);
+        place(right);
+        generate(n.right, t, f);
+      }
+
+      break;
+    case node_type::not_:
+      generate(n.left, f, t);
+      break;
+    case node_type::ip:
+      family(family_ipv4, t, f);
+      break;
+    case node_type::ip6:
+      family(family_ipv6, t, f);
+      break;
+    case node_type::arp:
+      if (_M_version) {
+        always(f);
+      } else {
+        test(bpf::class_ld | bpf::size_h | bpf::mode_abs,
+             _M_ethertype,
+             0xffffffff,
+             bpf::op_jeq,
+             ethertype_arp,
+             t,
+             f);
+      }
+
+      break;
+    case node_type::protocol:
+      ip(n.families,
+         [this, &n](uint32_t t, uint32_t f) {
+           test(bpf::class_ld | bpf::size_b | bpf::mode_abs,
+                _M_l3 + 9,
+                0xffffffff,
+                bpf::op_jeq,
+                n.protocol,
+                t,
+                f);
+         },
+         [this, &n](uint32_t t, uint32_t f) {
+           test(bpf::class_ld | bpf::size_b | bpf::mode_abs,
+                _M_l3 + 6,
+                0xffffffff,
+                bpf::op_jeq,
+                n.protocol,
+                t,
+                f);
+         },
+         t,
+         f);
+
+      break;
+    case node_type::host:
+    case node_type::net:
+      ip(n.families,
+         [this, &n](uint32_t t, uint32_t f) {
+           endpoints(n.dir,
+                     [this, &n](bool src, uint32_t t, uint32_t f) {
+                       address(_M_l3 + (src ? 12 : 16),
+                               n.addr,
+                               4,
+                               n.prefix,
+                               t,
+                               f);
+                     },
+                     t,
+                     f);
+         },
+         [this, &n](uint32_t t, uint32_t f) {
+           endpoints(n.dir,
+                     [this, &n](bool src, uint32_t t, uint32_t f) {
+                       address(_M_l3 + (src ? 8 : 24),
+                               n.addr,
+                               16,
+                               n.prefix,
+                               t,
+                               f);
+                     },
+                     t,
+                     f);
+         },
+         t,
+         f);
+
+      break;
+    case node_type::port:
+      ip(n.families,
+         [this, &n](uint32_t t, uint32_t f) {
+           // First (or only) fragment, ports after the options.
+           const uint32_t unfragmented = label();
+           const uint32_t ports = label();
+
+           protocols(_M_l3 + 9, n.protocols, unfragmented, f);
+           place(unfragmented);
+
+           test(bpf::class_ld | bpf::size_h | bpf::mode_abs,
+                _M_l3 + 6,
+                0xffffffff,
+                bpf::op_jset,
+                0x1fff,
+                f,
+                ports);
+
+           place(ports);
+           endpoints(n.dir,
+                     [this, &n](bool src, uint32_t t, uint32_t f) {
+                       emit(bpf::class_ldx | bpf::size_b | bpf::mode_msh,
+                            _M_l3);
+
+                       port(bpf::class_ld | bpf::size_h | bpf::mode_ind,
+                            _M_l3 + (src ? 0 : 2),
+                            n.lo,
+                            n.hi,
+                            t,
+                            f);
+                     },
+                     t,
+                     f);
+         },
+         [this, &n](uint32_t t, uint32_t f) {
+           const uint32_t ports = label();
+
+           protocols(_M_l3 + 6, n.protocols, ports, f);
+           place(ports);
+
+           endpoints(n.dir,
+                     [this, &n](bool src, uint32_t t, uint32_t f) {
+                       port(bpf::class_ld | bpf::size_h | bpf::mode_abs,
+                            _M_l3 + 40 + (src ? 0 : 2),
+                            n.lo,
+                            n.hi,
+                            t,
+                            f);
+                     },
+                     t,
+                     f);
+         },
+         t,
+         f);
+
+      break;
+    case node_type::length:
+      emit(bpf::class_ld | bpf::size_w | bpf::mode_len, 0);
+
+      switch (n.cmp) {
+        case comparison::eq:
+          jump(bpf::class_jmp | bpf::op_jeq | bpf::src_k, n.lo, t, f);
+          break;
+        case comparison::ne:
+          jump(bpf::class_jmp | bpf::op_jeq | bpf::src_k, n.lo, f, t);
+          break;
+        case comparison::lt:
+          jump(bpf::class_jmp | bpf::op_jge | bpf::src_k, n.lo, f, t);
+          break;
+        case comparison::le:
+          jump(bpf::class_jmp | bpf::op_jgt | bpf::src_k, n.lo, f, t);
+          break;
+        case comparison::gt:
+          jump(bpf::class_jmp | bpf::op_jgt | bpf::src_k, n.lo, t, f);
+          break;
+        case comparison::ge:
+          jump(bpf::class_jmp | bpf::op_jge | bpf::src_k, n.lo, t, f);
+          break;
+      }
+
+      break;
+  }
+}
+
+void pcap::filter::generator::family(unsigned family, uint32_t t, uint32_t f)
+{
+  if (_M_version) {
+    test(bpf::class_ld | bpf::size_b | bpf::mode_abs,
+         0,
+         0xf0,
+         bpf::op_jeq,
+         (family == family_ipv4) ? 0x40 : 0x60,
+         t,
+         f);
+  } else {
+    test(bpf::class_ld | bpf::size_h | bpf::mode_abs,
+         _M_ethertype,
+         0xffffffff,
+         bpf::op_jeq,
+         (family == family_ipv4) ? ethertype_ipv4 : ethertype_ipv6,
+         t,
+         f);
+  }
+}
+
+template<typename IPv4, typename IPv6>
+void pcap::filter::generator::ip(unsigned families,
+                                 IPv4 ipv4,
+                                 IPv6 ipv6,
+                                 uint32_t t,
+                                 uint32_t f)
+{
+  if (families & family_ipv4) {
+    const uint32_t body = label();
+    const uint32_t other = (families & family_ipv6) ? label() : f;
+
+    family(family_ipv4, body, other);
+    place(body);
+    ipv4(t, other);
+
+    if (other == f) {
+      return;
+    }
+
+    place(other);
+  }
+
+  const uint32_t body = label();
+
+  family(family_ipv6, body, f);
+  place(body);
+  ipv6(t, f);
+}
+
+template<typename Endpoint>
+void pcap::filter::generator::endpoints(direction dir,
+                                        Endpoint endpoint,
+                                        uint32_t t,
+                                        uint32_t f)
+{
+  switch (dir) {
+    case direction::src:
+      endpoint(true, t, f);
+      break;
+    case direction::dst:
+      endpoint(false, t, f);
+      break;
+    case direction::src_or_dst:
+      {
+        const uint32_t dst = label();
+        endpoint(true, t, dst);
+        place(dst);
+        endpoint(false, t, f);
+      }
+
+      break;
+    case direction::src_and_dst:
+      {
+        const uint32_t dst = label();
+        endpoint(true, dst, f);
+        place(dst);
+        endpoint(false, t, f);
+      }
+
+      break;
+  }
+}
+
+void pcap::filter::generator::address(uint32_t offset,
+                                      const uint8_t* addr,
+                                      size_t len,
+                                      unsigned prefix,
+                                      uint32_t t,
+                                      uint32_t f)
+{
+  // Compare the 32-bit words which are (partly) in the prefix.
+  const size_t nwords = (prefix + 31) / 32;
+
+  if (nwords == 0) {
+    always(t);
+    return;
+  }
+
+  for (size_t i = 0; i < nwords; i++) {
+    const unsigned bits = (prefix - 32 * i >= 32) ? 32 : prefix - 32 * i;
+    const uint32_t mask = (bits == 32) ? 0xffffffff :
+                                         ~(0xffffffffu >> bits);
+
+    const uint32_t word = (static_cast<uint32_t>(addr[4 * i]) << 24) |
+                          (static_cast<uint32_t>(addr[4 * i + 1]) << 16) |
+                          (static_cast<uint32_t>(addr[4 * i + 2]) << 8) |
+                          addr[4 * i + 3];
+
+    const uint32_t next = (i + 1 < nwords) ? label() : t;
+
+    test(bpf::class_ld | bpf::size_w | bpf::mode_abs,
+         offset + 4 * i,
+         mask,
+         bpf::op_jeq,
+         word & mask,
+         next,
+         f);
+
+    if (next != t) {
+      place(next);
+    }
+  }
+}
+
+void pcap::filter::generator::protocols(uint32_t offset,
+                                        unsigned protocols,
+                                        uint32_t t,
+                                        uint32_t f)
+{
+  static const struct {
+    unsigned bit;
+    uint8_t protocol;
+  } table[] = {
+    {ports_tcp,  protocol_tcp},
+    {ports_udp,  protocol_udp},
+    {ports_sctp, protocol_sctp}
+  };
+
+  emit(bpf::class_ld | bpf::size_b | bpf::mode_abs, offset);
+
+  for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+    if (protocols & table[i].bit) {
+      // More protocols to compare?
+      const bool last = ((protocols & ~((table[i].bit << 1) - 1)) == 0);
+      const uint32_t next = last ? f : label();
+
+      jump(bpf::class_jmp | bpf::op_jeq | bpf::src_k,
+           table[i].protocol,
+           t,
+           next);
+
+      if (last) {
+        break;
+      }
+
+      place(next);
+    }
+  }
+}
+
+void pcap::filter::generator::port(uint16_t code,
+                                   uint32_t offset,
+                                   uint32_t lo,
+                                   uint32_t hi,
+                                   uint32_t t,
+                                   uint32_t f)
+{
+  emit(code, offset);
+
+  if (lo == hi) {
+    jump(bpf::class_jmp | bpf::op_jeq | bpf::src_k, lo, t, f);
+  } else {
+    const uint32_t upper = label();
+
+    jump(bpf::class_jmp | bpf::op_jge | bpf::src_k, lo, upper, f);
+    place(upper);
+    jump(bpf::class_jmp | bpf::op_jgt | bpf::src_k, hi, f, t);
+  }
+}
@@ -0,0 +1,100 @@
+#ifndef PCAP_FILTER_H
+#define PCAP_FILTER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include "pcap/bpf.h"
+
+namespace pcap {
+  // Packet filter.
+  // The expression, in a subset of the pcap-filter language, is parsed once
+  // into a tree; a classic BPF program is generated from the tree for each
+  // link type the first time a packet of that link type is matched, and run
+  // by the interpreter of pcap::bpf::program.
+  //
+  // Supported primitives: `ip`, `ip6`, `arp`, `tcp`, `udp`, `sctp`, `icmp`,
+  // `icmp6`, `[ip|ip6] proto N`, `[ip|ip6] [src|dst] host ADDR`,
+  // `[ip|ip6] [src|dst] net ADDR[/LEN]`,
+  // `[ip|ip6|tcp|udp|sctp] [src|dst] port N` (or `portrange N-M`),
+  // `len OP N` (OP: <, <=, >, >=, =, ==, !=), `greater N` and `less N`,
+  // combined with `and` (&&), `or` (||), `not` (!) and parentheses (`and`
+  // and `or` have the same precedence, from left to right). A value after
+  // `and` or `or` without qualifiers takes the ones of the previous
+  // primitive (`port 80 or 443`). Addresses are numeric. Supported link
+  // types: Ethernet, raw IP and Linux cooked capture; the packets of other
+  // link types never match.
+  class filter {
+    public:
+      // Constructor.
+      filter() = default;
+
+      // Destructor.
+      ~filter();
+
+      // Parse expression.
+      // Returns false (with a message in `error`) if it is invalid.
+      bool compile(const char* expr, char* error, size_t size);
+
+      // Does a packet of link type `linktype` match?
+      bool match(uint32_t linktype,
+                 const void* data,
+                 uint32_t caplen,
+                 uint32_t len)
+      {
+        if ((!_M_last) || (_M_last->linktype != linktype)) {
+          _M_last = get(linktype);
+        }
+
+        return (_M_last->program) &&
+               (_M_last->program->run(data, caplen, len) != 0);
+      }
+
+      // Is the link type supported?
+      static bool supports(uint32_t linktype);
+
+      // Print the BPF program of `linktype` (one instruction per line).
+      bool dump(uint32_t linktype, FILE* out);
+
+    private:
+      // Node of the expression tree.
+      struct node;
+
+      // Parser of the expression and generator of the programs.
+      class parser;
+      class generator;
+
+      // Program of a link type (nullptr if the link type is not supported
+      // or if the program couldn't be generated).
+      struct compiled {
+        uint32_t linktype;
+        bpf::instruction* insns;
+        size_t count;
+        bpf::program* program;
+      };
+
+      // Expression tree (the root is the last node).
+      node* _M_nodes = nullptr;
+      size_t _M_size = 0;
+      size_t _M_used = 0;
+
+      // Programs.
+      compiled* _M_programs = nullptr;
+      size_t _M_nprograms = 0;
+
+      // Program of the last packet.
+      const compiled* _M_last = nullptr;
+
+      // Get the program of `linktype` (generated on first use).
+      const compiled* get(uint32_t linktype);
+
+      // Release resources.
+      void clear();
+
+      // Disable copy constructor and assignment operator.
+      filter(const filter&) = delete;
+      filter& operator=(const filter&) = delete;
+  };
+}
+
+#endif // PCAP_FILTER_H
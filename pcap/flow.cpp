@@ -0,0 +1,352 @@
+#include <string.h>
+#include "pcap/flow.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+#endif
+
+// Link types.
+static constexpr const uint32_t linktype_null = 0;
+static constexpr const uint32_t linktype_ethernet = 1;
+static constexpr const uint32_t linktype_raw = 101;
+static constexpr const uint32_t linktype_loop = 108;
+static constexpr const uint32_t linktype_linux_sll = 113;
+static constexpr const uint32_t linktype_ipv4 = 228;
+static constexpr const uint32_t linktype_ipv6 = 229;
+static constexpr const uint32_t linktype_linux_sll2 = 276;
+
+// Ethertypes.
+static constexpr const uint16_t ethertype_ipv4 = 0x0800;
+static constexpr const uint16_t ethertype_ipv6 = 0x86dd;
+static constexpr const uint16_t ethertype_vlan = 0x8100;
+static constexpr const uint16_t ethertype_qinq = 0x88a8;
+static constexpr const uint16_t ethertype_qinq_old = 0x9100;
+
+// Maximum number of VLAN tags and IPv6 extension headers skipped.
+static constexpr const unsigned max_vlan_tags = 4;
+static constexpr const unsigned max_extension_headers = 8;
+
+// Canonical tuple: lower endpoint address, higher endpoint address, their
+// ports and the protocol, zero-padded to whole 64-bit words.
+struct tuple {
+  uint64_t words[5];
+};
+
+// CRC32C function.
+typedef uint32_t (*crc32c_function)(const uint64_t*, size_t);
+
+static inline uint16_t be16(const uint8_t* ptr)
+{
+  return (static_cast<uint16_t>(ptr[0]) << 8) | ptr[1];
+}
+
+static const uint32_t* crc32c_table()
+{
+  static uint32_t table[256];
+  static bool initialized = false;
+
+  if (!initialized) {
+    for (uint32_t i = 0; i < 256; i++) {
+      uint32_t crc = i;
+      for (unsigned j = 0; j < 8; j++) {
+        crc = (crc >> 1) ^ ((crc & 1) ? 0x82f63b78 : 0);
+      }
+
+      table[i] = crc;
+    }
+
+    initialized = true;
+  }
+
+  return table;
+}
+
+static uint32_t crc32c_scalar(const uint64_t* words, size_t count)
+{
+  static const uint32_t* const table = crc32c_table();
+
+  // The bytes of the words in memory order, like the crc32 instruction on
+  // little-endian machines.
+  const uint8_t* const p = reinterpret_cast<const uint8_t*>(words);
+
+  uint32_t crc = 0xffffffff;
+  for (size_t i = 0; i < count * sizeof(uint64_t); i++) {
+    crc = (crc >> 8) ^ table[(crc ^ p[i]) & 0xff];
+  }
+
+  return ~crc;
+}
+
+#if defined(__x86_64__)
+  __attribute__((target("sse4.2")))
+  static uint32_t crc32c_sse42(const uint64_t* words, size_t count)
+  {
+    uint64_t crc = 0xffffffff;
+    for (size_t i = 0; i < count; i++) {
+      crc = _mm_crc32_u64(crc, words[i]);
+    }
+
+    return ~static_cast<uint32_t>(crc);
+  }
+#endif // defined(__x86_64__)
+
+static crc32c_function select()
+{
+#if defined(__x86_64__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("sse4.2")) {
+    return crc32c_sse42;
+  }
+#endif
+
+  return crc32c_scalar;
+}
+
+// Build the canonical tuple of two endpoints (`len`-byte addresses) and
+// hash it.
+static uint32_t hash(const uint8_t* src,
+                     const uint8_t* dst,
+                     size_t len,
+                     uint16_t sport,
+                     uint16_t dport,
+                     uint8_t protocol)
+{
+  static const crc32c_function fn = select();
+
+  int cmp = memcmp(src, dst, len);
+  if ((cmp > 0) || ((cmp == 0) && (sport > dport))) {
+    const uint8_t* const addr = src;
+    src = dst;
+    dst = addr;
+
+    const uint16_t port = sport;
+    sport = dport;
+    dport = port;
+  }
+
+  tuple t;
+  memset(&t, 0, sizeof(tuple));
+
+  uint8_t* const p = reinterpret_cast<uint8_t*>(t.words);
+  memcpy(p, src, len);
+  memcpy(p + len, dst, len);
+  memcpy(p + 2 * len, &sport, sizeof(uint16_t));
+  memcpy(p + 2 * len + 2, &dport, sizeof(uint16_t));
+  p[2 * len + 4] = protocol;
+
+  return fn(t.words, (2 * len + 5 + 7) / sizeof(uint64_t));
+}
+
+// Does the protocol have 16-bit source and destination ports at the start
+// of its header?
+static inline bool has_ports(uint8_t protocol)
+{
+  switch (protocol) {
+    case 6:   // TCP.
+    case 17:  // UDP.
+    case 33:  // DCCP.
+    case 132: // SCTP.
+    case 136: // UDP-Lite.
+      return true;
+    default:
+      return false;
+  }
+}
+
+// Hash of the addresses, the ports (if the transport header at `l4` is
+// complete and `fragment` is false) and the protocol.
+static uint32_t hash_ip(const uint8_t* src,
+                        const uint8_t* dst,
+                        size_t len,
+                        uint8_t protocol,
+                        const uint8_t* l4,
+                        const uint8_t* end,
+                        bool fragment)
+{
+  uint16_t sport = 0;
+  uint16_t dport = 0;
+
+  if ((!fragment) && (has_ports(protocol)) && (l4 + 4 <= end)) {
+    sport = be16(l4);
+    dport = be16(l4 + 2);
+  }
+
+  return hash(src, dst, len, sport, dport, protocol);
+}
+
+static uint32_t hash_ipv4(const uint8_t* ptr, const uint8_t* end)
+{
+  if (ptr + 20 <= end) {
+    const size_t ihl = (ptr[0] & 0x0f) * 4;
+
+    if (ihl >= 20) {
+      // More fragments flag or fragment offset.
+      const bool fragment = ((be16(ptr + 6) & 0x3fff) != 0);
+
+      return hash_ip(ptr + 12, ptr + 16, 4, ptr[9], ptr + ihl, end, fragment);
+    }
+  }
+
+  return 0;
+}
+
+static uint32_t hash_ipv6(const uint8_t* ptr, const uint8_t* end)
+{
+  if (ptr + 40 <= end) {
+    uint8_t next = ptr[6];
+    const uint8_t* l4 = ptr + 40;
+    bool fragment = false;
+
+    // Skip extension headers.
+    for (unsigned i = 0; (i < max_extension_headers) && (l4 + 8 <= end); i++) {
+      if ((next == 0) || (next == 43) || (next == 60)) {
+        // Hop-by-hop options, routing and destination options.
+        next = l4[0];
+        l4 += (static_cast<size_t>(l4[1]) + 1) * 8;
+      } else if (next == 44) {
+        // Fragment.
+        next = l4[0];
+        l4 += 8;
+        fragment = true;
+      } else if (next == 51) {
+        // Authentication header.
+        next = l4[0];
+        l4 += (static_cast<size_t>(l4[1]) + 2) * 4;
+      } else {
+        break;
+      }
+    }
+
+    return hash_ip(ptr + 8, ptr + 24, 16, next, l4, end, fragment);
+  }
+
+  return 0;
+}
+
+bool pcap::ip_header(uint32_t linktype,
+                     const void* data,
+                     size_t caplen,
+                     size_t& offset,
+                     unsigned& version)
+{
+  const uint8_t* const ptr = static_cast<const uint8_t*>(data);
+  const uint8_t* const end = ptr + caplen;
+
+  uint16_t ethertype;
+
+  switch (linktype) {
+    case linktype_ethernet:
+      if (caplen < 14) {
+        return false;
+      }
+
+      ethertype = be16(ptr + 12);
+      offset = 14;
+
+      for (unsigned i = 0;
+           (i < max_vlan_tags) &&
+           ((ethertype == ethertype_vlan) ||
+            (ethertype == ethertype_qinq) ||
+            (ethertype == ethertype_qinq_old)) &&
+           (ptr + offset + 4 <= end);
+           i++) {
+        ethertype = be16(ptr + offset + 2);
+        offset += 4;
+      }
+
+      break;
+    case linktype_null:
+    case linktype_loop:
+      // Address family, in the byte order of the capturing machine (null)
+      // or in network byte order (loop); AF_INET is 2 everywhere, AF_INET6
+      // varies.
+      if (caplen >= 4) {
+        uint32_t family;
+        memcpy(&family, ptr, sizeof(uint32_t));
+
+        if ((family & 0xffff) == 0) {
+          family = __builtin_bswap32(family);
+        }
+
+        offset = 4;
+
+        switch (family) {
+          case 2:
+            version = 4;
+            return true;
+          case 10:
+          case 24:
+          case 28:
+          case 30:
+            version = 6;
+            return true;
+        }
+      }
+
+      return false;
+    case linktype_linux_sll:
+      if (caplen < 16) {
+        return false;
+      }
+
+      ethertype = be16(ptr + 14);
+      offset = 16;
+
+      break;
+    case linktype_linux_sll2:
+      if (caplen < 20) {
+        return false;
+      }
+
+      ethertype = be16(ptr);
+      offset = 20;
+
+      break;
+    case linktype_raw:
+    case linktype_ipv4:
+    case linktype_ipv6:
+      // Version from the first byte.
+      if (caplen > 0) {
+        offset = 0;
+        version = ptr[0] >> 4;
+
+        return ((version == 4) || (version == 6));
+      }
+
+      return false;
+    default:
+      return false;
+  }
+
+  switch (ethertype) {
+    case ethertype_ipv4:
+      version = 4;
+      return true;
+    case ethertype_ipv6:
+      version = 6;
+      return true;
+    default:
+      return false;
+  }
+}
+
+uint32_t pcap::flow_hash(uint32_t linktype, const void* data, size_t caplen)
+{
+  const uint8_t* const ptr = static_cast<const uint8_t*>(data);
+  const uint8_t* const end = ptr + caplen;
+
+  size_t offset;
+  unsigned version;
+  if (ip_header(linktype, data, caplen, offset, version)) {
+    return (version == 4) ? hash_ipv4(ptr + offset, end) :
+                            hash_ipv6(ptr + offset, end);
+  }
+
+  // Non-IP Ethernet frame: destination and source MAC addresses.
+  if ((linktype == linktype_ethernet) && (caplen >= 14)) {
+    return hash(ptr + 6, ptr, 6, 0, 0, 0);
+  }
+
+  return 0;
+}
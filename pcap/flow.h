@@ -0,0 +1,38 @@
+#ifndef PCAP_FLOW_H
+#define PCAP_FLOW_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace pcap {
+  // Symmetric hash of the flow of a packet: the IP addresses, the ports
+  // (TCP, UDP, SCTP, DCCP and UDP-Lite) and the protocol, with the two
+  // endpoints in a canonical order so both directions of a flow get the
+  // same hash. The link layer can be Ethernet (with VLAN tags), raw IP,
+  // BSD loopback or Linux cooked capture. Fragments are hashed without the
+  // ports, so all the fragments of a datagram get the same hash; non-IP
+  // Ethernet frames are hashed by their MAC addresses and other packets get
+  // 0.
+  //
+  // The hash is the CRC32C of the canonical tuple, computed with the crc32
+  // instruction if the CPU supports SSE 4.2 (selected at run time) and with
+  // a lookup table otherwise; both give the same result.
+  uint32_t flow_hash(uint32_t linktype, const void* data, size_t caplen);
+
+  // Offset of the IPv4 or IPv6 header of a packet, after the link-layer
+  // header (link types as above), and its version (4 or 6). Returns false
+  // if the packet is not IP. The IP header itself might be truncated.
+  bool ip_header(uint32_t linktype,
+                 const void* data,
+                 size_t caplen,
+                 size_t& offset,
+                 unsigned& version);
+
+  // Shard of a hash among `nshards` (multiply-shift, `hash` is uniform).
+  static inline unsigned flow_shard(uint32_t hash, unsigned nshards)
+  {
+    return (static_cast<uint64_t>(hash) * nshards) >> 32;
+  }
+}
+
+#endif // PCAP_FLOW_H
@@ -0,0 +1,268 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include "pcap/frames.h"
+#include "io/rw.h"
+
+// Signature and version of the index file.
+static const uint8_t signature[8] = {'M', 'C', 'A', 'P', 'F', 'I', 'D', 'X'};
+static constexpr const uint32_t version = 1;
+
+pcap::frame_index::~frame_index()
+{
+  free(_M_header);
+  free(_M_entries);
+}
+
+void pcap::frame_index::add(void* arg,
+                            const uint8_t* data,
+                            size_t len,
+                            uint64_t offset,
+                            size_t size)
+{
+  frame_index* const index = static_cast<frame_index*>(arg);
+
+  if (index->_M_used == index->_M_size) {
+    const size_t n = (index->_M_size > 0) ? index->_M_size * 2 : 1024;
+
+    entry* entries;
+    if ((entries = static_cast<entry*>(
+                     realloc(index->_M_entries, n * sizeof(entry))
+                   )) == nullptr) {
+      index->_M_failed = true;
+      return;
+    }
+
+    index->_M_entries = entries;
+    index->_M_size = n;
+  }
+
+  entry* const e = &index->_M_entries[index->_M_used++];
+  e->offset = offset;
+  e->size = size;
+  e->data_offset = index->_M_pos;
+  e->data_size = len;
+  e->first_record = no_record;
+  e->first_timestamp = 0;
+  e->last_timestamp = 0;
+  e->packets = 0;
+
+  index->scan(data, len);
+}
+
+bool pcap::frame_index::save(const char* filename) const
+{
+  if (_M_failed) {
+    return false;
+  }
+
+  // Write to a temporary file and rename it, so readers never see a
+  // partially written index.
+  char tmpname[PATH_MAX];
+  if (snprintf(tmpname,
+               sizeof(tmpname),
+               "%s.%ld.tmp",
+               filename,
+               static_cast<long>(getpid())) >=
+      static_cast<int>(sizeof(tmpname))) {
+    return false;
+  }
+
+  int fd;
+  if ((fd = open(tmpname, O_CREAT | O_TRUNC | O_WRONLY, 0644)) != -1) {
+    header hdr;
+    memcpy(hdr.signature, signature, sizeof(signature));
+    hdr.version = version;
+    hdr.entry_size = sizeof(entry);
+    hdr.count = _M_used;
+
+    bool ret = (io::write_all(fd, &hdr, sizeof(header))) &&
+               (io::write_all(fd, _M_entries, _M_used * sizeof(entry)));
+
+    // The descriptor is closed exactly once, even if close() fails.
+    ret = (close(fd) == 0) && (ret);
+
+    if ((ret) && (rename(tmpname, filename) == 0)) {
+      return true;
+    }
+
+    unlink(tmpname);
+  }
+
+  return false;
+}
+
+void pcap::frame_index::scan(const uint8_t* data, size_t len)
+{
+  // File header.
+  if (_M_pos < _M_header_size) {
+    const size_t n = collect_header(data, len);
+
+    data += n;
+    len -= n;
+  }
+
+  while (len > 0) {
+    // Skip the rest of the current record.
+    if (_M_pos < _M_next) {
+      const size_t n = (_M_next - _M_pos < len) ? _M_next - _M_pos : len;
+
+      _M_pos += n;
+      data += n;
+      len -= n;
+
+      continue;
+    }
+
+    // Add bytes to the head of the record at `_M_next`.
+    size_t n = sizeof(_M_head) - _M_headlen;
+    if (n > len) {
+      n = len;
+    }
+
+    memcpy(_M_head + _M_headlen, data, n);
+    _M_headlen += n;
+
+    _M_pos += n;
+    data += n;
+    len -= n;
+
+    // Parse the records whose heads are complete.
+    while (parse_record()) {
+    }
+  }
+}
+
+size_t pcap::frame_index::collect_header(const uint8_t* data, size_t len)
+{
+  if ((!_M_header) &&
+      ((_M_header = static_cast<uint8_t*>(malloc(_M_header_size))) ==
+       nullptr)) {
+    // Don't look for records.
+    _M_failed = true;
+    _M_next = UINT64_MAX;
+  }
+
+  size_t n = _M_header_size - _M_pos;
+  if (n > len) {
+    n = len;
+  }
+
+  if (_M_header) {
+    memcpy(_M_header + _M_pos, data, n);
+  }
+
+  _M_pos += n;
+
+  if ((_M_pos == _M_header_size) && (_M_header)) {
+    if (_M_pcapng) {
+      // Parse the interface description blocks.
+      pcapng::packet pkt;
+      if ((!_M_parser.open(_M_header, _M_header_size)) ||
+          (_M_parser.next(pkt))) {
+        _M_next = UINT64_MAX;
+      }
+    } else {
+      _M_resolution = resolution_of(
+                        reinterpret_cast<const pcap_file_header*>(
+                          _M_header
+                        )->magic
+                      );
+    }
+  }
+
+  return n;
+}
+
+bool pcap::frame_index::parse_record()
+{
+  uint64_t len;
+
+  if (!_M_pcapng) {
+    if (_M_headlen < sizeof(pcap_pkthdr)) {
+      return false;
+    }
+
+    const pcap_pkthdr* const
+      hdr = reinterpret_cast<const pcap_pkthdr*>(_M_head);
+
+    len = sizeof(pcap_pkthdr) + static_cast<uint64_t>(hdr->caplen);
+
+    add_packet(_M_next, timestamp(hdr, _M_resolution));
+  } else {
+    if (_M_headlen < 8) {
+      return false;
+    }
+
+    uint32_t type, blocklen;
+    memcpy(&type, _M_head, 4);
+    memcpy(&blocklen, _M_head + 4, 4);
+
+    if ((blocklen < 12) || ((blocklen % 4) != 0)) {
+      // Not a pcapng block: stop looking for records.
+      _M_next = UINT64_MAX;
+      _M_headlen = 0;
+
+      return false;
+    }
+
+    if (static_cast<pcapng::block_type>(type) ==
+        pcapng::block_type::enhanced_packet) {
+      if (_M_headlen < 20) {
+        return false;
+      }
+
+      uint32_t id, high, low;
+      memcpy(&id, _M_head + 8, 4);
+      memcpy(&high, _M_head + 12, 4);
+      memcpy(&low, _M_head + 16, 4);
+
+      const pcapng::interface* iface;
+      if ((iface = _M_parser.get_interface(id)) != nullptr) {
+        add_packet(_M_next,
+                   iface->timestamp((static_cast<uint64_t>(high) << 32) |
+                                    low));
+      }
+    }
+
+    len = blocklen;
+  }
+
+  if (len >= _M_headlen) {
+    _M_next += len;
+    _M_headlen = 0;
+
+    return false;
+  }
+
+  // The head holds the beginning of the next record too.
+  memmove(_M_head, _M_head + len, _M_headlen - len);
+  _M_headlen -= len;
+  _M_next += len;
+
+  return true;
+}
+
+void pcap::frame_index::add_packet(uint64_t start, nanoseconds ts)
+{
+  // The head of the record might have been completed in a later frame.
+  size_t i = _M_used - 1;
+  while ((i > 0) && (start < _M_entries[i].data_offset)) {
+    i--;
+  }
+
+  entry* const e = &_M_entries[i];
+
+  if (e->packets++ == 0) {
+    e->first_record = start;
+    e->first_timestamp = ts;
+    e->last_timestamp = ts;
+  } else if (ts < e->first_timestamp) {
+    e->first_timestamp = ts;
+  } else if (ts > e->last_timestamp) {
+    e->last_timestamp = ts;
+  }
+}
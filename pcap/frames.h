@@ -0,0 +1,131 @@
+#ifndef PCAP_FRAMES_H
+#define PCAP_FRAMES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/pcap.h"
+#include "pcap/pcapng.h"
+
+namespace pcap {
+  // Timestamp index of the frames of a compressed output file.
+  // The uncompressed data of the frames is scanned in order (as a PCAP or
+  // pcapng file) and each frame gets the offset of the first record which
+  // starts in it and the earliest and latest timestamps of its packets, so
+  // a time range can be extracted by decompressing only the frames which
+  // overlap it (a record can continue into the next frame).
+  //
+  // The index is saved as a sidecar file: a header followed by one entry per
+  // frame, in host byte order.
+  class frame_index {
+    public:
+      // Frame entry.
+      struct entry {
+        // Offset and size of the compressed frame.
+        uint64_t offset;
+        uint64_t size;
+
+        // Offset and size of the uncompressed data.
+        uint64_t data_offset;
+        uint64_t data_size;
+
+        // Offset (in the uncompressed data) of the first record which starts
+        // in the frame (`no_record` if none).
+        uint64_t first_record;
+
+        // Earliest and latest timestamps (nanoseconds) and number of
+        // packets starting in the frame.
+        uint64_t first_timestamp;
+        uint64_t last_timestamp;
+        uint64_t packets;
+      };
+
+      // Header of the sidecar file.
+      struct header {
+        uint8_t signature[8];
+        uint32_t version;
+        uint32_t entry_size;
+        uint64_t count;
+      };
+
+      static constexpr const uint64_t no_record = UINT64_MAX;
+
+      // Constructor: the output file is a pcapng file (with a section
+      // header and interface description blocks of `header_size` bytes) or a
+      // PCAP file.
+      frame_index(bool pcapng, uint64_t header_size)
+        : _M_pcapng(pcapng),
+          _M_header_size(header_size),
+          _M_next(header_size)
+      {
+      }
+
+      // Destructor.
+      ~frame_index();
+
+      // Add frame (an io::compressor::frame_function).
+      static void add(void* arg,
+                      const uint8_t* data,
+                      size_t len,
+                      uint64_t offset,
+                      size_t size);
+
+      // Number of frames.
+      size_t count() const
+      {
+        return _M_used;
+      }
+
+      // Save index.
+      bool save(const char* filename) const;
+
+    private:
+      // Is the output file a pcapng file?
+      bool _M_pcapng;
+
+      // Size of the file header (PCAP file header or pcapng section header
+      // and interface description blocks), collected in `_M_header`.
+      uint64_t _M_header_size;
+      uint8_t* _M_header = nullptr;
+
+      // Interfaces of the pcapng file.
+      pcapng::parser _M_parser;
+
+      // Resolution of the PCAP file.
+      resolution _M_resolution = resolution::microseconds;
+
+      // Position in the uncompressed data and start of the next record.
+      uint64_t _M_pos = 0;
+      uint64_t _M_next = 0;
+
+      // First bytes of the next record.
+      uint8_t _M_head[20];
+      size_t _M_headlen = 0;
+
+      // Entries.
+      entry* _M_entries = nullptr;
+      size_t _M_size = 0;
+      size_t _M_used = 0;
+
+      // Could an entry not be allocated?
+      bool _M_failed = false;
+
+      // Scan the uncompressed data of the last frame.
+      void scan(const uint8_t* data, size_t len);
+
+      // Collect file header; returns the number of bytes consumed.
+      size_t collect_header(const uint8_t* data, size_t len);
+
+      // Parse the head of the record starting at `_M_next`.
+      // Returns false if more bytes are needed.
+      bool parse_record();
+
+      // Account packet of the last frame.
+      void add_packet(uint64_t start, nanoseconds ts);
+
+      // Disable copy constructor and assignment operator.
+      frame_index(const frame_index&) = delete;
+      frame_index& operator=(const frame_index&) = delete;
+  };
+}
+
+#endif // PCAP_FRAMES_H
@@ -0,0 +1,277 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "pcap/interfaces.h"
+#include "pcap/decompress.h"
+#include "util/parallel.h"
+
+pcap::pcapng::interfaces::~interfaces()
+{
+  free(_M_blocks);
+  free(_M_offsets);
+  free(_M_maps);
+  free(_M_first);
+}
+
+bool pcap::pcapng::interfaces::build(const files& files, unsigned nworkers)
+{
+  const size_t count = files.count();
+
+  size_t* first;
+  if ((first = static_cast<size_t*>(
+                 realloc(_M_first, (count + 1) * sizeof(size_t))
+               )) == nullptr) {
+    return false;
+  }
+
+  // Indices of the pcapng files.
+  size_t* indices;
+  if ((indices = static_cast<size_t*>(
+                   malloc((count > 0 ? count : 1) * sizeof(size_t))
+                 )) == nullptr) {
+    return false;
+  }
+
+  size_t npcapng = 0;
+  for (size_t i = 0; i < count; i++) {
+    if (is_pcapng(files.get(i)->magic)) {
+      indices[npcapng++] = i;
+    }
+  }
+
+  // Parse the pcapng files in parallel, each one into its own table.
+  interfaces* tables = nullptr;
+  if ((npcapng > 0) &&
+      (((tables = new (std::nothrow) interfaces[npcapng]) == nullptr) ||
+       (!util::parallel_for(
+           npcapng,
+           nworkers,
+           [&](unsigned worker, size_t idx) {
+             return tables[idx].add(*files.get(indices[idx]));
+           }
+         )))) {
+    delete [] tables;
+    free(indices);
+
+    return false;
+  }
+
+  free(indices);
+
+  _M_first = first;
+  _M_nfiles = count;
+  _M_used = 0;
+  _M_count = 0;
+  _M_nmaps = 0;
+
+  size_t next = 0;
+  for (size_t i = 0; i < count; i++) {
+    const file* const f = files.get(i);
+
+    _M_first[i] = _M_nmaps;
+
+    if (is_pcapng(f->magic)) {
+      if (!add(tables[next++])) {
+        delete [] tables;
+        return false;
+      }
+    } else {
+      struct interface iface;
+      iface.linktype = f->linktype;
+      iface.snaplen = f->snaplen;
+      iface.exponent = (resolution_of(f->magic) == resolution::nanoseconds) ?
+                       9 :
+                       6;
+
+      iface.power_of_two = false;
+      iface.offset = 0;
+
+      uint8_t block[max_interface_size];
+      if (!add(block, encode_interface(block, iface))) {
+        delete [] tables;
+        return false;
+      }
+    }
+  }
+
+  delete [] tables;
+
+  _M_first[count] = _M_nmaps;
+
+  return true;
+}
+
+bool pcap::pcapng::interfaces::write(writer& w) const
+{
+  uint8_t shb[section_header_size];
+  encode_section_header(shb);
+
+  return (w.copy(shb, sizeof(shb))) && (w.write(_M_blocks, _M_used));
+}
+
+void pcap::pcapng::interfaces::limit_snaplen(uint32_t snaplen)
+{
+  for (size_t id = 0; id < _M_count; id++) {
+    // Snapshot length after the block type, the block length, the link type
+    // and the reserved field (0: no limit).
+    uint8_t* const ptr = _M_blocks + _M_offsets[id] + 12;
+
+    uint32_t current;
+    memcpy(&current, ptr, sizeof(uint32_t));
+
+    if ((current == 0) || (current > snaplen)) {
+      memcpy(ptr, &snaplen, sizeof(uint32_t));
+    }
+  }
+}
+
+bool pcap::pcapng::interfaces::identity(size_t idx) const
+{
+  for (size_t i = _M_first[idx]; i < _M_first[idx + 1]; i++) {
+    if (_M_maps[i] != i - _M_first[idx]) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+bool pcap::pcapng::interfaces::add(const uint8_t* block, size_t len)
+{
+  // Look for the interface.
+  size_t id;
+  for (id = 0; id < _M_count; id++) {
+    const size_t end = (id + 1 < _M_count) ? _M_offsets[id + 1] : _M_used;
+
+    if ((end - _M_offsets[id] == len) &&
+        (memcmp(_M_blocks + _M_offsets[id], block, len) == 0)) {
+      break;
+    }
+  }
+
+  if (id == _M_count) {
+    // New interface.
+    if (_M_used + len > _M_size) {
+      size_t size = (_M_size > 0) ? _M_size * 2 : 4096;
+      while (_M_used + len > size) {
+        size *= 2;
+      }
+
+      uint8_t* blocks;
+      if ((blocks = static_cast<uint8_t*>(realloc(_M_blocks, size))) ==
+          nullptr) {
+        return false;
+      }
+
+      _M_blocks = blocks;
+      _M_size = size;
+    }
+
+    // Grow the array of offsets when the count reaches a power of two.
+    if ((_M_count & (_M_count - 1)) == 0) {
+      size_t* offsets;
+      if ((offsets = static_cast<size_t*>(
+                       realloc(_M_offsets,
+                               (_M_count > 0 ? _M_count * 2 : 1) *
+                               sizeof(size_t))
+                     )) == nullptr) {
+        return false;
+      }
+
+      _M_offsets = offsets;
+    }
+
+    memcpy(_M_blocks + _M_used, block, len);
+
+    _M_offsets[_M_count++] = _M_used;
+    _M_used += len;
+  }
+
+  // Add interface ID to the map of the current file (growing the maps when
+  // their size reaches a power of two).
+  if ((_M_nmaps & (_M_nmaps - 1)) == 0) {
+    uint32_t* maps;
+    if ((maps = static_cast<uint32_t*>(
+                  realloc(_M_maps,
+                          (_M_nmaps > 0 ? _M_nmaps * 2 : 1) * sizeof(uint32_t))
+                )) == nullptr) {
+      return false;
+    }
+
+    _M_maps = maps;
+  }
+
+  _M_maps[_M_nmaps++] = id;
+
+  return true;
+}
+
+bool pcap::pcapng::interfaces::add(const file& f)
+{
+  // Open file for reading.
+  uint64_t size;
+  int fd;
+  if ((fd = open_data(f, size)) == -1) {
+    return false;
+  }
+
+  // Map file into memory.
+  void* base;
+  if ((base = mmap(nullptr,
+                   size,
+                   PROT_READ,
+                   MAP_SHARED,
+                   fd,
+                   0)) == MAP_FAILED) {
+    close(fd);
+    return false;
+  }
+
+  close(fd);
+
+  bool ret = true;
+
+  // Collect the interfaces of all the sections.
+  parser parser;
+  if (parser.open(base, size)) {
+    // (interface description blocks can appear anywhere in the file).
+    packet pkt;
+    while (parser.next(pkt)) {
+    }
+
+    for (size_t i = 0; (ret) && (i < parser.interfaces()); i++) {
+      const struct interface* const iface = parser.get_interface(i);
+
+      if (!iface->swapped) {
+        ret = add(iface->block, iface->block_length);
+      } else {
+        uint8_t block[max_interface_size];
+        ret = add(block, encode_interface(block, *iface));
+      }
+    }
+  } else {
+    ret = false;
+  }
+
+  munmap(base, size);
+
+  return ret;
+}
+
+bool pcap::pcapng::interfaces::add(const interfaces& other)
+{
+  for (size_t i = 0; i < other._M_nmaps; i++) {
+    const size_t id = other._M_maps[i];
+    const size_t end = (id + 1 < other._M_count) ? other._M_offsets[id + 1] :
+                                                   other._M_used;
+
+    if (!add(other._M_blocks + other._M_offsets[id],
+             end - other._M_offsets[id])) {
+      return false;
+    }
+  }
+
+  return true;
+}
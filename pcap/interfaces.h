@@ -0,0 +1,95 @@
+#ifndef PCAP_INTERFACES_H
+#define PCAP_INTERFACES_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/files.h"
+#include "pcap/pcapng.h"
+
+namespace pcap {
+  namespace pcapng {
+    // Interface table of a pcapng output file.
+    // The interfaces of all the input files are merged into a single
+    // section: interface description blocks with the same contents (in host
+    // byte order) are written once, and each input file gets a map from its
+    // interfaces (in all its sections) to the interface IDs of the output
+    // file. PCAP files have a single interface with their link type,
+    // snapshot length and timestamp resolution.
+    class interfaces {
+      public:
+        // Constructor.
+        interfaces() = default;
+
+        // Destructor.
+        ~interfaces();
+
+        // Build the table for the files [0, files.count()). The pcapng files
+        // are parsed by `nworkers` threads into tables of their own, merged
+        // in the order of the files.
+        bool build(const files& files, unsigned nworkers);
+
+        // Number of interfaces.
+        size_t count() const
+        {
+          return _M_count;
+        }
+
+        // Size of the section header block and the interface description
+        // blocks.
+        uint64_t header_size() const
+        {
+          return section_header_size + _M_used;
+        }
+
+        // Write the section header block and the interface description
+        // blocks (the writer is not flushed).
+        bool write(writer& w) const;
+
+        // Lower the snapshot length of the interfaces to `snaplen` (for
+        // truncated packets).
+        void limit_snaplen(uint32_t snaplen);
+
+        // Map of the interfaces of the file `idx`.
+        const uint32_t* map(size_t idx) const
+        {
+          return _M_maps + _M_first[idx];
+        }
+
+        // Do the interfaces of the file `idx` keep their IDs?
+        bool identity(size_t idx) const;
+
+      private:
+        // Interface description blocks.
+        uint8_t* _M_blocks = nullptr;
+        size_t _M_size = 0;
+        size_t _M_used = 0;
+
+        // Offsets of the interface description blocks.
+        size_t* _M_offsets = nullptr;
+        size_t _M_count = 0;
+
+        // Maps of the files (the map of the file `i` starts at
+        // `_M_maps[_M_first[i]]`).
+        uint32_t* _M_maps = nullptr;
+        size_t _M_nmaps = 0;
+        size_t* _M_first = nullptr;
+        size_t _M_nfiles = 0;
+
+        // Add interface description block (if not already present) and
+        // its ID to the map of the current file.
+        bool add(const uint8_t* block, size_t len);
+
+        // Add interfaces of a pcapng file.
+        bool add(const file& f);
+
+        // Add the interfaces of the table of a single file.
+        bool add(const interfaces& other);
+
+        // Disable copy constructor and assignment operator.
+        interfaces(const interfaces&) = delete;
+        interfaces& operator=(const interfaces&) = delete;
+    };
+  }
+}
+
+#endif // PCAP_INTERFACES_H
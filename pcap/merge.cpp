@@ -0,0 +1,202 @@
+#include <stdlib.h>
+#include <new>
+#include "pcap/merge.h"
+#include "pcap/reader.h"
+
+namespace {
+  // Loser tree.
+  // Leaves are the readers; internal node n (1 <= n < k) holds the loser of
+  // the match played at that node and node 0 holds the overall winner.
+  class loser_tree {
+    public:
+      // Constructor.
+      loser_tree(pcap::reader* readers, unsigned k)
+        : _M_readers(readers),
+          _M_k(k)
+      {
+      }
+
+      // Destructor.
+      ~loser_tree()
+      {
+        free(_M_tree);
+      }
+
+      // Build tree.
+      bool build()
+      {
+        unsigned* winners;
+        if (((_M_tree = static_cast<unsigned*>(
+                          malloc(_M_k * sizeof(unsigned))
+                        )) == nullptr) ||
+            ((winners = static_cast<unsigned*>(
+                          malloc(2 * _M_k * sizeof(unsigned))
+                        )) == nullptr)) {
+          return false;
+        }
+
+        for (unsigned i = 0; i < _M_k; i++) {
+          winners[_M_k + i] = i;
+        }
+
+        for (unsigned n = _M_k - 1; n > 0; n--) {
+          const unsigned a = winners[2 * n];
+          const unsigned b = winners[2 * n + 1];
+
+          if (less(a, b)) {
+            winners[n] = a;
+            _M_tree[n] = b;
+          } else {
+            winners[n] = b;
+            _M_tree[n] = a;
+          }
+        }
+
+        _M_tree[0] = (_M_k > 1) ? winners[1] : 0;
+
+        free(winners);
+
+        return true;
+      }
+
+      // Get winner.
+      unsigned winner() const
+      {
+        return _M_tree[0];
+      }
+
+      // Replay the matches of the leaf `i` (after its reader has moved).
+      void replay(unsigned i)
+      {
+        unsigned winner = i;
+
+        for (unsigned n = (_M_k + i) / 2; n > 0; n /= 2) {
+          if (less(_M_tree[n], winner)) {
+            const unsigned tmp = _M_tree[n];
+            _M_tree[n] = winner;
+            winner = tmp;
+          }
+        }
+
+        _M_tree[0] = winner;
+      }
+
+    private:
+      pcap::reader* _M_readers;
+      unsigned _M_k;
+      unsigned* _M_tree = nullptr;
+
+      // Does the reader `a` go before the reader `b`?
+      // Exhausted readers go last; ties are broken by file order.
+      bool less(unsigned a, unsigned b) const
+      {
+        const pcap::reader& ra = _M_readers[a];
+        const pcap::reader& rb = _M_readers[b];
+
+        if (ra.valid()) {
+          if (rb.valid()) {
+            return (ra.timestamp() < rb.timestamp()) ||
+                   ((ra.timestamp() == rb.timestamp()) && (a < b));
+          }
+
+          return true;
+        }
+
+        return (!rb.valid()) && (a < b);
+      }
+  };
+}
+
+bool pcap::merge(const files& files,
+                 size_t first,
+                 size_t last,
+                 writer& w,
+                 const pcapng::interfaces* ifaces)
+{
+  writer* const writers[1] = {&w};
+
+  return merge(files, first, last, writers, 1, nullptr, nullptr, ifaces);
+}
+
+bool pcap::merge(const files& files,
+                 size_t first,
+                 size_t last,
+                 writer* const* writers,
+                 size_t nwriters,
+                 route_function route,
+                 void* arg,
+                 const pcapng::interfaces* ifaces)
+{
+  const unsigned k = last - first;
+
+  reader* readers;
+  if ((readers = new (std::nothrow) reader[k]) == nullptr) {
+    return false;
+  }
+
+  for (unsigned i = 0; i < k; i++) {
+    if (!readers[i].open(*files.get(first + i))) {
+      delete [] readers;
+      return false;
+    }
+  }
+
+  bool ret = false;
+
+  loser_tree tree(readers, k);
+  if (tree.build()) {
+    do {
+      const unsigned i = tree.winner();
+      reader& r = readers[i];
+
+      if (!r.valid()) {
+        // All the readers are exhausted.
+        ret = true;
+        for (size_t j = 0; j < nwriters; j++) {
+          if (!writers[j]->flush()) {
+            ret = false;
+          }
+        }
+
+        break;
+      }
+
+      const unsigned dest = route ? route(arg, r) : 0;
+
+      if (dest != drop_packet) {
+        writer& w = *writers[dest];
+
+        if (!ifaces) {
+          if (!w.write(r.header(), r.data(), r.timestamp_resolution())) {
+            break;
+          }
+        } else {
+          const uint32_t id = ifaces->map(first + i)[r.interface()];
+
+          // Packets longer than the snapshot length are encoded again.
+          const uint32_t caplen = r.header()->caplen;
+
+          if (!(((r.block()) && (caplen <= w.snaplen())) ?
+                  pcapng::write_block(w, r.block(), r.block_length(), id) :
+                  pcapng::write_packet(w,
+                                       id,
+                                       r.ticks(),
+                                       r.data(),
+                                       (caplen <= w.snaplen()) ? caplen :
+                                                                 w.snaplen(),
+                                       r.header()->len))) {
+            break;
+          }
+        }
+      }
+
+      r.next();
+      tree.replay(i);
+    } while (true);
+  }
+
+  // The writers have been flushed (or failed) before unmapping the files.
+  delete [] readers;
+
+  return ret;
+}
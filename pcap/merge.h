@@ -0,0 +1,45 @@
+#ifndef PCAP_MERGE_H
+#define PCAP_MERGE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+#include "pcap/interfaces.h"
+#include "pcap/reader.h"
+#include "pcap/writer.h"
+
+namespace pcap {
+  // Routing function: index of the writer of the current packet of `r`, or
+  // `drop_packet` to skip it.
+  typedef unsigned (*route_function)(void* arg, const reader& r);
+
+  static constexpr const unsigned drop_packet = UINT32_MAX;
+
+  // Merge the packets of the files [first, last) by timestamp (k-way merge
+  // over a loser tree) and write them with `w` (which is flushed).
+  // Packets with the same timestamp keep the order of the files.
+  // Timestamps are converted to the resolution of the writer if needed and
+  // packets are truncated to its snapshot length.
+  // If `ifaces` is not nullptr, packets are written as pcapng enhanced
+  // packet blocks with the interface IDs of the output file.
+  bool merge(const files& files,
+             size_t first,
+             size_t last,
+             writer& w,
+             const pcapng::interfaces* ifaces);
+
+  // Merge the packets of the files [first, last) by timestamp and write each
+  // of them with the writer chosen by `route` among `writers` (which are all
+  // flushed).
+  bool merge(const files& files,
+             size_t first,
+             size_t last,
+             writer* const* writers,
+             size_t nwriters,
+             route_function route,
+             void* arg,
+             const pcapng::interfaces* ifaces);
+}
+
+#endif // PCAP_MERGE_H
@@ -0,0 +1,426 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <limits.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <atomic>
+#include "pcap/offsets.h"
+#include "io/rw.h"
+#include "util/parallel.h"
+
+// Signature and version of the sidecar file.
+static const uint8_t signature[8] = {'M', 'C', 'A', 'P', 'O', 'I', 'D', 'X'};
+static constexpr const uint32_t version = 1;
+
+// Distance (in bytes) at which the packet headers are prefetched.
+static constexpr const size_t prefetch_distance = 4096;
+
+// Get the timestamp of the packet record at `ptr` and the start of the next
+// one. Returns false if the record is truncated.
+static inline bool read_record(const uint8_t* ptr,
+                               const uint8_t* end,
+                               bool swapped,
+                               pcap::resolution res,
+                               pcap::nanoseconds& ts,
+                               const uint8_t*& next)
+{
+  if (ptr + sizeof(pcap::pcap_pkthdr) <= end) {
+    pcap::pcap_pkthdr hdr = *reinterpret_cast<const pcap::pcap_pkthdr*>(ptr);
+    if (swapped) {
+      pcap::swap(hdr);
+    }
+
+    next = ptr + sizeof(pcap::pcap_pkthdr) + hdr.caplen;
+    if (next <= end) {
+      ts = pcap::timestamp(&hdr, res);
+      return true;
+    }
+  }
+
+  return false;
+}
+
+// Index of the first sample for which `pred` is true (the samples are
+// partitioned by `pred`).
+template<typename Predicate>
+static size_t partition_point(const pcap::offset_index::sample* samples,
+                              size_t count,
+                              Predicate pred)
+{
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+
+    if (!pred(samples[mid])) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+// Walk the packets from the sample `from` up to the offset `to` until `stop`
+// is true for a packet (timestamp, offset and number); returns its offset
+// and stores its number in `packet` (if not null).
+template<typename Predicate>
+static uint64_t walk_from(const uint8_t* base,
+                          const pcap::file& f,
+                          const pcap::offset_index::sample& from,
+                          uint64_t to,
+                          Predicate stop,
+                          uint64_t* packet)
+{
+  const uint8_t* const end = base + to;
+  const uint8_t* ptr = base + from.offset;
+  uint64_t n = from.packet;
+
+  const pcap::resolution res = pcap::resolution_of(f.magic);
+  const bool swapped = pcap::is_swapped(f.magic);
+
+  pcap::nanoseconds ts;
+  const uint8_t* next;
+  while ((read_record(ptr, end, swapped, res, ts, next)) &&
+         (!stop(ts, ptr - base, n))) {
+    ptr = next;
+    n++;
+  }
+
+  if (packet) {
+    *packet = n;
+  }
+
+  return ptr - base;
+}
+
+pcap::offset_index::~offset_index()
+{
+  free(_M_samples);
+}
+
+bool pcap::offset_index::build(const uint8_t* base,
+                               const file& f,
+                               unsigned packet_interval,
+                               uint64_t byte_interval)
+{
+  _M_used = 0;
+
+  const uint8_t* const end = base + f.data_end();
+  const uint8_t* ptr = base + sizeof(pcap_file_header);
+
+  const resolution res = resolution_of(f.magic);
+  const bool swapped = is_swapped(f.magic);
+
+  // Packet number and offset of the next sample.
+  uint64_t next_packet = 0;
+  uint64_t next_offset = 0;
+
+  uint64_t n = 0;
+  nanoseconds ts;
+  const uint8_t* next;
+  for (; read_record(ptr, end, swapped, res, ts, next); n++) {
+    // The next headers are somewhere ahead.
+    __builtin_prefetch(ptr + prefetch_distance);
+
+    const uint64_t offset = ptr - base;
+
+    if ((n >= next_packet) || (offset >= next_offset)) {
+      if (!add(ts, offset, n)) {
+        return false;
+      }
+
+      next_packet = n + packet_interval;
+      next_offset = offset + byte_interval;
+    }
+
+    ptr = next;
+  }
+
+  _M_packets = n;
+  _M_end = ptr - base;
+
+  return true;
+}
+
+bool pcap::offset_index::load(const file& f)
+{
+  char filename[PATH_MAX];
+  if (!sidecar(f, filename, sizeof(filename))) {
+    return false;
+  }
+
+  int fd;
+  if ((fd = open(filename, O_RDONLY)) == -1) {
+    return false;
+  }
+
+  bool ret = false;
+
+  header hdr;
+  struct stat sbuf;
+  if ((io::read_all(fd, &hdr, sizeof(header))) &&
+      (memcmp(hdr.signature, signature, sizeof(signature)) == 0) &&
+      (hdr.version == version) &&
+      (hdr.sample_size == sizeof(sample)) &&
+      (hdr.filesize == f.filesize) &&
+      (hdr.inode == f.inode) &&
+      (hdr.mtime == f.mtime) &&
+      (fstat(fd, &sbuf) == 0) &&
+      (static_cast<uint64_t>(sbuf.st_size) ==
+       sizeof(header) + hdr.count * sizeof(sample)) &&
+      (allocate(hdr.count)) &&
+      (io::read_all(fd, _M_samples, hdr.count * sizeof(sample)))) {
+    _M_used = hdr.count;
+    _M_packets = hdr.packets;
+    _M_end = hdr.end;
+
+    ret = true;
+  }
+
+  close(fd);
+
+  return ret;
+}
+
+bool pcap::offset_index::save(const file& f) const
+{
+  char filename[PATH_MAX];
+  if (!sidecar(f, filename, sizeof(filename))) {
+    return false;
+  }
+
+  // Write to a temporary file and rename it, so readers never see a
+  // partially written index.
+  char tmpname[PATH_MAX];
+  if (snprintf(tmpname,
+               sizeof(tmpname),
+               "%s.%ld.tmp",
+               filename,
+               static_cast<long>(getpid())) >=
+      static_cast<int>(sizeof(tmpname))) {
+    return false;
+  }
+
+  int fd;
+  if ((fd = open(tmpname, O_CREAT | O_TRUNC | O_WRONLY, 0644)) != -1) {
+    header hdr;
+    memcpy(hdr.signature, signature, sizeof(signature));
+    hdr.version = version;
+    hdr.sample_size = sizeof(sample);
+    hdr.filesize = f.filesize;
+    hdr.inode = f.inode;
+    hdr.mtime = f.mtime;
+    hdr.end = _M_end;
+    hdr.packets = _M_packets;
+    hdr.count = _M_used;
+
+    bool ret = (io::write_all(fd, &hdr, sizeof(header))) &&
+               (io::write_all(fd, _M_samples, _M_used * sizeof(sample)));
+
+    // The descriptor is closed exactly once, even if close() fails.
+    ret = (close(fd) == 0) && (ret);
+
+    if ((ret) && (rename(tmpname, filename) == 0)) {
+      return true;
+    }
+
+    unlink(tmpname);
+  }
+
+  return false;
+}
+
+uint64_t pcap::offset_index::seek(const uint8_t* base,
+                                  const file& f,
+                                  nanoseconds ts,
+                                  uint64_t* packet) const
+{
+  const size_t idx = partition_point(_M_samples,
+                                     _M_used,
+                                     [ts](const sample& s) {
+                                       return (s.timestamp >= ts);
+                                     });
+
+  if (idx == 0) {
+    return first(packet);
+  }
+
+  return walk_from(base,
+                   f,
+                   _M_samples[idx - 1],
+                   (idx < _M_used) ? _M_samples[idx].offset : _M_end,
+                   [ts](nanoseconds t, uint64_t, uint64_t) {
+                     return (t >= ts);
+                   },
+                   packet);
+}
+
+uint64_t pcap::offset_index::seek_offset(const uint8_t* base,
+                                         const file& f,
+                                         uint64_t offset,
+                                         uint64_t* packet) const
+{
+  const size_t idx = partition_point(_M_samples,
+                                     _M_used,
+                                     [offset](const sample& s) {
+                                       return (s.offset >= offset);
+                                     });
+
+  if (idx == 0) {
+    return first(packet);
+  }
+
+  return walk_from(base,
+                   f,
+                   _M_samples[idx - 1],
+                   (idx < _M_used) ? _M_samples[idx].offset : _M_end,
+                   [offset](nanoseconds, uint64_t off, uint64_t) {
+                     return (off >= offset);
+                   },
+                   packet);
+}
+
+uint64_t pcap::offset_index::seek_packet(const uint8_t* base,
+                                         const file& f,
+                                         uint64_t n) const
+{
+  const size_t idx = partition_point(_M_samples,
+                                     _M_used,
+                                     [n](const sample& s) {
+                                       return (s.packet > n);
+                                     });
+
+  // The first sample is the first packet.
+  if (idx == 0) {
+    return _M_end;
+  }
+
+  return walk_from(base,
+                   f,
+                   _M_samples[idx - 1],
+                   (idx < _M_used) ? _M_samples[idx].offset : _M_end,
+                   [n](nanoseconds, uint64_t, uint64_t packet) {
+                     return (packet == n);
+                   },
+                   nullptr);
+}
+
+uint64_t pcap::offset_index::first(uint64_t* packet) const
+{
+  if (_M_used > 0) {
+    if (packet) {
+      *packet = 0;
+    }
+
+    return _M_samples[0].offset;
+  }
+
+  if (packet) {
+    *packet = _M_packets;
+  }
+
+  return _M_end;
+}
+
+bool pcap::offset_index::sidecar(const file& f, char* buf, size_t size)
+{
+  return (snprintf(buf, size, "%s.oidx", f.filename) <
+          static_cast<int>(size));
+}
+
+bool pcap::offset_index::add(nanoseconds ts, uint64_t offset, uint64_t packet)
+{
+  if ((_M_used == _M_size) &&
+      (!allocate((_M_size > 0) ? _M_size * 2 : 1024))) {
+    return false;
+  }
+
+  _M_samples[_M_used].timestamp = ts;
+  _M_samples[_M_used].offset = offset;
+  _M_samples[_M_used].packet = packet;
+  _M_used++;
+
+  return true;
+}
+
+bool pcap::offset_index::allocate(size_t count)
+{
+  if (count <= _M_size) {
+    return true;
+  }
+
+  sample* samples;
+  if ((samples = static_cast<sample*>(
+                   realloc(_M_samples, count * sizeof(sample))
+                 )) != nullptr) {
+    _M_samples = samples;
+    _M_size = count;
+
+    return true;
+  }
+
+  return false;
+}
+
+size_t pcap::build_offset_indices(const files& files, unsigned nworkers)
+{
+  std::atomic<size_t> nbuilt(0);
+
+  // Each worker indexes whole files.
+  util::parallel_for(
+    files.count(),
+    nworkers,
+    [&](unsigned worker, size_t idx) {
+      const file* const f = files.get(idx);
+
+      if ((is_pcapng(f->magic)) || (f->compressed)) {
+        return true;
+      }
+
+      offset_index index;
+      if (index.load(*f)) {
+        // Up to date.
+        return true;
+      }
+
+      bool ret = false;
+
+      // Open file for reading.
+      int fd;
+      if ((fd = open(f->filename, O_RDONLY)) != -1) {
+        // Map file into memory.
+        void* base;
+        if ((base = mmap(nullptr,
+                         f->filesize,
+                         PROT_READ,
+                         MAP_SHARED,
+                         fd,
+                         0)) != MAP_FAILED) {
+          madvise(base, f->filesize, MADV_SEQUENTIAL);
+
+          ret = (index.build(static_cast<const uint8_t*>(base), *f)) &&
+                (index.save(*f));
+
+          munmap(base, f->filesize);
+        }
+
+        close(fd);
+      }
+
+      if (ret) {
+        nbuilt++;
+      } else {
+        fprintf(stderr, "Error indexing '%s'.\n", f->filename);
+      }
+
+      return true;
+    }
+  );
+
+  return nbuilt;
+}
@@ -0,0 +1,140 @@
+#ifndef PCAP_OFFSETS_H
+#define PCAP_OFFSETS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+
+namespace pcap {
+  // Sparse index of the packet records of a PCAP file: the timestamp, the
+  // offset and the number of a packet every `packet_interval` packets or
+  // every `byte_interval` bytes, whichever comes first. A packet (by time,
+  // by offset or by number) is found with a binary search over the samples
+  // and a walk of at most one interval, assuming for the searches by time
+  // that the packets of the file are in timestamp order.
+  //
+  // The index can be saved as a sidecar file (FILENAME.oidx): a header,
+  // which identifies the PCAP file by size, inode number and modification
+  // time, followed by the samples, in host byte order.
+  class offset_index {
+    public:
+      // Sample.
+      struct sample {
+        nanoseconds timestamp;
+        uint64_t offset;
+        uint64_t packet;
+      };
+
+      // Header of the sidecar file.
+      struct header {
+        uint8_t signature[8];
+        uint32_t version;
+        uint32_t sample_size;
+        uint64_t filesize;
+        uint64_t inode;
+        int64_t mtime;
+        uint64_t end;
+        uint64_t packets;
+        uint64_t count;
+      };
+
+      // Default intervals between two samples.
+      static constexpr const unsigned default_packet_interval = 1024;
+      static constexpr const uint64_t default_byte_interval = 1024 * 1024;
+
+      // Constructor.
+      offset_index() = default;
+
+      // Destructor.
+      ~offset_index();
+
+      // Build the index of the packet records of a file mapped at `base`, in
+      // one sequential pass.
+      bool build(const uint8_t* base,
+                 const file& f,
+                 unsigned packet_interval = default_packet_interval,
+                 uint64_t byte_interval = default_byte_interval);
+
+      // Load the index from the sidecar file of `f`.
+      // Returns false if there is none or if it is out of date.
+      bool load(const file& f);
+
+      // Save the index to the sidecar file of `f`.
+      bool save(const file& f) const;
+
+      // Offset of the first packet whose timestamp is not earlier than `ts`
+      // (end of the packet records if there is none); its number is stored
+      // in `packet` (if not null).
+      uint64_t seek(const uint8_t* base,
+                    const file& f,
+                    nanoseconds ts,
+                    uint64_t* packet = nullptr) const;
+
+      // Offset of the first packet starting at or after `offset`.
+      uint64_t seek_offset(const uint8_t* base,
+                           const file& f,
+                           uint64_t offset,
+                           uint64_t* packet = nullptr) const;
+
+      // Offset of the packet number `n` (end of the packet records if the
+      // file has less packets).
+      uint64_t seek_packet(const uint8_t* base,
+                           const file& f,
+                           uint64_t n) const;
+
+      // Number of samples.
+      size_t count() const
+      {
+        return _M_used;
+      }
+
+      // Number of packets.
+      uint64_t packets() const
+      {
+        return _M_packets;
+      }
+
+      // End of the packet records.
+      uint64_t end() const
+      {
+        return _M_end;
+      }
+
+      // Get the name of the sidecar file of `f`.
+      static bool sidecar(const file& f, char* buf, size_t size);
+
+    private:
+      // Samples.
+      sample* _M_samples = nullptr;
+      size_t _M_size = 0;
+      size_t _M_used = 0;
+
+      // Number of packets and end of the packet records.
+      uint64_t _M_packets = 0;
+      uint64_t _M_end = 0;
+
+      // Offset of the first packet (end of the packet records if there is
+      // none).
+      uint64_t first(uint64_t* packet) const;
+
+      // Add sample.
+      bool add(nanoseconds ts, uint64_t offset, uint64_t packet);
+
+      // Allocate `count` samples.
+      bool allocate(size_t count);
+
+      // Disable copy constructor and assignment operator.
+      offset_index(const offset_index&) = delete;
+      offset_index& operator=(const offset_index&) = delete;
+  };
+
+  // Build the offset index of the PCAP files of the list which don't have an
+  // up-to-date sidecar file, using `nworkers` threads, and save it (the
+  // compressed files are skipped). pcapng files are not indexed: their
+  // records can't be read without their interface blocks.
+  // Returns the number of indices built.
+  size_t build_offset_indices(const files& files, unsigned nworkers);
+}
+
+#endif // PCAP_OFFSETS_H
@@ -0,0 +1,132 @@
+#ifndef PCAP_PCAP_H
+#define PCAP_PCAP_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace pcap {
+  enum class magic : uint32_t {
+    microseconds = 0xa1b2c3d4,
+    nanoseconds = 0xa1b23c4d,
+
+    // Written by a machine with the opposite byte order.
+    swapped_microseconds = 0xd4c3b2a1,
+    swapped_nanoseconds = 0x4d3cb2a1,
+
+    // pcapng file (block type of the section header block).
+    pcapng = 0x0a0d0d0a
+  };
+
+  static constexpr const uint16_t version_major = 2;
+  static constexpr const uint16_t version_minor = 4;
+
+  struct pcap_file_header {
+    uint32_t magic;
+    uint16_t version_major;
+    uint16_t version_minor;
+    int32_t thiszone;
+    uint32_t sigfigs;
+    uint32_t snaplen;
+    uint32_t linktype;
+  };
+
+  struct timeval {
+    uint32_t tv_sec;
+    uint32_t tv_usec;
+  };
+
+  struct pcap_pkthdr {
+    timeval ts;
+    uint32_t caplen;
+    uint32_t len;
+  };
+
+  // Link type of a pcapng file whose interfaces have different link types.
+  static constexpr const uint32_t linktype_mixed = 0xffffffff;
+
+  // Reserved bits of the link type field (they must be zero).
+  static constexpr const uint32_t linktype_reserved = 0x03ff0000;
+
+  // Snapshot length used when a file doesn't limit it (snapshot length 0).
+  static constexpr const uint32_t maximum_snaplen = 262144;
+
+  // Minimum size of a PCAP file.
+  static constexpr const size_t
+         minimum_size = sizeof(pcap_file_header) + sizeof(pcap_pkthdr);
+
+  // Timestamp: nanoseconds since the Epoch.
+  // Used for sorting and merging, whatever the resolution of the files.
+  typedef uint64_t nanoseconds;
+
+  // Resolution of the timestamps of a PCAP file.
+  enum class resolution {
+    microseconds,
+    nanoseconds
+  };
+
+  // Get resolution from the magic number.
+  // The timestamps of pcapng files are converted to nanoseconds when they
+  // are read.
+  static inline resolution resolution_of(uint32_t m)
+  {
+    return ((static_cast<magic>(m) == magic::nanoseconds) ||
+            (static_cast<magic>(m) == magic::swapped_nanoseconds) ||
+            (static_cast<magic>(m) == magic::pcapng)) ?
+             resolution::nanoseconds :
+             resolution::microseconds;
+  }
+
+  // Has the file been written by a machine with the opposite byte order?
+  static inline bool is_swapped(uint32_t m)
+  {
+    return (static_cast<magic>(m) == magic::swapped_microseconds) ||
+           (static_cast<magic>(m) == magic::swapped_nanoseconds);
+  }
+
+  // Is it a pcapng file?
+  static inline bool is_pcapng(uint32_t m)
+  {
+    return (static_cast<magic>(m) == magic::pcapng);
+  }
+
+  // Swap the byte order of a PCAP file header.
+  static inline void swap(pcap_file_header& hdr)
+  {
+    hdr.magic = __builtin_bswap32(hdr.magic);
+    hdr.version_major = __builtin_bswap16(hdr.version_major);
+    hdr.version_minor = __builtin_bswap16(hdr.version_minor);
+    hdr.thiszone = static_cast<int32_t>(
+                     __builtin_bswap32(static_cast<uint32_t>(hdr.thiszone))
+                   );
+    hdr.sigfigs = __builtin_bswap32(hdr.sigfigs);
+    hdr.snaplen = __builtin_bswap32(hdr.snaplen);
+    hdr.linktype = __builtin_bswap32(hdr.linktype);
+  }
+
+  // Swap the byte order of a packet header.
+  static inline void swap(pcap_pkthdr& hdr)
+  {
+    hdr.ts.tv_sec = __builtin_bswap32(hdr.ts.tv_sec);
+    hdr.ts.tv_usec = __builtin_bswap32(hdr.ts.tv_usec);
+    hdr.caplen = __builtin_bswap32(hdr.caplen);
+    hdr.len = __builtin_bswap32(hdr.len);
+  }
+
+  // Get magic number for a resolution.
+  static inline uint32_t magic_of(resolution res)
+  {
+    return static_cast<uint32_t>((res == resolution::nanoseconds) ?
+                                   magic::nanoseconds :
+                                   magic::microseconds);
+  }
+
+  // Get timestamp of a packet.
+  static inline nanoseconds timestamp(const pcap_pkthdr* hdr, resolution res)
+  {
+    return (res == resolution::nanoseconds) ?
+             (hdr->ts.tv_sec * 1000000000ull) + hdr->ts.tv_usec :
+             (hdr->ts.tv_sec * 1000000000ull) + hdr->ts.tv_usec * 1000ull;
+  }
+}
+
+#endif // PCAP_PCAP_H
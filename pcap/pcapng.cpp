@@ -0,0 +1,451 @@
+#include <stdlib.h>
+#include <string.h>
+#include "pcap/pcapng.h"
+
+__extension__ typedef unsigned __int128 uint128_t;
+
+// Powers of 10.
+static const uint64_t powers_of_ten[] = {
+  1ull,
+  10ull,
+  100ull,
+  1000ull,
+  10000ull,
+  100000ull,
+  1000000ull,
+  10000000ull,
+  100000000ull,
+  1000000000ull,
+  10000000000ull,
+  100000000000ull,
+  1000000000000ull,
+  10000000000000ull,
+  100000000000000ull,
+  1000000000000000ull,
+  10000000000000000ull,
+  100000000000000000ull,
+  1000000000000000000ull,
+  10000000000000000000ull
+};
+
+// Option codes.
+static constexpr const uint16_t opt_endofopt = 0;
+static constexpr const uint16_t if_tsresol = 9;
+static constexpr const uint16_t if_tsoffset = 14;
+
+// Size of the block header (type + length) and trailer (length).
+static constexpr const size_t block_overhead = 12;
+
+pcap::nanoseconds pcap::pcapng::interface::timestamp(uint64_t ts) const
+{
+  nanoseconds ns;
+
+  if (power_of_two) {
+    // Round to the nearest nanosecond.
+    const uint128_t half = (exponent > 0) ?
+                           static_cast<uint128_t>(1) << (exponent - 1) :
+                           0;
+
+    ns = static_cast<nanoseconds>(
+           (static_cast<uint128_t>(ts) * 1000000000ull + half) >> exponent
+         );
+  } else if (exponent <= 9) {
+    ns = ts * powers_of_ten[9 - exponent];
+  } else if (exponent - 9u <
+             sizeof(powers_of_ten) / sizeof(powers_of_ten[0])) {
+    ns = ts / powers_of_ten[exponent - 9];
+  } else {
+    ns = 0;
+  }
+
+  return ns + static_cast<nanoseconds>(offset) * 1000000000ull;
+}
+
+uint64_t pcap::pcapng::interface::ticks(nanoseconds ns) const
+{
+  ns -= static_cast<nanoseconds>(offset) * 1000000000ull;
+
+  if (power_of_two) {
+    return static_cast<uint64_t>(
+             (static_cast<uint128_t>(ns) << exponent) / 1000000000ull
+           );
+  } else if (exponent <= 9) {
+    return ns / powers_of_ten[9 - exponent];
+  } else if (exponent - 9u <
+             sizeof(powers_of_ten) / sizeof(powers_of_ten[0])) {
+    return ns * powers_of_ten[exponent - 9];
+  } else {
+    return 0;
+  }
+}
+
+pcap::pcapng::parser::~parser()
+{
+  free(_M_interfaces);
+}
+
+bool pcap::pcapng::parser::open(const void* buf, size_t len)
+{
+  if (is_pcapng(buf, len)) {
+    _M_ptr = static_cast<const uint8_t*>(buf);
+    _M_end = _M_ptr + len;
+    _M_swapped = false;
+    _M_used = 0;
+    _M_base = 0;
+    _M_last = 0;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool pcap::pcapng::parser::next(packet& pkt)
+{
+  while (read(pkt)) {
+    if ((pkt.timestamp >= _M_window_start) &&
+        (pkt.timestamp < _M_window_end)) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool pcap::pcapng::parser::read(packet& pkt)
+{
+  while (_M_ptr + block_overhead <= _M_end) {
+    const uint32_t raw = *reinterpret_cast<const uint32_t*>(_M_ptr);
+
+    // The block type of the section header block reads the same in both
+    // byte orders; the byte-order magic tells the byte order of the
+    // section.
+    if (static_cast<block_type>(raw) == block_type::section_header) {
+      const uint32_t
+        bom = *reinterpret_cast<const uint32_t*>(_M_ptr + 8);
+
+      if (bom == byte_order_magic) {
+        _M_swapped = false;
+      } else if (bom == __builtin_bswap32(byte_order_magic)) {
+        _M_swapped = true;
+      } else {
+        return false;
+      }
+    }
+
+    const uint32_t len = u32(_M_ptr + 4);
+
+    // Malformed or truncated block?
+    if ((len < block_overhead) ||
+        ((len % 4) != 0) ||
+        (len > static_cast<size_t>(_M_end - _M_ptr))) {
+      return false;
+    }
+
+    const uint8_t* const body = _M_ptr + 8;
+    const size_t bodylen = len - block_overhead;
+
+    switch (static_cast<block_type>(u32(_M_ptr))) {
+      case block_type::section_header:
+        if (!section_header(body, bodylen)) {
+          return false;
+        }
+
+        break;
+      case block_type::interface_description:
+        if (!interface_description(_M_ptr, len)) {
+          return false;
+        }
+
+        break;
+      case block_type::enhanced_packet:
+        {
+          if (bodylen < 20) {
+            return false;
+          }
+
+          const uint32_t id = u32(body);
+          const uint32_t caplen = u32(body + 12);
+
+          if ((id >= _M_used - _M_base) || (caplen > bodylen - 20)) {
+            return false;
+          }
+
+          const uint64_t ts = (static_cast<uint64_t>(u32(body + 4)) << 32) |
+                              u32(body + 8);
+
+          pkt.data = body + 20;
+          pkt.caplen = caplen;
+          pkt.len = u32(body + 16);
+          pkt.interface = _M_base + id;
+          pkt.timestamp = _M_interfaces[_M_base + id].timestamp(ts);
+          pkt.ticks = ts;
+          pkt.block = _M_ptr;
+          pkt.block_length = len;
+          pkt.enhanced = true;
+
+          _M_last = pkt.timestamp;
+          _M_ptr += len;
+
+          return true;
+        }
+      case block_type::simple_packet:
+        {
+          // Simple packet blocks belong to the first interface and have no
+          // timestamp: the timestamp of the previous packet is used.
+          if ((bodylen < 4) || (_M_used == _M_base)) {
+            return false;
+          }
+
+          const struct interface* const iface = &_M_interfaces[_M_base];
+
+          uint32_t caplen = u32(body);
+
+          if (caplen > bodylen - 4) {
+            caplen = bodylen - 4;
+          }
+
+          if ((iface->snaplen != 0) && (caplen > iface->snaplen)) {
+            caplen = iface->snaplen;
+          }
+
+          pkt.data = body + 4;
+          pkt.caplen = caplen;
+          pkt.len = u32(body);
+          pkt.interface = _M_base;
+          pkt.timestamp = _M_last;
+          pkt.ticks = iface->ticks(_M_last);
+          pkt.block = _M_ptr;
+          pkt.block_length = len;
+          pkt.enhanced = false;
+
+          _M_ptr += len;
+
+          return true;
+        }
+      case block_type::interface_statistics:
+      default:
+        // Skip block.
+        break;
+    }
+
+    _M_ptr += len;
+  }
+
+  return false;
+}
+
+bool pcap::pcapng::parser::is_pcapng(const void* buf, size_t len)
+{
+  if (len >= block_overhead) {
+    const uint32_t* const p = static_cast<const uint32_t*>(buf);
+
+    return (static_cast<block_type>(p[0]) == block_type::section_header) &&
+           ((p[2] == byte_order_magic) ||
+            (p[2] == __builtin_bswap32(byte_order_magic)));
+  }
+
+  return false;
+}
+
+bool pcap::pcapng::parser::section_header(const uint8_t* body, size_t len)
+{
+  // Byte-order magic, major version, minor version and section length.
+  if ((len >= 16) && (u16(body + 4) == 1)) {
+    // Interface IDs are local to the section.
+    _M_base = _M_used;
+
+    return true;
+  }
+
+  return false;
+}
+
+bool pcap::pcapng::parser::interface_description(const uint8_t* block,
+                                                 size_t len)
+{
+  if (len < block_overhead + 8) {
+    return false;
+  }
+
+  const uint8_t* const body = block + 8;
+
+  if (_M_used == _M_size) {
+    const size_t size = (_M_size > 0) ? _M_size * 2 : 8;
+
+    struct interface* interfaces;
+    if ((interfaces = static_cast<struct interface*>(
+                        realloc(_M_interfaces,
+                                size * sizeof(struct interface))
+                      )) == nullptr) {
+      return false;
+    }
+
+    _M_interfaces = interfaces;
+    _M_size = size;
+  }
+
+  struct interface* const iface = &_M_interfaces[_M_used++];
+
+  iface->linktype = u16(body);
+  iface->snaplen = u32(body + 4);
+  iface->exponent = 6;
+  iface->power_of_two = false;
+  iface->offset = 0;
+  iface->block = block;
+  iface->block_length = len;
+  iface->swapped = _M_swapped;
+
+  // Parse options.
+  const uint8_t* opt = body + 8;
+  const uint8_t* const end = block + len - 4;
+
+  while (opt + 4 <= end) {
+    const uint16_t code = u16(opt);
+    const uint16_t optlen = u16(opt + 2);
+
+    const uint8_t* const value = opt + 4;
+
+    if ((code == opt_endofopt) || (optlen > end - value)) {
+      break;
+    }
+
+    switch (code) {
+      case if_tsresol:
+        if (optlen >= 1) {
+          iface->exponent = *value & 0x7f;
+          iface->power_of_two = ((*value & 0x80) != 0);
+        }
+
+        break;
+      case if_tsoffset:
+        if (optlen >= 8) {
+          iface->offset = static_cast<int64_t>(u64(value));
+        }
+
+        break;
+    }
+
+    // Options are padded to 32 bits.
+    opt = value + ((optlen + 3) & ~3u);
+  }
+
+  return true;
+}
+
+size_t pcap::pcapng::encode_section_header(uint8_t* buf)
+{
+  const uint32_t len = section_header_size;
+  const uint32_t type = static_cast<uint32_t>(block_type::section_header);
+  const uint16_t major = 1;
+  const uint16_t minor = 0;
+  const int64_t section_length = -1;
+
+  memcpy(buf, &type, 4);
+  memcpy(buf + 4, &len, 4);
+  memcpy(buf + 8, &byte_order_magic, 4);
+  memcpy(buf + 12, &major, 2);
+  memcpy(buf + 14, &minor, 2);
+  memcpy(buf + 16, &section_length, 8);
+  memcpy(buf + 24, &len, 4);
+
+  return len;
+}
+
+size_t pcap::pcapng::encode_interface(uint8_t* buf,
+                                      const struct interface& iface)
+{
+  const uint32_t type =
+    static_cast<uint32_t>(block_type::interface_description);
+
+  const uint16_t linktype = iface.linktype;
+  const uint16_t reserved = 0;
+
+  memcpy(buf, &type, 4);
+  memcpy(buf + 8, &linktype, 2);
+  memcpy(buf + 10, &reserved, 2);
+  memcpy(buf + 12, &iface.snaplen, 4);
+
+  size_t len = 16;
+
+  // Options.
+  if ((iface.exponent != 6) || (iface.power_of_two)) {
+    const uint16_t code = if_tsresol;
+    const uint16_t optlen = 1;
+    const uint8_t tsresol = iface.exponent | (iface.power_of_two ? 0x80 : 0);
+
+    memcpy(buf + len, &code, 2);
+    memcpy(buf + len + 2, &optlen, 2);
+    memset(buf + len + 4, 0, 4);
+    buf[len + 4] = tsresol;
+
+    len += 8;
+  }
+
+  if (iface.offset != 0) {
+    const uint16_t code = if_tsoffset;
+    const uint16_t optlen = 8;
+
+    memcpy(buf + len, &code, 2);
+    memcpy(buf + len + 2, &optlen, 2);
+    memcpy(buf + len + 4, &iface.offset, 8);
+
+    len += 12;
+  }
+
+  if (len > 16) {
+    memset(buf + len, 0, 4);
+    len += 4;
+  }
+
+  // Block length.
+  const uint32_t total = len + 4;
+  memcpy(buf + 4, &total, 4);
+  memcpy(buf + len, &total, 4);
+
+  return total;
+}
+
+bool pcap::pcapng::write_packet(writer& w,
+                                uint32_t interface,
+                                uint64_t ticks,
+                                const void* data,
+                                uint32_t caplen,
+                                uint32_t len)
+{
+  const uint32_t total = enhanced_packet_size(caplen);
+
+  uint32_t hdr[7];
+  hdr[0] = static_cast<uint32_t>(block_type::enhanced_packet);
+  hdr[1] = total;
+  hdr[2] = interface;
+  hdr[3] = static_cast<uint32_t>(ticks >> 32);
+  hdr[4] = static_cast<uint32_t>(ticks);
+  hdr[5] = caplen;
+  hdr[6] = len;
+
+  // Padding and block length.
+  uint8_t trailer[8] = {0};
+  const size_t padding = total - 32 - caplen;
+  memcpy(trailer + padding, &total, 4);
+
+  return (w.copy(hdr, sizeof(hdr))) &&
+         (w.write(data, caplen)) &&
+         (w.copy(trailer, padding + 4));
+}
+
+bool pcap::pcapng::write_block(writer& w,
+                               const uint8_t* block,
+                               uint32_t len,
+                               uint32_t interface)
+{
+  if (*reinterpret_cast<const uint32_t*>(block + 8) == interface) {
+    return w.write(block, len);
+  }
+
+  uint32_t hdr[3];
+  memcpy(hdr, block, 8);
+  hdr[2] = interface;
+
+  return (w.copy(hdr, sizeof(hdr))) && (w.write(block + 12, len - 12));
+}
@@ -0,0 +1,219 @@
+#ifndef PCAP_PCAPNG_H
+#define PCAP_PCAPNG_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/pcap.h"
+#include "pcap/writer.h"
+
+namespace pcap {
+  namespace pcapng {
+    // Block types.
+    enum class block_type : uint32_t {
+      interface_description = 0x00000001,
+      simple_packet = 0x00000003,
+      interface_statistics = 0x00000005,
+      enhanced_packet = 0x00000006,
+      section_header = 0x0a0d0d0a
+    };
+
+    // Byte-order magic of the section header block.
+    static constexpr const uint32_t byte_order_magic = 0x1a2b3c4d;
+
+    // Size of a section header block (without options).
+    static constexpr const size_t section_header_size = 28;
+
+    // Maximum size of an encoded interface description block.
+    static constexpr const size_t max_interface_size = 44;
+
+    // Size of an enhanced packet block without options.
+    static inline uint64_t enhanced_packet_size(uint32_t caplen)
+    {
+      return 32 + ((static_cast<uint64_t>(caplen) + 3) & ~3ull);
+    }
+
+    // Interface (from an interface description block).
+    struct interface {
+      uint32_t linktype;
+      uint32_t snaplen;
+
+      // Timestamp resolution (if_tsresol): 10^-exponent or 2^-exponent
+      // seconds.
+      uint8_t exponent;
+      bool power_of_two;
+
+      // Offset of the timestamps in seconds (if_tsoffset).
+      int64_t offset;
+
+      // Interface description block (in the mapped file) and byte order.
+      const uint8_t* block;
+      uint32_t block_length;
+      bool swapped;
+
+      // Convert timestamp to nanoseconds since the Epoch.
+      nanoseconds timestamp(uint64_t ts) const;
+
+      // Convert nanoseconds since the Epoch to a timestamp.
+      uint64_t ticks(nanoseconds ns) const;
+    };
+
+    // Packet (from an enhanced or simple packet block).
+    struct packet {
+      // Packet data (in the mapped file).
+      const uint8_t* data;
+
+      uint32_t caplen;
+      uint32_t len;
+
+      // Interface (index among all the interfaces of the file, whatever
+      // the section).
+      uint32_t interface;
+
+      // Timestamp in nanoseconds and in units of the interface.
+      nanoseconds timestamp;
+      uint64_t ticks;
+
+      // Packet block (in the mapped file); `enhanced` is false for simple
+      // packet blocks.
+      const uint8_t* block;
+      uint32_t block_length;
+      bool enhanced;
+    };
+
+    // Parser of the blocks of a pcapng file in memory.
+    // Packets are not copied: they point into the buffer. Sections written
+    // by a machine with the opposite byte order are supported. Blocks other
+    // than SHB, IDB, EPB, SPB and ISB are skipped.
+    class parser {
+      public:
+        // Constructor.
+        parser() = default;
+
+        // Destructor.
+        ~parser();
+
+        // Start parsing the blocks in `buf` (`len` bytes), which has to
+        // begin with a section header block.
+        bool open(const void* buf, size_t len);
+
+        // Get the next packet.
+        // Returns false at the end of the buffer or if a block is truncated
+        // or malformed.
+        bool next(packet& pkt);
+
+        // Skip the packets outside of the time window [start, end).
+        void set_window(nanoseconds start, nanoseconds end)
+        {
+          _M_window_start = start;
+          _M_window_end = end;
+        }
+
+        // End of the last block parsed.
+        const uint8_t* position() const
+        {
+          return _M_ptr;
+        }
+
+        // Does the current section have the opposite byte order?
+        bool swapped() const
+        {
+          return _M_swapped;
+        }
+
+        // Number of interfaces found so far (in all the sections).
+        size_t interfaces() const
+        {
+          return _M_used;
+        }
+
+        // Get interface.
+        const struct interface* get_interface(size_t idx) const
+        {
+          return (idx < _M_used) ? &_M_interfaces[idx] : nullptr;
+        }
+
+        // Does the buffer start with a section header block?
+        static bool is_pcapng(const void* buf, size_t len);
+
+      private:
+        // Current position and end of the buffer.
+        const uint8_t* _M_ptr = nullptr;
+        const uint8_t* _M_end = nullptr;
+
+        // Does the current section have the opposite byte order?
+        bool _M_swapped = false;
+
+        // Interfaces of all the sections; the interfaces of the current
+        // section start at `_M_base`.
+        struct interface* _M_interfaces = nullptr;
+        size_t _M_size = 0;
+        size_t _M_used = 0;
+        size_t _M_base = 0;
+
+        // Timestamp of the last packet (simple packet blocks have none).
+        nanoseconds _M_last = 0;
+
+        // Time window of the packets returned by next().
+        nanoseconds _M_window_start = 0;
+        nanoseconds _M_window_end = UINT64_MAX;
+
+        // Get the next packet, whatever its timestamp.
+        bool read(packet& pkt);
+
+        // Read integers in the byte order of the section.
+        uint16_t u16(const uint8_t* ptr) const
+        {
+          uint16_t n = *reinterpret_cast<const uint16_t*>(ptr);
+          return _M_swapped ? __builtin_bswap16(n) : n;
+        }
+
+        uint32_t u32(const uint8_t* ptr) const
+        {
+          uint32_t n = *reinterpret_cast<const uint32_t*>(ptr);
+          return _M_swapped ? __builtin_bswap32(n) : n;
+        }
+
+        uint64_t u64(const uint8_t* ptr) const
+        {
+          uint64_t n = *reinterpret_cast<const uint64_t*>(ptr);
+          return _M_swapped ? __builtin_bswap64(n) : n;
+        }
+
+        // Parse section header block.
+        bool section_header(const uint8_t* body, size_t len);
+
+        // Parse interface description block.
+        bool interface_description(const uint8_t* block, size_t len);
+
+        // Disable copy constructor and assignment operator.
+        parser(const parser&) = delete;
+        parser& operator=(const parser&) = delete;
+    };
+
+    // Encode a section header block (host byte order, unknown section
+    // length). Returns the number of bytes written (`section_header_size`).
+    size_t encode_section_header(uint8_t* buf);
+
+    // Encode an interface description block (host byte order) with the
+    // link type, snapshot length and timestamp resolution and offset of
+    // `iface`. Returns the number of bytes written.
+    size_t encode_interface(uint8_t* buf, const struct interface& iface);
+
+    // Write an enhanced packet block (without options).
+    bool write_packet(writer& w,
+                      uint32_t interface,
+                      uint64_t ticks,
+                      const void* data,
+                      uint32_t caplen,
+                      uint32_t len);
+
+    // Write an enhanced packet block in host byte order as it is, except
+    // for its interface ID.
+    bool write_block(writer& w,
+                     const uint8_t* block,
+                     uint32_t len,
+                     uint32_t interface);
+  }
+}
+
+#endif // PCAP_PCAPNG_H
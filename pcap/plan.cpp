@@ -0,0 +1,81 @@
+#include <stdlib.h>
+#include "pcap/pcap.h"
+#include "pcap/plan.h"
+
+bool pcap::plan::build(const files& files,
+                       bool merge,
+                       resolution res,
+                       const pcapng::interfaces* ifaces)
+{
+  const size_t count = files.count();
+
+  free(_M_segments);
+  _M_segments = nullptr;
+  _M_used = 0;
+  _M_size = ifaces ? ifaces->header_size() : sizeof(pcap_file_header);
+  _M_clusters = 0;
+  _M_merged_files = 0;
+  _M_converted_files = 0;
+  _M_overlapping_files = 0;
+
+  if (count == 0) {
+    return true;
+  }
+
+  if ((_M_segments = static_cast<segment*>(
+                       malloc(count * sizeof(segment))
+                     )) == nullptr) {
+    return false;
+  }
+
+  // Sweep the intervals in order of their start.
+  for (size_t i = 0; i < count; ) {
+    segment* const seg = &_M_segments[_M_used++];
+    seg->first = i;
+    seg->outoff = _M_size;
+    seg->size = 0;
+
+    // End of the interval covered by the segment.
+    bool known = true;
+    uint64_t end = 0;
+
+    do {
+      const file* const f = files.get(i++);
+
+      if (f->walked) {
+        if (f->last_timestamp > end) {
+          end = f->last_timestamp;
+        }
+      } else {
+        known = false;
+      }
+
+      seg->size += ifaces ? f->blocks_size : f->output_size();
+    } while ((known) &&
+             (i < count) &&
+             (files.get(i)->timestamp < end) &&
+             (merge));
+
+    seg->last = i;
+    seg->convert = (!seg->merge()) &&
+                   ((ifaces) ||
+                    (files.get(seg->first)->magic != magic_of(res)));
+
+    if (seg->convert) {
+      _M_converted_files++;
+    }
+
+    if (seg->merge()) {
+      _M_clusters++;
+      _M_merged_files += seg->last - seg->first;
+      _M_overlapping_files += seg->last - seg->first;
+    } else if ((known) && (i < count) && (files.get(i)->timestamp < end)) {
+      // Overlapping files which are not going to be merged.
+      _M_overlapping_files++;
+    }
+
+    _M_size += seg->size;
+  }
+
+  return true;
+}
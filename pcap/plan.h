@@ -0,0 +1,118 @@
+#ifndef PCAP_PLAN_H
+#define PCAP_PLAN_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+#include "pcap/interfaces.h"
+
+namespace pcap {
+  // Run of (sorted) files written to the output as a unit.
+  struct segment {
+    // Files [first, last).
+    size_t first;
+    size_t last;
+
+    // Offset and size in the output file.
+    uint64_t outoff;
+    uint64_t size;
+
+    // Do the packet headers of a single file have to be converted?
+    bool convert;
+
+    // Do the packets of the files have to be merged?
+    // A single file is copied as a whole.
+    bool merge() const
+    {
+      return (last - first > 1);
+    }
+  };
+
+  // Output plan.
+  // The files (sorted by the timestamp of their first packet) are seen as
+  // time intervals [first packet, last packet]; overlapping intervals are
+  // grouped into clusters, whose packets are merged. Files which don't
+  // overlap any other file are copied (or converted, if the resolution of
+  // their timestamps is not the one of the output file or they have been
+  // written by a machine with the opposite byte order).
+  class plan {
+    public:
+      // Constructor.
+      plan() = default;
+
+      // Destructor.
+      ~plan()
+      {
+        free(_M_segments);
+      }
+
+      // Build plan for an output file with resolution `res`, or for a
+      // pcapng output file if `ifaces` is not nullptr (every file which is
+      // not merged is then converted; the packet headers of all the files
+      // must have been walked).
+      // If `merge` is false or the packet headers of a file have not been
+      // walked, the file is assumed not to overlap the following files.
+      bool build(const files& files,
+                 bool merge,
+                 resolution res,
+                 const pcapng::interfaces* ifaces);
+
+      // Get number of segments.
+      size_t count() const
+      {
+        return _M_used;
+      }
+
+      // Get segment.
+      const segment* get(size_t idx) const
+      {
+        return (idx < _M_used) ? &_M_segments[idx] : nullptr;
+      }
+
+      // Size of the output file (including the PCAP file header or the
+      // pcapng section header and interface description blocks).
+      uint64_t size() const
+      {
+        return _M_size;
+      }
+
+      // Number of clusters of overlapping files.
+      size_t clusters() const
+      {
+        return _M_clusters;
+      }
+
+      // Number of files in clusters.
+      size_t merged_files() const
+      {
+        return _M_merged_files;
+      }
+
+      // Number of files whose packet headers are converted.
+      size_t converted_files() const
+      {
+        return _M_converted_files;
+      }
+
+      // Number of overlapping files found (even if they are not merged).
+      size_t overlapping_files() const
+      {
+        return _M_overlapping_files;
+      }
+
+    private:
+      segment* _M_segments = nullptr;
+      size_t _M_used = 0;
+
+      uint64_t _M_size = 0;
+
+      size_t _M_clusters = 0;
+      size_t _M_merged_files = 0;
+      size_t _M_converted_files = 0;
+      size_t _M_overlapping_files = 0;
+  };
+}
+
+#endif // PCAP_PLAN_H
@@ -0,0 +1,464 @@
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/mman.h>
+#include "pcap/pcap.h"
+#include "pcap/probe.h"
+#include "pcap/pcapng.h"
+#include "io/decompressor.h"
+
+// Number of bytes decompressed to probe a compressed file (the first packet
+// of a pcapng file comes after the section header and interface description
+// blocks).
+static constexpr const size_t probe_size = 64 * 1024;
+
+// Probe a compressed file: decompress its beginning and get the timestamp of
+// the first packet.
+static void probe_compressed(int fd, pcap::file& f)
+{
+  uint8_t* buf;
+  if ((buf = static_cast<uint8_t*>(malloc(probe_size))) == nullptr) {
+    return;
+  }
+
+  io::decompressor decompressor;
+  ssize_t len;
+  if ((lseek(fd, 0, SEEK_SET) == 0) &&
+      (decompressor.open(fd, f.compression)) &&
+      ((len = decompressor.read(buf, probe_size)) >=
+       static_cast<ssize_t>(pcap::minimum_size))) {
+    if (pcap::pcapng::parser::is_pcapng(buf, len)) {
+      // Use the first packet (the link types of the other interfaces are
+      // checked when the file is walked after decompression).
+      pcap::pcapng::parser parser;
+      pcap::pcapng::packet pkt;
+      if ((parser.open(buf, len)) && (parser.next(pkt))) {
+        const pcap::pcapng::interface* const
+          iface = parser.get_interface(pkt.interface);
+
+        f.magic = static_cast<uint32_t>(pcap::magic::pcapng);
+        f.timestamp = pkt.timestamp;
+        f.linktype = iface->linktype;
+        f.snaplen = (iface->snaplen != 0) ? iface->snaplen :
+                                            pcap::maximum_snaplen;
+
+        f.valid = true;
+      }
+    } else {
+      pcap::get_first_timestamp(buf, f);
+    }
+  }
+
+  free(buf);
+}
+
+bool pcap::probe(int dirfd, const char* filename, bool walk, file& f)
+{
+  f.magic = 0;
+  f.valid = false;
+  f.walked = false;
+  f.compressed = false;
+
+  // Open PCAP file for reading.
+  int fd;
+  if ((fd = openat(dirfd, filename, O_RDONLY)) != -1) {
+    // Read PCAP file header and the header of the first packet.
+    // (pcapng files are always walked).
+    uint8_t buf[minimum_size];
+    if (read(fd, buf, minimum_size) == static_cast<ssize_t>(minimum_size)) {
+      if (get_first_timestamp(buf, f)) {
+        if (walk) {
+          pcap::walk(fd, f.filesize, f);
+        }
+      } else if (f.compressed) {
+        probe_compressed(fd, f);
+      } else if (is_pcapng(f.magic)) {
+        pcap::walk(fd, f.filesize, f);
+      }
+    }
+
+    close(fd);
+  }
+
+  return f.valid;
+}
+
+bool pcap::get_first_timestamp(const uint8_t* buf, file& f)
+{
+  // Compressed file?
+  if (io::decompressor::detect(buf, minimum_size, f.compression)) {
+    f.compressed = true;
+    f.valid = false;
+
+    return false;
+  }
+
+  // pcapng file? The packets have to be walked to find the first one.
+  if (pcapng::parser::is_pcapng(buf, minimum_size)) {
+    f.magic = static_cast<uint32_t>(magic::pcapng);
+    f.valid = false;
+
+    return false;
+  }
+
+  pcap_file_header filehdr = *reinterpret_cast<const pcap_file_header*>(buf);
+
+  pcap_pkthdr pkthdr = *reinterpret_cast<const pcap_pkthdr*>(
+                          buf + sizeof(pcap_file_header)
+                        );
+
+  // File written by a machine with the opposite byte order?
+  if (is_swapped(filehdr.magic)) {
+    swap(filehdr);
+    swap(pkthdr);
+
+    // Keep the magic number as it is in the file.
+    filehdr.magic = __builtin_bswap32(filehdr.magic);
+  }
+
+  // Check magic, version and link type.
+  if (((static_cast<magic>(filehdr.magic) == magic::microseconds) ||
+       (static_cast<magic>(filehdr.magic) == magic::nanoseconds) ||
+       (is_swapped(filehdr.magic))) &&
+      (filehdr.version_major == version_major) &&
+      (filehdr.version_minor == version_minor) &&
+      ((filehdr.linktype & linktype_reserved) == 0)) {
+    // No snapshot length limit?
+    if (filehdr.snaplen == 0) {
+      filehdr.snaplen = maximum_snaplen;
+    }
+
+    f.magic = filehdr.magic;
+    f.snaplen = filehdr.snaplen;
+    f.linktype = filehdr.linktype;
+    f.timestamp = timestamp(&pkthdr, resolution_of(filehdr.magic));
+    f.valid = true;
+
+    return true;
+  }
+
+  f.valid = false;
+
+  return false;
+}
+
+// Walk the packets of a pcapng file mapped into memory.
+static void walk_pcapng(const uint8_t* begin, uint64_t size, pcap::file& f)
+{
+  pcap::pcapng::parser parser;
+  if (parser.open(begin, size)) {
+    parser.set_window(f.window_start, f.window_end);
+
+    pcap::pcapng::packet pkt;
+    uint64_t packets = 0;
+    uint64_t records_size = 0;
+    uint64_t blocks_size = 0;
+
+    while (parser.next(pkt)) {
+      const pcap::pcapng::interface* const
+        iface = parser.get_interface(pkt.interface);
+
+      if (packets++ == 0) {
+        f.timestamp = pkt.timestamp;
+        f.linktype = iface->linktype;
+        f.snaplen = 0;
+      } else if (iface->linktype != f.linktype) {
+        f.linktype = pcap::linktype_mixed;
+      }
+
+      // Largest snapshot length.
+      const uint32_t snaplen = iface->snaplen;
+      if (snaplen == 0) {
+        f.snaplen = pcap::maximum_snaplen;
+      } else if (snaplen > f.snaplen) {
+        f.snaplen = snaplen;
+      }
+
+      f.last_timestamp = pkt.timestamp;
+      records_size += sizeof(pcap::pcap_pkthdr) + pkt.caplen;
+
+      // Enhanced packet blocks in host byte order are written as they are.
+      blocks_size += ((pkt.enhanced) && (!parser.swapped())) ?
+                       pkt.block_length :
+                       pcap::pcapng::enhanced_packet_size(pkt.caplen);
+    }
+
+    f.packets = packets;
+    f.end = parser.position() - begin;
+    f.records_size = records_size;
+    f.blocks_size = blocks_size;
+    f.walked = true;
+
+    // A pcapng file is valid if it has at least one packet.
+    f.valid = (packets > 0);
+  }
+}
+
+bool pcap::walk(int fd, uint64_t size, file& f)
+{
+  // Map file into memory.
+  void* base;
+  if ((base = mmap(nullptr,
+                   size,
+                   PROT_READ,
+                   MAP_SHARED,
+                   fd,
+                   0)) != MAP_FAILED) {
+    madvise(base, size, MADV_SEQUENTIAL);
+
+    const uint8_t* const begin = static_cast<const uint8_t*>(base);
+
+    if (is_pcapng(f.magic)) {
+      walk_pcapng(begin, size, f);
+    } else {
+      walk(begin, size, f);
+    }
+
+    munmap(base, size);
+
+    return true;
+  }
+
+  return false;
+}
+
+void pcap::walk(const uint8_t* base, uint64_t end, file& f)
+{
+  const uint8_t* const limit = base + end;
+  const uint8_t* ptr = base + f.begin;
+
+  const resolution res = resolution_of(f.magic);
+  const bool swapped = is_swapped(f.magic);
+
+  uint64_t packets = 0;
+  uint64_t blocks_size = 0;
+  const pcap_pkthdr* first = nullptr;
+  const pcap_pkthdr* last = nullptr;
+
+  while (ptr + sizeof(pcap_pkthdr) <= limit) {
+    const pcap_pkthdr* const
+      pkthdr = reinterpret_cast<const pcap_pkthdr*>(ptr);
+
+    const uint32_t caplen = swapped ? __builtin_bswap32(pkthdr->caplen) :
+                                      pkthdr->caplen;
+
+    const uint8_t* const next = ptr + sizeof(pcap_pkthdr) + caplen;
+
+    // Truncated packet?
+    if (next > limit) {
+      break;
+    }
+
+    if (!first) {
+      first = pkthdr;
+    }
+
+    last = pkthdr;
+    packets++;
+    blocks_size += pcapng::enhanced_packet_size(caplen);
+
+    ptr = next;
+  }
+
+  if (last) {
+    pcap_pkthdr hdr = *first;
+    if (swapped) {
+      swap(hdr);
+    }
+
+    f.timestamp = timestamp(&hdr, res);
+
+    hdr = *last;
+    if (swapped) {
+      swap(hdr);
+    }
+
+    f.last_timestamp = timestamp(&hdr, res);
+  } else {
+    f.last_timestamp = f.timestamp;
+  }
+
+  f.packets = packets;
+  f.end = ptr - base;
+  f.records_size = f.end - f.begin;
+  f.blocks_size = blocks_size;
+  f.walked = true;
+}
+
+void pcap::probe(files& files,
+                 size_t first,
+                 size_t last,
+                 int dirfd,
+                 bool walk)
+{
+  for (size_t i = first; i < last; i++) {
+    file* const f = files.get(i);
+    probe(dirfd, base_name(f->filename), walk, *f);
+  }
+}
+
+bool pcap::probe(files& files,
+                 size_t first,
+                 size_t last,
+                 int dirfd,
+                 io::uring& ring)
+{
+  // Each file takes three submission queue entries (open, read and close).
+  const unsigned nslots = ring.entries() / 3;
+  if (nslots == 0) {
+    return false;
+  }
+
+  uint8_t* buffers;
+  if ((buffers = static_cast<uint8_t*>(
+                   malloc(nslots * (minimum_size + sizeof(unsigned)))
+                 )) == nullptr) {
+    return false;
+  }
+
+  // Number of completions pending per slot.
+  unsigned* const pending = reinterpret_cast<unsigned*>(
+                              buffers + nslots * minimum_size
+                            );
+
+  // Free slots.
+  unsigned* free_slots;
+  int* fds;
+  if (((free_slots = static_cast<unsigned*>(
+                       malloc(nslots * sizeof(unsigned))
+                     )) == nullptr) ||
+      ((fds = static_cast<int*>(malloc(nslots * sizeof(int)))) == nullptr)) {
+    free(free_slots);
+    free(buffers);
+
+    return false;
+  }
+
+  for (unsigned i = 0; i < nslots; i++) {
+    free_slots[i] = nslots - 1 - i;
+    pending[i] = 0;
+    fds[i] = -1;
+  }
+
+  // Register buffers and an empty table of direct descriptors.
+  struct iovec iov;
+  iov.iov_base = buffers;
+  iov.iov_len = nslots * minimum_size;
+
+  const bool fixed_buffers = ring.register_buffers(&iov, 1);
+
+  if (!ring.register_files(fds, nslots)) {
+    if (fixed_buffers) {
+      ring.unregister_buffers();
+    }
+
+    free(fds);
+    free(free_slots);
+    free(buffers);
+
+    return false;
+  }
+
+  free(fds);
+
+  size_t next = first;
+  unsigned nfree = nslots;
+  bool supported = true;
+
+  while (((next < last) && (supported)) || (nfree < nslots)) {
+    // Queue open + read + close for as many files as possible.
+    while ((next < last) && (supported) && (nfree > 0)) {
+      const unsigned slot = free_slots[--nfree];
+      file* const f = files.get(next);
+
+      f->magic = 0;
+      f->valid = false;
+      f->walked = false;
+      f->compressed = false;
+
+      const uint64_t data = (static_cast<uint64_t>(next) << 32) | slot;
+
+      struct io_uring_sqe* sqe = ring.get_sqe();
+      sqe->opcode = IORING_OP_OPENAT;
+      sqe->fd = dirfd;
+      sqe->addr = reinterpret_cast<uintptr_t>(base_name(f->filename));
+      sqe->open_flags = O_RDONLY;
+      sqe->file_index = slot + 1;
+      sqe->flags = IOSQE_IO_HARDLINK;
+      sqe->user_data = data;
+
+      sqe = ring.get_sqe();
+      sqe->opcode = fixed_buffers ? IORING_OP_READ_FIXED : IORING_OP_READ;
+      sqe->fd = slot;
+      sqe->addr = reinterpret_cast<uintptr_t>(buffers + slot * minimum_size);
+      sqe->len = minimum_size;
+      sqe->off = 0;
+      sqe->buf_index = 0;
+      sqe->flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+      sqe->user_data = data | (1ull << 31);
+
+      sqe = ring.get_sqe();
+      sqe->opcode = IORING_OP_CLOSE;
+      sqe->file_index = slot + 1;
+      sqe->user_data = data | (1ull << 30);
+
+      pending[slot] = 3;
+      next++;
+    }
+
+    if (ring.submit() < 0) {
+      // Don't touch the buffers while requests could be in flight.
+      break;
+    }
+
+    // Process completions.
+    struct io_uring_cqe cqe;
+    bool wait = true;
+    while (ring.get_cqe(cqe, wait)) {
+      const unsigned slot = cqe.user_data & 0x3fffffff;
+      file* const f = files.get(cqe.user_data >> 32);
+
+      if ((cqe.user_data & ((1ull << 31) | (1ull << 30))) == 0) {
+        // Open: direct descriptors not supported by the kernel?
+        if (cqe.res == -EINVAL) {
+          supported = false;
+        }
+      } else if (cqe.user_data & (1ull << 31)) {
+        // Read.
+        if (cqe.res == static_cast<int>(minimum_size)) {
+          get_first_timestamp(buffers + slot * minimum_size, *f);
+        }
+      }
+
+      if (--pending[slot] == 0) {
+        free_slots[nfree++] = slot;
+      }
+
+      wait = false;
+    }
+  }
+
+  const bool ret = (supported) && (next == last) && (nfree == nslots);
+
+  ring.unregister_files();
+
+  if (fixed_buffers) {
+    ring.unregister_buffers();
+  }
+
+  if (nfree == nslots) {
+    free(buffers);
+  }
+
+  free(free_slots);
+
+  return ret;
+}
+
+const char* pcap::base_name(const char* filename)
+{
+  const char* const slash = strrchr(filename, '/');
+  return slash ? slash + 1 : filename;
+}
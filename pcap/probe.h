@@ -0,0 +1,55 @@
+#ifndef PCAP_PROBE_H
+#define PCAP_PROBE_H
+
+#include <stdint.h>
+#include "pcap/files.h"
+#include "io/uring.h"
+
+namespace pcap {
+  // Probe PCAP file (`filename` is relative to `dirfd`): get the fields of
+  // the file header and the timestamp of the first packet and, if `walk` is
+  // true, walk the packet headers.
+  // Only the beginning of compressed files is decompressed; they are not
+  // walked.
+  bool probe(int dirfd, const char* filename, bool walk, file& f);
+
+  // Get timestamp of the first packet from a buffer holding the PCAP file
+  // header and the header of the first packet (`minimum_size` bytes).
+  // For pcapng files, `f.magic` is set to `magic::pcapng` and false is
+  // returned: they have to be walked. For compressed files, `f.compressed`
+  // is set and false is returned: they have to be probed with probe().
+  bool get_first_timestamp(const uint8_t* buf, file& f);
+
+  // Walk the packet headers of an open PCAP file of `size` bytes: get the
+  // timestamp of the last packet and the number of packets. pcapng files
+  // are validated and all their fields are set.
+  bool walk(int fd, uint64_t size, file& f);
+
+  // Walk the packet records of a PCAP file mapped into memory from
+  // `f.begin` up to the offset `end` (also sets the timestamp of the first
+  // packet).
+  void walk(const uint8_t* base, uint64_t end, file& f);
+
+  // Probe the PCAP files in the range [first, last) of the directory
+  // `dirfd` (the files are opened by the last component of their names):
+  // set the timestamp of the first packet of each file and mark the files
+  // which are not valid.
+  void probe(files& files, size_t first, size_t last, int dirfd, bool walk);
+
+  // Probe the PCAP files in the range [first, last) of the directory
+  // `dirfd` through io_uring (open, read and close are submitted as linked
+  // requests using registered buffers and direct descriptors). Packet
+  // headers are not walked.
+  // Returns false if the kernel doesn't support it; the files have then to
+  // be probed with probe(files, first, last, dirfd, walk).
+  bool probe(files& files,
+             size_t first,
+             size_t last,
+             int dirfd,
+             io::uring& ring);
+
+  // Last component of a file name (the name relative to its directory).
+  const char* base_name(const char* filename);
+}
+
+#endif // PCAP_PROBE_H
@@ -0,0 +1,61 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include "pcap/reader.h"
+#include "pcap/decompress.h"
+
+bool pcap::reader::open(const file& f)
+{
+  close();
+
+  // Open file for reading.
+  uint64_t size;
+  int fd;
+  if ((fd = open_data(f, size)) != -1) {
+    // Map file into memory.
+    void* base;
+    if ((base = mmap(nullptr,
+                     size,
+                     PROT_READ,
+                     MAP_SHARED,
+                     fd,
+                     0)) != MAP_FAILED) {
+      ::close(fd);
+
+      madvise(base, size, MADV_SEQUENTIAL);
+
+      _M_base = base;
+      _M_size = size;
+      _M_end = static_cast<const uint8_t*>(base) + f.data_end();
+      _M_resolution = resolution_of(f.magic);
+      _M_swapped = is_swapped(f.magic);
+      _M_linktype = f.linktype;
+      _M_pcapng = is_pcapng(f.magic);
+
+      if (!_M_pcapng) {
+        load(static_cast<const uint8_t*>(base) + f.begin);
+      } else if (_M_parser.open(base, size)) {
+        _M_parser.set_window(f.window_start, f.window_end);
+        load();
+      } else {
+        _M_hdr = nullptr;
+      }
+
+      return true;
+    }
+
+    ::close(fd);
+  }
+
+  return false;
+}
+
+void pcap::reader::close()
+{
+  if (_M_base) {
+    munmap(_M_base, _M_size);
+
+    _M_base = nullptr;
+    _M_hdr = nullptr;
+  }
+}
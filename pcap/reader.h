@@ -0,0 +1,215 @@
+#ifndef PCAP_READER_H
+#define PCAP_READER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+#include "pcap/pcapng.h"
+
+namespace pcap {
+  // Sequential reader of the packets of a PCAP file mapped into memory.
+  // Packet headers of files written by a machine with the opposite byte
+  // order are returned in host byte order. The packets of pcapng files are
+  // returned with PCAP packet headers (nanosecond resolution).
+  class reader {
+    public:
+      // Constructor.
+      reader() = default;
+
+      // Destructor.
+      ~reader()
+      {
+        close();
+      }
+
+      // Open PCAP file and position at the first packet.
+      bool open(const file& f);
+
+      // Close PCAP file.
+      void close();
+
+      // Is there a current packet?
+      bool valid() const
+      {
+        return (_M_hdr != nullptr);
+      }
+
+      // Header of the current packet (host byte order).
+      const pcap_pkthdr* header() const
+      {
+        return _M_hdr;
+      }
+
+      // Data of the current packet.
+      const void* data() const
+      {
+        return _M_data;
+      }
+
+      // Size of the current record (packet header + packet data).
+      size_t record_size() const
+      {
+        return sizeof(pcap_pkthdr) + _M_hdr->caplen;
+      }
+
+      // Timestamp of the current packet.
+      nanoseconds timestamp() const
+      {
+        return _M_timestamp;
+      }
+
+      // Interface of the current packet (pcapng files).
+      uint32_t interface() const
+      {
+        return _M_interface;
+      }
+
+      // Link type of the current packet.
+      uint32_t linktype() const
+      {
+        if (_M_pcapng) {
+          const struct pcapng::interface* const
+            iface = _M_parser.get_interface(_M_interface);
+
+          return iface ? iface->linktype : _M_linktype;
+        }
+
+        return _M_linktype;
+      }
+
+      // Timestamp of the current packet in units of its interface.
+      uint64_t ticks() const
+      {
+        if (_M_pcapng) {
+          return _M_ticks;
+        }
+
+        return (_M_resolution == resolution::nanoseconds) ?
+                 _M_hdr->ts.tv_sec * 1000000000ull + _M_hdr->ts.tv_usec :
+                 _M_hdr->ts.tv_sec * 1000000ull + _M_hdr->ts.tv_usec;
+      }
+
+      // Enhanced packet block of the current packet if it is in host byte
+      // order (pcapng files), nullptr otherwise.
+      const uint8_t* block() const
+      {
+        return _M_block;
+      }
+
+      uint32_t block_length() const
+      {
+        return _M_block_length;
+      }
+
+      // Resolution of the timestamps of the file.
+      resolution timestamp_resolution() const
+      {
+        return _M_resolution;
+      }
+
+      // Move to the next packet.
+      // Returns false if there are no more (complete) packets.
+      bool next()
+      {
+        return _M_pcapng ? load() : load(_M_data + _M_hdr->caplen);
+      }
+
+    private:
+      // Mapped file.
+      void* _M_base = nullptr;
+      size_t _M_size = 0;
+
+      // End of the packet data.
+      const uint8_t* _M_end = nullptr;
+
+      // Resolution of the timestamps.
+      resolution _M_resolution = resolution::microseconds;
+
+      // Opposite byte order?
+      bool _M_swapped = false;
+
+      // Link type of the file (first interface of pcapng files).
+      uint32_t _M_linktype = 0;
+
+      // pcapng file?
+      bool _M_pcapng = false;
+      pcapng::parser _M_parser;
+
+      // Current packet: header in host byte order (either the header in the
+      // file or `_M_native`) and packet data.
+      const pcap_pkthdr* _M_hdr = nullptr;
+      const uint8_t* _M_data = nullptr;
+      pcap_pkthdr _M_native;
+      nanoseconds _M_timestamp = 0;
+
+      // Current packet of a pcapng file.
+      uint32_t _M_interface = 0;
+      uint64_t _M_ticks = 0;
+      const uint8_t* _M_block = nullptr;
+      uint32_t _M_block_length = 0;
+
+      // Load packet at `ptr`.
+      bool load(const uint8_t* ptr)
+      {
+        if (ptr + sizeof(pcap_pkthdr) <= _M_end) {
+          const pcap_pkthdr* const
+            raw = reinterpret_cast<const pcap_pkthdr*>(ptr);
+
+          const pcap_pkthdr* hdr = raw;
+          if (_M_swapped) {
+            _M_native = *raw;
+            swap(_M_native);
+
+            hdr = &_M_native;
+          }
+
+          if (ptr + sizeof(pcap_pkthdr) + hdr->caplen <= _M_end) {
+            _M_hdr = hdr;
+            _M_data = ptr + sizeof(pcap_pkthdr);
+            _M_timestamp = pcap::timestamp(hdr, _M_resolution);
+
+            return true;
+          }
+        }
+
+        _M_hdr = nullptr;
+
+        return false;
+      }
+
+      // Load the next packet of a pcapng file.
+      bool load()
+      {
+        pcapng::packet pkt;
+        if (_M_parser.next(pkt)) {
+          _M_native.ts.tv_sec = pkt.timestamp / 1000000000ull;
+          _M_native.ts.tv_usec = pkt.timestamp % 1000000000ull;
+          _M_native.caplen = pkt.caplen;
+          _M_native.len = pkt.len;
+
+          _M_hdr = &_M_native;
+          _M_data = pkt.data;
+          _M_timestamp = pkt.timestamp;
+
+          _M_interface = pkt.interface;
+          _M_ticks = pkt.ticks;
+          _M_block = ((pkt.enhanced) && (!_M_parser.swapped())) ? pkt.block :
+                                                                  nullptr;
+          _M_block_length = pkt.block_length;
+
+          return true;
+        }
+
+        _M_hdr = nullptr;
+
+        return false;
+      }
+
+      // Disable copy constructor and assignment operator.
+      reader(const reader&) = delete;
+      reader& operator=(const reader&) = delete;
+  };
+}
+
+#endif // PCAP_READER_H
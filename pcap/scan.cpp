@@ -0,0 +1,333 @@
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/stat.h>
+#include "pcap/pcap.h"
+#include "pcap/probe.h"
+#include "pcap/cache.h"
+#include "pcap/scan.h"
+#include "util/parallel.h"
+
+// Number of directory entries processed by a worker at once.
+static constexpr const size_t shard_size = 64;
+
+namespace {
+  // State of a directory entry.
+  enum class state {
+    skipped,  // Not a regular file or too small.
+    cached,   // Found in the index cache.
+    probed,   // Probed by a worker.
+    pending   // To be probed through io_uring.
+  };
+
+  // Directory entry.
+  struct entry {
+    char* name;
+    pcap::file info;
+    state st;
+  };
+
+  // List of directory entries.
+  class entries {
+    public:
+      // Constructor.
+      entries() = default;
+
+      // Destructor.
+      ~entries()
+      {
+        if (_M_entries) {
+          for (; _M_used > 0; _M_used--) {
+            free(_M_entries[_M_used - 1].name);
+          }
+
+          free(_M_entries);
+        }
+      }
+
+      // Add entry.
+      bool add(const char* name)
+      {
+        if (_M_used == _M_size) {
+          const size_t size = (_M_size > 0) ? _M_size * 2 : 1024;
+
+          entry* e;
+          if ((e = static_cast<entry*>(
+                     realloc(_M_entries, size * sizeof(entry))
+                   )) != nullptr) {
+            _M_entries = e;
+            _M_size = size;
+          } else {
+            return false;
+          }
+        }
+
+        char* n;
+        if ((n = strdup(name)) != nullptr) {
+          entry* const e = &_M_entries[_M_used++];
+
+          e->name = n;
+          memset(&e->info, 0, sizeof(pcap::file));
+          e->info.select_all();
+          e->st = state::skipped;
+
+          return true;
+        }
+
+        return false;
+      }
+
+      // Get number of entries.
+      size_t count() const
+      {
+        return _M_used;
+      }
+
+      // Get entry.
+      entry* get(size_t idx)
+      {
+        return &_M_entries[idx];
+      }
+
+    private:
+      entry* _M_entries = nullptr;
+      size_t _M_size = 0;
+      size_t _M_used = 0;
+  };
+}
+
+// Might the directory entry be a PCAP file?
+static bool is_candidate(const struct dirent* entry);
+
+// Does the file name end in `.pcap` or `.pcapng`?
+static bool has_pcap_extension(const char* name, size_t len);
+
+bool pcap::scan(const char* dirname,
+                const scan_options& options,
+                files& files)
+{
+  // Load index cache.
+  cache index;
+  if (options.cache) {
+    index.load(options.cache);
+  }
+
+  // Open directory.
+  DIR* dir;
+  if ((dir = opendir(dirname)) == nullptr) {
+    return false;
+  }
+
+  const int dirfd = ::dirfd(dir);
+
+  // Collect candidates.
+  entries list;
+
+  struct dirent* entry;
+  while ((entry = readdir(dir)) != nullptr) {
+    if ((is_candidate(entry)) && (!list.add(entry->d_name))) {
+      closedir(dir);
+
+      errno = ENOMEM;
+      return false;
+    }
+  }
+
+  // Stat (and probe) the candidates in parallel.
+  const size_t count = list.count();
+
+  util::parallel_for(
+    (count + shard_size - 1) / shard_size,
+    options.nworkers,
+    [&](unsigned worker, size_t shard) {
+      const size_t end = ((shard + 1) * shard_size < count) ?
+                         (shard + 1) * shard_size :
+                         count;
+
+      for (size_t i = shard * shard_size; i < end; i++) {
+        struct entry* const e = list.get(i);
+
+        // If it is a regular file and is not too small...
+        struct stat sbuf;
+        if ((fstatat(dirfd, e->name, &sbuf, 0) == 0) &&
+            (S_ISREG(sbuf.st_mode)) &&
+            (sbuf.st_size > static_cast<off_t>(minimum_size))) {
+          const int64_t mtime = sbuf.st_mtim.tv_sec * 1000000000ll +
+                                sbuf.st_mtim.tv_nsec;
+
+          if ((index.find(sbuf.st_dev,
+                          sbuf.st_ino,
+                          sbuf.st_size,
+                          mtime,
+                          e->info)) &&
+              ((!options.walk) || (!e->info.valid) || (e->info.walked))) {
+            e->st = state::cached;
+          } else {
+            e->info.filesize = sbuf.st_size;
+            e->info.device = sbuf.st_dev;
+            e->info.inode = sbuf.st_ino;
+            e->info.mtime = mtime;
+
+            if (!options.ring) {
+              probe(dirfd, e->name, options.walk, e->info);
+              e->st = state::probed;
+            } else {
+              e->st = state::pending;
+            }
+          }
+        }
+      }
+
+      return true;
+    }
+  );
+
+  // Fill the list of PCAP files; files to be probed through io_uring go
+  // first.
+  const size_t first = files.count();
+  size_t npending = 0;
+  size_t ncached = 0;
+
+  for (unsigned pass = 0; pass < 2; pass++) {
+    for (size_t i = 0; i < count; i++) {
+      const struct entry* const e = list.get(i);
+
+      if ((e->st != state::skipped) &&
+          ((e->st == state::pending) == (pass == 0))) {
+        // Compose full filename.
+        char pathname[PATH_MAX];
+        snprintf(pathname, sizeof(pathname), "%s/%s", dirname, e->name);
+
+        if (!files.add(pathname, e->info)) {
+          closedir(dir);
+
+          errno = ENOMEM;
+          return false;
+        }
+
+        if (e->st == state::pending) {
+          npending++;
+        } else if (e->st == state::cached) {
+          ncached++;
+        }
+      }
+    }
+  }
+
+  if (npending > 0) {
+    // Probe the new files through io_uring.
+    if (!probe(files, first, first + npending, dirfd, *options.ring)) {
+      probe(files, first, first + npending, dirfd, options.walk);
+    } else {
+      // Walk the packet headers (pcapng files are always walked) and
+      // probe the compressed files.
+      util::parallel_for(
+        npending,
+        options.nworkers,
+        [&](unsigned worker, size_t idx) {
+          file* const f = files.get(first + idx);
+
+          if (f->compressed) {
+            probe(dirfd, base_name(f->filename), false, *f);
+          } else if (((f->valid) && (options.walk)) ||
+                     (is_pcapng(f->magic))) {
+            const char* const name = base_name(f->filename);
+
+            int fd;
+            if ((fd = openat(dirfd, name, O_RDONLY)) != -1) {
+              walk(fd, f->filesize, *f);
+              close(fd);
+            }
+          }
+
+          return true;
+        }
+      );
+    }
+  }
+
+  closedir(dir);
+
+  // Save the index cache if it has changed.
+  if ((options.cache) && (ncached != files.count() - first)) {
+    if (!cache::save(options.cache, files)) {
+      fprintf(stderr, "Error saving index '%s'.\n", options.cache);
+    }
+  }
+
+  return true;
+}
+
+bool is_candidate(const struct dirent* entry)
+{
+  switch (entry->d_type) {
+    case DT_REG:
+    case DT_LNK:
+    case DT_UNKNOWN:
+      return pcap::is_capture_name(entry->d_name);
+    default:
+      return false;
+  }
+}
+
+bool pcap::is_capture_name(const char* name)
+{
+  static const char* const compressed[] = {".gz", ".zst", ".lz4"};
+
+  const size_t len = strlen(name);
+
+  // PCAP or pcapng file?
+  if (has_pcap_extension(name, len)) {
+    return true;
+  }
+
+  // Compressed PCAP or pcapng file?
+  const size_t n = sizeof(compressed) / sizeof(compressed[0]);
+  for (size_t i = 0; i < n; i++) {
+    const size_t extlen = strlen(compressed[i]);
+
+    if ((len > extlen) &&
+        (strcasecmp(name + len - extlen, compressed[i]) == 0) &&
+        (has_pcap_extension(name, len - extlen))) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+bool pcap::scan_file(const char* pathname, bool walk, file& f)
+{
+  memset(&f, 0, sizeof(file));
+  f.select_all();
+
+  // If it is a regular file and is not too small...
+  struct stat sbuf;
+  if ((stat(pathname, &sbuf) == 0) &&
+      (S_ISREG(sbuf.st_mode)) &&
+      (sbuf.st_size > static_cast<off_t>(minimum_size))) {
+    f.filesize = sbuf.st_size;
+    f.device = sbuf.st_dev;
+    f.inode = sbuf.st_ino;
+    f.mtime = sbuf.st_mtim.tv_sec * 1000000000ll + sbuf.st_mtim.tv_nsec;
+
+    return probe(AT_FDCWD, pathname, walk, f);
+  }
+
+  return false;
+}
+
+bool has_pcap_extension(const char* name, size_t len)
+{
+  return (((len > 5) &&
+           (name[len - 5] == '.') &&
+           (strncasecmp(name + len - 4, "pcap", 4) == 0)) ||
+          ((len > 7) &&
+           (name[len - 7] == '.') &&
+           (strncasecmp(name + len - 6, "pcapng", 6) == 0)));
+}
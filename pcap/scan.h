@@ -0,0 +1,45 @@
+#ifndef PCAP_SCAN_H
+#define PCAP_SCAN_H
+
+#include "pcap/files.h"
+#include "io/uring.h"
+
+namespace pcap {
+  // Scan options.
+  struct scan_options {
+    // Number of worker threads.
+    unsigned nworkers = 1;
+
+    // If not null, headers are probed in io_uring batches.
+    io::uring* ring = nullptr;
+
+    // If not null, index file caching the information of each file.
+    const char* cache = nullptr;
+
+    // Walk the packet headers (timestamp of the last packet and number of
+    // packets)?
+    bool walk = false;
+  };
+
+  // Scan directory and add its PCAP files to `files`.
+  // Directory entries are stat'ed and probed relative to the directory file
+  // descriptor by the worker threads, each one writing to its own entries;
+  // the list of files is filled at the end by the calling thread.
+  // Files found in the index cache with the same device, inode number, size
+  // and modification time are not opened. Compressed files (.gz, .zst,
+  // .lz4) are only probed: they have to be walked with decompress().
+  // Files which are not valid are left in the list, so the index cache can
+  // be saved again from it: compact it before using it.
+  // On error, returns false and sets errno.
+  bool scan(const char* dirname, const scan_options& options, files& files);
+
+  // Might the file be a PCAP file (its name ends in `.pcap` or `.pcapng`,
+  // optionally followed by `.gz`, `.zst` or `.lz4`)?
+  bool is_capture_name(const char* name);
+
+  // Stat and probe a single file like scan() does (the index cache is not
+  // used). Returns false if it is not a valid PCAP file.
+  bool scan_file(const char* pathname, bool walk, file& f);
+}
+
+#endif // PCAP_SCAN_H
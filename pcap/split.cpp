@@ -0,0 +1,473 @@
+#include <stdlib.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <new>
+#include "pcap/split.h"
+#include "pcap/probe.h"
+#include "pcap/decompress.h"
+#include "util/parallel.h"
+
+// Restrict the piece of a PCAP file to its packets in [start, end).
+static void select_range(const uint8_t* base,
+                         const pcap::offset_index& index,
+                         const pcap::file& f,
+                         pcap::nanoseconds start,
+                         pcap::nanoseconds end,
+                         pcap::file& piece)
+{
+  uint64_t first = (f.timestamp < start) ? index.seek(base, f, start) :
+                                           f.begin;
+
+  uint64_t next = (f.last_timestamp >= end) ? index.seek(base, f, end) :
+                                              f.data_end();
+
+  if (first < f.begin) {
+    first = f.begin;
+  }
+
+  if (next > f.data_end()) {
+    next = f.data_end();
+  }
+
+  if (next <= first) {
+    piece.packets = 0;
+    return;
+  }
+
+  piece.begin = first;
+  pcap::walk(base, next, piece);
+}
+
+pcap::splitter::~splitter()
+{
+  clear();
+}
+
+bool pcap::splitter::build(const files& files,
+                           mode m,
+                           uint64_t limit,
+                           bool pcapng,
+                           unsigned nworkers)
+{
+  clear();
+
+  const size_t count = files.count();
+
+  _M_files = &files;
+  _M_mode = m;
+  _M_pcapng = pcapng;
+
+  if (((_M_sources = new (std::nothrow) source[count + 1]) == nullptr) ||
+      ((_M_prefix = static_cast<uint64_t*>(
+                      malloc((count + 1) * sizeof(uint64_t))
+                    )) == nullptr) ||
+      ((_M_max_last = static_cast<nanoseconds*>(
+                        malloc((count + 1) * sizeof(nanoseconds))
+                      )) == nullptr)) {
+    return false;
+  }
+
+  // Get the offset indices of the PCAP files; each worker only touches the
+  // sources of its files.
+  if (!util::parallel_for(
+         count,
+         nworkers,
+         [&](unsigned worker, size_t idx) {
+           const file* const f = files.get(idx);
+           source* const src = &_M_sources[idx];
+
+           switch (m) {
+             case mode::size:
+               src->amount = pcapng ? f->blocks_size : f->records_size;
+               break;
+             case mode::packets:
+             case mode::interval:
+               src->amount = f->packets;
+               break;
+           }
+
+           // The compressed files are only decompressed if they cross the
+           // boundary of a chunk: they are estimated like the pcapng files.
+           if ((is_pcapng(f->magic)) || (f->compressed)) {
+             return true;
+           }
+
+           if ((!src->index.load(*f)) &&
+               ((!map(idx)) || (!src->index.build(src->base, *f)))) {
+             return false;
+           }
+
+           // The file starts in the middle (time window).
+           if (f->begin != sizeof(pcap_file_header)) {
+             if (!map(idx)) {
+               return false;
+             }
+
+             src->index.seek_offset(src->base,
+                                    *f,
+                                    f->begin,
+                                    &src->first_packet);
+           }
+
+           return true;
+         }
+       )) {
+    return false;
+  }
+
+  _M_prefix[0] = 0;
+  for (size_t i = 0; i < count; i++) {
+    const nanoseconds last = files.get(i)->last_timestamp;
+
+    _M_prefix[i + 1] = _M_prefix[i] + _M_sources[i].amount;
+    _M_max_last[i] = ((i == 0) || (last > _M_max_last[i - 1])) ?
+                       last :
+                       _M_max_last[i - 1];
+  }
+
+  if (!add(0)) {
+    return false;
+  }
+
+  if (count > 0) {
+    const nanoseconds first = files.get(0)->timestamp;
+    const nanoseconds last = _M_max_last[count - 1];
+
+    if (m == mode::interval) {
+      // Boundaries at multiples of the interval.
+      for (nanoseconds ts = (first / limit + 1) * limit;
+           ts <= last;
+           ts += limit) {
+        if (!add(ts)) {
+          return false;
+        }
+
+        // Overflow?
+        if (ts > UINT64_MAX - limit) {
+          break;
+        }
+      }
+    } else {
+      const uint64_t total = _M_prefix[count];
+
+      nanoseconds cur = 0;
+      uint64_t done = 0;
+
+      while (total - done > limit) {
+        // Latest boundary `ts` with at most `limit` bytes or packets in
+        // [cur, ts). The packets with the timestamp `ts` go to the next
+        // chunk, unless they alone exceed the limit.
+        nanoseconds lo = cur + 1;
+        nanoseconds hi = last + 1;
+
+        if (amount_before(lo) - done <= limit) {
+          while (hi - lo > 1) {
+            const nanoseconds mid = lo + (hi - lo) / 2;
+
+            if (amount_before(mid) - done <= limit) {
+              lo = mid;
+            } else {
+              hi = mid;
+            }
+          }
+        }
+
+        if (!add(lo)) {
+          return false;
+        }
+
+        cur = lo;
+        done = amount_before(cur);
+      }
+    }
+  }
+
+  return add(UINT64_MAX);
+}
+
+bool pcap::splitter::get(size_t idx, files& chunk)
+{
+  const nanoseconds start = _M_bounds[idx];
+  const nanoseconds end = _M_bounds[idx + 1];
+
+  // First file which ends in or after the chunk.
+  size_t lo = 0;
+  size_t hi = files_before(end);
+  const size_t last = hi;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+
+    if (_M_max_last[mid] < start) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  // The compressed files which end before the chunk are not read again
+  // (the chunks are read in order).
+  for (; _M_unmapped < lo; _M_unmapped++) {
+    if (_M_files->get(_M_unmapped)->compressed) {
+      unmap(_M_unmapped);
+    }
+  }
+
+  for (size_t i = lo; i < last; i++) {
+    const file* const f = _M_files->get(i);
+
+    if (f->last_timestamp < start) {
+      if (f->compressed) {
+        unmap(i);
+      }
+
+      continue;
+    }
+
+    file piece = *f;
+
+    // Does the file cross a boundary of the chunk?
+    if ((f->timestamp < start) || (f->last_timestamp >= end)) {
+      if (is_pcapng(f->magic)) {
+        piece.window_start = (start > f->window_start) ? start :
+                                                         f->window_start;
+        piece.window_end = (end < f->window_end) ? end : f->window_end;
+
+        uint64_t size;
+        int fd;
+        if ((fd = open_data(*f, size)) == -1) {
+          return false;
+        }
+
+        const bool ret = walk(fd, size, piece);
+        close(fd);
+
+        if (!ret) {
+          return false;
+        }
+      } else {
+        // The offset index of a compressed file is built the first time it
+        // crosses a boundary and kept for the next chunks.
+        const uint8_t* base;
+        if ((base = f->compressed ? map_compressed(i) : map(i)) == nullptr) {
+          return false;
+        }
+
+        select_range(base, _M_sources[i].index, *f, start, end, piece);
+      }
+
+      if (piece.packets == 0) {
+        continue;
+      }
+    }
+
+    if (!chunk.add(f->filename, piece)) {
+      return false;
+    }
+  }
+
+  // The first packet of the files crossing the start of the chunk has
+  // changed.
+  chunk.sort();
+
+  return true;
+}
+
+uint64_t pcap::splitter::amount_before(size_t idx, nanoseconds ts)
+{
+  const file* const f = _M_files->get(idx);
+  const source* const src = &_M_sources[idx];
+
+  if (ts <= f->timestamp) {
+    return 0;
+  } else if (ts > f->last_timestamp) {
+    return src->amount;
+  }
+
+  if ((is_pcapng(f->magic)) || (f->compressed)) {
+    // Assume that the packets are evenly spread over time.
+    return static_cast<uint64_t>(
+             static_cast<long double>(src->amount) *
+             (ts - f->timestamp) /
+             (f->last_timestamp - f->timestamp + 1)
+           );
+  }
+
+  const uint8_t* base;
+  if ((base = map(idx)) == nullptr) {
+    return 0;
+  }
+
+  uint64_t packet;
+  const uint64_t off = src->index.seek(base, *f, ts, &packet);
+
+  if (off <= f->begin) {
+    return 0;
+  } else if (off >= f->data_end()) {
+    return src->amount;
+  }
+
+  const uint64_t packets = packet - src->first_packet;
+
+  if (_M_mode != mode::size) {
+    return packets;
+  }
+
+  // An enhanced packet block is at least 16 bytes larger than the PCAP
+  // record.
+  return (off - f->begin) + (_M_pcapng ? 16 * packets : 0);
+}
+
+uint64_t pcap::splitter::amount_before(nanoseconds ts)
+{
+  const size_t n = files_before(ts);
+
+  // All the files starting before `ts`, minus the part after `ts` of the
+  // ones which end after it (the latest timestamp of the files up to `i`
+  // tells when there are no more of them).
+  uint64_t amount = _M_prefix[n];
+  for (size_t i = n; (i > 0) && (_M_max_last[i - 1] >= ts); i--) {
+    if (_M_files->get(i - 1)->last_timestamp >= ts) {
+      amount -= _M_sources[i - 1].amount - amount_before(i - 1, ts);
+    }
+  }
+
+  return amount;
+}
+
+size_t pcap::splitter::files_before(nanoseconds ts) const
+{
+  size_t lo = 0;
+  size_t hi = _M_files->count();
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+
+    if (_M_files->get(mid)->timestamp < ts) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  return lo;
+}
+
+const uint8_t* pcap::splitter::map(size_t idx)
+{
+  source* const src = &_M_sources[idx];
+
+  if (!src->base) {
+    const file* const f = _M_files->get(idx);
+
+    // Open file for reading.
+    int fd;
+    if ((fd = open(f->filename, O_RDONLY)) != -1) {
+      // Map file into memory.
+      void* base;
+      if ((base = mmap(nullptr,
+                       f->filesize,
+                       PROT_READ,
+                       MAP_SHARED,
+                       fd,
+                       0)) != MAP_FAILED) {
+        src->base = static_cast<const uint8_t*>(base);
+        src->size = f->filesize;
+      }
+
+      close(fd);
+    }
+  }
+
+  return src->base;
+}
+
+const uint8_t* pcap::splitter::map_compressed(size_t idx)
+{
+  source* const src = &_M_sources[idx];
+
+  if (!src->base) {
+    const file* const f = _M_files->get(idx);
+
+    // Open the decompressed data for reading.
+    uint64_t size;
+    int fd;
+    if ((fd = open_data(*f, size)) == -1) {
+      return nullptr;
+    }
+
+    // Map it into memory.
+    void* base;
+    if ((base = mmap(nullptr,
+                     size,
+                     PROT_READ,
+                     MAP_SHARED,
+                     fd,
+                     0)) != MAP_FAILED) {
+      src->base = static_cast<const uint8_t*>(base);
+      src->size = size;
+
+      if (!src->index.build(src->base, *f)) {
+        unmap(idx);
+      }
+    }
+
+    close(fd);
+  }
+
+  return src->base;
+}
+
+void pcap::splitter::unmap(size_t idx)
+{
+  source* const src = &_M_sources[idx];
+
+  if (src->base) {
+    munmap(const_cast<uint8_t*>(src->base), src->size);
+    src->base = nullptr;
+  }
+}
+
+bool pcap::splitter::add(nanoseconds ts)
+{
+  if (_M_nbounds == _M_size) {
+    const size_t size = (_M_size > 0) ? _M_size * 2 : 64;
+
+    nanoseconds* bounds;
+    if ((bounds = static_cast<nanoseconds*>(
+                    realloc(_M_bounds, size * sizeof(nanoseconds))
+                  )) == nullptr) {
+      return false;
+    }
+
+    _M_bounds = bounds;
+    _M_size = size;
+  }
+
+  _M_bounds[_M_nbounds++] = ts;
+
+  return true;
+}
+
+void pcap::splitter::clear()
+{
+  if (_M_sources) {
+    for (size_t i = 0; i < _M_files->count(); i++) {
+      unmap(i);
+    }
+
+    delete [] _M_sources;
+    _M_sources = nullptr;
+  }
+
+  free(_M_prefix);
+  _M_prefix = nullptr;
+
+  free(_M_max_last);
+  _M_max_last = nullptr;
+
+  free(_M_bounds);
+  _M_bounds = nullptr;
+  _M_size = 0;
+  _M_nbounds = 0;
+  _M_unmapped = 0;
+}
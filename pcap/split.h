@@ -0,0 +1,131 @@
+#ifndef PCAP_SPLIT_H
+#define PCAP_SPLIT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+#include "pcap/offsets.h"
+
+namespace pcap {
+  // Splitting of the output into chunks by size, number of packets or time.
+  // The chunks are consecutive time windows whose boundaries are computed up
+  // front from the offset indices of the PCAP files (the packets of a file
+  // are assumed to be in timestamp order; the packets of pcapng files are
+  // assumed to be evenly spread over time). Every chunk then gets its own
+  // list of files, the PCAP files crossing a boundary being restricted to
+  // the byte range of their packets in the chunk and the pcapng files being
+  // filtered packet by packet, so each chunk can be planned, sized and
+  // copied like a whole output.
+  class splitter {
+    public:
+      // Split criteria.
+      enum class mode {
+        size,     // Size of the packets (bytes).
+        packets,  // Number of packets.
+        interval  // Duration (nanoseconds), the chunks start at multiples of
+                  // it.
+      };
+
+      // Constructor.
+      splitter() = default;
+
+      // Destructor.
+      ~splitter();
+
+      // Compute the chunks of `files` (sorted and walked) with at most
+      // `limit` bytes, packets or nanoseconds each, using `nworkers` threads
+      // to get the offset indices (sidecar files are used if they are up to
+      // date). The sizes are the ones of the packets in a pcapng file if
+      // `pcapng` is true. A chunk only exceeds the limit when it holds packets
+      // with the same timestamp.
+      bool build(const files& files,
+                 mode m,
+                 uint64_t limit,
+                 bool pcapng,
+                 unsigned nworkers);
+
+      // Number of chunks (some might be empty).
+      size_t count() const
+      {
+        return (_M_nbounds > 0) ? _M_nbounds - 1 : 0;
+      }
+
+      // Time window of chunk `idx`: [start(idx), start(idx + 1)).
+      nanoseconds start(size_t idx) const
+      {
+        return _M_bounds[idx];
+      }
+
+      // Get the files of chunk `idx` (the chunks are read in order).
+      bool get(size_t idx, files& chunk);
+
+    private:
+      // Input file.
+      struct source {
+        // Offset index (PCAP files) and mapped file (the decompressed data
+        // of a compressed file).
+        offset_index index;
+        const uint8_t* base = nullptr;
+        uint64_t size = 0;
+
+        // Number of the first packet of the file (at `file::begin`).
+        uint64_t first_packet = 0;
+
+        // Number of bytes or packets of the file.
+        uint64_t amount = 0;
+      };
+
+      // Input files.
+      const files* _M_files = nullptr;
+      source* _M_sources = nullptr;
+
+      // Sum of the amounts of the files before each file and latest
+      // timestamp of the files up to each file.
+      uint64_t* _M_prefix = nullptr;
+      nanoseconds* _M_max_last = nullptr;
+
+      // Split criteria.
+      mode _M_mode = mode::size;
+      bool _M_pcapng = false;
+
+      // Boundaries of the chunks.
+      nanoseconds* _M_bounds = nullptr;
+      size_t _M_size = 0;
+      size_t _M_nbounds = 0;
+
+      // Files before `_M_unmapped` end before the last chunk read.
+      size_t _M_unmapped = 0;
+
+      // Number of bytes or packets of the file `idx` before `ts`.
+      uint64_t amount_before(size_t idx, nanoseconds ts);
+
+      // Number of bytes or packets of all the files before `ts`.
+      uint64_t amount_before(nanoseconds ts);
+
+      // Number of files whose first packet is before `ts`.
+      size_t files_before(nanoseconds ts) const;
+
+      // Map file `idx` into memory (if not already mapped).
+      const uint8_t* map(size_t idx);
+
+      // Map compressed file `idx` and build its offset index (if not
+      // already done).
+      const uint8_t* map_compressed(size_t idx);
+
+      // Unmap file `idx`.
+      void unmap(size_t idx);
+
+      // Add boundary.
+      bool add(nanoseconds ts);
+
+      // Release resources.
+      void clear();
+
+      // Disable copy constructor and assignment operator.
+      splitter(const splitter&) = delete;
+      splitter& operator=(const splitter&) = delete;
+  };
+}
+
+#endif // PCAP_SPLIT_H
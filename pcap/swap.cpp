@@ -0,0 +1,82 @@
+#include "pcap/swap.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+  #include <immintrin.h>
+#endif
+
+// Swap function.
+typedef void (*swap_function)(pcap::pcap_pkthdr*, size_t);
+
+static void swap_scalar(pcap::pcap_pkthdr* hdrs, size_t count)
+{
+  for (size_t i = 0; i < count; i++) {
+    pcap::swap(hdrs[i]);
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+  __attribute__((target("ssse3")))
+  static void swap_ssse3(pcap::pcap_pkthdr* hdrs, size_t count)
+  {
+    // Reverse the bytes of each 32-bit field.
+    const __m128i mask = _mm_set_epi8(12, 13, 14, 15,
+                                      8, 9, 10, 11,
+                                      4, 5, 6, 7,
+                                      0, 1, 2, 3);
+
+    __m128i* const p = reinterpret_cast<__m128i*>(hdrs);
+
+    for (size_t i = 0; i < count; i++) {
+      _mm_storeu_si128(p + i, _mm_shuffle_epi8(_mm_loadu_si128(p + i), mask));
+    }
+  }
+
+  __attribute__((target("avx2")))
+  static void swap_avx2(pcap::pcap_pkthdr* hdrs, size_t count)
+  {
+    // The shuffle works on each 128-bit lane (one header per lane).
+    const __m256i mask = _mm256_set_epi8(12, 13, 14, 15,
+                                         8, 9, 10, 11,
+                                         4, 5, 6, 7,
+                                         0, 1, 2, 3,
+                                         12, 13, 14, 15,
+                                         8, 9, 10, 11,
+                                         4, 5, 6, 7,
+                                         0, 1, 2, 3);
+
+    __m256i* const p = reinterpret_cast<__m256i*>(hdrs);
+
+    size_t i;
+    for (i = 0; i + 2 <= count; i += 2) {
+      _mm256_storeu_si256(p + i / 2,
+                          _mm256_shuffle_epi8(_mm256_loadu_si256(p + i / 2),
+                                              mask));
+    }
+
+    if (i < count) {
+      pcap::swap(hdrs[i]);
+    }
+  }
+#endif // defined(__x86_64__) || defined(__i386__)
+
+static swap_function select()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2")) {
+    return swap_avx2;
+  } else if (__builtin_cpu_supports("ssse3")) {
+    return swap_ssse3;
+  }
+#endif
+
+  return swap_scalar;
+}
+
+void pcap::swap(pcap_pkthdr* hdrs, size_t count)
+{
+  static const swap_function fn = select();
+
+  fn(hdrs, count);
+}
@@ -0,0 +1,15 @@
+#ifndef PCAP_SWAP_H
+#define PCAP_SWAP_H
+
+#include <stddef.h>
+#include "pcap/pcap.h"
+
+namespace pcap {
+  // Swap the byte order of an array of packet headers.
+  // Each 16-byte header is swapped with a single byte shuffle (pshufb), two
+  // headers per instruction if the CPU supports AVX2. The implementation is
+  // selected at run time; other architectures use scalar byte swaps.
+  void swap(pcap_pkthdr* hdrs, size_t count);
+}
+
+#endif // PCAP_SWAP_H
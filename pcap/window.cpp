@@ -0,0 +1,144 @@
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include "pcap/window.h"
+#include "pcap/offsets.h"
+#include "pcap/probe.h"
+#include "pcap/decompress.h"
+#include "util/parallel.h"
+
+// Keep the packets of a file crossing a boundary of the time window.
+// Returns false if the file couldn't be read.
+static bool select_file(pcap::file& f,
+                        pcap::nanoseconds start,
+                        pcap::nanoseconds end,
+                        bool& nomem)
+{
+  // Open file for reading.
+  uint64_t size;
+  int fd;
+  if ((fd = pcap::open_data(f, size)) == -1) {
+    return false;
+  }
+
+  bool ret = false;
+
+  if (pcap::is_pcapng(f.magic)) {
+    // The walk only counts the packets in the window.
+    f.window_start = start;
+    f.window_end = end;
+
+    ret = pcap::walk(fd, size, f);
+  } else {
+    // Map file into memory.
+    void* base;
+    if ((base = mmap(nullptr,
+                     size,
+                     PROT_READ,
+                     MAP_SHARED,
+                     fd,
+                     0)) != MAP_FAILED) {
+      madvise(base, size, MADV_SEQUENTIAL);
+
+      const uint8_t* const begin = static_cast<const uint8_t*>(base);
+
+      // Use the sidecar index if it is up to date.
+      pcap::offset_index index;
+      if ((index.load(f)) || (index.build(begin, f))) {
+        const uint64_t first = index.seek(begin, f, start);
+        uint64_t last = index.seek(begin, f, end);
+
+        // The packets of the file are not in timestamp order.
+        if (last < first) {
+          last = first;
+        }
+
+        f.begin = first;
+        pcap::walk(begin, last, f);
+
+        ret = true;
+      } else {
+        nomem = true;
+      }
+
+      munmap(base, size);
+    }
+  }
+
+  close(fd);
+
+  if (ret) {
+    f.valid = (f.packets > 0);
+  }
+
+  return ret;
+}
+
+bool pcap::select(files& files, nanoseconds start, nanoseconds end,
+                  unsigned nworkers)
+{
+  const size_t count = files.count();
+
+  // The files are sorted by the timestamp of their first packet: the files
+  // starting at or after the end of the window are dropped.
+  size_t lo = 0;
+  size_t hi = count;
+  while (lo < hi) {
+    const size_t mid = lo + (hi - lo) / 2;
+
+    if (files.get(mid)->timestamp < end) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+
+  for (size_t i = lo; i < count; i++) {
+    files.get(i)->valid = false;
+  }
+
+  std::atomic<bool> nomem(false);
+
+  // Each worker only touches the entries of its files.
+  util::parallel_for(
+    lo,
+    nworkers,
+    [&](unsigned worker, size_t idx) {
+      file* const f = files.get(idx);
+
+      if (f->walked) {
+        if (f->last_timestamp < start) {
+          // Before the window.
+          f->valid = false;
+          return true;
+        } else if ((f->timestamp >= start) && (f->last_timestamp < end)) {
+          // Inside the window.
+          return true;
+        }
+      }
+
+      bool failed = false;
+      if (!select_file(*f, start, end, failed)) {
+        if (failed) {
+          nomem.store(true);
+          return false;
+        }
+
+        fprintf(stderr, "Skipping '%s': error reading.\n", f->filename);
+        f->valid = false;
+      }
+
+      return true;
+    }
+  );
+
+  files.compact();
+
+  // The first packet of the files crossing the start of the window has
+  // changed.
+  files.sort();
+
+  return !nomem.load();
+}
@@ -0,0 +1,22 @@
+#ifndef PCAP_WINDOW_H
+#define PCAP_WINDOW_H
+
+#include "pcap/pcap.h"
+#include "pcap/files.h"
+
+namespace pcap {
+  // Keep only the packets of the (sorted) list in the time window
+  // [start, end), using `nworkers` threads.
+  // Files which are completely outside of the window are removed from the
+  // list without being read and files which are completely inside are kept
+  // as they are. The packet records of the PCAP files crossing a boundary
+  // of the window are found through a sparse offset index: the file then
+  // refers to the byte range of the records in the window, which is copied
+  // like a whole file. pcapng files crossing a boundary are filtered packet
+  // by packet.
+  // Returns false if memory could not be allocated.
+  bool select(files& files, nanoseconds start, nanoseconds end,
+              unsigned nworkers);
+}
+
+#endif // PCAP_WINDOW_H
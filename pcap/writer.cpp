@@ -0,0 +1,88 @@
+#include <unistd.h>
+#include <errno.h>
+#include "pcap/writer.h"
+
+bool pcap::writer::flush()
+{
+  if (_M_stream) {
+    // Append the records to the stream.
+    for (unsigned i = 0; i < _M_niov; i++) {
+      if (!_M_stream->write(_M_iov[i].iov_base, _M_iov[i].iov_len)) {
+        return false;
+      }
+    }
+
+    _M_offset += _M_pending;
+    _M_pending = 0;
+    _M_niov = 0;
+    _M_used = 0;
+
+    return true;
+  }
+
+  if (_M_pipe) {
+    return flush_pipe();
+  }
+
+  struct iovec* iov = _M_iov;
+  unsigned niov = _M_niov;
+
+  while (niov > 0) {
+    const ssize_t ret = pwritev(_M_fd, iov, niov, _M_offset);
+
+    if (ret > 0) {
+      _M_offset += ret;
+      _M_pending -= ret;
+
+      // Skip the iovecs which have been written completely.
+      size_t written = ret;
+      while ((niov > 0) && (written >= iov->iov_len)) {
+        written -= iov->iov_len;
+
+        iov++;
+        niov--;
+      }
+
+      if (written > 0) {
+        iov->iov_base = static_cast<uint8_t*>(iov->iov_base) + written;
+        iov->iov_len -= written;
+      }
+    } else if ((ret == 0) || (errno != EINTR)) {
+      return false;
+    }
+  }
+
+  _M_niov = 0;
+  _M_used = 0;
+
+  return true;
+}
+
+bool pcap::writer::flush_pipe()
+{
+  // Runs of iovecs which are spliced (records referenced, of at least a
+  // page: every iovec takes a buffer of the pipe) or written (copies, as the
+  // buffer is reused before the reader consumes them, and small records).
+  unsigned first = 0;
+  while (first < _M_niov) {
+    const bool splice = spliceable(_M_iov[first]);
+
+    unsigned last = first + 1;
+    while ((last < _M_niov) && (spliceable(_M_iov[last]) == splice)) {
+      last++;
+    }
+
+    if (!_M_pipe->write(_M_iov + first, last - first, splice)) {
+      return false;
+    }
+
+    first = last;
+  }
+
+  _M_offset += _M_pending;
+  _M_pending = 0;
+  _M_niov = 0;
+  _M_used = 0;
+
+  return true;
+}
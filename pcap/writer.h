@@ -0,0 +1,247 @@
+#ifndef PCAP_WRITER_H
+#define PCAP_WRITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <sys/uio.h>
+#include "pcap/pcap.h"
+#include "io/compressor.h"
+#include "io/pipe.h"
+
+namespace pcap {
+  // Batched writer.
+  // Writes records at increasing offsets of the output file with pwritev(),
+  // or appends them to a compressed stream or to a pipe (where the records
+  // referenced, pages of the mapped input files, are spliced and the copies
+  // written).
+  // Records are referenced, not copied, so they have to stay valid until the
+  // next flush(). Adjacent records are coalesced into a single iovec.
+  // Packet headers which have to be rewritten (e.g. to the resolution of the
+  // output file or to a snapshot length) are copied to a buffer; consecutive
+  // copies are coalesced too. Truncated packets keep referencing the first
+  // bytes of their data.
+  class writer {
+    public:
+      // Maximum number of iovecs per system call.
+      static constexpr const unsigned max_iov = 1024;
+
+      // Maximum number of bytes buffered before flushing.
+      static constexpr const size_t max_pending = 4 * 1024 * 1024;
+
+      // Size of the buffer for copied data.
+      static constexpr const size_t buffer_size = max_iov * 32;
+
+      // Minimum size of the records spliced into a pipe.
+      static constexpr const size_t min_splice = 4096;
+
+      // Constructor.
+      writer(int fd, uint64_t offset, resolution res)
+        : _M_fd(fd),
+          _M_offset(offset),
+          _M_resolution(res)
+      {
+      }
+
+      // Constructor for a compressed stream (offsets are positions in the
+      // uncompressed data).
+      writer(io::compressor& stream, resolution res)
+        : _M_fd(-1),
+          _M_stream(&stream),
+          _M_offset(stream.bytes_in()),
+          _M_resolution(res)
+      {
+      }
+
+      // Constructor for a pipe (offsets are positions in the stream).
+      writer(io::pipe_output& pipe, resolution res)
+        : _M_fd(pipe.fd()),
+          _M_pipe(&pipe),
+          _M_offset(0),
+          _M_resolution(res)
+      {
+      }
+
+      // Add record.
+      bool write(const void* data, size_t len)
+      {
+        if ((_M_niov > 0) &&
+            (static_cast<const uint8_t*>(_M_iov[_M_niov - 1].iov_base) +
+             _M_iov[_M_niov - 1].iov_len == data)) {
+          _M_iov[_M_niov - 1].iov_len += len;
+        } else {
+          if ((_M_niov == max_iov) && (!flush())) {
+            return false;
+          }
+
+          _M_iov[_M_niov].iov_base = const_cast<void*>(data);
+          _M_iov[_M_niov].iov_len = len;
+          _M_niov++;
+        }
+
+        return ((_M_pending += len) < max_pending) || (flush());
+      }
+
+      // Add a copy of `data` (e.g. a rewritten header).
+      bool copy(const void* data, size_t len)
+      {
+        // Larger data is copied in pieces.
+        while (len > buffer_size) {
+          if (!copy(data, buffer_size)) {
+            return false;
+          }
+
+          data = static_cast<const uint8_t*>(data) + buffer_size;
+          len -= buffer_size;
+        }
+
+        if (((_M_used + len > buffer_size) || (_M_niov == max_iov)) &&
+            (!flush())) {
+          return false;
+        }
+
+        uint8_t* const p = _M_buffer + _M_used;
+        memcpy(p, data, len);
+        _M_used += len;
+
+        return write(p, len);
+      }
+
+      // Add record with a new packet header.
+      bool write(const pcap_pkthdr& hdr, const void* data)
+      {
+        return (copy(&hdr, sizeof(pcap_pkthdr))) && (write(data, hdr.caplen));
+      }
+
+      // Add packet of a file with resolution `res` (truncated to the
+      // snapshot length).
+      // `hdr` is in host byte order; if it is not followed by the data, it
+      // is copied.
+      bool write(const pcap_pkthdr* hdr, const void* data, resolution res)
+      {
+        if ((res == _M_resolution) && (hdr->caplen <= _M_snaplen)) {
+          if (hdr + 1 == data) {
+            return write(hdr, sizeof(pcap_pkthdr) + hdr->caplen);
+          }
+
+          return write(*hdr, data);
+        }
+
+        pcap_pkthdr h = *hdr;
+
+        if (res != _M_resolution) {
+          h.ts.tv_usec = (_M_resolution == resolution::nanoseconds) ?
+                           h.ts.tv_usec * 1000 :
+                           h.ts.tv_usec / 1000;
+        }
+
+        if (h.caplen > _M_snaplen) {
+          h.caplen = _M_snaplen;
+        }
+
+        return write(h, data);
+      }
+
+      // Write the pending records.
+      bool flush();
+
+      // Flush the pending records and continue at `offset` (the bytes
+      // in between are written by someone else).
+      bool seek(uint64_t offset)
+      {
+        if (flush()) {
+          _M_offset = offset;
+          return true;
+        }
+
+        return false;
+      }
+
+      // File descriptor (-1 for compressed streams).
+      int fd() const
+      {
+        return _M_fd;
+      }
+
+      // Compressed stream (nullptr when writing to a file).
+      io::compressor* stream() const
+      {
+        return _M_stream;
+      }
+
+      // Are the records appended (compressed stream or pipe) rather than
+      // written at offsets?
+      bool sequential() const
+      {
+        return (_M_stream) || (_M_pipe);
+      }
+
+      // Resolution of the output file.
+      resolution timestamp_resolution() const
+      {
+        return _M_resolution;
+      }
+
+      // Snapshot length: the packets are truncated to `snaplen` bytes.
+      void set_snaplen(uint32_t snaplen)
+      {
+        _M_snaplen = snaplen;
+      }
+
+      uint32_t snaplen() const
+      {
+        return _M_snaplen;
+      }
+
+      // Offset of the next record.
+      uint64_t offset() const
+      {
+        return _M_offset + _M_pending;
+      }
+
+    private:
+      // File descriptor.
+      int _M_fd;
+
+      // Compressed stream.
+      io::compressor* _M_stream = nullptr;
+
+      // Pipe.
+      io::pipe_output* _M_pipe = nullptr;
+
+      // Offset of the first pending record.
+      uint64_t _M_offset;
+
+      // Resolution of the output file.
+      resolution _M_resolution;
+
+      // Snapshot length.
+      uint32_t _M_snaplen = UINT32_MAX;
+
+      // Pending records.
+      struct iovec _M_iov[max_iov];
+      unsigned _M_niov = 0;
+      size_t _M_pending = 0;
+
+      // Copied data.
+      uint8_t _M_buffer[buffer_size];
+      size_t _M_used = 0;
+
+      // Write the pending records to the pipe.
+      bool flush_pipe();
+
+      // Can the data of the iovec be spliced into the pipe?
+      bool spliceable(const struct iovec& iov) const
+      {
+        return (iov.iov_len >= min_splice) &&
+               ((iov.iov_base < _M_buffer) ||
+                (iov.iov_base >= _M_buffer + buffer_size));
+      }
+
+      // Disable copy constructor and assignment operator.
+      writer(const writer&) = delete;
+      writer& operator=(const writer&) = delete;
+  };
+}
+
+#endif // PCAP_WRITER_H
@@ -0,0 +1,307 @@
+#include <stdint.h>
+#include <string.h>
+#include "pcap/bpf.h"
+#include "tests/check.h"
+
+using namespace pcap::bpf;
+
+// Shorthands for the instructions.
+static constexpr instruction stmt(uint16_t code, uint32_t k)
+{
+  return instruction{code, 0, 0, k};
+}
+
+static constexpr instruction jump(uint16_t code,
+                                  uint32_t k,
+                                  uint8_t jt,
+                                  uint8_t jf)
+{
+  return instruction{code, jt, jf, k};
+}
+
+// Run program on `caplen` bytes of a packet of `len` bytes.
+template<size_t N>
+static uint32_t run(const instruction (&insns)[N],
+                    const uint8_t* data,
+                    uint32_t caplen,
+                    uint32_t len)
+{
+  program prog;
+  if (!tests::check(prog.load(insns, N), "program not loaded")) {
+    return UINT32_MAX;
+  }
+
+  return prog.run(data, caplen, len);
+}
+
+// The loads past the captured bytes stop the program (the packet is
+// dropped), whether the precheck of the capture length catches them or not.
+static void test_truncated()
+{
+  uint8_t pkt[128];
+  for (size_t i = 0; i < sizeof(pkt); i++) {
+    pkt[i] = static_cast<uint8_t>(i);
+  }
+
+  // ld [20]; ret #1: at least 24 bytes.
+  static const instruction word[] = {
+    stmt(class_ld | size_w | mode_abs, 20),
+    stmt(class_ret | src_k, 1)
+  };
+
+  program prog;
+  if (tests::check(prog.load(word, 2), "word load not loaded")) {
+    tests::check(prog.min_caplen() == 24,
+                 "minimum capture length %u instead of 24",
+                 prog.min_caplen());
+  }
+
+  tests::check(run(word, pkt, 23, 128) == 0, "ld [20] with 23 bytes");
+  tests::check(run(word, pkt, 24, 128) == 1, "ld [20] with 24 bytes");
+
+  // ldh [126] and ldb [127] at the end of the packet.
+  static const instruction half[] = {
+    stmt(class_ld | size_h | mode_abs, 126),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(half, pkt, 127, 128) == 0, "ldh [126] with 127 bytes");
+  tests::check(run(half, pkt, 128, 128) == 0x7e7f, "ldh [126] value");
+
+  static const instruction byte[] = {
+    stmt(class_ld | size_b | mode_abs, 127),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(byte, pkt, 127, 128) == 0, "ldb [127] with 127 bytes");
+  tests::check(run(byte, pkt, 128, 128) == 0x7f, "ldb [127] value");
+
+  // A branch accepting short packets makes the precheck pass: the load of
+  // the other branch has to stop the program.
+  //   ldb [0]; jeq #0 jt 2 jf 3; ld [100]; ret #2; ret #3
+  static const instruction branch[] = {
+    stmt(class_ld | size_b | mode_abs, 0),
+    jump(class_jmp | op_jeq | src_k, 0, 0, 2),
+    stmt(class_ld | size_w | mode_abs, 100),
+    stmt(class_ret | src_k, 2),
+    stmt(class_ret | src_k, 3)
+  };
+
+  tests::check(run(branch, pkt, 50, 128) == 0, "ld [100] with 50 bytes");
+  tests::check(run(branch, pkt, 104, 128) == 2, "ld [100] with 104 bytes");
+
+  pkt[0] = 1;
+  tests::check(run(branch, pkt, 50, 128) == 3, "branch without load");
+
+  // ldxb 4*([k]&0xf) past the end.
+  static const instruction msh[] = {
+    stmt(class_ldx | size_b | mode_msh, 14),
+    stmt(class_misc | op_txa, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(msh, pkt, 14, 128) == 0, "ldxb [14] with 14 bytes");
+  tests::check(run(msh, pkt, 15, 128) == 4 * (14 & 0x0f), "ldxb [14] value");
+
+  // The length is the one of the packet, not the captured one.
+  static const instruction len[] = {
+    stmt(class_ld | size_w | mode_len, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(len, pkt, 10, 1500) == 1500, "ld #pktlen");
+}
+
+// A division or modulo by X = 0 stops the program (the divisor K is
+// checked when the program is validated).
+static void test_division()
+{
+  const uint8_t pkt[1] = {0};
+
+  //   ldx #X; ld #10; div x; ret a
+  const instruction div0[] = {
+    stmt(class_ldx | size_w | mode_imm, 0),
+    stmt(class_ld | size_w | mode_imm, 10),
+    stmt(class_alu | op_div | src_x, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  const instruction div2[] = {
+    stmt(class_ldx | size_w | mode_imm, 2),
+    stmt(class_ld | size_w | mode_imm, 10),
+    stmt(class_alu | op_div | src_x, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(div0, pkt, 1, 1) == 0, "div by X = 0");
+  tests::check(run(div2, pkt, 1, 1) == 5, "div by X = 2");
+
+  //   ldx #X; ld #10; mod x; ret #7
+  const instruction mod0[] = {
+    stmt(class_ldx | size_w | mode_imm, 0),
+    stmt(class_ld | size_w | mode_imm, 10),
+    stmt(class_alu | op_mod | src_x, 0),
+    stmt(class_ret | src_k, 7)
+  };
+
+  const instruction mod3[] = {
+    stmt(class_ldx | size_w | mode_imm, 3),
+    stmt(class_ld | size_w | mode_imm, 10),
+    stmt(class_alu | op_mod | src_x, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(mod0, pkt, 1, 1) == 0, "mod by X = 0");
+  tests::check(run(mod3, pkt, 1, 1) == 1, "mod by X = 3");
+
+  // X = 0 loaded from the scratch memory.
+  const instruction mem0[] = {
+    stmt(class_ld | size_w | mode_imm, 0),
+    stmt(class_st, 5),
+    stmt(class_ldx | size_w | mode_mem, 5),
+    stmt(class_ld | size_w | mode_imm, 10),
+    stmt(class_alu | op_div | src_x, 0),
+    stmt(class_ret | src_k, 7)
+  };
+
+  tests::check(run(mem0, pkt, 1, 1) == 0, "div by M[5] = 0");
+}
+
+// Indirect loads past the captured bytes, including offsets overflowing
+// 32 bits.
+static void test_indirect()
+{
+  uint8_t pkt[64];
+  for (size_t i = 0; i < sizeof(pkt); i++) {
+    pkt[i] = static_cast<uint8_t>(i);
+  }
+
+  //   ldx #60; ldb [x + 3]; ret a
+  static const instruction byte[] = {
+    stmt(class_ldx | size_w | mode_imm, 60),
+    stmt(class_ld | size_b | mode_ind, 3),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(byte, pkt, 63, 64) == 0, "ldb [x + 3] with 63 bytes");
+  tests::check(run(byte, pkt, 64, 64) == 63, "ldb [x + 3] value");
+
+  //   ldx #60; ldh [x + 3]; ret a
+  static const instruction half[] = {
+    stmt(class_ldx | size_w | mode_imm, 60),
+    stmt(class_ld | size_h | mode_ind, 3),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(half, pkt, 64, 64) == 0, "ldh [x + 3] past the end");
+
+  //   ldx #60; ld [x + 0]; ret a
+  static const instruction word[] = {
+    stmt(class_ldx | size_w | mode_imm, 60),
+    stmt(class_ld | size_w | mode_ind, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  tests::check(run(word, pkt, 63, 64) == 0, "ld [x + 0] with 63 bytes");
+  tests::check(run(word, pkt, 64, 64) == 0x3c3d3e3f, "ld [x + 0] value");
+
+  // X + K wraps around in 32 bits.
+  static const instruction wrap[] = {
+    stmt(class_ldx | size_w | mode_imm, 0xffffffff),
+    stmt(class_ld | size_b | mode_ind, 2),
+    stmt(class_ret | src_k, 1)
+  };
+
+  tests::check(run(wrap, pkt, 64, 64) == 0, "ldb [x + 2] with X = 2^32 - 1");
+
+  static const instruction wrapw[] = {
+    stmt(class_ldx | size_w | mode_imm, 0xfffffffe),
+    stmt(class_ld | size_w | mode_ind, 4),
+    stmt(class_ret | src_k, 1)
+  };
+
+  tests::check(run(wrapw, pkt, 64, 64) == 0, "ld [x + 4] with X = 2^32 - 2");
+
+  // X from the IPv4 header length (ldxb 4*([k]&0xf)), past the end.
+  uint8_t ip[34];
+  memset(ip, 0, sizeof(ip));
+  ip[14] = 0x4f;
+
+  static const instruction hdr[] = {
+    stmt(class_ldx | size_b | mode_msh, 14),
+    stmt(class_ld | size_h | mode_ind, 14),
+    stmt(class_ret | src_k, 1)
+  };
+
+  tests::check(run(hdr, ip, sizeof(ip), 1500) == 0,
+               "ldh [x + 14] with a 60-byte IPv4 header");
+}
+
+// Invalid programs are rejected.
+static void test_validate()
+{
+  static const instruction div0[] = {
+    stmt(class_ld | size_w | mode_imm, 10),
+    stmt(class_alu | op_div | src_k, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  static const instruction mod0[] = {
+    stmt(class_ld | size_w | mode_imm, 10),
+    stmt(class_alu | op_mod | src_k, 0),
+    stmt(class_ret | src_a, 0)
+  };
+
+  static const instruction mem[] = {
+    stmt(class_ld | size_w | mode_mem, memwords),
+    stmt(class_ret | src_a, 0)
+  };
+
+  static const instruction shift[] = {
+    stmt(class_alu | op_lsh | src_k, 32),
+    stmt(class_ret | src_a, 0)
+  };
+
+  static const instruction jt[] = {
+    jump(class_jmp | op_jeq | src_k, 0, 1, 0),
+    stmt(class_ret | src_k, 0)
+  };
+
+  static const instruction ja[] = {
+    stmt(class_jmp | op_ja, 1),
+    stmt(class_ret | src_k, 0)
+  };
+
+  static const instruction noret[] = {
+    stmt(class_ld | size_w | mode_imm, 10)
+  };
+
+  static const instruction opcode[] = {
+    stmt(0xff, 0),
+    stmt(class_ret | src_k, 0)
+  };
+
+  tests::check(!validate(div0, 3), "div #0 accepted");
+  tests::check(!validate(mod0, 3), "mod #0 accepted");
+  tests::check(!validate(mem, 2), "M[16] accepted");
+  tests::check(!validate(shift, 2), "lsh #32 accepted");
+  tests::check(!validate(jt, 2), "jt past the end accepted");
+  tests::check(!validate(ja, 2), "ja past the end accepted");
+  tests::check(!validate(noret, 1), "program without ret accepted");
+  tests::check(!validate(opcode, 2), "unknown opcode accepted");
+  tests::check(!validate(noret, 0), "empty program accepted");
+
+  program prog;
+  tests::check(!prog.load(div0, 3), "div #0 loaded");
+  tests::check(prog.run(nullptr, 0, 0) == 0, "unloaded program accepts");
+}
+
+int main()
+{
+  test_truncated();
+  test_division();
+  test_indirect();
+  test_validate();
+
+  return tests::report("bpf");
+}
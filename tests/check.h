@@ -0,0 +1,43 @@
+#ifndef TESTS_CHECK_H
+#define TESTS_CHECK_H
+
+#include <stdarg.h>
+#include <stdio.h>
+
+// Minimal test harness: each test program counts its checks and exits with
+// a non-zero status if any of them failed.
+namespace tests {
+  static unsigned nchecks = 0;
+  static unsigned nfailures = 0;
+
+  // Check condition (the message describes the failure).
+  __attribute__((format(printf, 2, 3)))
+  static bool check(bool cond, const char* format, ...)
+  {
+    nchecks++;
+
+    if (!cond) {
+      nfailures++;
+
+      va_list ap;
+      va_start(ap, format);
+
+      fprintf(stderr, "FAIL: ");
+      vfprintf(stderr, format, ap);
+      fprintf(stderr, "\n");
+
+      va_end(ap);
+    }
+
+    return cond;
+  }
+
+  // Print the number of checks and failures; returns the exit status.
+  static int report(const char* name)
+  {
+    printf("%s: %u checks, %u failures.\n", name, nchecks, nfailures);
+    return (nfailures == 0) ? 0 : 1;
+  }
+}
+
+#endif // TESTS_CHECK_H
@@ -0,0 +1,371 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "pcap/dedup.h"
+#include "tests/check.h"
+
+// Maximum length hashed.
+static constexpr const size_t max_length = 300;
+
+// Link type.
+static constexpr const uint32_t linktype_ethernet = 1;
+
+// Size of the packets of the table tests.
+static constexpr const size_t packet_size = 64;
+
+// The hash is the same with and without AVX2, for all the lengths around
+// the stripes (32 bytes) and the blocks of stripes (256 bytes), from any
+// alignment.
+static void test_avx2()
+{
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+
+  if (!__builtin_cpu_supports("avx2")) {
+    printf("dedup: AVX2 not supported, only the scalar hash is used.\n");
+    return;
+  }
+
+  uint8_t buf[max_length + 32];
+  uint64_t state = 0x243f6a8885a308d3ull;
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    state = state * 6364136223846793005ull + 1442695040888963407ull;
+    buf[i] = static_cast<uint8_t>(state >> 56);
+  }
+
+  static const uint64_t seeds[] = {0, 1, 60, 1514, UINT64_MAX};
+
+  for (size_t align = 0; align < 32; align += 7) {
+    for (size_t len = 0; len <= max_length; len++) {
+      for (size_t i = 0; i < sizeof(seeds) / sizeof(seeds[0]); i++) {
+        const uint64_t h = pcap::deduplicator::hash(buf + align,
+                                                    len,
+                                                    seeds[i]);
+
+        const uint64_t expected =
+          pcap::deduplicator::hash_scalar(buf + align, len, seeds[i]);
+
+        tests::check(h == expected,
+                     "hash of %zu bytes (alignment %zu, seed %llu): "
+                     "%016llx instead of %016llx",
+                     len,
+                     align,
+                     static_cast<unsigned long long>(seeds[i]),
+                     static_cast<unsigned long long>(h),
+                     static_cast<unsigned long long>(expected));
+      }
+    }
+  }
+#else
+  printf("dedup: not an x86 CPU, only the scalar hash is used.\n");
+#endif
+}
+
+// Any changed byte or length changes the hash.
+static void test_sensitivity()
+{
+  uint8_t buf[max_length];
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] = static_cast<uint8_t>(i * 31);
+  }
+
+  const uint64_t h = pcap::deduplicator::hash(buf, sizeof(buf), 0);
+
+  for (size_t i = 0; i < sizeof(buf); i++) {
+    buf[i] ^= 0x01;
+
+    tests::check(pcap::deduplicator::hash(buf, sizeof(buf), 0) != h,
+                 "flipping byte %zu doesn't change the hash",
+                 i);
+
+    buf[i] ^= 0x01;
+  }
+
+  for (size_t len = 1; len < sizeof(buf); len++) {
+    tests::check(pcap::deduplicator::hash(buf, len, 0) !=
+                 pcap::deduplicator::hash(buf, len - 1, 0),
+                 "hashes of %zu and %zu bytes are the same",
+                 len,
+                 len - 1);
+  }
+}
+
+// Ethernet frame of packet `n` (its number in the payload).
+static void make_packet(uint8_t* pkt, uint64_t n)
+{
+  memset(pkt, 0, packet_size);
+  pkt[12] = 0x88;
+  pkt[13] = 0xb5;
+  memcpy(pkt + 14, &n, sizeof(uint64_t));
+}
+
+// A packet seen again less than the window after it is a duplicate; once
+// the window has passed, it is a new packet.
+static void test_window()
+{
+  static constexpr const pcap::nanoseconds window = 1000;
+
+  pcap::deduplicator dedup;
+  if (!tests::check(dedup.init(window, false), "deduplicator not created")) {
+    return;
+  }
+
+  uint8_t a[packet_size];
+  uint8_t b[packet_size];
+  make_packet(a, 1);
+  make_packet(b, 2);
+
+  tests::check(!dedup.duplicate(linktype_ethernet, a, packet_size, 100, 0),
+               "first packet is a duplicate");
+  tests::check(!dedup.duplicate(linktype_ethernet, b, packet_size, 100, 10),
+               "different packet is a duplicate");
+  tests::check(dedup.duplicate(linktype_ethernet, a, packet_size, 100, 999),
+               "packet seen 999 ns before is not a duplicate");
+
+  // Same bytes but different length on the wire.
+  tests::check(!dedup.duplicate(linktype_ethernet, a, packet_size, 200, 999),
+               "packet with another length is a duplicate");
+
+  // The window starts at the first packet (duplicates don't extend it).
+  tests::check(!dedup.duplicate(linktype_ethernet, a, packet_size, 100, 1000),
+               "packet seen 1000 ns before is a duplicate");
+  tests::check(dedup.duplicate(linktype_ethernet, b, packet_size, 100, 1009),
+               "packet seen 999 ns before is not a duplicate");
+  tests::check(!dedup.duplicate(linktype_ethernet, b, packet_size, 100, 1010),
+               "packet seen 1000 ns before is a duplicate");
+}
+
+// Check that the packets [first, last) are duplicates at `timestamp`
+// (a duplicate is not remembered again, so the state doesn't change).
+static void check_remembered(pcap::deduplicator& dedup,
+                             uint64_t first,
+                             uint64_t last,
+                             pcap::nanoseconds timestamp,
+                             const char* what)
+{
+  uint64_t nmissing = 0;
+  for (uint64_t n = first; n < last; n++) {
+    uint8_t pkt[packet_size];
+    make_packet(pkt, n);
+
+    if (!dedup.duplicate(linktype_ethernet,
+                         pkt,
+                         packet_size,
+                         packet_size,
+                         timestamp)) {
+      nmissing++;
+    }
+  }
+
+  tests::check(nmissing == 0,
+               "%s: %llu packets of [%llu, %llu) not found",
+               what,
+               static_cast<unsigned long long>(nmissing),
+               static_cast<unsigned long long>(first),
+               static_cast<unsigned long long>(last));
+}
+
+// The table keeps working when it grows, when the queue wraps around and
+// when entries are removed from the middle of clusters (backward shift).
+static void test_table()
+{
+  // 20000 packets at the same time: the table grows from 4096 entries to
+  // 32768.
+  static constexpr const uint64_t count = 20000;
+
+  pcap::deduplicator dedup;
+  if (!tests::check(dedup.init(1000000, false), "deduplicator not created")) {
+    return;
+  }
+
+  uint64_t ndup = 0;
+  for (uint64_t n = 0; n < count; n++) {
+    uint8_t pkt[packet_size];
+    make_packet(pkt, n);
+
+    if (dedup.duplicate(linktype_ethernet, pkt, packet_size, packet_size, 0)) {
+      ndup++;
+    }
+  }
+
+  tests::check(ndup == 0,
+               "%llu new packets taken for duplicates",
+               static_cast<unsigned long long>(ndup));
+
+  check_remembered(dedup, 0, count, 0, "after growing");
+
+  // One packet per nanosecond with a window of 6000 ns: each new packet
+  // expires the oldest one, the queue (8192 entries after growing once)
+  // wraps around several times and the table stays about 37% full, with
+  // clusters to shift back on removal.
+  static constexpr const pcap::nanoseconds window = 6000;
+  static constexpr const uint64_t total = 50000;
+
+  if (!tests::check(dedup.init(window, false), "deduplicator not created")) {
+    return;
+  }
+
+  ndup = 0;
+  for (uint64_t n = 0; n < total; n++) {
+    uint8_t pkt[packet_size];
+    make_packet(pkt, n);
+
+    if (dedup.duplicate(linktype_ethernet, pkt, packet_size, packet_size, n)) {
+      ndup++;
+    }
+
+    // Every packet still in the window has to be found.
+    if ((n % 7919 == 0) || (n == window + 2000)) {
+      const uint64_t first = (n + 1 > window) ? n + 1 - window : 0;
+      check_remembered(dedup, first, n + 1, n, "sliding window");
+    }
+  }
+
+  tests::check(ndup == 0,
+               "%llu new packets taken for duplicates in the window",
+               static_cast<unsigned long long>(ndup));
+
+  // All the packets in the window are found, the ones which expired are
+  // new packets again.
+  check_remembered(dedup, total - window, total, total - 1, "at the end");
+
+  uint64_t nexpired = 0;
+  for (uint64_t n = total - 2 * window; n < total - window; n++) {
+    uint8_t pkt[packet_size];
+    make_packet(pkt, n);
+
+    if (dedup.duplicate(linktype_ethernet,
+                        pkt,
+                        packet_size,
+                        packet_size,
+                        total - 1)) {
+      nexpired++;
+    }
+  }
+
+  tests::check(nexpired == 0,
+               "%llu expired packets taken for duplicates",
+               static_cast<unsigned long long>(nexpired));
+}
+
+// Ethernet frame with an IPv4 header (TTL, checksum and source address
+// given) and a UDP payload.
+static size_t make_ipv4(uint8_t* pkt, uint8_t ttl, uint16_t sum, uint8_t src)
+{
+  memset(pkt, 0, 60);
+  pkt[12] = 0x08;
+  pkt[13] = 0x00;
+
+  uint8_t* const ip = pkt + 14;
+  ip[0] = 0x45;
+  ip[3] = 46;
+  ip[8] = ttl;
+  ip[9] = 17;
+  ip[10] = static_cast<uint8_t>(sum >> 8);
+  ip[11] = static_cast<uint8_t>(sum);
+  ip[12] = 10;
+  ip[15] = src;
+  ip[16] = 10;
+  ip[19] = 2;
+
+  for (size_t i = 34; i < 60; i++) {
+    pkt[i] = static_cast<uint8_t>(i);
+  }
+
+  return 60;
+}
+
+// Ethernet frame with an IPv6 header (hop limit and source address given).
+static size_t make_ipv6(uint8_t* pkt, uint8_t hops, uint8_t src)
+{
+  memset(pkt, 0, 78);
+  pkt[12] = 0x86;
+  pkt[13] = 0xdd;
+
+  uint8_t* const ip = pkt + 14;
+  ip[0] = 0x60;
+  ip[5] = 24;
+  ip[6] = 17;
+  ip[7] = hops;
+  ip[8] = 0x20;
+  ip[23] = src;
+  ip[24] = 0x20;
+  ip[39] = 2;
+
+  for (size_t i = 54; i < 78; i++) {
+    pkt[i] = static_cast<uint8_t>(i);
+  }
+
+  return 78;
+}
+
+// Is `second` (seen 1 ns after `first`) a duplicate of `first`?
+static bool same(bool ignore_volatile,
+                 const uint8_t* first,
+                 const uint8_t* second,
+                 size_t len)
+{
+  pcap::deduplicator dedup;
+  if (!tests::check(dedup.init(1000, ignore_volatile),
+                    "deduplicator not created")) {
+    return false;
+  }
+
+  dedup.duplicate(linktype_ethernet, first, len, len, 0);
+
+  return dedup.duplicate(linktype_ethernet, second, len, len, 1);
+}
+
+// Packets differing only in the TTL and header checksum (IPv4) or in the
+// hop limit (IPv6) are duplicates only if the volatile fields are ignored.
+static void test_volatile()
+{
+  uint8_t a[60];
+  uint8_t b[60];
+  size_t len = make_ipv4(a, 64, 0x1234, 1);
+
+  make_ipv4(b, 63, 0x1334, 1);
+  tests::check(!same(false, a, b, len), "TTL and checksum not hashed");
+  tests::check(same(true, a, b, len), "TTL and checksum hashed");
+
+  make_ipv4(b, 64, 0x4321, 1);
+  tests::check(!same(false, a, b, len), "checksum not hashed");
+  tests::check(same(true, a, b, len), "checksum hashed");
+
+  make_ipv4(b, 64, 0x1234, 3);
+  tests::check(!same(true, a, b, len), "IPv4 source address ignored");
+
+  make_ipv4(b, 64, 0x1234, 1);
+  b[59] ^= 0xff;
+  tests::check(!same(true, a, b, len), "IPv4 payload ignored");
+
+  uint8_t c[78];
+  uint8_t d[78];
+  len = make_ipv6(c, 64, 1);
+
+  make_ipv6(d, 62, 1);
+  tests::check(!same(false, c, d, len), "hop limit not hashed");
+  tests::check(same(true, c, d, len), "hop limit hashed");
+
+  make_ipv6(d, 64, 3);
+  tests::check(!same(true, c, d, len), "IPv6 source address ignored");
+
+  // Not IP: every byte counts.
+  uint8_t e[packet_size];
+  uint8_t f[packet_size];
+  make_packet(e, 1);
+  make_packet(f, 1);
+  f[22] = 0xff;
+  tests::check(!same(true, e, f, packet_size), "non-IP byte ignored");
+}
+
+int main()
+{
+  test_avx2();
+  test_sensitivity();
+  test_window();
+  test_table();
+  test_volatile();
+
+  return tests::report("dedup");
+}
@@ -0,0 +1,442 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdio.h>
+#include "pcap/filter.h"
+#include "tests/check.h"
+
+using pcap::bpf::instruction;
+
+// Link types.
+static constexpr const uint32_t linktype_ethernet = 1;
+static constexpr const uint32_t linktype_linux_sll = 113;
+
+// Classic BPF programs generated by libpcap (`tcpdump -dd`, and the listing
+// of `tcpdump -d` when the generated program is expected to be the same).
+struct reference {
+  const char* expr;
+  uint32_t linktype;
+  const instruction* insns;
+  size_t count;
+  const char* listing;
+};
+
+static const instruction ip[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 1, 0x00000800},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+static const instruction not_ip[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 1, 0x00000800},
+  {0x06, 0, 0, 0x00000000},
+  {0x06, 0, 0, 0x00040000}
+};
+
+static const instruction arp[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 1, 0x00000806},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+static const instruction ip_proto_udp[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 3, 0x00000800},
+  {0x30, 0, 0, 0x00000017},
+  {0x15, 0, 1, 0x00000011},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+static const instruction ip_src_host[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 3, 0x00000800},
+  {0x20, 0, 0, 0x0000001a},
+  {0x15, 0, 1, 0x0a000001},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+static const instruction len_greater[] = {
+  {0x80, 0, 0, 0x00000000},
+  {0x25, 0, 1, 0x00000064},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+static const instruction tcp_port_80[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 6, 0x000086dd},
+  {0x30, 0, 0, 0x00000014},
+  {0x15, 0, 15, 0x00000006},
+  {0x28, 0, 0, 0x00000036},
+  {0x15, 12, 0, 0x00000050},
+  {0x28, 0, 0, 0x00000038},
+  {0x15, 10, 11, 0x00000050},
+  {0x15, 0, 10, 0x00000800},
+  {0x30, 0, 0, 0x00000017},
+  {0x15, 0, 8, 0x00000006},
+  {0x28, 0, 0, 0x00000014},
+  {0x45, 6, 0, 0x00001fff},
+  {0xb1, 0, 0, 0x0000000e},
+  {0x48, 0, 0, 0x0000000e},
+  {0x15, 2, 0, 0x00000050},
+  {0x48, 0, 0, 0x00000010},
+  {0x15, 0, 1, 0x00000050},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+static const instruction udp_port_53[] = {
+  {0x28, 0, 0, 0x0000000c},
+  {0x15, 0, 6, 0x000086dd},
+  {0x30, 0, 0, 0x00000014},
+  {0x15, 0, 15, 0x00000011},
+  {0x28, 0, 0, 0x00000036},
+  {0x15, 12, 0, 0x00000035},
+  {0x28, 0, 0, 0x00000038},
+  {0x15, 10, 11, 0x00000035},
+  {0x15, 0, 10, 0x00000800},
+  {0x30, 0, 0, 0x00000017},
+  {0x15, 0, 8, 0x00000011},
+  {0x28, 0, 0, 0x00000014},
+  {0x45, 6, 0, 0x00001fff},
+  {0xb1, 0, 0, 0x0000000e},
+  {0x48, 0, 0, 0x0000000e},
+  {0x15, 2, 0, 0x00000035},
+  {0x48, 0, 0, 0x00000010},
+  {0x15, 0, 1, 0x00000035},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+static const instruction sll_ip[] = {
+  {0x28, 0, 0, 0x0000000e},
+  {0x15, 0, 1, 0x00000800},
+  {0x06, 0, 0, 0x00040000},
+  {0x06, 0, 0, 0x00000000}
+};
+
+#define INSNS(a) a, sizeof(a) / sizeof(a[0])
+
+static const reference references[] = {
+  {
+    "ip",
+    linktype_ethernet,
+    INSNS(ip),
+    "(000) ldh      [12]\n"
+    "(001) jeq      #0x800 jt 2 jf 3\n"
+    "(002) ret      #262144\n"
+    "(003) ret      #0\n"
+  },
+  {"not ip", linktype_ethernet, INSNS(not_ip), nullptr},
+  {
+    "arp",
+    linktype_ethernet,
+    INSNS(arp),
+    "(000) ldh      [12]\n"
+    "(001) jeq      #0x806 jt 2 jf 3\n"
+    "(002) ret      #262144\n"
+    "(003) ret      #0\n"
+  },
+  {
+    "ip proto 17",
+    linktype_ethernet,
+    INSNS(ip_proto_udp),
+    "(000) ldh      [12]\n"
+    "(001) jeq      #0x800 jt 2 jf 5\n"
+    "(002) ldb      [23]\n"
+    "(003) jeq      #0x11 jt 4 jf 5\n"
+    "(004) ret      #262144\n"
+    "(005) ret      #0\n"
+  },
+  {
+    "ip src host 10.0.0.1",
+    linktype_ethernet,
+    INSNS(ip_src_host),
+    "(000) ldh      [12]\n"
+    "(001) jeq      #0x800 jt 2 jf 5\n"
+    "(002) ld       [26]\n"
+    "(003) jeq      #0xa000001 jt 4 jf 5\n"
+    "(004) ret      #262144\n"
+    "(005) ret      #0\n"
+  },
+  {
+    "len > 100",
+    linktype_ethernet,
+    INSNS(len_greater),
+    "(000) ld       #pktlen\n"
+    "(001) jgt      #0x64 jt 2 jf 3\n"
+    "(002) ret      #262144\n"
+    "(003) ret      #0\n"
+  },
+  {"tcp port 80", linktype_ethernet, INSNS(tcp_port_80), nullptr},
+  {"udp port 53", linktype_ethernet, INSNS(udp_port_53), nullptr},
+  {
+    "ip",
+    linktype_linux_sll,
+    INSNS(sll_ip),
+    "(000) ldh      [14]\n"
+    "(001) jeq      #0x800 jt 2 jf 3\n"
+    "(002) ret      #262144\n"
+    "(003) ret      #0\n"
+  }
+};
+
+// Packets (network layer) the programs are run on.
+struct packet {
+  uint8_t data[128];
+  uint32_t len;
+  uint16_t ethertype;
+};
+
+static constexpr const size_t max_packets = 32;
+
+static packet packets[max_packets];
+static size_t npackets = 0;
+
+static void put16(uint8_t* ptr, uint16_t n)
+{
+  ptr[0] = static_cast<uint8_t>(n >> 8);
+  ptr[1] = static_cast<uint8_t>(n);
+}
+
+static void put32(uint8_t* ptr, uint32_t n)
+{
+  put16(ptr, static_cast<uint16_t>(n >> 16));
+  put16(ptr + 2, static_cast<uint16_t>(n));
+}
+
+// Add IPv4 packet (`ihl` in 32-bit words) with a transport header.
+static void add_ipv4(uint8_t proto,
+                     uint32_t src,
+                     uint16_t sport,
+                     uint16_t dport,
+                     uint16_t fragment,
+                     uint8_t ihl,
+                     uint32_t len)
+{
+  packet* const pkt = &packets[npackets++];
+  memset(pkt, 0, sizeof(packet));
+
+  uint8_t* const hdr = pkt->data;
+  hdr[0] = 0x40 | ihl;
+  put16(hdr + 2, static_cast<uint16_t>(len));
+  put16(hdr + 6, fragment);
+  hdr[8] = 64;
+  hdr[9] = proto;
+  put32(hdr + 12, src);
+  put32(hdr + 16, 0xc0a80001);
+
+  uint8_t* const l4 = hdr + 4 * ihl;
+  put16(l4, sport);
+  put16(l4 + 2, dport);
+
+  pkt->len = len;
+  pkt->ethertype = 0x0800;
+}
+
+// Add IPv6 packet with a transport header.
+static void add_ipv6(uint8_t proto, uint16_t sport, uint16_t dport)
+{
+  packet* const pkt = &packets[npackets++];
+  memset(pkt, 0, sizeof(packet));
+
+  uint8_t* const hdr = pkt->data;
+  hdr[0] = 0x60;
+  put16(hdr + 4, 20);
+  hdr[6] = proto;
+  hdr[7] = 64;
+  hdr[23] = 1;
+  hdr[39] = 2;
+
+  put16(hdr + 40, sport);
+  put16(hdr + 42, dport);
+
+  pkt->len = 60;
+  pkt->ethertype = 0x86dd;
+}
+
+// Add ARP request.
+static void add_arp()
+{
+  packet* const pkt = &packets[npackets++];
+  memset(pkt, 0, sizeof(packet));
+
+  put16(pkt->data, 1);
+  put16(pkt->data + 2, 0x0800);
+  pkt->data[4] = 6;
+  pkt->data[5] = 4;
+  put16(pkt->data + 6, 1);
+
+  pkt->len = 28;
+  pkt->ethertype = 0x0806;
+}
+
+static void build_packets()
+{
+  static constexpr const uint8_t tcp = 6;
+  static constexpr const uint8_t udp = 17;
+  static constexpr const uint8_t icmp = 1;
+
+  add_ipv4(tcp, 0x0a000001, 40000, 80, 0, 5, 40);
+  add_ipv4(tcp, 0x0a000002, 80, 40000, 0, 5, 100);
+  add_ipv4(tcp, 0x0a000002, 40000, 443, 0, 5, 40);
+  add_ipv4(tcp, 0x0a000001, 40000, 80, 0x0010, 5, 40);
+  add_ipv4(tcp, 0x0a000001, 40000, 80, 0x2000, 5, 40);
+  add_ipv4(tcp, 0x0a000003, 40000, 80, 0, 6, 44);
+  add_ipv4(tcp, 0x0a000003, 53, 40000, 0, 15, 80);
+  add_ipv4(udp, 0x0a000001, 53, 40000, 0, 5, 28);
+  add_ipv4(udp, 0x0a000004, 40000, 53, 0, 5, 128);
+  add_ipv4(udp, 0x0a000004, 40000, 5353, 0, 5, 28);
+  add_ipv4(udp, 0x0a000004, 40000, 53, 0x0100, 5, 28);
+  add_ipv4(icmp, 0x0a000001, 0, 80, 0, 5, 28);
+  add_ipv6(tcp, 40000, 80);
+  add_ipv6(tcp, 80, 40000);
+  add_ipv6(tcp, 40000, 22);
+  add_ipv6(udp, 53, 40000);
+  add_ipv6(udp, 40000, 53);
+  add_ipv6(udp, 40000, 123);
+  add_arp();
+}
+
+// Build frame of `linktype` for a packet; returns its length.
+static uint32_t build_frame(uint32_t linktype,
+                            const packet& pkt,
+                            uint8_t* frame)
+{
+  size_t hdrlen;
+
+  if (linktype == linktype_ethernet) {
+    memset(frame, 0, 12);
+    frame[5] = 1;
+    frame[11] = 2;
+    put16(frame + 12, pkt.ethertype);
+    hdrlen = 14;
+  } else {
+    // Linux cooked capture.
+    memset(frame, 0, 14);
+    put16(frame + 2, 1);
+    put16(frame + 4, 6);
+    put16(frame + 14, pkt.ethertype);
+    hdrlen = 16;
+  }
+
+  memcpy(frame + hdrlen, pkt.data, pkt.len);
+
+  return static_cast<uint32_t>(hdrlen + pkt.len);
+}
+
+// Listing of the program generated for an expression.
+static bool listing(pcap::filter& f, uint32_t linktype, char*& buf)
+{
+  size_t size;
+  FILE* out;
+  if ((out = open_memstream(&buf, &size)) == nullptr) {
+    return false;
+  }
+
+  const bool ret = f.dump(linktype, out);
+  fclose(out);
+
+  return ret;
+}
+
+// The generated program accepts the same packets as the reference, with
+// every capture length (truncated packets).
+static void test_reference(const reference& ref)
+{
+  pcap::filter f;
+  char error[256];
+  if (!tests::check(f.compile(ref.expr, error, sizeof(error)),
+                    "'%s' not compiled: %s",
+                    ref.expr,
+                    error)) {
+    return;
+  }
+
+  if (ref.listing) {
+    char* buf = nullptr;
+    if (tests::check(listing(f, ref.linktype, buf),
+                     "'%s': no program",
+                     ref.expr)) {
+      tests::check(strcmp(buf, ref.listing) == 0,
+                   "'%s' generated:\n%sinstead of:\n%s",
+                   ref.expr,
+                   buf,
+                   ref.listing);
+    }
+
+    free(buf);
+  }
+
+  pcap::bpf::program prog;
+  if (!tests::check(prog.load(ref.insns, ref.count),
+                    "reference of '%s' not loaded",
+                    ref.expr)) {
+    return;
+  }
+
+  for (size_t i = 0; i < npackets; i++) {
+    uint8_t frame[256];
+    const uint32_t len = build_frame(ref.linktype, packets[i], frame);
+
+    for (uint32_t caplen = 0; caplen <= len; caplen++) {
+      const bool expected = (prog.run(frame, caplen, len) != 0);
+      const bool matched = f.match(ref.linktype, frame, caplen, len);
+
+      if (!tests::check(matched == expected,
+                        "'%s' (link type %u) %s packet %zu (%u of %u "
+                        "bytes)",
+                        ref.expr,
+                        ref.linktype,
+                        matched ? "matches" : "doesn't match",
+                        i,
+                        caplen,
+                        len)) {
+        break;
+      }
+    }
+  }
+}
+
+// Invalid expressions are rejected.
+static void test_errors()
+{
+  static const char* const exprs[] = {
+    "",
+    "tcp port",
+    "port 70000",
+    "host 10.0.0",
+    "net 10.0.0.0/33",
+    "(tcp",
+    "tcp)",
+    "tcp and",
+    "len >",
+    "foo"
+  };
+
+  for (size_t i = 0; i < sizeof(exprs) / sizeof(exprs[0]); i++) {
+    pcap::filter f;
+    char error[256];
+    tests::check(!f.compile(exprs[i], error, sizeof(error)),
+                 "'%s' compiled",
+                 exprs[i]);
+  }
+}
+
+int main()
+{
+  build_packets();
+
+  for (size_t i = 0; i < sizeof(references) / sizeof(references[0]); i++) {
+    test_reference(references[i]);
+  }
+
+  test_errors();
+
+  return tests::report("filter");
+}
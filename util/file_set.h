@@ -0,0 +1,155 @@
+#ifndef UTIL_FILE_SET_H
+#define UTIL_FILE_SET_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdlib.h>
+
+namespace util {
+  // Set of files identified by their device and inode numbers, with some
+  // per-file state (open addressing, linear probing).
+  template<typename Value>
+  class file_set {
+    public:
+      // Entry.
+      struct entry {
+        uint64_t device;
+        uint64_t inode;
+        Value value;
+        bool used;
+      };
+
+      // Constructor.
+      file_set() = default;
+
+      // Destructor.
+      ~file_set()
+      {
+        free(_M_entries);
+      }
+
+      // Find file.
+      entry* find(uint64_t device, uint64_t inode)
+      {
+        if (_M_count > 0) {
+          entry* const e = &_M_entries[slot(device, inode)];
+          if (e->used) {
+            return e;
+          }
+        }
+
+        return nullptr;
+      }
+
+      // Insert file (or find it if it is already in the set).
+      // Returns nullptr if memory could not be allocated.
+      entry* insert(uint64_t device, uint64_t inode)
+      {
+        // Keep the load factor under 1/2.
+        if (((_M_count + 1) * 2 > _M_size) && (!resize(_M_size * 2))) {
+          return nullptr;
+        }
+
+        entry* const e = &_M_entries[slot(device, inode)];
+        if (!e->used) {
+          e->device = device;
+          e->inode = inode;
+          e->value = Value();
+          e->used = true;
+
+          _M_count++;
+        }
+
+        return e;
+      }
+
+      // Remove the files for which `pred(value)` is true (the table is
+      // rebuilt).
+      template<typename Predicate>
+      bool remove_if(Predicate pred)
+      {
+        for (size_t i = 0; i < _M_size; i++) {
+          if ((_M_entries[i].used) && (pred(_M_entries[i].value))) {
+            _M_entries[i].used = false;
+            _M_count--;
+          }
+        }
+
+        return resize(_M_size);
+      }
+
+      // Number of files.
+      size_t count() const
+      {
+        return _M_count;
+      }
+
+    private:
+      // Initial number of slots.
+      static constexpr const size_t initial_size = 1024;
+
+      entry* _M_entries = nullptr;
+      size_t _M_size = 0;
+      size_t _M_count = 0;
+
+      // Slot of the file (or the empty slot where it would go).
+      size_t slot(uint64_t device, uint64_t inode) const
+      {
+        const size_t mask = _M_size - 1;
+
+        size_t i = hash(device, inode) & mask;
+        while ((_M_entries[i].used) &&
+               ((_M_entries[i].device != device) ||
+                (_M_entries[i].inode != inode))) {
+          i = (i + 1) & mask;
+        }
+
+        return i;
+      }
+
+      // Rehash the entries into `size` slots (a power of two).
+      bool resize(size_t size)
+      {
+        if (size < initial_size) {
+          size = initial_size;
+        }
+
+        entry* entries;
+        if ((entries = static_cast<entry*>(
+                         calloc(size, sizeof(entry))
+                       )) == nullptr) {
+          return false;
+        }
+
+        entry* const old = _M_entries;
+        const size_t oldsize = _M_size;
+
+        _M_entries = entries;
+        _M_size = size;
+
+        for (size_t i = 0; i < oldsize; i++) {
+          if (old[i].used) {
+            _M_entries[slot(old[i].device, old[i].inode)] = old[i];
+          }
+        }
+
+        free(old);
+
+        return true;
+      }
+
+      static uint64_t hash(uint64_t device, uint64_t inode)
+      {
+        uint64_t h = (inode ^ (device << 32) ^ (device >> 32)) *
+                     0x9e3779b97f4a7c15ull;
+
+        return h ^ (h >> 29);
+      }
+
+      // Disable copy constructor and assignment operator.
+      file_set(const file_set&) = delete;
+      file_set& operator=(const file_set&) = delete;
+  };
+}
+
+#endif // UTIL_FILE_SET_H
@@ -0,0 +1,63 @@
+#ifndef UTIL_PARALLEL_H
+#define UTIL_PARALLEL_H
+
+#include <stddef.h>
+#include <new>
+#include <atomic>
+#include <thread>
+
+namespace util {
+  // Call `fn(worker, idx)` for every `idx` in [0, count) using `nworkers`
+  // threads (the calling thread is worker 0). Items are handed out
+  // dynamically, so workers which get small items pick up more of them.
+  // Stops handing out items as soon as a call returns false.
+  // Returns true if all the calls succeeded.
+  template<typename Function>
+  bool parallel_for(size_t count, unsigned nworkers, Function fn)
+  {
+    std::atomic<size_t> next(0);
+    std::atomic<bool> failed(false);
+
+    auto run = [&](unsigned worker) {
+      size_t idx;
+      while ((!failed.load(std::memory_order_relaxed)) &&
+             ((idx = next.fetch_add(1, std::memory_order_relaxed)) < count)) {
+        if (!fn(worker, idx)) {
+          failed.store(true, std::memory_order_relaxed);
+        }
+      }
+    };
+
+    if (nworkers > count) {
+      nworkers = (count > 0) ? count : 1;
+    }
+
+    std::thread* threads = nullptr;
+    unsigned nthreads = 0;
+
+    if (nworkers > 1) {
+      if ((threads = new (std::nothrow) std::thread[nworkers - 1]) != nullptr) {
+        for (; nthreads < nworkers - 1; nthreads++) {
+          try {
+            threads[nthreads] = std::thread(run, nthreads + 1);
+          } catch (...) {
+            // Continue with the threads which could be created.
+            break;
+          }
+        }
+      }
+    }
+
+    run(0);
+
+    for (unsigned i = 0; i < nthreads; i++) {
+      threads[i].join();
+    }
+
+    delete [] threads;
+
+    return !failed.load();
+  }
+}
+
+#endif // UTIL_PARALLEL_H